@@ -0,0 +1,421 @@
+// offline benchmark for the looper~, glooper~ and gl~ perform routines
+//
+// links the externals against the Pd stub in pd_stub.c, records a second or
+// so of synthetic input into each object, then times the perform routine in
+// its playback state. reports ns per sample, CPU load as a percentage of real
+// time, last-level cache misses (when perf counters are available) and a hash
+// of the output so A/B runs can check for bit-identical results.
+//
+// usage: looper-bench [options]
+//   -o name      object to run (looper~, glooper~, gl~); repeatable, default all
+//   -b list      comma separated block sizes, default 64,256,1024,4096
+//   -r list      comma separated sample rates, default 48000
+//   -g list      comma separated grain counts (glooper~, gl~), default 1,8,64
+//   -l ms        grain length in ms, default 50
+//   -c channels  channel count creation argument, default 1. the main inlet
+//                gets as many channels, each at a different level; ns/sample
+//                is per frame of all of them
+//   -t seconds   length of the measured run, default 10
+//   -w seconds   length of the recording pass before measuring, default 6 (enough
+//                to fill the 4 second buffers, which looper~ and glooper~ round up
+//                to a power of 2)
+//   -m "msg"     message sent after creation, e.g. -m "interp sinc"; repeatable
+//   -p "msg"     message that starts the measured pass instead of the object's
+//                usual play message, e.g. -o looper~ -p overdub
+//   -e "msg"     message sent after the measured pass; with -v, e.g.
+//                -m "profile 1" -e stats prints the object's own timing
+//   -v           print the externals' post() output
+
+#include "pd_stub.h"
+#include "worker.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define BENCH_MAXLIST 16
+#define BENCH_MAXMSGS 16
+#define BENCH_MAXSIGNALS 8
+
+void looper_tilde_setup(void);
+void glooper_tilde_setup(void);
+void gl_tilde_setup(void);
+
+typedef struct _scenario {
+  const char *name;
+  int grains; // takes (grain_ms, num_grains) creation arguments
+  const char *record; // message that starts recording
+  const char *play; // message that switches to playback
+} t_scenario;
+
+static const t_scenario scenarios[] = {
+  {"looper~", 0, "bang", "bang"},
+  {"glooper~", 1, "record", "play"},
+  {"gl~", 1, "record", "play"},
+};
+#define NSCENARIOS (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+typedef struct _options {
+  const char *objects[NSCENARIOS];
+  int nobjects;
+  int blocks[BENCH_MAXLIST];
+  int nblocks;
+  int rates[BENCH_MAXLIST];
+  int nrates;
+  int grains[BENCH_MAXLIST];
+  int ngrains;
+  float grain_ms;
+  int channels;
+  double seconds;
+  double warmup;
+  const char *msgs[BENCH_MAXMSGS];
+  int nmsgs;
+  const char *play; // overrides the scenario's play message
+  const char *end; // sent after the measured pass
+} t_options;
+
+typedef struct _result {
+  double ns_per_sample;
+  double cpu_percent;
+  long long cache_misses; // -1 if unavailable
+  unsigned int hash;
+  double rms;
+  double nsamples;
+} t_result;
+
+static int parse_list(const char *arg, int *dest)
+{
+  int n = 0;
+  char *copy = strdup(arg);
+  for (char *tok = strtok(copy, ","); tok != NULL && n < BENCH_MAXLIST; tok = strtok(NULL, ",")) {
+    int v = atoi(tok);
+    if (v > 0) dest[n++] = v;
+  }
+  free(copy);
+  return n;
+}
+
+static double now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int perf_open(void)
+{
+#ifdef __linux__
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+static void perf_start(int fd)
+{
+#ifdef __linux__
+  if (fd < 0) return;
+  ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+  ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+static long long perf_stop(int fd)
+{
+#ifdef __linux__
+  long long count;
+  if (fd < 0) return -1;
+  ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  if (read(fd, &count, sizeof(count)) != sizeof(count)) return -1;
+  return count;
+#else
+  return -1;
+#endif
+}
+
+static int send_message(t_object *x, const char *msg)
+{
+  char *copy = strdup(msg);
+  const char *argv[STUB_MAXARGS + 1];
+  int argc = 0;
+  char *sel = strtok(copy, " ");
+  char *tok;
+  while (sel != NULL && argc <= STUB_MAXARGS && (tok = strtok(NULL, " ")) != NULL) {
+    argv[argc++] = tok;
+  }
+  int ok = (sel != NULL) && stub_send(x, sel, argc, argv);
+  free(copy);
+  return ok;
+}
+
+// synthetic input: a couple of partials plus a little noise on the main inlet,
+// a slow sweep across (-1, 1) on the grain position inlet, and whatever an
+// unconnected inlet would read (fixed[j]) elsewhere
+static void fill_inputs(t_sample **in, const t_float *fixed, int nin, int n, long offset,
+                        int sr, unsigned int *seed)
+{
+  for (int i = 0; i < n; i++) {
+    double t = (double)(offset + i) / sr;
+    *seed = *seed * 1664525u + 1013904223u;
+    double noise = ((*seed >> 8) / (double)(1 << 24)) * 2.0 - 1.0;
+    in[0][i] = (t_sample)(0.5 * sin(2 * M_PI * 220.0 * t) + 0.25 * sin(2 * M_PI * 331.0 * t)
+                          + 0.05 * noise);
+    if (nin > 1) in[1][i] = (t_sample)(0.9 * sin(2 * M_PI * 0.25 * t));
+    for (int j = 2; j < nin; j++) in[j][i] = fixed[j];
+  }
+}
+
+// the first channel of a multichannel input copied to the others, each a
+// little quieter than the one before
+static void spread_channels(t_sample *in, int channels, int n)
+{
+  for (int c = 1; c < channels; c++) {
+    t_sample gain = 1.0f / (c + 1);
+    for (int i = 0; i < n; i++) in[c * n + i] = in[i] * gain;
+  }
+}
+
+static unsigned int hash_block(unsigned int h, const t_sample *v, int n)
+{
+  const unsigned char *p = (const unsigned char *)v;
+  for (size_t i = 0; i < n * sizeof(t_sample); i++) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h;
+}
+
+static int run_one(const t_options *o, const t_scenario *sc, int bs, int sr, int grains,
+                   int perf_fd, t_result *r)
+{
+  t_class *c = stub_findclass(sc->name);
+  if (c == NULL) {
+    fprintf(stderr, "bench: class %s not found\n", sc->name);
+    return 0;
+  }
+
+  int channels = o->channels;
+  t_object *x;
+  if (sc->grains) {
+    t_float args[3] = {o->grain_ms, (t_float)grains, (t_float)channels};
+    x = stub_new(c, (channels > 1) ? 3 : 2, args);
+  } else {
+    t_float args[2] = {0, (t_float)channels}; // the default buffer length
+    x = stub_new(c, (channels > 1) ? 2 : 0, args);
+  }
+  if (x == NULL) {
+    fprintf(stderr, "bench: couldn't create %s\n", sc->name);
+    return 0;
+  }
+  for (int i = 0; i < o->nmsgs; i++) send_message(x, o->msgs[i]);
+
+  int nin = stub_signal_inlets(x);
+  int nout = stub_signal_outlets(x);
+  if (nin < 1 || nout < 1 || nin + nout > BENCH_MAXSIGNALS) {
+    fprintf(stderr, "bench: unexpected signal inlets/outlets for %s\n", sc->name);
+    stub_free(x);
+    return 0;
+  }
+
+  t_signal sigs[BENCH_MAXSIGNALS];
+  t_signal *sp[BENCH_MAXSIGNALS];
+  t_sample *in[BENCH_MAXSIGNALS];
+  t_float fixed[BENCH_MAXSIGNALS];
+  for (int i = 0; i < nin + nout; i++) {
+    int nchans = (i == 0) ? channels : 1;
+    memset(&sigs[i], 0, sizeof(t_signal));
+    sigs[i].s_length = sigs[i].s_vecsize = bs;
+    sigs[i].s_n = bs * nchans;
+    sigs[i].s_nchans = nchans;
+    sigs[i].s_sr = (t_float)sr;
+    sigs[i].s_vec = calloc((size_t)bs * nchans, sizeof(t_sample));
+    sp[i] = &sigs[i];
+    if (i < nin) {
+      in[i] = sigs[i].s_vec;
+      fixed[i] = stub_signal_default(x, i);
+    }
+  }
+
+  t_stub_chain chain = {NULL, 0};
+  if (!stub_dsp(x, sp, &chain)) {
+    fprintf(stderr, "bench: %s didn't add a perform routine\n", sc->name);
+    stub_free(x);
+    return 0;
+  }
+  // a multichannel object sets its outlet up in the dsp method
+  t_sample *out = sigs[nin].s_vec;
+  int nout_samples = bs * sigs[nin].s_nchans;
+  // let the worker finish the input buffers before the first block, so every
+  // run swaps them in at the same point and the hashes stay comparable
+  worker_wait_idle();
+
+  unsigned int seed = 1;
+  long offset = 0;
+  long warm_blocks = (long)(o->warmup * sr / bs) + 1;
+  long blocks = (long)(o->seconds * sr / bs) + 1;
+  double block_ms = 1000.0 * bs / sr;
+
+  send_message(x, sc->record);
+  for (long b = 0; b < warm_blocks; b++, offset += bs) {
+    fill_inputs(in, fixed, nin, bs, offset, sr, &seed);
+    spread_channels(in[0], channels, bs);
+    stub_time_advance(block_ms);
+    stub_chain_run(&chain);
+    // let storage the messages asked for (a format, say) land while
+    // recording, waiting for it so it's swapped in at the same block each run
+    stub_clocks_run();
+    worker_wait_idle();
+  }
+  send_message(x, (o->play != NULL) ? o->play : sc->play);
+  stub_clocks_run(); // reclaim the buffers the perform routine retired
+
+  // inputs are generated outside of the timed region
+  double elapsed = 0;
+  double sumsq = 0;
+  long long misses = 0;
+  unsigned int h = 2166136261u;
+  for (long b = 0; b < blocks; b++, offset += bs) {
+    fill_inputs(in, fixed, nin, bs, offset, sr, &seed);
+    spread_channels(in[0], channels, bs);
+    stub_time_advance(block_ms);
+    perf_start(perf_fd);
+    double t0 = now_ns();
+    stub_chain_run(&chain);
+    elapsed += now_ns() - t0;
+    long long m = perf_stop(perf_fd);
+    if (m > 0) misses += m;
+    h = hash_block(h, out, nout_samples);
+    for (int i = 0; i < nout_samples; i++) sumsq += (double)out[i] * out[i];
+  }
+
+  if (o->end != NULL) send_message(x, o->end);
+
+  double nsamples = (double)blocks * bs;
+  r->ns_per_sample = elapsed / nsamples;
+  r->cpu_percent = 100.0 * elapsed / (nsamples / sr * 1e9);
+  r->cache_misses = (perf_fd >= 0) ? misses : -1;
+  r->hash = h;
+  r->rms = sqrt(sumsq / (nsamples * sigs[nin].s_nchans));
+  r->nsamples = nsamples;
+
+  stub_chain_free(&chain);
+  stub_free(x);
+  for (int i = 0; i < nin + nout; i++) free(sigs[i].s_vec);
+  return 1;
+}
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "usage: looper-bench [-o object] [-b blocks] [-r rates] [-g grains]\n"
+          "                    [-l grain_ms] [-c channels] [-t seconds] [-w seconds]\n"
+          "                    [-m \"msg\"] [-p \"msg\"] [-e \"msg\"] [-v]\n");
+}
+
+int main(int argc, char **argv)
+{
+  t_options o;
+  memset(&o, 0, sizeof(o));
+  o.nblocks = parse_list("64,256,1024,4096", o.blocks);
+  o.nrates = parse_list("48000", o.rates);
+  o.ngrains = parse_list("1,8,64", o.grains);
+  o.grain_ms = 50;
+  o.channels = 1;
+  o.seconds = 10;
+  o.warmup = 6;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "o:b:r:g:l:c:t:w:m:p:e:vh")) != -1) {
+    switch (opt) {
+      case 'o':
+        if (o.nobjects < NSCENARIOS) o.objects[o.nobjects++] = optarg;
+        break;
+      case 'b': o.nblocks = parse_list(optarg, o.blocks); break;
+      case 'r': o.nrates = parse_list(optarg, o.rates); break;
+      case 'g': o.ngrains = parse_list(optarg, o.grains); break;
+      case 'l': o.grain_ms = (float)atof(optarg); break;
+      case 'c': o.channels = atoi(optarg); break;
+      case 't': o.seconds = atof(optarg); break;
+      case 'w': o.warmup = atof(optarg); break;
+      case 'p': o.play = optarg; break;
+      case 'e': o.end = optarg; break;
+      case 'm':
+        if (o.nmsgs < BENCH_MAXMSGS) o.msgs[o.nmsgs++] = optarg;
+        break;
+      case 'v': stub_verbose = 1; break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+  if (o.nblocks == 0 || o.nrates == 0 || o.ngrains == 0 || o.seconds <= 0 || o.channels < 1) {
+    usage();
+    return 1;
+  }
+
+  looper_tilde_setup();
+  glooper_tilde_setup();
+  gl_tilde_setup();
+
+  int perf_fd = perf_open();
+  if (perf_fd < 0) {
+    fprintf(stderr, "bench: cache miss counter unavailable (%s)\n", strerror(errno));
+  }
+
+  printf("%-9s %6s %7s %6s %10s %8s %14s %10s %10s\n",
+         "object", "block", "sr", "grains", "ns/sample", "cpu%", "misses/ksmp", "rms", "hash");
+  for (int s = 0; s < NSCENARIOS; s++) {
+    const t_scenario *sc = &scenarios[s];
+    if (o.nobjects > 0) {
+      int wanted = 0;
+      for (int i = 0; i < o.nobjects; i++) wanted |= !strcmp(o.objects[i], sc->name);
+      if (!wanted) continue;
+    }
+    int ngrains = sc->grains ? o.ngrains : 1;
+    for (int ri = 0; ri < o.nrates; ri++) {
+      for (int bi = 0; bi < o.nblocks; bi++) {
+        for (int gi = 0; gi < ngrains; gi++) {
+          t_result r;
+          int grains = sc->grains ? o.grains[gi] : 0;
+          if (!run_one(&o, sc, o.blocks[bi], o.rates[ri], grains, perf_fd, &r)) return 1;
+          char misses[32];
+          if (r.cache_misses >= 0) {
+            snprintf(misses, sizeof(misses), "%.2f", r.cache_misses / (r.nsamples / 1000.0));
+          } else {
+            snprintf(misses, sizeof(misses), "n/a");
+          }
+          char name[32];
+          if (o.channels > 1) {
+            snprintf(name, sizeof(name), "%s:%d", sc->name, o.channels);
+          } else {
+            snprintf(name, sizeof(name), "%s", sc->name);
+          }
+          printf("%-9s %6d %7d %6d %10.2f %8.3f %14s %10.5f   %08x\n",
+                 name, o.blocks[bi], o.rates[ri], grains,
+                 r.ns_per_sample, r.cpu_percent, misses, r.rms, r.hash);
+          fflush(stdout);
+        }
+      }
+    }
+  }
+
+  if (perf_fd >= 0) close(perf_fd);
+  return 0;
+}
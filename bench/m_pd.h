@@ -0,0 +1,159 @@
+// minimal stand-in for Pd's m_pd.h, just enough to compile the externals in
+// src/ into the offline benchmark. signatures follow Pd vanilla so the
+// externals don't need any #ifdefs; anything not listed here isn't used by
+// them (yet). see pd_stub.c for the implementations.
+
+#ifndef __m_pd_h_
+#define __m_pd_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PD_MAJOR_VERSION 0
+#define PD_MINOR_VERSION 54
+#define PD_FLOATSIZE 32
+
+#define EXTERN extern
+#define MAXPDSTRING 1000
+
+typedef intptr_t t_int;
+typedef float t_float;
+typedef float t_floatarg;
+typedef float t_sample;
+
+typedef struct _symbol {
+  const char *s_name;
+  void *s_thing;
+  struct _symbol *s_next;
+} t_symbol;
+
+typedef enum {
+  A_NULL,
+  A_FLOAT,
+  A_SYMBOL,
+  A_POINTER,
+  A_SEMI,
+  A_COMMA,
+  A_DEFFLOAT,
+  A_DEFSYM,
+  A_DOLLAR,
+  A_DOLLSYM,
+  A_GIMME,
+  A_CANT
+} t_atomtype;
+
+typedef struct _class t_class;
+typedef t_class *t_pd;
+
+typedef struct _inlet t_inlet;
+typedef struct _garray t_garray;
+typedef struct _clock t_clock;
+typedef struct _outlet t_outlet;
+typedef struct _glist t_glist;
+#define t_canvas struct _glist
+
+typedef struct _object {
+  t_pd ob_pd;
+  void *ob_binbuf;
+  void *ob_outlet;
+  void *ob_inlet;
+} t_object;
+
+// as wide as a pointer, like Pd's: on 64-bit builds the floats in an array
+// are 8 bytes apart
+typedef union word {
+  t_float w_float;
+  t_symbol *w_symbol;
+  void *w_gpointer;
+  int w_index;
+} t_word;
+
+typedef struct _atom {
+  t_atomtype a_type;
+  t_word a_w;
+} t_atom;
+
+#define SETFLOAT(atom, f) ((atom)->a_type = A_FLOAT, (atom)->a_w.w_float = (f))
+
+typedef void (*t_method)(void);
+typedef void *(*t_newmethod)(void);
+
+typedef t_int *(*t_perfroutine)(t_int *args);
+
+typedef struct _signal {
+  int s_n;
+  t_sample *s_vec;
+  t_float s_sr;
+  int s_refcount;
+  int s_isborrowed;
+  struct _signal *s_borrowedfrom;
+  struct _signal *s_nextfree;
+  struct _signal *s_nextused;
+  int s_vecsize;
+  int s_length;
+  int s_nchans;
+} t_signal;
+
+EXTERN t_symbol s_signal;
+EXTERN t_symbol s_float;
+EXTERN t_symbol s_bang;
+EXTERN t_symbol s_;
+EXTERN t_symbol s_anything;
+
+#define CLASS_DEFAULT 1
+#define CLASS_MULTICHANNEL 0x10
+
+EXTERN t_symbol *gensym(const char *s);
+EXTERN t_class *class_new(t_symbol *name, t_newmethod newmethod, t_method freemethod,
+                          size_t size, int flags, t_atomtype arg1, ...);
+EXTERN void class_addmethod(t_class *c, t_method fn, t_symbol *sel, t_atomtype arg1, ...);
+EXTERN void class_addbang(t_class *c, t_method fn);
+EXTERN void class_domainsignalin(t_class *c, int onset);
+#define class_addbang(x, y) class_addbang((x), (t_method)(y))
+
+#define CLASS_MAINSIGNALIN(c, type, field) \
+  class_domainsignalin(c, (char *)(&((type *)0)->field) - (char *)0)
+
+EXTERN t_pd *pd_new(t_class *cls);
+EXTERN t_pd *pd_findbyclass(t_symbol *s, const t_class *c);
+EXTERN t_inlet *inlet_new(t_object *owner, t_pd *dest, t_symbol *s1, t_symbol *s2);
+EXTERN void inlet_free(t_inlet *x);
+EXTERN t_inlet *signalinlet_new(t_object *owner, t_float f);
+EXTERN t_outlet *outlet_new(t_object *owner, t_symbol *s);
+// messages are post()ed, so only seen with -v
+EXTERN void outlet_anything(t_outlet *x, t_symbol *s, int argc, t_atom *argv);
+
+EXTERN void *getbytes(size_t nbytes);
+EXTERN void *resizebytes(void *old, size_t oldsize, size_t newsize);
+EXTERN void freebytes(void *x, size_t nbytes);
+
+EXTERN void post(const char *fmt, ...);
+EXTERN void pd_error(const void *object, const char *fmt, ...);
+
+EXTERN void dsp_add(t_perfroutine f, int n, ...);
+EXTERN void dsp_add_zero(t_sample *out, int n);
+// a CLASS_MULTICHANNEL object sets up its own signal outlets
+EXTERN void signal_setmultiout(t_signal **sig, int nchans);
+EXTERN t_float sys_getsr(void);
+
+// there's no patch: the current canvas is NULL and file names are used as given
+EXTERN t_glist *canvas_getcurrent(void);
+EXTERN void canvas_makefilename(const t_glist *c, const char *file, char *result,
+                                int resultsize);
+
+// arrays are made with stub_garray_new()
+EXTERN t_class *garray_class;
+EXTERN int garray_getfloatwords(t_garray *x, int *size, t_word **vec);
+EXTERN void garray_redraw(t_garray *x);
+EXTERN void garray_usedindsp(t_garray *x);
+
+// clocks never fire on their own in the stub; see stub_clocks_run()
+EXTERN t_clock *clock_new(void *owner, t_method fn);
+EXTERN void clock_delay(t_clock *x, double delaytime);
+EXTERN void clock_unset(t_clock *x);
+EXTERN void clock_free(t_clock *x);
+// logical time only moves when the bench calls stub_time_advance()
+EXTERN double clock_getlogicaltime(void);
+EXTERN double clock_gettimesince(double prevsystime);
+
+#endif // __m_pd_h_
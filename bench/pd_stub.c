@@ -0,0 +1,606 @@
+// just enough of the Pd runtime to host the externals outside of Pd: a class
+// table with message dispatch, inlet/outlet bookkeeping, memory functions and a
+// dsp_add that records the perform routine instead of adding it to a real
+// dsp chain.
+
+#include "pd_stub.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STUB_MAXCLASSES 16
+#define STUB_MAXMETHODS 64
+#define STUB_MAXOBJECTS 64
+#define STUB_MAXSYMBOLS 256
+#define STUB_MAXSIGIN 8
+#define STUB_MAXARRAYS 8
+
+typedef struct _stub_method {
+  t_symbol *m_sel;
+  t_method m_fn;
+  t_atomtype m_args[STUB_MAXARGS + 1];
+} t_stub_method;
+
+struct _class {
+  t_symbol *c_name;
+  t_newmethod c_new;
+  t_method c_free;
+  size_t c_size;
+  t_atomtype c_newargs[STUB_MAXARGS + 1];
+  t_stub_method c_methods[STUB_MAXMETHODS];
+  int c_nmethods;
+  t_method c_bang;
+  int c_mainsignalin;
+};
+
+struct _inlet {
+  t_object *i_owner;
+  int i_signal;
+};
+
+struct _outlet {
+  t_object *o_owner;
+  int o_signal;
+};
+
+struct _garray {
+  t_symbol *a_name;
+  t_word *a_words;
+  int a_n;
+  int a_redraws;
+};
+
+struct _clock {
+  void *k_owner;
+  t_method k_fn;
+  int k_set;
+  struct _clock *k_next;
+};
+
+typedef struct _stub_object {
+  t_object *so_obj;
+  int so_sigin;
+  t_float so_default[STUB_MAXSIGIN];
+  int so_sigout;
+} t_stub_object;
+
+t_symbol s_signal = {"signal", NULL, NULL};
+t_symbol s_float = {"float", NULL, NULL};
+t_symbol s_bang = {"bang", NULL, NULL};
+t_symbol s_ = {"", NULL, NULL};
+t_symbol s_anything = {"anything", NULL, NULL};
+
+static t_class stub_garray_class;
+t_class *garray_class = &stub_garray_class;
+static t_garray stub_arrays[STUB_MAXARRAYS];
+static int stub_narrays = 0;
+
+int stub_verbose = 0;
+
+static t_class stub_classes[STUB_MAXCLASSES];
+static int stub_nclasses = 0;
+static t_stub_object stub_objects[STUB_MAXOBJECTS];
+static t_symbol stub_symbols[STUB_MAXSYMBOLS];
+static int stub_nsymbols = 0;
+
+static t_clock *stub_clocks = NULL;
+static double stub_time = 0; // ms
+
+// dsp_add writes here while stub_dsp is running
+static t_stub_chain *stub_current_chain = NULL;
+
+t_symbol *gensym(const char *s)
+{
+  if (!strcmp(s, "signal")) return &s_signal;
+  if (!strcmp(s, "float")) return &s_float;
+  if (!strcmp(s, "bang")) return &s_bang;
+  if (!strcmp(s, "anything")) return &s_anything;
+  if (!*s) return &s_;
+  for (int i = 0; i < stub_nsymbols; i++) {
+    if (!strcmp(stub_symbols[i].s_name, s)) return &stub_symbols[i];
+  }
+  if (stub_nsymbols == STUB_MAXSYMBOLS) {
+    fprintf(stderr, "pd_stub: out of symbols\n");
+    exit(1);
+  }
+  t_symbol *sym = &stub_symbols[stub_nsymbols++];
+  sym->s_name = strdup(s);
+  sym->s_thing = NULL;
+  sym->s_next = NULL;
+  return sym;
+}
+
+static void collect_args(t_atomtype *dest, t_atomtype first, va_list ap)
+{
+  int n = 0;
+  t_atomtype t = first;
+  while (t != A_NULL && n < STUB_MAXARGS) {
+    dest[n++] = t;
+    t = (t_atomtype)va_arg(ap, int);
+  }
+  dest[n] = A_NULL;
+}
+
+t_class *class_new(t_symbol *name, t_newmethod newmethod, t_method freemethod,
+                   size_t size, int flags, t_atomtype arg1, ...)
+{
+  (void)flags;
+  if (stub_nclasses == STUB_MAXCLASSES) return NULL;
+  t_class *c = &stub_classes[stub_nclasses++];
+  memset(c, 0, sizeof(*c));
+  c->c_name = name;
+  c->c_new = newmethod;
+  c->c_free = freemethod;
+  c->c_size = size;
+  va_list ap;
+  va_start(ap, arg1);
+  collect_args(c->c_newargs, arg1, ap);
+  va_end(ap);
+  return c;
+}
+
+void class_addmethod(t_class *c, t_method fn, t_symbol *sel, t_atomtype arg1, ...)
+{
+  if (c->c_nmethods == STUB_MAXMETHODS) return;
+  t_stub_method *m = &c->c_methods[c->c_nmethods++];
+  m->m_sel = sel;
+  m->m_fn = fn;
+  va_list ap;
+  va_start(ap, arg1);
+  collect_args(m->m_args, arg1, ap);
+  va_end(ap);
+}
+
+void (class_addbang)(t_class *c, t_method fn)
+{
+  c->c_bang = fn;
+}
+
+void class_domainsignalin(t_class *c, int onset)
+{
+  (void)onset;
+  c->c_mainsignalin = 1;
+}
+
+static t_stub_object *stub_lookup(t_object *x)
+{
+  for (int i = 0; i < STUB_MAXOBJECTS; i++) {
+    if (stub_objects[i].so_obj == x) return &stub_objects[i];
+  }
+  return NULL;
+}
+
+t_pd *pd_new(t_class *cls)
+{
+  t_stub_object *slot = stub_lookup(NULL);
+  if (slot == NULL) return NULL;
+  t_object *x = calloc(1, cls->c_size);
+  x->ob_pd = cls;
+  slot->so_obj = x;
+  slot->so_sigin = cls->c_mainsignalin;
+  slot->so_sigout = 0;
+  memset(slot->so_default, 0, sizeof(slot->so_default));
+  return &x->ob_pd;
+}
+
+t_pd *pd_findbyclass(t_symbol *s, const t_class *c)
+{
+  if (c != garray_class) return NULL;
+  for (int i = 0; i < stub_narrays; i++) {
+    if (stub_arrays[i].a_name == s) return (t_pd *)&stub_arrays[i];
+  }
+  return NULL;
+}
+
+t_garray *stub_garray_new(const char *name, int n)
+{
+  if (stub_narrays == STUB_MAXARRAYS) return NULL;
+  t_garray *a = &stub_arrays[stub_narrays++];
+  a->a_name = gensym(name);
+  a->a_words = calloc(n, sizeof(t_word));
+  a->a_n = n;
+  a->a_redraws = 0;
+  return a;
+}
+
+void stub_garray_resize(t_garray *a, int n)
+{
+  t_word *words = calloc(n, sizeof(t_word));
+  memcpy(words, a->a_words, (n < a->a_n ? n : a->a_n) * sizeof(t_word));
+  free(a->a_words);
+  a->a_words = words;
+  a->a_n = n;
+}
+
+t_word *stub_garray_words(t_garray *a, int *n)
+{
+  *n = a->a_n;
+  return a->a_words;
+}
+
+int stub_garray_redraws(t_garray *a)
+{
+  return a->a_redraws;
+}
+
+int garray_getfloatwords(t_garray *x, int *size, t_word **vec)
+{
+  *size = x->a_n;
+  *vec = x->a_words;
+  return 1;
+}
+
+void garray_redraw(t_garray *x)
+{
+  x->a_redraws++;
+}
+
+void garray_usedindsp(t_garray *x)
+{
+  (void)x;
+}
+
+t_inlet *inlet_new(t_object *owner, t_pd *dest, t_symbol *s1, t_symbol *s2)
+{
+  (void)dest;
+  (void)s2;
+  t_inlet *in = calloc(1, sizeof(*in));
+  in->i_owner = owner;
+  in->i_signal = (s1 == &s_signal);
+  t_stub_object *so = stub_lookup(owner);
+  if (so != NULL && in->i_signal) so->so_sigin++;
+  return in;
+}
+
+t_inlet *signalinlet_new(t_object *owner, t_float f)
+{
+  t_stub_object *so = stub_lookup(owner);
+  if (so != NULL && so->so_sigin < STUB_MAXSIGIN) so->so_default[so->so_sigin] = f;
+  return inlet_new(owner, &owner->ob_pd, &s_signal, &s_signal);
+}
+
+void inlet_free(t_inlet *x)
+{
+  free(x);
+}
+
+t_outlet *outlet_new(t_object *owner, t_symbol *s)
+{
+  t_outlet *out = calloc(1, sizeof(*out));
+  out->o_owner = owner;
+  out->o_signal = (s == &s_signal);
+  t_stub_object *so = stub_lookup(owner);
+  if (so != NULL && out->o_signal) so->so_sigout++;
+  return out;
+}
+
+void outlet_anything(t_outlet *x, t_symbol *s, int argc, t_atom *argv)
+{
+  (void)x;
+  char line[256];
+  int n = snprintf(line, sizeof(line), "%s", s->s_name);
+  for (int i = 0; i < argc && n < (int)sizeof(line); i++) {
+    if (argv[i].a_type == A_FLOAT) {
+      n += snprintf(line + n, sizeof(line) - n, " %g", argv[i].a_w.w_float);
+    } else if (argv[i].a_type == A_SYMBOL) {
+      n += snprintf(line + n, sizeof(line) - n, " %s", argv[i].a_w.w_symbol->s_name);
+    }
+  }
+  post("outlet: %s", line);
+}
+
+void *getbytes(size_t nbytes)
+{
+  return calloc(1, nbytes ? nbytes : 1);
+}
+
+void *resizebytes(void *old, size_t oldsize, size_t newsize)
+{
+  void *p = realloc(old, newsize ? newsize : 1);
+  if (p != NULL && newsize > oldsize) {
+    memset((char *)p + oldsize, 0, newsize - oldsize);
+  }
+  return p;
+}
+
+void freebytes(void *x, size_t nbytes)
+{
+  (void)nbytes;
+  free(x);
+}
+
+void post(const char *fmt, ...)
+{
+  if (!stub_verbose) return;
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+}
+
+void pd_error(const void *object, const char *fmt, ...)
+{
+  (void)object;
+  va_list ap;
+  va_start(ap, fmt);
+  fputs("error: ", stderr);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+}
+
+void dsp_add(t_perfroutine f, int n, ...)
+{
+  t_stub_chain *chain = stub_current_chain;
+  if (chain == NULL) return;
+  int newsize = chain->c_size + n + 1;
+  // keep room for the terminating 0
+  chain->c_prog = realloc(chain->c_prog, (newsize + 1) * sizeof(t_int));
+  t_int *ip = chain->c_prog + chain->c_size;
+  *ip++ = (t_int)f;
+  va_list ap;
+  va_start(ap, n);
+  for (int i = 0; i < n; i++) {
+    *ip++ = va_arg(ap, t_int);
+  }
+  va_end(ap);
+  *ip = 0;
+  chain->c_size = newsize;
+}
+
+static t_int *stub_zero_perform(t_int *w)
+{
+  memset((t_sample *)w[1], 0, (size_t)w[2] * sizeof(t_sample));
+  return w + 3;
+}
+
+void dsp_add_zero(t_sample *out, int n)
+{
+  dsp_add(stub_zero_perform, 2, out, (t_int)n);
+}
+
+// the bench allocates every signal with calloc, so this can swap it for one
+// with room for all the channels
+void signal_setmultiout(t_signal **sig, int nchans)
+{
+  t_signal *s = *sig;
+  if (s->s_nchans == nchans) return;
+  free(s->s_vec);
+  s->s_vec = calloc((size_t)s->s_length * nchans, sizeof(t_sample));
+  s->s_nchans = nchans;
+  s->s_n = s->s_length * nchans;
+}
+
+t_float sys_getsr(void)
+{
+  return 44100;
+}
+
+t_glist *canvas_getcurrent(void)
+{
+  return NULL;
+}
+
+void canvas_makefilename(const t_glist *c, const char *file, char *result, int resultsize)
+{
+  (void)c;
+  snprintf(result, resultsize, "%s", file);
+}
+
+t_clock *clock_new(void *owner, t_method fn)
+{
+  t_clock *x = calloc(1, sizeof(t_clock));
+  x->k_owner = owner;
+  x->k_fn = fn;
+  x->k_next = stub_clocks;
+  stub_clocks = x;
+  return x;
+}
+
+void clock_delay(t_clock *x, double delaytime)
+{
+  (void)delaytime;
+  x->k_set = 1;
+}
+
+void clock_unset(t_clock *x)
+{
+  x->k_set = 0;
+}
+
+void clock_free(t_clock *x)
+{
+  t_clock **link = &stub_clocks;
+  while (*link != NULL && *link != x) link = &(*link)->k_next;
+  if (*link != NULL) *link = x->k_next;
+  free(x);
+}
+
+double clock_getlogicaltime(void)
+{
+  return stub_time;
+}
+
+double clock_gettimesince(double prevsystime)
+{
+  return stub_time - prevsystime;
+}
+
+void stub_time_advance(double ms)
+{
+  stub_time += ms;
+}
+
+void stub_clocks_run(void)
+{
+  // collect first: a callback may set its own clock again
+  int n = 0;
+  for (t_clock *k = stub_clocks; k != NULL; k = k->k_next) n += k->k_set;
+  for (t_clock *k = stub_clocks; k != NULL && n > 0; k = k->k_next) {
+    if (!k->k_set) continue;
+    k->k_set = 0;
+    n--;
+    ((void (*)(void *))k->k_fn)(k->k_owner);
+  }
+}
+
+t_class *stub_findclass(const char *name)
+{
+  for (int i = 0; i < stub_nclasses; i++) {
+    if (!strcmp(stub_classes[i].c_name->s_name, name)) return &stub_classes[i];
+  }
+  return NULL;
+}
+
+static int count_float_args(const t_atomtype *args)
+{
+  int n = 0;
+  while (args[n] != A_NULL) {
+    if (args[n] != A_FLOAT && args[n] != A_DEFFLOAT) return -1;
+    n++;
+  }
+  return n;
+}
+
+// Pd passes float arguments through t_floatarg; the externals here only need
+// up to three floats to be created, two for a method, or one symbol followed
+// by up to one float
+static void *call_float_method(void *fn, void *x, int nargs, const t_float *a, int isnew)
+{
+  typedef void *(*f0)(void);
+  typedef void *(*f1)(t_floatarg);
+  typedef void *(*f2)(t_floatarg, t_floatarg);
+  typedef void *(*f3)(t_floatarg, t_floatarg, t_floatarg);
+  typedef void (*m0)(void *);
+  typedef void (*m1)(void *, t_floatarg);
+  typedef void (*m2)(void *, t_floatarg, t_floatarg);
+
+  if (isnew) {
+    switch (nargs) {
+      case 0: return ((f0)fn)();
+      case 1: return ((f1)fn)(a[0]);
+      case 2: return ((f2)fn)(a[0], a[1]);
+      case 3: return ((f3)fn)(a[0], a[1], a[2]);
+    }
+    return NULL;
+  }
+  switch (nargs) {
+    case 0: ((m0)fn)(x); break;
+    case 1: ((m1)fn)(x, a[0]); break;
+    case 2: ((m2)fn)(x, a[0], a[1]); break;
+  }
+  return NULL;
+}
+
+static int call_symbol_method(t_stub_method *m, void *x, int argc, const char **argv)
+{
+  typedef void (*ms)(void *, t_symbol *);
+  typedef void (*msf)(void *, t_symbol *, t_floatarg);
+
+  if (m->m_args[1] == A_NULL) {
+    ((ms)m->m_fn)(x, gensym(argc > 0 ? argv[0] : ""));
+    return 1;
+  }
+  if ((m->m_args[1] == A_FLOAT || m->m_args[1] == A_DEFFLOAT) && m->m_args[2] == A_NULL) {
+    ((msf)m->m_fn)(x, gensym(argc > 0 ? argv[0] : ""),
+                   argc > 1 ? (t_float)atof(argv[1]) : 0);
+    return 1;
+  }
+  return 0;
+}
+
+t_object *stub_new(t_class *c, int argc, const t_float *argv)
+{
+  t_float args[STUB_MAXARGS] = {0};
+  int nargs = count_float_args(c->c_newargs);
+  if (nargs < 0 || nargs > 3) {
+    fprintf(stderr, "pd_stub: unsupported creation arguments for %s\n", c->c_name->s_name);
+    return NULL;
+  }
+  for (int i = 0; i < argc && i < nargs; i++) args[i] = argv[i];
+  return call_float_method((void *)c->c_new, NULL, nargs, args, 1);
+}
+
+void stub_free(t_object *x)
+{
+  if (x == NULL) return;
+  t_class *c = x->ob_pd;
+  if (c->c_free != NULL) ((void (*)(void *))c->c_free)(x);
+  t_stub_object *so = stub_lookup(x);
+  if (so != NULL) so->so_obj = NULL;
+  free(x);
+}
+
+int stub_send(t_object *x, const char *sel, int argc, const char **argv)
+{
+  t_class *c = x->ob_pd;
+  if (!strcmp(sel, "bang") && c->c_bang != NULL) {
+    ((void (*)(void *))c->c_bang)(x);
+    return 1;
+  }
+  t_symbol *s = gensym(sel);
+  for (int i = 0; i < c->c_nmethods; i++) {
+    t_stub_method *m = &c->c_methods[i];
+    if (m->m_sel != s) continue;
+    if (m->m_args[0] == A_SYMBOL || m->m_args[0] == A_DEFSYM) {
+      if (call_symbol_method(m, x, argc, argv)) return 1;
+      break;
+    }
+    int nargs = count_float_args(m->m_args);
+    if (nargs < 0 || nargs > 2) break;
+    t_float args[STUB_MAXARGS] = {0};
+    for (int j = 0; j < argc && j < nargs; j++) args[j] = (t_float)atof(argv[j]);
+    call_float_method((void *)m->m_fn, x, nargs, args, 0);
+    return 1;
+  }
+  fprintf(stderr, "%s: no method for '%s'\n", c->c_name->s_name, sel);
+  return 0;
+}
+
+int stub_signal_inlets(t_object *x)
+{
+  t_stub_object *so = stub_lookup(x);
+  return so ? so->so_sigin : 0;
+}
+
+t_float stub_signal_default(t_object *x, int inlet)
+{
+  t_stub_object *so = stub_lookup(x);
+  return (so != NULL && inlet >= 0 && inlet < STUB_MAXSIGIN) ? so->so_default[inlet] : 0;
+}
+
+int stub_signal_outlets(t_object *x)
+{
+  t_stub_object *so = stub_lookup(x);
+  return so ? so->so_sigout : 0;
+}
+
+int stub_dsp(t_object *x, t_signal **sp, t_stub_chain *chain)
+{
+  t_class *c = x->ob_pd;
+  t_symbol *s = gensym("dsp");
+  for (int i = 0; i < c->c_nmethods; i++) {
+    if (c->c_methods[i].m_sel != s) continue;
+    stub_current_chain = chain;
+    ((void (*)(void *, t_signal **))c->c_methods[i].m_fn)(x, sp);
+    stub_current_chain = NULL;
+    return chain->c_size > 0;
+  }
+  return 0;
+}
+
+void stub_chain_run(t_stub_chain *chain)
+{
+  t_int *ip = chain->c_prog;
+  while (*ip) ip = (*(t_perfroutine)(*ip))(ip);
+}
+
+void stub_chain_free(t_stub_chain *chain)
+{
+  free(chain->c_prog);
+  chain->c_prog = NULL;
+  chain->c_size = 0;
+}
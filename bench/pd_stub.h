@@ -0,0 +1,45 @@
+// bench-side view of the Pd stub: find classes registered by the *_setup
+// functions, instantiate objects, send them messages and build a one-object
+// dsp chain that can be run block by block.
+
+#ifndef PD_STUB_H
+#define PD_STUB_H
+
+#include "m_pd.h"
+
+#define STUB_MAXARGS 4
+
+typedef struct _stub_chain {
+  t_int *c_prog; // [routine, args..., routine, args..., 0]
+  int c_size;
+} t_stub_chain;
+
+t_class *stub_findclass(const char *name);
+t_object *stub_new(t_class *c, int argc, const t_float *argv);
+void stub_free(t_object *x);
+// arguments are converted to whatever the method was declared with
+int stub_send(t_object *x, const char *sel, int argc, const char **argv);
+// a named array of n zeroed words; resizing reallocates it, like Pd does
+t_garray *stub_garray_new(const char *name, int n);
+void stub_garray_resize(t_garray *a, int n);
+t_word *stub_garray_words(t_garray *a, int *n);
+int stub_garray_redraws(t_garray *a);
+int stub_signal_inlets(t_object *x);
+// the value an unconnected signal inlet reads (signalinlet_new), else 0
+t_float stub_signal_default(t_object *x, int inlet);
+int stub_signal_outlets(t_object *x);
+
+// calls the object's dsp method with freshly described signals and captures
+// whatever it passes to dsp_add
+int stub_dsp(t_object *x, t_signal **sp, t_stub_chain *chain);
+void stub_chain_run(t_stub_chain *chain);
+void stub_chain_free(t_stub_chain *chain);
+
+// fires every clock that is currently set, once, as if its delay had passed
+void stub_clocks_run(void);
+// moves Pd's logical time on; call before running each block
+void stub_time_advance(double ms);
+
+extern int stub_verbose; // print post() output?
+
+#endif
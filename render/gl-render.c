@@ -0,0 +1,541 @@
+// offline renderer: sound files through the gl~ grain engine, as fast as the
+// CPU allows
+//
+// links gl_engine.c and the kernels it uses with no Pd at all (see engine.h).
+// each input file is loaded whole into the engine's buffer, as if gl~ had
+// just recorded it, and played back with the grain positions sweeping across
+// it; the output is a 32-bit float WAVE file at the input's sample rate.
+// files are rendered in parallel, and with -s so are the channels of each
+// one, as separate mono engines.
+//
+// usage: gl-render [options] input...
+//   -o path      output file, only with a single input. default <input>.gl.wav
+//   -g ms        grain length in ms, default 100
+//   -n voices    grains in the looping cloud, default 16
+//   -l seconds   length of the output, default the length of the input
+//   -p from:to   where the grains start over the output, as fractions of the
+//                input, default 0:1. 0.5:0.5 freezes in the middle
+//   -r rate      playback rate of the grains, default 1
+//   -b block     samples processed at a time, default 1024
+//   -j jobs      files (or with -s, channels) rendered at once, default the
+//                number of CPUs
+//   -s           render each channel on its own, so -j can split a file
+//   -c channels  channels of raw (non-WAVE) inputs, default 1
+//   -S sr        sample rate of raw inputs, default 48000
+//   -m "msg"     gl~ message applied before rendering: mix, spread, density,
+//                jitter, seed, interp, window, render, resize or threads,
+//                e.g. -m "density 40" -m "jitter pitch 0.1"; repeatable. mix
+//                defaults to 1, the input itself is the dry signal
+//   -q           don't report each file
+//
+// with -m "threads <n>" each engine also renders its cloud on the render
+// pool (render_pool.h), which pays off for a few very dense files rather
+// than many light ones.
+
+#include "gl_engine.h"
+#include "sound_file.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RENDER_MAXMSGS 16
+#define RENDER_MAXARGS 4
+
+typedef struct _options {
+  const char *out;
+  int grain_ms;
+  int voices;
+  double seconds; // 0 for the length of the input
+  t_float from;
+  t_float to;
+  t_float rate;
+  int block;
+  int jobs;
+  int split;
+  int raw_channels;
+  t_float raw_sr;
+  const char *msgs[RENDER_MAXMSGS];
+  int nmsgs;
+  int quiet;
+} t_options;
+
+// one input file, loaded by the first of its jobs to run and written by the
+// last to finish
+typedef struct _file {
+  const char *f_path;
+  char *f_out;
+  pthread_mutex_t f_lock;
+  int f_loaded;
+  int f_error; // as sound_file.h, or ENOMEM
+  int f_parts_left;
+  int f_channels;
+  long f_frames;
+  t_float f_sr;
+  int f_size; // of the engine's buffer: f_frames, or 2 * DSP_GUARD if that's more
+  int f_stride; // f_size plus DSP_GUARD mirrored samples either side
+  t_sample *f_in; // f_channels planes of f_stride samples, see file_plane
+  long f_out_frames;
+  t_sample *f_result; // f_channels planes of f_out_frames samples
+  double f_seconds; // spent rendering, summed over its jobs
+} t_file;
+
+// one engine's worth of work: `channels` channels of a file from `first`
+typedef struct _job {
+  t_file *j_file;
+  int j_first;
+  int j_channels;
+} t_job;
+
+typedef struct _render {
+  const t_options *r_options;
+  t_job *r_jobs;
+  int r_njobs;
+  atomic_int r_next;
+  atomic_int r_failed;
+} t_render;
+
+// the window table cache and the render pool are for one control thread
+// (window_table.h, render_pool.h), so creating, changing and freeing
+// engines is done under this
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char *error_string(int error)
+{
+  return (error == ENOMEM) ? "out of memory" : sound_file_strerror(error);
+}
+
+// the format, from the header: which jobs the file makes and how much memory
+// it needs
+static int probe_file(t_file *f, const t_options *o)
+{
+  t_sound_file sf;
+  int error = sound_file_open_read(&sf, f->f_path, o->raw_channels);
+  if (error) return error;
+  sound_file_close(&sf);
+  if (sf.f_frames < 1 || sf.f_frames > (1 << 30)) return SOUND_FILE_EFORMAT;
+  f->f_channels = sf.f_channels;
+  f->f_frames = sf.f_frames;
+  f->f_sr = (sf.f_sr > 0) ? sf.f_sr : o->raw_sr;
+  // guarded, so the buffer can be just the file (see dsp_wrap)
+  f->f_size = (f->f_frames < 2 * DSP_GUARD) ? 2 * DSP_GUARD : (int)f->f_frames;
+  f->f_stride = f->f_size + 2 * DSP_GUARD;
+  f->f_out_frames = (o->seconds > 0) ? (long)(o->seconds * f->f_sr) : f->f_frames;
+  return (f->f_out_frames > 0) ? 0 : SOUND_FILE_EFORMAT;
+}
+
+static t_sample *file_plane(const t_file *f, int c)
+{
+  return f->f_in + (size_t)c * f->f_stride + DSP_GUARD;
+}
+
+// the whole file into planes of the buffer, zero past the end of a very short
+// one, with the guard samples the engine's unmasked reads expect
+static int load_file(t_file *f, const t_options *o)
+{
+  f->f_in = (t_sample *)getbytes((size_t)f->f_channels * f->f_stride * sizeof(t_sample));
+  f->f_result = (t_sample *)getbytes((size_t)f->f_channels * f->f_out_frames
+                                     * sizeof(t_sample));
+  if (f->f_in == NULL || f->f_result == NULL) return ENOMEM;
+  t_sound_file sf;
+  int error = sound_file_open_read(&sf, f->f_path, o->raw_channels);
+  if (error) return error;
+  t_sample *dst[SOUND_FILE_CHUNK];
+  long done = 0;
+  while (done < f->f_frames) {
+    for (int c = 0; c < f->f_channels; c++) dst[c] = file_plane(f, c) + done;
+    int got = 0;
+    error = sound_file_read(&sf, dst, f->f_channels, SOUND_FILE_CHUNK, &got);
+    if (error || got == 0) break;
+    done += got;
+  }
+  sound_file_close(&sf);
+  if (!error && done < f->f_frames) error = SOUND_FILE_EFORMAT; // cut short
+  for (int c = 0; c < f->f_channels; c++) {
+    dsp_guard_fill(file_plane(f, c), SAMPLE_FLOAT, f->f_size, DSP_GUARD);
+  }
+  return error;
+}
+
+static int write_file(t_file *f)
+{
+  t_sound_file sf;
+  int error = sound_file_open_write(&sf, f->f_out, f->f_out_frames, f->f_channels, f->f_sr);
+  if (error) return error;
+  t_sample *src[SOUND_FILE_CHUNK];
+  for (int c = 0; c < f->f_channels; c++) src[c] = f->f_result + (size_t)c * f->f_out_frames;
+  error = sound_file_write(&sf, src, (int)f->f_out_frames);
+  int close_error = sound_file_close(&sf);
+  return error ? error : close_error;
+}
+
+static void free_file(t_file *f)
+{
+  if (f->f_in != NULL) {
+    freebytes(f->f_in, (size_t)f->f_channels * f->f_stride * sizeof(t_sample));
+    f->f_in = NULL;
+  }
+  if (f->f_result != NULL) {
+    freebytes(f->f_result, (size_t)f->f_channels * f->f_out_frames * sizeof(t_sample));
+    f->f_result = NULL;
+  }
+}
+
+// a gl~ message, as Pd would have parsed it. returns 0 if it isn't one
+static int apply_message(t_gl_engine *e, const char *msg)
+{
+  char copy[256];
+  snprintf(copy, sizeof(copy), "%s", msg);
+  char *argv[RENDER_MAXARGS];
+  int argc = 0;
+  char *sel = strtok(copy, " ");
+  char *tok;
+  while (sel != NULL && argc < RENDER_MAXARGS && (tok = strtok(NULL, " ")) != NULL) {
+    argv[argc++] = tok;
+  }
+  if (sel == NULL || argc < 1) return 0;
+  t_float f = (t_float)atof(argv[argc - 1]);
+  if (!strcmp(sel, "mix")) {
+    gl_engine_mix(e, (f < 0) ? 0 : (f > 1) ? 1 : f);
+  } else if (!strcmp(sel, "spread")) {
+    gl_engine_spread(e, (f > 0) ? f : 0);
+  } else if (!strcmp(sel, "density")) {
+    gl_engine_density(e, (f > 0) ? f : 0);
+  } else if (!strcmp(sel, "resize")) {
+    gl_engine_grain_ms(e, (f > 10) ? f : 10);
+  } else if (!strcmp(sel, "seed")) {
+    gl_engine_seed(e, (unsigned int)f);
+  } else if (!strcmp(sel, "render")) {
+    if (!(f >= RENDER_SIMD && f <= RENDER_SCALAR) || f != (int)f) return 0;
+    gl_engine_render(e, (t_gl_render)(int)f);
+  } else if (!strcmp(sel, "threads")) {
+    if (!gl_engine_threads(e, (int)f)) gl_engine_threads(e, 0);
+  } else if (!strcmp(sel, "interp")) {
+    int kind = dsp_interp_from_name(argv[0]);
+    if (kind < 0) return 0;
+    gl_engine_interp(e, (t_interp)kind);
+  } else if (!strcmp(sel, "window")) {
+    int shape = window_shape_from_name(argv[0]);
+    if (shape < 0 || !gl_engine_window(e, (t_window_shape)shape)) return 0;
+  } else if (!strcmp(sel, "jitter") && argc == 2) {
+    if (f < 0) f = 0;
+    if (!strcmp(argv[0], "onset")) {
+      gl_engine_jitter(e, JITTER_ONSET, (f < 1) ? f : 1);
+    } else if (!strcmp(argv[0], "position")) {
+      gl_engine_jitter(e, JITTER_POSITION, f);
+    } else if (!strcmp(argv[0], "duration")) {
+      gl_engine_jitter(e, JITTER_DURATION, (f < 1) ? f : 1);
+    } else if (!strcmp(argv[0], "pitch")) {
+      gl_engine_jitter(e, JITTER_PITCH, f);
+    } else {
+      return 0;
+    }
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+// the messages are applied before gl_engine_dsp, at no sample rate, so the
+// ramps jump straight to them; threads needs the block size, so comes after
+static int setup_engine(t_gl_engine *e, const t_options *o, const t_file *f, int channels)
+{
+  int ok = gl_engine_init(e, o->grain_ms, o->voices, channels);
+  if (ok) {
+    gl_engine_mix(e, 1);
+    for (int i = 0; i < o->nmsgs; i++) {
+      if (strncmp(o->msgs[i], "threads", 7)) apply_message(e, o->msgs[i]);
+    }
+    ok = gl_engine_dsp(e, f->f_sr, channels, o->block);
+    for (int i = 0; ok && i < o->nmsgs; i++) {
+      if (!strncmp(o->msgs[i], "threads", 7)) apply_message(e, o->msgs[i]);
+    }
+  }
+  return ok;
+}
+
+// the grain positions for n output samples from `at`, and the dry input
+// under them, laid out the way gl_engine_process reads them
+static void fill_inputs(const t_options *o, const t_file *f, int first, int channels,
+                        long at, int n, t_sample *dry, t_sample *pos)
+{
+  double span = (f->f_out_frames > 1) ? f->f_out_frames - 1 : 1;
+  double scale = (double)f->f_frames / f->f_size;
+  for (int i = 0; i < n; i++) {
+    double frac = o->from + (o->to - o->from) * ((at + i) / span);
+    pos[i] = (t_sample)(2 * frac * scale - 1);
+  }
+  for (int c = 0; c < channels; c++) {
+    const t_sample *in = file_plane(f, first + c);
+    t_sample *d = dry + (size_t)c * o->block;
+    for (int i = 0; i < n; i++) d[i] = (at + i < f->f_frames) ? in[at + i] : 0;
+  }
+}
+
+static int render_job(const t_options *o, const t_job *job)
+{
+  t_file *f = job->j_file;
+  int channels = job->j_channels;
+  int block = o->block;
+  size_t scratch = (size_t)(2 * channels + 2) * block;
+  t_sample *mem = (t_sample *)getbytes(scratch * sizeof(t_sample));
+  if (mem == NULL) return ENOMEM;
+  t_sample *dry = mem;
+  t_sample *out = dry + (size_t)channels * block;
+  t_sample *pos = out + (size_t)channels * block;
+  t_sample *rate = pos + block;
+  for (int i = 0; i < block; i++) rate[i] = o->rate;
+
+  t_gl_engine e;
+  pthread_mutex_lock(&control_lock);
+  int ok = setup_engine(&e, o, f, channels);
+  pthread_mutex_unlock(&control_lock);
+  if (ok) {
+    gl_engine_buffer(&e, file_plane(f, job->j_first), f->f_size, 0, DSP_GUARD, SAMPLE_FLOAT);
+    e.e_recorded = (int)f->f_frames;
+    e.e_write_phase = dsp_wrap((int)f->f_frames, f->f_size);
+    gl_engine_state(&e, STATE_PLAYING);
+
+    // ahead, the output is a block late: the first block is dropped and one
+    // more is rendered at the end
+    int late = gl_engine_ahead(&e) ? block : 0;
+    for (long at = 0; at < f->f_out_frames + late; at += block) {
+      int n = (int)((f->f_out_frames + late - at < block) ? f->f_out_frames + late - at
+                                                          : block);
+      fill_inputs(o, f, job->j_first, channels, at, n, dry, pos);
+      if (late) {
+        gl_engine_finish(&e);
+        // a short last block would change what the pool renders into
+        if (n < block) memset(pos + n, 0, (block - n) * sizeof(t_sample));
+        gl_engine_process_ahead(&e, dry, pos, rate, out, block);
+      } else {
+        gl_engine_process(&e, dry, pos, rate, out, n);
+      }
+      long to = at - late;
+      int from = 0;
+      if (to < 0) {
+        from = (int)-to;
+        to = 0;
+      }
+      for (int c = 0; c < channels; c++) {
+        t_sample *dst = f->f_result + (size_t)(job->j_first + c) * f->f_out_frames;
+        for (int i = from; i < n && to + i - from < f->f_out_frames; i++) {
+          dst[to + i - from] = out[(size_t)c * block + i];
+        }
+      }
+    }
+  }
+  pthread_mutex_lock(&control_lock);
+  gl_engine_free(&e);
+  pthread_mutex_unlock(&control_lock);
+  freebytes(mem, scratch * sizeof(t_sample));
+  return ok ? 0 : ENOMEM;
+}
+
+static void run_job(t_render *r, const t_job *job)
+{
+  const t_options *o = r->r_options;
+  t_file *f = job->j_file;
+
+  pthread_mutex_lock(&f->f_lock);
+  if (!f->f_loaded) {
+    f->f_error = load_file(f, o);
+    f->f_loaded = 1;
+  }
+  int error = f->f_error;
+  pthread_mutex_unlock(&f->f_lock);
+
+  double start = now_seconds();
+  if (!error) error = render_job(o, job);
+  double seconds = now_seconds() - start;
+
+  pthread_mutex_lock(&f->f_lock);
+  f->f_seconds += seconds;
+  if (error && !f->f_error) f->f_error = error;
+  int done = (--f->f_parts_left == 0);
+  pthread_mutex_unlock(&f->f_lock);
+  if (!done) return;
+
+  if (!f->f_error) f->f_error = write_file(f);
+  if (f->f_error) {
+    fprintf(stderr, "gl-render: %s: %s\n", f->f_path, error_string(f->f_error));
+    atomic_store(&r->r_failed, 1);
+  } else if (!o->quiet) {
+    double length = (double)f->f_out_frames / f->f_sr;
+    printf("%s -> %s: %.1f s in %.2f s cpu, %.0fx realtime\n", f->f_path, f->f_out, length,
+           f->f_seconds, length / (f->f_seconds > 0 ? f->f_seconds : 1e-9));
+    fflush(stdout);
+  }
+  free_file(f);
+}
+
+static void *render_thread(void *arg)
+{
+  t_render *r = (t_render *)arg;
+  int i;
+  while ((i = atomic_fetch_add(&r->r_next, 1)) < r->r_njobs) run_job(r, &r->r_jobs[i]);
+  return NULL;
+}
+
+static char *output_name(const char *path)
+{
+  const char *dot = strrchr(path, '.');
+  const char *slash = strrchr(path, '/');
+  size_t stem = (dot != NULL && (slash == NULL || dot > slash)) ? (size_t)(dot - path)
+                                                                : strlen(path);
+  char *out = (char *)malloc(stem + sizeof(".gl.wav"));
+  if (out != NULL) {
+    memcpy(out, path, stem);
+    strcpy(out + stem, ".gl.wav");
+  }
+  return out;
+}
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "usage: gl-render [-o out] [-g grain_ms] [-n voices] [-l seconds] [-p from:to]\n"
+          "                 [-r rate] [-b block] [-j jobs] [-s] [-c channels] [-S sr]\n"
+          "                 [-m \"msg\"] [-q] input...\n");
+}
+
+int main(int argc, char **argv)
+{
+  t_options o;
+  memset(&o, 0, sizeof(o));
+  o.grain_ms = 100;
+  o.voices = 16;
+  o.from = 0;
+  o.to = 1;
+  o.rate = 1;
+  o.block = 1024;
+  o.jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  o.raw_channels = 1;
+  o.raw_sr = 48000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "o:g:n:l:p:r:b:j:sc:S:m:qh")) != -1) {
+    switch (opt) {
+      case 'o': o.out = optarg; break;
+      case 'g': o.grain_ms = atoi(optarg); break;
+      case 'n': o.voices = atoi(optarg); break;
+      case 'l': o.seconds = atof(optarg); break;
+      case 'p':
+        if (sscanf(optarg, "%f:%f", &o.from, &o.to) != 2) o.from = o.to = -1;
+        break;
+      case 'r': o.rate = (t_float)atof(optarg); break;
+      case 'b': o.block = atoi(optarg); break;
+      case 'j': o.jobs = atoi(optarg); break;
+      case 's': o.split = 1; break;
+      case 'c': o.raw_channels = atoi(optarg); break;
+      case 'S': o.raw_sr = (t_float)atof(optarg); break;
+      case 'm':
+        if (o.nmsgs < RENDER_MAXMSGS) o.msgs[o.nmsgs++] = optarg;
+        break;
+      case 'q': o.quiet = 1; break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+  int nfiles = argc - optind;
+  if (nfiles < 1 || (o.out != NULL && nfiles > 1) || o.grain_ms < 10 || o.voices < 1
+      || o.from < 0 || o.from > 1 || o.to < 0 || o.to > 1 || o.block < 1 || o.seconds < 0
+      || o.raw_channels < 1 || o.raw_sr <= 0) {
+    usage();
+    return 1;
+  }
+  if (o.jobs < 1) o.jobs = 1;
+  gl_engine_setup();
+
+  // the messages are checked once on an engine of their own, so a typo stops
+  // the run before anything is rendered
+  t_gl_engine check;
+  if (!gl_engine_init(&check, o.grain_ms, o.voices, 1)) {
+    fprintf(stderr, "gl-render: out of memory\n");
+    return 1;
+  }
+  for (int i = 0; i < o.nmsgs; i++) {
+    if (!apply_message(&check, o.msgs[i])) {
+      fprintf(stderr, "gl-render: bad message '%s'\n", o.msgs[i]);
+      gl_engine_free(&check);
+      return 1;
+    }
+  }
+  gl_engine_free(&check);
+
+  t_file *files = (t_file *)calloc(nfiles, sizeof(t_file));
+  t_render r;
+  r.r_options = &o;
+  r.r_njobs = 0;
+  atomic_init(&r.r_next, 0);
+  atomic_init(&r.r_failed, 0);
+  if (files == NULL) {
+    fprintf(stderr, "gl-render: out of memory\n");
+    return 1;
+  }
+  for (int i = 0; i < nfiles; i++) {
+    t_file *f = &files[i];
+    f->f_path = argv[optind + i];
+    f->f_out = (o.out != NULL) ? strdup(o.out) : output_name(f->f_path);
+    pthread_mutex_init(&f->f_lock, NULL);
+    int error = (f->f_out != NULL) ? probe_file(f, &o) : ENOMEM;
+    if (error) {
+      fprintf(stderr, "gl-render: %s: %s\n", f->f_path, error_string(error));
+      atomic_store(&r.r_failed, 1);
+      continue;
+    }
+    f->f_parts_left = o.split ? f->f_channels : 1;
+    r.r_njobs += f->f_parts_left;
+  }
+  // the jobs are taken in order, so only about -j files are in memory at once
+  r.r_jobs = (t_job *)calloc(r.r_njobs + 1, sizeof(t_job));
+  if (r.r_jobs == NULL) {
+    fprintf(stderr, "gl-render: out of memory\n");
+    return 1;
+  }
+  t_job *job = r.r_jobs;
+  for (int i = 0; i < nfiles; i++) {
+    for (int c = 0; c < files[i].f_parts_left; c++, job++) {
+      job->j_file = &files[i];
+      job->j_first = o.split ? c : 0;
+      job->j_channels = o.split ? 1 : files[i].f_channels;
+    }
+  }
+
+  double start = now_seconds();
+  int threads = (o.jobs < r.r_njobs) ? o.jobs : r.r_njobs;
+  if (threads < 1) threads = 1;
+  pthread_t *tids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  int started = 0;
+  while (tids != NULL && started < threads - 1
+         && pthread_create(&tids[started], NULL, render_thread, &r) == 0) {
+    started++;
+  }
+  render_thread(&r);
+  for (int i = 0; i < started; i++) pthread_join(tids[i], NULL);
+  if (!o.quiet && nfiles > 1) {
+    printf("%d files in %.2f s\n", nfiles, now_seconds() - start);
+  }
+
+  for (int i = 0; i < nfiles; i++) {
+    pthread_mutex_destroy(&files[i].f_lock);
+    free(files[i].f_out);
+  }
+  free(tids);
+  free(files);
+  free(r.r_jobs);
+  return atomic_load(&r.r_failed) ? 1 : 0;
+}
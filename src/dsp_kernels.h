@@ -0,0 +1,296 @@
+// interpolation kernels shared by looper~, glooper~ and gl~ (the window
+// shapes and the sinc table live in window_table.c)
+//
+// header only so every kernel can be inlined into the perform loops. all of
+// the interpolators read a ring buffer with the look-behind layout gl~ has
+// always used: for a tap index i and a fraction frac they return the
+// signal at (i - 1) - frac, i.e. frac = 0 gives buffer[i - 1] and frac = 1
+// gives buffer[i - 2]. ring sample i lives at buffer[i << shift]: shift is 0
+// for our own buffers and 1 for a Pd array of 8-byte t_words (ring_buffer.h).
+// a ring can also have guard samples either side of it that mirror its other
+// end (dsp_guard_fill), so all the taps of a wrapped index are next to each
+// other and can be read without masking each one, see DSP_GUARD. the
+// kernels read t_samples; storage in a compact format (sample_format.h) is
+// written with dsp_ring_store and decoded by the renderers before it gets
+// to them.
+//
+// the *_n variants interpolate n indices in one call. their loops have no
+// dependencies between iterations so the compiler can vectorize them.
+
+#ifndef DSP_KERNELS_H
+#define DSP_KERNELS_H
+
+#include "engine.h"
+#include "sample_format.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#define DSP_INLINE static __forceinline
+#else
+#define DSP_INLINE static inline __attribute__((always_inline))
+#endif
+
+typedef enum {
+  INTERP_LINEAR,
+  INTERP_CUBIC,
+  INTERP_HERMITE,
+  INTERP_SINC
+} t_interp;
+
+#define INTERP_DEFAULT INTERP_CUBIC
+
+// windowed sinc: SINC_TAPS taps, kernel tabulated at SINC_PHASES fractions
+// (plus guard rows so the phase lerp never reads past the end)
+#define SINC_TAPS 8
+#define SINC_PHASES 512
+
+// one table for the whole binary, in window_table.c
+extern t_sample dsp_sinc_table[(SINC_PHASES + 2) * SINC_TAPS];
+
+// fills the sinc table, once, from the class setup functions (or
+// grains_select_engine for hosts without Pd); calling it again does nothing
+void dsp_kernels_setup(void);
+
+// returns -1 for an unknown name
+static inline int dsp_interp_from_name(const char *name)
+{
+  if (!strcmp(name, "linear")) return INTERP_LINEAR;
+  if (!strcmp(name, "cubic")) return INTERP_CUBIC;
+  if (!strcmp(name, "hermite")) return INTERP_HERMITE;
+  if (!strcmp(name, "sinc")) return INTERP_SINC;
+  return -1;
+}
+
+#define DSP_TAP(buffer, i, mask, shift) ((buffer)[((i) & (mask)) << (shift)])
+
+// ring position `index`, any int, wrapped into a ring of `size` samples. a
+// ring without a guard is always a power of 2 and this is the mask it has
+// always been; with one it can be any size, since the taps around a wrapped
+// index are in the guard (see DSP_GUARD). then a position already in range
+// costs a compare, and one that isn't a division. the power of 2 test is
+// the same all through a loop, so the compiler takes it out of it
+DSP_INLINE int dsp_wrap(int index, int size)
+{
+  if ((size & (size - 1)) == 0) return index & (size - 1);
+  if ((unsigned int)index < (unsigned int)size) return index;
+  index %= size;
+  return (index < 0) ? index + size : index;
+}
+
+// guard samples either side of a ring that has them: buffer[-DSP_GUARD] up
+// to buffer[-1] hold its last DSP_GUARD samples, and buffer[size] onwards its
+// first. that covers every tap of every interpolator (interp_sinc reaches
+// furthest, index + 2 down to index - 5), so with shift 0 the taps of a
+// wrapped index are buffer[index + 2] down to buffer[index - 5] as they are,
+// and read with -1 as the mask.
+// whatever writes to the ring keeps the mirrors up to date, either sample by
+// sample with dsp_ring_write or in one go with dsp_guard_fill. guarded rings
+// are at least 2 * DSP_GUARD samples
+#define DSP_GUARD 8
+
+// sample `index` (wrapped) of a ring of `size` samples with `guard` samples
+// either side, 0 or DSP_GUARD, and its mirror if it has one
+DSP_INLINE void dsp_ring_write(t_sample *buffer, int index, int size, int shift, int guard,
+                               t_sample value)
+{
+  buffer[index << shift] = value;
+  if (guard > 0) {
+    if (index < guard) {
+      buffer[index + size] = value;
+    } else if (index >= size - guard) {
+      buffer[index - size] = value;
+    }
+  }
+}
+
+// dsp_ring_write for storage in any format. compact storage is always our
+// own, so its shift is 0; the mirror gets the same bits as the sample
+DSP_INLINE void dsp_ring_store(void *buffer, t_sample_format format, int index, int size,
+                               int shift, int guard, t_sample value)
+{
+  if (format == SAMPLE_FLOAT) {
+    dsp_ring_write((t_sample *)buffer, index, size, shift, guard, value);
+    return;
+  }
+  uint16_t *samples = (uint16_t *)buffer;
+  uint16_t bits = (format == SAMPLE_INT16) ? (uint16_t)sample_to_int16(value, index)
+                                           : sample_to_half(value);
+  samples[index] = bits;
+  if (guard > 0) {
+    if (index < guard) {
+      samples[index + size] = bits;
+    } else if (index >= size - guard) {
+      samples[index - size] = bits;
+    }
+  }
+}
+
+// both mirrors of a ring of `size` samples in `format`, after writing to it
+// in bulk
+static inline void dsp_guard_fill(void *buffer, t_sample_format format, int size, int guard)
+{
+  if (guard <= 0) return;
+  size_t bytes = sample_format_bytes(format);
+  char *b = (char *)buffer;
+  memcpy(b - guard * bytes, b + (size - guard) * bytes, guard * bytes);
+  memcpy(b + size * bytes, b, guard * bytes);
+}
+
+DSP_INLINE t_sample interp_linear(const t_sample *buffer, int index, int mask, int shift,
+                                  t_sample frac)
+{
+  t_sample b = DSP_TAP(buffer, index - 1, mask, shift);
+  t_sample c = DSP_TAP(buffer, index - 2, mask, shift);
+  return b + frac * (c - b);
+}
+
+// the original gl~/glooper~ cubic
+DSP_INLINE t_sample interp_cubic(const t_sample *buffer, int index, int mask, int shift,
+                                 t_sample frac)
+{
+  t_sample a = DSP_TAP(buffer, index, mask, shift);
+  t_sample b = DSP_TAP(buffer, index - 1, mask, shift);
+  t_sample c = DSP_TAP(buffer, index - 2, mask, shift);
+  t_sample d = DSP_TAP(buffer, index - 3, mask, shift);
+  t_sample cminusb = c - b;
+
+  return b + frac * (
+      cminusb - 0.1666667f * (1.0f - frac) * (
+          (d - a - 3.0f * cminusb) * frac + (d + 2.0f * a - 3.0f * b)
+      )
+  );
+}
+
+// 4-point, 3rd order hermite (catmull-rom)
+DSP_INLINE t_sample interp_hermite(const t_sample *buffer, int index, int mask, int shift,
+                                   t_sample frac)
+{
+  t_sample xm1 = DSP_TAP(buffer, index, mask, shift);
+  t_sample x0 = DSP_TAP(buffer, index - 1, mask, shift);
+  t_sample x1 = DSP_TAP(buffer, index - 2, mask, shift);
+  t_sample x2 = DSP_TAP(buffer, index - 3, mask, shift);
+  t_sample c1 = 0.5f * (x1 - xm1);
+  t_sample c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+  t_sample c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+  return ((c3 * frac + c2) * frac + c1) * frac + x0;
+}
+
+// SINC_TAPS taps centred on the read position, buffer[index + 2] down to
+// buffer[index - 5]. the kernel is linearly interpolated between phases
+DSP_INLINE t_sample interp_sinc(const t_sample *buffer, int index, int mask, int shift,
+                                t_sample frac)
+{
+  t_sample p = frac * SINC_PHASES;
+  int row = (int)p;
+  t_sample f = p - row;
+  const t_sample *h0 = dsp_sinc_table + row * SINC_TAPS;
+  const t_sample *h1 = h0 + SINC_TAPS;
+  t_sample y = 0.0f;
+  for (int t = 0; t < SINC_TAPS; t++) {
+    t_sample h = h0[t] + f * (h1[t] - h0[t]);
+    y += h * DSP_TAP(buffer, index + SINC_TAPS / 2 - 2 - t, mask, shift);
+  }
+  return y;
+}
+
+DSP_INLINE t_sample interp_sample(t_interp kind, const t_sample *buffer, int index, int mask,
+                                  int shift, t_sample frac)
+{
+  switch (kind) {
+    case INTERP_LINEAR: return interp_linear(buffer, index, mask, shift, frac);
+    case INTERP_HERMITE: return interp_hermite(buffer, index, mask, shift, frac);
+    case INTERP_SINC: return interp_sinc(buffer, index, mask, shift, frac);
+    default: return interp_cubic(buffer, index, mask, shift, frac);
+  }
+}
+
+// splits a non-negative buffer position into a masked tap index and fraction
+DSP_INLINE int interp_split(float full_index, int mask, t_sample *frac)
+{
+  int index = (int)full_index;
+  *frac = full_index - (t_sample)index;
+  return index & mask;
+}
+
+// read pointers that move at a rate are kept as a whole number of samples plus
+// a fraction in [0, 1). a float position loses precision the further it gets
+// into the buffer (at 2^18 samples it only resolves 1/64 of a sample) and a
+// float accumulator would drift a little more every step; this way the
+// fraction keeps its 24 bits anywhere in the buffer
+DSP_INLINE void phase_step(int *whole, t_sample *frac, t_sample step)
+{
+  t_sample f = *frac + step;
+  t_sample carry = floorf(f);
+  *whole += (int)carry;
+  *frac = f - carry;
+}
+
+// a position made of a whole part and a sum of fractions (>= 0, possibly past
+// 1) -> tap index, wrapped into a ring of `size` samples, and fraction
+DSP_INLINE int interp_split_parts(int whole, t_sample frac_sum, int size, t_sample *frac)
+{
+  int carry = (int)frac_sum;
+  *frac = frac_sum - (t_sample)carry;
+  return dsp_wrap(whole + carry, size);
+}
+
+// the whole and fractional parts of a non-negative position in double
+DSP_INLINE int position_split(double position, t_sample *frac)
+{
+  int whole = (int)position;
+  *frac = (t_sample)(position - whole);
+  return whole;
+}
+
+// a grain start inlet value in [-1, 1] -> where it lands in a buffer of size
+// samples, split like the read pointers. start_split scales it to (0, 1) in
+// t_sample, as gl~ and glooper~ always have: that rounds it to 1 / 2^24 of
+// the buffer, which past DSP_FLOAT_SAFE samples is coarser than 1/64 of a
+// sample and grains moving slowly through a long buffer step audibly.
+// start_split_wide does the same in double and keeps all the precision the
+// inlet has
+#define DSP_START_SPLIT(name, real) \
+  DSP_INLINE int name(t_sample in, int size, t_sample *frac) \
+  { \
+    real s = in; \
+    if (s > 1) s = 1; \
+    if (s < -1) s = -1; \
+    s = s * (real)0.5 + (real)0.5; \
+    return position_split((double)s * size, frac); \
+  }
+
+DSP_START_SPLIT(start_split, t_sample)
+DSP_START_SPLIT(start_split_wide, double)
+
+// buffers longer than this use start_split_wide
+#define DSP_FLOAT_SAFE (1 << 18)
+
+// n positions, already split into masked tap indices and fractions
+#define DSP_INTERP_N(name, kernel) \
+  DSP_INLINE void name(const t_sample *buffer, int mask, int shift, const int *index, \
+                       const t_sample *frac, t_sample *out, int n) \
+  { \
+    for (int i = 0; i < n; i++) { \
+      out[i] = kernel(buffer, index[i], mask, shift, frac[i]); \
+    } \
+  }
+
+DSP_INTERP_N(interp_linear_n, interp_linear)
+DSP_INTERP_N(interp_cubic_n, interp_cubic)
+DSP_INTERP_N(interp_hermite_n, interp_hermite)
+DSP_INTERP_N(interp_sinc_n, interp_sinc)
+
+// interpolates n buffer positions; the switch is outside of the loop
+DSP_INLINE void interp_n(t_interp kind, const t_sample *buffer, int mask, int shift,
+                         const int *index, const t_sample *frac, t_sample *out, int n)
+{
+  switch (kind) {
+    case INTERP_LINEAR: interp_linear_n(buffer, mask, shift, index, frac, out, n); break;
+    case INTERP_HERMITE: interp_hermite_n(buffer, mask, shift, index, frac, out, n); break;
+    case INTERP_SINC: interp_sinc_n(buffer, mask, shift, index, frac, out, n); break;
+    default: interp_cubic_n(buffer, mask, shift, index, frac, out, n); break;
+  }
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "dsp_stats.h"
+#include <stdlib.h>
+
+void dsp_stats_init(t_dsp_stats *s)
+{
+  s->s_enabled = 0;
+  s->s_blocks = NULL;
+  atomic_init(&s->s_count, 0);
+  atomic_init(&s->s_reset, 0);
+}
+
+void dsp_stats_free(t_dsp_stats *s)
+{
+  s->s_enabled = 0;
+  if (s->s_blocks != NULL) {
+    freebytes(s->s_blocks, DSP_STATS_BLOCKS * sizeof(t_dsp_block));
+    s->s_blocks = NULL;
+  }
+}
+
+int dsp_stats_enable(t_dsp_stats *s, int on)
+{
+  if (!on) {
+    s->s_enabled = 0;
+    return 1;
+  }
+  // perform may still be writing to it, so it's never freed before the object
+  if (s->s_blocks == NULL) {
+    s->s_blocks = (t_dsp_block *)getbytes(DSP_STATS_BLOCKS * sizeof(t_dsp_block));
+    if (s->s_blocks == NULL) return 0;
+  }
+  atomic_store_explicit(&s->s_reset, 1, memory_order_release);
+  s->s_enabled = 1;
+  return 1;
+}
+
+static int compare_float(const void *a, const void *b)
+{
+  float x = *(const float *)a, y = *(const float *)b;
+  return (x > y) - (x < y);
+}
+
+void dsp_stats_report(t_dsp_stats *s, t_outlet *outlet, t_float sr)
+{
+  t_atom a[8];
+  unsigned int count = (s->s_blocks == NULL) ? 0
+    : atomic_load_explicit(&s->s_count, memory_order_acquire);
+  int n = (count < DSP_STATS_BLOCKS) ? (int)count : DSP_STATS_BLOCKS;
+  for (int i = 0; i < 8; i++) SETFLOAT(&a[i], 0);
+  SETFLOAT(&a[0], n);
+
+  float *ns = (n > 0) ? (float *)getbytes(n * sizeof(float)) : NULL;
+  if (ns != NULL) {
+    double total = 0, samples = 0, grains = 0;
+    for (int i = 0; i < n; i++) {
+      const t_dsp_block *b = &s->s_blocks[i];
+      ns[i] = b->b_ns;
+      total += b->b_ns;
+      samples += b->b_samples;
+      grains += b->b_grains;
+    }
+    qsort(ns, n, sizeof(float), compare_float);
+    int p99 = (int)(0.99 * n + 0.5) - 1;
+    if (p99 < 0) p99 = 0;
+    SETFLOAT(&a[1], ns[0] * 0.001f);
+    SETFLOAT(&a[2], total / n * 0.001);
+    SETFLOAT(&a[3], ns[p99] * 0.001f);
+    SETFLOAT(&a[4], ns[n - 1] * 0.001f);
+    // real time for those samples is samples / sr seconds
+    if (samples > 0 && sr > 0) SETFLOAT(&a[5], 100.0 * total * sr / (samples * 1e9));
+    SETFLOAT(&a[6], grains / n);
+    SETFLOAT(&a[7], s->s_blocks[(count - 1) & (DSP_STATS_BLOCKS - 1)].b_fill);
+    freebytes(ns, n * sizeof(float));
+  }
+  outlet_anything(outlet, gensym("stats"), 8, a);
+}
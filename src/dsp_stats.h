@@ -0,0 +1,74 @@
+// opt-in timing of the perform routines, reported by a `stats` message
+//
+// `profile 1` allocates a ring of the last DSP_STATS_BLOCKS blocks and turns
+// the timing on; from then on perform reads the clock before and after its
+// work and adds the block to the ring, with how many grains were playing and
+// how full the buffer was. `stats` sorts a copy of the ring on the message
+// thread and sends the blocks counted, the min, mean, 99th percentile and max
+// time per block in microseconds, the mean load as a percentage of real time,
+// the mean number of grains and the last fill (0..1) out of the info outlet:
+//
+//   stats <blocks> <min> <mean> <p99> <max> <load> <grains> <fill>
+//
+// while it's off perform only tests s_enabled once per block: the perform
+// routines inline their work into both sides of that test. the ring is
+// written by perform and read by the methods; s_count is published with
+// release order so a report never reads a block that isn't finished, like
+// event_queue.h.
+
+#ifndef DSP_STATS_H
+#define DSP_STATS_H
+
+#include "m_pd.h"
+#include <stdatomic.h>
+#include <time.h>
+
+#define DSP_STATS_BLOCKS 1024 // power of 2, ~1.4 s of 64 sample blocks at 48k
+
+typedef struct _dsp_block {
+  float b_ns;
+  int b_samples;
+  int b_grains;
+  float b_fill;
+} t_dsp_block;
+
+typedef struct _dsp_stats {
+  int s_enabled; // set by the methods, tested by perform
+  t_dsp_block *s_blocks; // allocated by the first `profile 1`, kept until free
+  _Atomic unsigned int s_count; // blocks written since the last reset
+  _Atomic int s_reset; // the methods ask perform to start the ring again
+} t_dsp_stats;
+
+void dsp_stats_init(t_dsp_stats *s);
+void dsp_stats_free(t_dsp_stats *s);
+// `profile`: on starts a fresh window. returns 0 if the ring couldn't be allocated
+int dsp_stats_enable(t_dsp_stats *s, int on);
+// `stats`: sends the summary to outlet; sr turns samples into real time
+void dsp_stats_report(t_dsp_stats *s, t_outlet *outlet, t_float sr);
+
+static inline double dsp_stats_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// perform routine side: one block of n samples that started at `start`
+static inline void dsp_stats_block(t_dsp_stats *s, double start, int n, int grains,
+                                   t_float fill)
+{
+  double ns = dsp_stats_now() - start;
+  unsigned int count = atomic_load_explicit(&s->s_count, memory_order_relaxed);
+  if (atomic_load_explicit(&s->s_reset, memory_order_acquire)) {
+    atomic_store_explicit(&s->s_reset, 0, memory_order_relaxed);
+    count = 0;
+  }
+  t_dsp_block *b = &s->s_blocks[count & (DSP_STATS_BLOCKS - 1)];
+  b->b_ns = (float)ns;
+  b->b_samples = n;
+  b->b_grains = grains;
+  b->b_fill = fill;
+  atomic_store_explicit(&s->s_count, count + 1, memory_order_release);
+}
+
+#endif
@@ -0,0 +1,46 @@
+// the little of Pd's m_pd.h that the engine code uses
+//
+// grains.c, window_table.c, sound_file.c, render_pool.c and gl_engine.c do
+// their work without Pd. built with ENGINE_STANDALONE (as render/Makefile
+// does) they get plain C stand-ins from here and need nothing but libc, libm
+// and pthreads; otherwise this is just m_pd.h.
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#ifdef ENGINE_STANDALONE
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PD_FLOATSIZE 32
+
+typedef float t_float;
+typedef float t_sample;
+
+// zeroed, like Pd's
+static inline void *getbytes(size_t nbytes)
+{
+  return calloc(1, (nbytes > 0) ? nbytes : 1);
+}
+
+static inline void *resizebytes(void *old, size_t oldsize, size_t newsize)
+{
+  void *p = realloc(old, (newsize > 0) ? newsize : 1);
+  if (p != NULL && newsize > oldsize) memset((char *)p + oldsize, 0, newsize - oldsize);
+  return p;
+}
+
+static inline void freebytes(void *x, size_t nbytes)
+{
+  (void)nbytes;
+  free(x);
+}
+
+#else
+
+#include "m_pd.h"
+
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+// timestamped control events, applied by the perform routine at the sample
+// they were sent for
+//
+// a method pushes an event stamped with Pd's logical time; the perform routine
+// works out which sample of the current block that time falls on, renders up to
+// it, applies the event and carries on. messages sent from a clock (delay,
+// metro, pipe...) land on the exact sample, messages from the GUI on the first
+// sample of the next block, like vline~.
+//
+// the queue is single producer (the methods) / single consumer (perform) and
+// lock free, so it stays correct if the two ever run on different threads.
+//
+// the values events set are usually smoothed with a t_ramp (ramp.h).
+
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include "m_pd.h"
+#include <math.h>
+#include <stdatomic.h>
+#include "ramp.h"
+
+#define EVENT_QUEUE_SIZE 128 // power of 2
+
+typedef struct _event {
+  double e_time; // ms since q_reference
+  int e_type; // defined by the object
+  t_float e_value;
+} t_event;
+
+typedef struct _event_queue {
+  t_event q_events[EVENT_QUEUE_SIZE];
+  _Atomic unsigned int q_head; // next event to apply, written by perform
+  _Atomic unsigned int q_tail; // next free slot, written by the methods
+  double q_reference; // logical time when the queue was created
+} t_event_queue;
+
+static inline void event_queue_init(t_event_queue *q)
+{
+  atomic_init(&q->q_head, 0);
+  atomic_init(&q->q_tail, 0);
+  q->q_reference = clock_getlogicaltime();
+}
+
+// returns 0 if the queue is full
+static inline int event_queue_push(t_event_queue *q, int type, t_float value)
+{
+  unsigned int tail = atomic_load_explicit(&q->q_tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&q->q_head, memory_order_acquire);
+  if (tail - head >= EVENT_QUEUE_SIZE) return 0;
+
+  t_event *e = &q->q_events[tail & (EVENT_QUEUE_SIZE - 1)];
+  e->e_time = clock_gettimesince(q->q_reference);
+  e->e_type = type;
+  e->e_value = value;
+  atomic_store_explicit(&q->q_tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+static inline int event_queue_empty(t_event_queue *q)
+{
+  return atomic_load_explicit(&q->q_head, memory_order_acquire)
+    == atomic_load_explicit(&q->q_tail, memory_order_relaxed);
+}
+
+// perform side. block_start is the logical time of the block's first sample
+static inline double event_queue_block_start(const t_event_queue *q, int n, t_float sms)
+{
+  return clock_gettimesince(q->q_reference) - ((sms > 0) ? n / sms : 0.0);
+}
+
+// the next event due in this block, or NULL. *offset is the sample it
+// applies at; late events apply at the start of the block
+static inline const t_event *event_queue_next(t_event_queue *q, double block_start,
+                                              t_float sms, int n, int *offset)
+{
+  unsigned int head = atomic_load_explicit(&q->q_head, memory_order_relaxed);
+  if (head == atomic_load_explicit(&q->q_tail, memory_order_acquire)) return NULL;
+
+  const t_event *e = &q->q_events[head & (EVENT_QUEUE_SIZE - 1)];
+  // rounded to the nearest sample: samples per ms is only a float, so a
+  // time that falls on a sample boundary can come out a hair short of it
+  int sample = (int)floor((e->e_time - block_start) * sms + 0.5);
+  if (sample >= n) return NULL;
+  *offset = (sample > 0) ? sample : 0;
+  return e;
+}
+
+static inline void event_queue_pop(t_event_queue *q)
+{
+  unsigned int head = atomic_load_explicit(&q->q_head, memory_order_relaxed);
+  atomic_store_explicit(&q->q_head, head + 1, memory_order_release);
+}
+
+#endif
@@ -0,0 +1,646 @@
+#include "gl_engine.h"
+#include <math.h>
+#include <string.h>
+
+static void update_grains(t_gl_engine *e);
+static void gl_part(void *arg, int part, unsigned int generation);
+static void finish_ahead(t_gl_engine *e, int wait);
+
+const char *gl_engine_setup(void)
+{
+  dsp_kernels_setup();
+  return grains_select_engine();
+}
+
+int gl_engine_init(t_gl_engine *e, int grain_ms, int voices, int channels)
+{
+  memset(e, 0, sizeof(*e));
+  e->e_grain_ms = grain_ms;
+  e->e_channels = channels;
+  e->e_in_channels = 1;
+  e->e_render = grains_render;
+  e->e_state = STATE_IDLE;
+  ramp_jump(&e->e_spread, 0.3f); // testing
+  ramp_jump(&e->e_mix, 0.5f);
+  grains_sched_init(&e->e_sched);
+  pool_job_init(&e->e_job, gl_part, e);
+
+  e->e_window = window_table_get(WINDOW_HANN, WINDOW_TABLE_SIZE);
+  if (e->e_window == NULL) return 0;
+  if (!grains_alloc(&e->e_grains, voices)) return 0;
+  grains_window(&e->e_grains, e->e_window);
+  update_grains(e);
+  return 1;
+}
+
+void gl_engine_free(t_gl_engine *e)
+{
+  if (e->e_threads > 0) gl_engine_threads(e, 0);
+  grains_free(&e->e_grains);
+  if (e->e_scratch != NULL) {
+    freebytes(e->e_scratch, (1 + e->e_channels) * e->e_scratch_samples * sizeof(t_sample));
+    e->e_scratch = NULL;
+  }
+  if (e->e_start != NULL) {
+    freebytes(e->e_start, e->e_scratch_samples * sizeof(int));
+    e->e_start = NULL;
+  }
+  if (e->e_window != NULL) {
+    window_table_release(e->e_window);
+    e->e_window = NULL;
+  }
+}
+
+// grain lengths and offsets follow e_grain_ms, e_sms and e_spread. with the
+// scheduler running only the timing of new grains changes; the ones already
+// playing finish as they were
+static void update_grains(t_gl_engine *e)
+{
+  if (e->e_density > 0) {
+    grains_sched_timing(&e->e_sched, 1000.0f * e->e_sms / e->e_density,
+                        e->e_grain_ms * e->e_sms);
+    e->e_sched.s_jitter_position = e->e_jitter_position_ms * e->e_sms;
+    return;
+  }
+  e->e_grain_samples = e->e_grain_ms * e->e_sms;
+  e->e_cloud_ticks = 0; // synced, it starts over on the next tick
+  grains_reset(&e->e_grains, e->e_grain_ms * e->e_sms);
+  grains_spread(&e->e_grains, e->e_grain_ms * e->e_sms * e->e_spread.r_value);
+}
+
+static int update_scratch(t_gl_engine *e, int n)
+{
+  if (n == e->e_scratch_samples) return 1;
+  int blocks = 1 + e->e_channels;
+  e->e_scratch = (t_sample *)resizebytes(e->e_scratch,
+                                         blocks * e->e_scratch_samples * sizeof(t_sample),
+                                         blocks * n * sizeof(t_sample));
+  e->e_start = (int *)resizebytes(e->e_start, e->e_scratch_samples * sizeof(int),
+                                  n * sizeof(int));
+  if (e->e_scratch == NULL || e->e_start == NULL) {
+    e->e_scratch_samples = 0;
+    return 0;
+  }
+  e->e_scratch_samples = n;
+  return 1;
+}
+
+// e_ahead is two slots of a block each, taking turns: while the pool renders
+// into one the last block is mixed from the other. a slot is the partial sums
+// (e_parts of them, each e_channels blocks), then a second copy of them for
+// the parts finish_ahead renders itself, then the dry input they'll be mixed
+// with, then the fractions of the start positions and the rate the pool
+// reads. after the slots are perform's own copy of the rate, for
+// finish_ahead, and the mix ramp. a job posted with generation g uses slot
+// g & 1. anything the pool is still rendering is finished first, and the
+// block in the other slot is dropped. returns 0 if there's no memory for it
+static int update_ahead(t_gl_engine *e)
+{
+  finish_ahead(e, 1);
+  int shadow = 1;
+  for (int k = 0; k < 2; k++) {
+    if (e->e_threads == 0 || e->e_shadow[k].g_capacity != e->e_grains.g_capacity) {
+      grains_free(&e->e_shadow[k]);
+    }
+    if (e->e_threads > 0 && e->e_shadow[k].g_capacity == 0) {
+      grains_alloc(&e->e_shadow[k], e->e_grains.g_capacity); // leaves it empty if it fails
+    }
+    if (e->e_threads > 0 && e->e_shadow[k].g_capacity == 0) shadow = 0;
+  }
+  int n = e->e_scratch_samples;
+  int groups = e->e_grains.g_capacity / GRAINS_LANES;
+  int parts = (e->e_threads < groups) ? e->e_threads : groups;
+  if (parts > POOL_MAX_PARTS) parts = POOL_MAX_PARTS;
+  if (parts < 1) parts = 1;
+  e->e_part_voices = (groups + parts - 1) / parts * GRAINS_LANES;
+  e->e_parts = (e->e_grains.g_capacity + e->e_part_voices - 1) / e->e_part_voices;
+
+  size_t slot = (size_t)(2 * e->e_parts * e->e_channels + e->e_in_channels + 2) * n;
+  size_t size = (e->e_threads > 0 && shadow) ? 2 * slot + 2 * n : 0;
+  if (size != e->e_ahead_size || n != e->e_ahead_block) {
+    if (e->e_ahead != NULL) {
+      freebytes(e->e_ahead, e->e_ahead_size * sizeof(t_sample));
+      freebytes(e->e_ahead_start, 2 * e->e_ahead_block * sizeof(int));
+    }
+    e->e_ahead = (size > 0) ? (t_sample *)getbytes(size * sizeof(t_sample)) : NULL;
+    e->e_ahead_start = (size > 0) ? (int *)getbytes(2 * n * sizeof(int)) : NULL;
+    if (e->e_ahead == NULL || e->e_ahead_start == NULL) {
+      if (e->e_ahead != NULL) freebytes(e->e_ahead, size * sizeof(t_sample));
+      if (e->e_ahead_start != NULL) freebytes(e->e_ahead_start, 2 * n * sizeof(int));
+      e->e_ahead = NULL;
+      e->e_ahead_start = NULL;
+    }
+    e->e_ahead_size = (e->e_ahead != NULL) ? size : 0;
+  }
+  e->e_ahead_block = n;
+  e->e_ahead_channels = e->e_in_channels;
+  e->e_rendered = 0;
+  return shadow && (size == 0 || e->e_ahead != NULL);
+}
+
+int gl_engine_dsp(t_gl_engine *e, t_float sr, int in_channels, int block)
+{
+  finish_ahead(e, 1);
+  e->e_sms = sr * 0.001f;
+  e->e_in_channels = in_channels;
+  e->e_block = block;
+  if (!update_scratch(e, block)) return 0;
+  update_grains(e);
+  if (e->e_threads > 0) update_ahead(e);
+  return 1;
+}
+
+void gl_engine_buffer(t_gl_engine *e, void *samples, int size, int shift, int guard,
+                      t_sample_format format)
+{
+  e->e_buffer = samples;
+  e->e_size = size;
+  e->e_shift = shift;
+  e->e_guard = guard;
+  e->e_format = format;
+  e->e_grains.g_guard = guard;
+  e->e_grains.g_format = format;
+}
+
+// the position input (-1, 1) -> grain start positions in buffer samples, in
+// e_start and the first block of e_scratch. past DSP_FLOAT_SAFE samples a
+// t_sample can't place them finely enough, so long buffers work them out in
+// double (see start_split in dsp_kernels.h); short ones keep the cheaper loop
+static void gl_starts(t_gl_engine *e, const t_sample *in2, int n)
+{
+  int size = e->e_size;
+  int *start = e->e_start;
+  t_sample *frac = e->e_scratch;
+
+  if (size > DSP_FLOAT_SAFE) {
+    for (int i = 0; i < n; i++) start[i] = start_split_wide(in2[i], size, &frac[i]);
+  } else {
+    for (int i = 0; i < n; i++) start[i] = start_split(in2[i], size, &frac[i]);
+  }
+  if (e->e_clamp != NULL) e->e_clamp(e->e_clamp_arg, start, frac, n);
+}
+
+// the grain loop itself lives in grains.c; this splits a stretch of the
+// block into the grain start positions, the rendered grains and the
+// wet/dry mix. the input and output may share memory, so everything is
+// staged in e_scratch until the final pass
+static void gl_render(t_gl_engine *e, const t_sample *in1, const t_sample *in2,
+                      const t_sample *rate, t_sample *out, int n)
+{
+  int shift = e->e_shift;
+  int write_phase = e->e_write_phase;
+  t_sample *grains = e->e_scratch + e->e_scratch_samples;
+
+  gl_starts(e, in2, n);
+
+  const t_sample *rec = (e->e_state == STATE_RECORDING) ? in1 : NULL;
+  if (e->e_density > 0) {
+    grains_schedule(&e->e_grains, &e->e_sched, e->e_render, e->e_buffer,
+                    e->e_size, shift, e->e_start, e->e_scratch, rate, rec,
+                    write_phase, grains, n);
+  } else {
+    e->e_render(&e->e_grains, e->e_buffer, e->e_size, shift, e->e_start,
+                e->e_scratch, rate, rec, write_phase, grains, n);
+  }
+  if (rec && e->e_recorded < e->e_size) e->e_recorded += n;
+
+  if (e->e_mix.r_left == 0) {
+    t_float mix = e->e_mix.r_value;
+    for (int i = 0; i < n; i++) {
+      out[i] = (grains[i] * mix) + (in1[i] * (1.0f - mix));
+    }
+  } else {
+    for (int i = 0; i < n; i++) {
+      t_float mix = ramp_next(&e->e_mix);
+      out[i] = (grains[i] * mix) + (in1[i] * (1.0f - mix));
+    }
+  }
+
+  e->e_write_phase = dsp_wrap(write_phase + n, e->e_size);
+}
+
+// gl_render for more than one channel. in1 and out are multichannel,
+// e_block samples from one channel to the next; the grain positions and
+// rate come from the first channel of their inputs. grains_render_planes
+// works out where each grain reads once for every channel, so the render
+// modes don't apply
+static void gl_render_planes(t_gl_engine *e, const t_sample *in1, const t_sample *in2,
+                             const t_sample *rate, t_sample *out, int n)
+{
+  int channels = e->e_channels;
+  int stride = e->e_block;
+  t_sample *grains = e->e_scratch + e->e_scratch_samples;
+
+  gl_starts(e, in2, n);
+
+  t_grains_planes planes;
+  planes.p_channels = channels;
+  planes.p_buffer = e->e_buffer;
+  planes.p_buffer_stride = e->e_size + 2 * e->e_guard;
+  planes.p_size = e->e_size;
+  planes.p_shift = e->e_shift;
+  planes.p_guard = e->e_guard;
+  planes.p_format = e->e_format;
+  planes.p_rec = (e->e_state == STATE_RECORDING) ? in1 : NULL;
+  planes.p_rec_channels = e->e_in_channels;
+  planes.p_out = grains;
+  planes.p_stride = e->e_scratch_samples;
+  if (e->e_density > 0) {
+    grains_schedule_planes(&e->e_grains, &e->e_sched, &planes, e->e_start, e->e_scratch,
+                           rate, e->e_write_phase, n);
+  } else {
+    grains_render_planes(&e->e_grains, &planes, e->e_start, e->e_scratch, rate,
+                         e->e_write_phase, n);
+  }
+  if (planes.p_rec && e->e_recorded < e->e_size) e->e_recorded += n;
+
+  // the positions are done with; the mix goes there, so it ramps once a sample
+  t_sample *mix = e->e_scratch;
+  for (int i = 0; i < n; i++) mix[i] = ramp_next(&e->e_mix);
+  for (int c = 0; c < channels; c++) {
+    const t_sample *g = grains + (size_t)c * e->e_scratch_samples;
+    const t_sample *in = in1 + (size_t)(c % e->e_in_channels) * stride;
+    t_sample *o = out + (size_t)c * stride;
+    for (int i = 0; i < n; i++) o[i] = (g[i] * mix[i]) + (in[i] * (1.0f - mix[i]));
+  }
+
+  e->e_write_phase = dsp_wrap(e->e_write_phase + n, e->e_size);
+}
+
+// while the spread ramps, the grain offsets move every GL_SPREAD_STEP samples,
+// and while voices fade their gains every GL_FADE_STEP
+void gl_engine_process(t_gl_engine *e, const t_sample *in1, const t_sample *in2,
+                       const t_sample *rate, t_sample *out, int n)
+{
+  // back to rendering inline, what the pool rendered last is dropped
+  e->e_rendered = 0;
+  while (n > 0) {
+    int span = n;
+    if (e->e_fading) {
+      if (span > GL_FADE_STEP) span = GL_FADE_STEP;
+      e->e_fading = grains_fade(&e->e_grains);
+    }
+    if (e->e_spread.r_left > 0 && e->e_density == 0) {
+      if (span > GL_SPREAD_STEP) span = GL_SPREAD_STEP;
+      ramp_advance(&e->e_spread, span);
+      grains_spread(&e->e_grains, e->e_grain_samples * e->e_spread.r_value);
+    }
+    if (e->e_channels > 1) {
+      gl_render_planes(e, in1, in2, rate, out, span);
+    } else {
+      gl_render(e, in1, in2, rate, out, span);
+    }
+    in1 += span;
+    in2 += span;
+    rate += span;
+    out += span;
+    n -= span;
+  }
+}
+
+void gl_engine_state(t_gl_engine *e, t_gl_state state)
+{
+  e->e_state = state;
+}
+
+void gl_engine_grain_ms(t_gl_engine *e, int ms)
+{
+  e->e_grain_ms = ms;
+  update_grains(e);
+}
+
+void gl_engine_mix(t_gl_engine *e, t_float mix)
+{
+  ramp_set(&e->e_mix, mix, GL_MIX_RAMP_MS * e->e_sms);
+}
+
+void gl_engine_spread(t_gl_engine *e, t_float spread)
+{
+  ramp_set(&e->e_spread, spread, GL_SPREAD_RAMP_MS * e->e_sms);
+}
+
+void gl_engine_density(t_gl_engine *e, t_float density)
+{
+  if (e->e_density == 0 && density > 0) {
+    grains_clear(&e->e_grains);
+    grains_sched_sync(&e->e_sched, e->e_synced);
+  }
+  e->e_density = density;
+  update_grains(e);
+}
+
+void gl_engine_jitter(t_gl_engine *e, t_gl_jitter which, t_float value)
+{
+  switch (which) {
+    case JITTER_ONSET: e->e_sched.s_jitter_onset = value; break;
+    case JITTER_POSITION:
+      e->e_jitter_position_ms = value;
+      e->e_sched.s_jitter_position = value * e->e_sms;
+      break;
+    case JITTER_DURATION: e->e_sched.s_jitter_duration = value; break;
+    case JITTER_PITCH: e->e_sched.s_jitter_pitch = value; break;
+  }
+}
+
+void gl_engine_seed(t_gl_engine *e, unsigned int seed)
+{
+  grains_sched_seed(&e->e_sched, seed);
+}
+
+void gl_engine_interp(t_gl_engine *e, t_interp kind)
+{
+  finish_ahead(e, 0);
+  e->e_grains.g_interp = kind;
+}
+
+// 1 and 2 produce identical output, the SIMD engine sums grains in a
+// different order. with more than one channel there's only gl_render_planes
+void gl_engine_render(t_gl_engine *e, t_gl_render mode)
+{
+  finish_ahead(e, 0);
+  switch (mode) {
+    case RENDER_GRAIN_MAJOR:
+      e->e_render = grains_render_grain_major;
+      break;
+    case RENDER_SCALAR:
+      e->e_render = grains_render_scalar;
+      break;
+    default:
+      e->e_render = grains_render;
+      break;
+  }
+}
+
+// the scheduler stops spawning past the limit, and its grains over it fade
+// out wherever they are; the looping cloud's come back when it's raised
+void gl_engine_limit(t_gl_engine *e, int voices)
+{
+  t_grains *g = &e->e_grains;
+  int before = g->g_limit;
+  int steps = (int)(GL_FADE_MS * e->e_sms / GL_FADE_STEP);
+  grains_limit(g, voices, steps);
+  if (g->g_limit == before) return;
+  if (g->g_limit > before && e->e_density == 0) {
+    grains_fill(g, steps);
+    grains_spread(g, e->e_grain_samples * e->e_spread.r_value);
+  }
+  e->e_fading = 1;
+}
+
+int gl_engine_window(t_gl_engine *e, t_window_shape shape)
+{
+  t_window_table *table = window_table_get(shape, WINDOW_TABLE_SIZE);
+  if (table == NULL) return 0;
+  finish_ahead(e, 1); // the pool may be reading the old one
+  window_table_release(e->e_window);
+  e->e_window = table;
+  grains_window(&e->e_grains, table);
+  return 1;
+}
+
+void gl_engine_sync(t_gl_engine *e, int on)
+{
+  e->e_synced = on;
+  grains_sched_sync(&e->e_sched, on);
+  if (!on) update_grains(e);
+}
+
+// the scheduler starts a grain, and the looping cloud starts over once every
+// e_cloud_ticks, its grains stretched to the whole number of ticks nearest
+// e_grain_ms
+void gl_engine_tick(t_gl_engine *e, double tick)
+{
+  if (e->e_density > 0) {
+    grains_sched_trigger(&e->e_sched);
+    return;
+  }
+  if (tick <= 0 || ++e->e_tick_count < e->e_cloud_ticks) return;
+  int ticks = (int)floor(e->e_grain_ms * e->e_sms / tick + 0.5);
+  e->e_cloud_ticks = (ticks > 1) ? ticks : 1;
+  e->e_tick_count = 0;
+  e->e_grain_samples = e->e_cloud_ticks * tick;
+  grains_reset(&e->e_grains, e->e_grain_samples);
+  grains_spread(&e->e_grains, e->e_grain_samples * e->e_spread.r_value);
+}
+
+int gl_engine_threads(t_gl_engine *e, int parts)
+{
+  if (parts < 0) parts = 0;
+  if (parts > POOL_MAX_PARTS) parts = POOL_MAX_PARTS;
+  if (parts > 0 && e->e_threads == 0) {
+    if (!pool_start()) return 0;
+    pool_job_init(&e->e_job, gl_part, e);
+    if (!pool_add(&e->e_job)) {
+      pool_stop();
+      return 0;
+    }
+  } else if (parts == 0 && e->e_threads > 0) {
+    finish_ahead(e, 1);
+    pool_remove(&e->e_job);
+    pool_stop();
+  }
+  e->e_threads = parts;
+  return update_ahead(e);
+}
+
+// rendering on the pool only covers the looping cloud with no ticks, where
+// nothing but the setters changes the voices between blocks
+int gl_engine_ahead(const t_gl_engine *e)
+{
+  return e->e_ahead != NULL && e->e_density == 0 && !e->e_synced
+    && e->e_ahead_block == e->e_block && e->e_ahead_channels == e->e_in_channels;
+}
+
+static size_t ahead_slot_size(const t_gl_engine *e)
+{
+  return (size_t)(2 * e->e_parts * e->e_channels + e->e_ahead_channels + 2) * e->e_ahead_block;
+}
+
+static t_sample *ahead_slot(const t_gl_engine *e, int slot)
+{
+  return e->e_ahead + slot * ahead_slot_size(e);
+}
+
+// the fractions of the start positions and the rate in a slot, after its
+// sums and dry input
+static t_sample *ahead_inputs(const t_gl_engine *e, int slot)
+{
+  int stride = e->e_ahead_block;
+  return ahead_slot(e, slot) + (size_t)(2 * e->e_parts * e->e_channels + e->e_ahead_channels) * stride;
+}
+
+// one part of the voices into partial sums at `out`
+static void render_part(t_gl_engine *e, t_grains *g, const int *start, const t_sample *frac,
+                        const t_sample *rate, int n, int write_phase, t_sample *out)
+{
+  int stride = e->e_ahead_block;
+  if (g->g_padded == 0) {
+    for (int c = 0; c < e->e_channels; c++) memset(out + (size_t)c * stride, 0, n * sizeof(t_sample));
+  } else if (e->e_channels > 1) {
+    t_grains_planes planes;
+    planes.p_channels = e->e_channels;
+    planes.p_buffer = e->e_buffer;
+    planes.p_buffer_stride = e->e_size + 2 * e->e_guard;
+    planes.p_size = e->e_size;
+    planes.p_shift = e->e_shift;
+    planes.p_guard = e->e_guard;
+    planes.p_format = e->e_format;
+    planes.p_rec = NULL;
+    planes.p_rec_channels = 1;
+    planes.p_out = out;
+    planes.p_stride = stride;
+    grains_render_planes(g, &planes, start, frac, rate, write_phase, n);
+  } else {
+    e->e_render(g, e->e_buffer, e->e_size, e->e_shift, start, frac, rate, NULL,
+                write_phase, out, n);
+  }
+}
+
+// pool side: one part of the voices in the slot of the job's generation,
+// into its partial sums there. the voices are the slot's copy of them, for
+// finish_ahead to keep if the part isn't late. the buffer was recorded into
+// before the block was posted
+static void gl_part(void *arg, int part, unsigned int generation)
+{
+  t_gl_engine *e = (t_gl_engine *)arg;
+  int slot = generation & 1;
+  const t_sample *inputs = ahead_inputs(e, slot);
+  t_grains g;
+  grains_part(&e->e_shadow[slot], part * e->e_part_voices, e->e_part_voices, &g);
+  render_part(e, &g, e->e_ahead_start + slot * e->e_ahead_block, inputs,
+              inputs + e->e_ahead_block, e->e_ahead_n[slot], e->e_ahead_write_phase[slot],
+              ahead_slot(e, slot) + (size_t)part * e->e_channels * e->e_ahead_block);
+}
+
+// a thread that's late with a part may be descheduled for any length of
+// time, and it's still writing the slot's copy of the part's sums and
+// voices. the part is rendered again here from the voices themselves and
+// perform's own copy of the inputs (e_start, e_scratch and the rate after
+// the slots), into the second copy of the sums, and what the thread leaves
+// behind is never read. a block that wasn't posted, because a thread was
+// still in the job, has all of its parts rendered here
+static void finish_ahead(t_gl_engine *e, int wait)
+{
+  if (e->e_job.j_pending) {
+    int slot = e->e_job_slot;
+    int n = e->e_job_n;
+    double wait_ns = GL_AHEAD_WAIT * n / e->e_sms * 1e6;
+    unsigned long long late = pool_finish(&e->e_job, wait_ns);
+    if (e->e_job_parts == 0) late = ~0ULL;
+    const t_sample *rate = e->e_ahead + 2 * ahead_slot_size(e);
+    for (int p = 0; p < e->e_parts; p++) {
+      int first = p * e->e_part_voices;
+      if (late & (1ULL << p)) {
+        t_grains g;
+        grains_part(&e->e_grains, first, e->e_part_voices, &g);
+        render_part(e, &g, e->e_start, e->e_scratch, rate, n, e->e_job_write_phase,
+                    ahead_slot(e, slot)
+                    + (size_t)(e->e_parts + p) * e->e_channels * e->e_ahead_block);
+      } else {
+        grains_state_copy(&e->e_grains, &e->e_shadow[slot], first, e->e_part_voices);
+      }
+    }
+    e->e_late = late;
+  }
+  if (wait) pool_wait(&e->e_job);
+}
+
+void gl_engine_finish(t_gl_engine *e)
+{
+  finish_ahead(e, 0);
+}
+
+int gl_engine_busy(t_gl_engine *e)
+{
+  return pool_busy(&e->e_job);
+}
+
+// positions, rate and the dry input are taken for this block and it's
+// posted to be rendered while the block before it, which the pool rendered
+// meanwhile, is mixed to the output. recording is done here first, all of
+// the block before any of it is read, rather than sample by sample like the
+// inline renderers. while a thread finish_ahead gave up on is still in the
+// job, the slot it reads can't be written, so the block isn't posted and
+// finish_ahead renders all of it
+void gl_engine_process_ahead(t_gl_engine *e, const t_sample *in1, const t_sample *in2,
+                             const t_sample *rate, t_sample *out, int n)
+{
+  int channels = e->e_channels;
+  int stride = e->e_ahead_block;
+  int slot = (pool_generation(&e->e_job) + 1) & 1;
+  t_sample *partials = ahead_slot(e, slot);
+  t_sample *dry = partials + (size_t)2 * e->e_parts * channels * stride;
+  t_sample *job_rate = e->e_ahead + 2 * ahead_slot_size(e);
+  t_sample *mix = job_rate + stride;
+  int size = e->e_size;
+  int shift = e->e_shift;
+
+  // a block's worth of fade steps at once, and the spread ramps once a block
+  for (int k = 0; e->e_fading && k < (n + GL_FADE_STEP - 1) / GL_FADE_STEP; k++) {
+    e->e_fading = grains_fade(&e->e_grains);
+  }
+  if (e->e_spread.r_left > 0) {
+    ramp_advance(&e->e_spread, n);
+    grains_spread(&e->e_grains, e->e_grain_samples * e->e_spread.r_value);
+  }
+  for (int c = 0; c < e->e_ahead_channels; c++) {
+    memcpy(dry + (size_t)c * stride, in1 + (size_t)c * e->e_block, n * sizeof(t_sample));
+  }
+  memcpy(job_rate, rate, n * sizeof(t_sample));
+  gl_starts(e, in2, n);
+
+  if (e->e_state == STATE_RECORDING) {
+    size_t plane = (e->e_size + 2 * e->e_guard) * sample_format_bytes(e->e_format);
+    for (int c = 0; c < channels; c++) {
+      void *buffer = (char *)e->e_buffer + c * plane;
+      const t_sample *in = dry + (size_t)(c % e->e_ahead_channels) * stride;
+      for (int i = 0; i < n; i++) {
+        dsp_ring_store(buffer, e->e_format, dsp_wrap(e->e_write_phase + i, size), size, shift,
+                       e->e_guard, in[i]);
+      }
+    }
+    if (e->e_recorded < e->e_size) e->e_recorded += n;
+  }
+
+  e->e_job_slot = slot;
+  e->e_job_n = n;
+  e->e_job_write_phase = e->e_write_phase;
+  e->e_job_parts = pool_busy(&e->e_job) ? 0 : e->e_parts;
+  if (e->e_job_parts > 0) {
+    t_sample *inputs = ahead_inputs(e, slot);
+    memcpy(e->e_ahead_start + slot * stride, e->e_start, n * sizeof(int));
+    memcpy(inputs, e->e_scratch, n * sizeof(t_sample));
+    memcpy(inputs + stride, rate, n * sizeof(t_sample));
+    grains_snapshot(&e->e_shadow[slot], &e->e_grains);
+    e->e_ahead_n[slot] = n;
+    e->e_ahead_write_phase[slot] = e->e_write_phase;
+  }
+  pool_post(&e->e_job, e->e_job_parts);
+  e->e_write_phase = dsp_wrap(e->e_write_phase + n, size);
+
+  int last = slot ^ 1;
+  if (!e->e_rendered) {
+    // nothing rendered yet: the block posted now is the first
+    for (int c = 0; c < channels; c++) memset(out + (size_t)c * e->e_block, 0, n * sizeof(t_sample));
+    e->e_rendered = 1;
+    return;
+  }
+  partials = ahead_slot(e, last);
+  const t_sample *last_dry = partials + (size_t)2 * e->e_parts * channels * stride;
+  for (int i = 0; i < n; i++) mix[i] = ramp_next(&e->e_mix);
+  for (int c = 0; c < channels; c++) {
+    const t_sample *in = last_dry + (size_t)(c % e->e_ahead_channels) * stride;
+    t_sample *o = out + (size_t)c * e->e_block;
+    for (int p = 0; p < e->e_parts; p++) {
+      // the second copy for the parts finish_ahead rendered itself
+      int copy = (e->e_late & (1ULL << p)) ? e->e_parts + p : p;
+      const t_sample *g = partials + ((size_t)copy * channels + c) * stride;
+      if (p == 0) {
+        memcpy(o, g, n * sizeof(t_sample));
+      } else {
+        for (int i = 0; i < n; i++) o[i] += g[i];
+      }
+    }
+    for (int i = 0; i < n; i++) o[i] = (o[i] * mix[i]) + (in[i] * (1.0f - mix[i]));
+  }
+}
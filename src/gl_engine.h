@@ -0,0 +1,211 @@
+// the gl~ grain engine, with no Pd in it
+//
+// everything gl~ does to a block of samples: a cloud of grains read from a
+// buffer the input can be recorded into, mixed with the input. gl~ wraps it
+// with Pd's side of things (messages timed to the sample, beat sync, Pd
+// arrays and files as the buffer, the profiler); other hosts use it as it
+// is, like render/gl-render, which runs it over sound files offline.
+//
+// the host owns the buffer, a ring laid out as in ring_buffer.h, and hands
+// the engine its current storage with gl_engine_buffer, ideally with
+// DSP_GUARD mirrored samples around each channel (dsp_kernels.h) so the
+// grains can read their taps without wrapping and the ring can be any size
+// rather than a power of 2 (see dsp_wrap), and in any of the formats in
+// sample_format.h (the compact ones only with a guard). the setters take
+// effect from the next sample processed, so a host that wants
+// them sample accurate cuts its blocks where they fall, as gl~ does with
+// event_queue.h. only gl_engine_init, gl_engine_dsp, gl_engine_window and
+// gl_engine_threads allocate; they're for the host's control thread, between
+// blocks.
+//
+// built with ENGINE_STANDALONE (engine.h) it needs nothing but libc, libm
+// and pthreads.
+
+#ifndef GL_ENGINE_H
+#define GL_ENGINE_H
+
+#include "engine.h"
+#include "grains.h"
+#include "window_table.h"
+#include "ramp.h"
+#include "render_pool.h"
+
+typedef enum {
+  STATE_IDLE,
+  STATE_RECORDING,
+  STATE_PLAYING
+} t_gl_state;
+
+typedef enum {
+  RENDER_SIMD, // sample-major, grains_render picked by gl_engine_setup
+  RENDER_GRAIN_MAJOR, // one grain across the whole block at a time
+  RENDER_SCALAR // sample-major reference loop
+} t_gl_render;
+
+typedef enum {
+  JITTER_ONSET,
+  JITTER_POSITION,
+  JITTER_DURATION,
+  JITTER_PITCH
+} t_gl_jitter;
+
+#define GL_MIX_RAMP_MS 10
+#define GL_SPREAD_RAMP_MS 50
+#define GL_SPREAD_STEP 16 // samples per grain offset update while spread ramps
+#define GL_FADE_MS 5 // voices shed or restored by gl_engine_limit
+#define GL_FADE_STEP 16 // samples per gain step while they fade
+// how long finishing a block ahead waits for a part a thread is still
+// rendering before rendering it itself, as a fraction of the block
+#define GL_AHEAD_WAIT 0.25
+
+// pulls grain start positions into the part of the buffer that's safe to
+// read, see ring_buffer_clamp_reads
+typedef void (*t_gl_clamp)(void *arg, int *start, t_sample *frac, int n);
+
+typedef struct _gl_engine {
+  t_grains e_grains;
+  t_grains_render e_render;
+  t_window_table *e_window; // shared, see window_table.c
+  int e_grain_ms;
+  t_float e_grain_samples; // of the looping cloud: e_grain_ms, or whole ticks while synced
+
+  int e_channels; // of the buffer and the output
+  int e_in_channels; // of the input, wrapped around if fewer
+  int e_block; // samples from one channel of the input and output to the next
+
+  // the host's storage: e_size samples per channel in e_format, sample i of
+  // channel c at e_buffer[c * (e_size + 2 * e_guard) + (i << e_shift)].
+  // e_size is a power of 2 unless there's a guard, see dsp_wrap
+  void *e_buffer;
+  int e_size;
+  int e_shift;
+  int e_guard; // mirrored samples either side of each channel, 0 or DSP_GUARD
+  t_sample_format e_format;
+  t_gl_clamp e_clamp; // NULL if every position is safe
+  void *e_clamp_arg;
+  // moved by the host along with its storage (ring_buffer_adopt)
+  int e_write_phase;
+  int e_recorded; // samples of the buffer that hold audio, up to e_size
+
+  t_gl_state e_state;
+  t_float e_sms; // samples per ms
+  t_ramp e_spread; // distance between the looping cloud's grains, in grains
+
+  // with a density, grains are spawned by e_sched instead of all looping
+  t_grains_sched e_sched;
+  t_float e_density; // grains per second, 0 for the looping cloud
+  t_float e_jitter_position_ms;
+
+  // ticks, see gl_engine_tick
+  int e_synced;
+  int e_cloud_ticks; // ticks per pass of the looping cloud
+  int e_tick_count; // ticks since the cloud last started over
+
+  t_ramp e_mix; // wet/dry
+  int e_fading; // voices are fading in or out, see gl_engine_limit
+
+  // per-block scratch: the fractions of the grain start positions and the
+  // summed grains, one block per channel. the whole samples are in e_start
+  t_sample *e_scratch;
+  int *e_start;
+  int e_scratch_samples;
+
+  // gl_engine_threads: the looping cloud's voices cut into parts that
+  // render_pool.c renders a block ahead of the output, into e_ahead
+  int e_threads; // the most parts to cut it into, 0 to render inline
+  t_pool_job e_job;
+  t_sample *e_ahead;
+  size_t e_ahead_size; // samples in e_ahead
+  int e_ahead_block; // samples per block it's laid out for
+  int e_ahead_channels; // input channels it's laid out for
+  int e_parts; // parts the voices are cut into
+  int e_part_voices; // voices per part, a multiple of GRAINS_LANES
+  int e_rendered; // the other half of e_ahead holds the last block
+  // per half of e_ahead, only written while no thread is in the job (see
+  // render_pool.h): the voices as the block was posted, which the threads
+  // render and step, the block's whole start positions, its samples and its
+  // write phase
+  t_grains e_shadow[2];
+  int *e_ahead_start;
+  int e_ahead_n[2];
+  int e_ahead_write_phase[2];
+  // perform's own view of the block posted last
+  int e_job_slot; // its half of e_ahead
+  int e_job_parts; // the parts it was posted with, 0 when it's rendered by finish_ahead
+  int e_job_n;
+  int e_job_write_phase;
+  unsigned long long e_late; // the parts of the last block rendered late, see gl_engine_finish
+} t_gl_engine;
+
+// once before any engine is used: fills the shared tables (dsp_kernels_setup)
+// and picks the grain renderer, returns its name
+const char *gl_engine_setup(void);
+
+// `voices` looping grains of `grain_ms`, `channels` of output. returns 0 if
+// it can't be allocated, after which gl_engine_free is still safe to call
+int gl_engine_init(t_gl_engine *e, int grain_ms, int voices, int channels);
+void gl_engine_free(t_gl_engine *e);
+// the sample rate, input channels and block size (also the distance between
+// channels of the input and output) processing is done at. returns 0 if
+// the scratch buffers can't be allocated; without memory to render a block
+// ahead it renders inline instead
+int gl_engine_dsp(t_gl_engine *e, t_float sr, int in_channels, int block);
+// the host's current storage, before processing if it's changed. with a
+// guard (shift 0 only) the engine keeps the mirrors up to date as it records.
+// a compact format needs a guard
+void gl_engine_buffer(t_gl_engine *e, void *samples, int size, int shift, int guard,
+                      t_sample_format format);
+
+// n samples, up to the block size: in1 the input (e_in_channels of them),
+// in2 the grain start positions (-1..1 across the buffer, first channel
+// only), rate the playback rate, out e_channels of output. in1 and out may
+// be the same memory
+void gl_engine_process(t_gl_engine *e, const t_sample *in1, const t_sample *in2,
+                       const t_sample *rate, t_sample *out, int n);
+
+void gl_engine_state(t_gl_engine *e, t_gl_state state);
+void gl_engine_grain_ms(t_gl_engine *e, int ms);
+void gl_engine_mix(t_gl_engine *e, t_float mix); // 0 dry .. 1 wet, ramped
+void gl_engine_spread(t_gl_engine *e, t_float spread); // ramped
+// grains per second. 0 goes back to every voice looping
+void gl_engine_density(t_gl_engine *e, t_float density);
+// onset and duration 0..1 (fraction of the mean), position ms, pitch semitones
+void gl_engine_jitter(t_gl_engine *e, t_gl_jitter which, t_float value);
+void gl_engine_seed(t_gl_engine *e, unsigned int seed);
+void gl_engine_interp(t_gl_engine *e, t_interp kind);
+void gl_engine_render(t_gl_engine *e, t_gl_render mode);
+// the most voices to play, for a host shedding load (gl~'s `budget`, see
+// grain_budget.h): the ones over it fade out over GL_FADE_MS and stop
+// costing anything, and the looping cloud's fade back in when it's raised
+void gl_engine_limit(t_gl_engine *e, int voices);
+// returns 0 if the table can't be allocated
+int gl_engine_window(t_gl_engine *e, t_window_shape shape);
+
+// ticks on (gl_engine_sync) make density grains start only on a tick and the
+// looping cloud start over on one, its grains stretched to a whole number of
+// ticks (tick samples apart) near the grain length. off, it goes back to
+// the grain length. see transport.h for where gl~ gets its ticks
+void gl_engine_sync(t_gl_engine *e, int on);
+void gl_engine_tick(t_gl_engine *e, double tick);
+
+// up to `parts` parts of the looping cloud rendered a block ahead on
+// render_pool.c's threads, 0 for inline. the output is then a block late,
+// changes take effect at the start of a block and recording is done a block
+// at a time, so the host needs gl_engine_ahead and gl_engine_process_ahead.
+// returns 0 if the pool can't be started or there's no memory for it
+int gl_engine_threads(t_gl_engine *e, int parts);
+// whether the next block goes through gl_engine_process_ahead. call
+// gl_engine_finish first, then make the block's changes, then ask
+int gl_engine_ahead(const t_gl_engine *e);
+// a whole block: posts it to the pool and mixes the one it rendered last
+void gl_engine_process_ahead(t_gl_engine *e, const t_sample *in1, const t_sample *in2,
+                             const t_sample *rate, t_sample *out, int n);
+// finishes the block the pool is rendering: the parts no thread has taken
+// yet are rendered here, and so are the ones a thread is still in after
+// GL_AHEAD_WAIT of a block. before anything changes the voices
+void gl_engine_finish(t_gl_engine *e);
+// whether a thread gl_engine_finish gave up on is still reading the buffer.
+// the host keeps its storage until it's out
+int gl_engine_busy(t_gl_engine *e);
+
+#endif
@@ -1,6 +1,11 @@
 #include "m_pd.h"
 #include <stdlib.h>
 #include <math.h>
+#include "dsp_kernels.h"
+#include "window_table.h"
+#include "ring_buffer.h"
+#include "event_queue.h"
+#include "dsp_stats.h"
 
 typedef enum {
   STATE_IDLE,
@@ -8,154 +13,284 @@ typedef enum {
   STATE_PLAYING
 } t_glooper_state;
 
+typedef enum {
+  EVENT_RECORD,
+  EVENT_PLAY,
+  EVENT_RESIZE,
+  EVENT_MIX
+} t_glooper_event;
+
+#define MIX_RAMP_MS 10
+
 typedef struct _glooper {
   t_object x_obj;
 
   int x_input_buffer_ms;
-  int x_input_buffer_samples;
-  t_sample *x_input_buffer;
+  t_ring_buffer x_buffer; // resized off the audio thread or a Pd array, see ring_buffer.c
 
   int x_grain_ms;
   int x_grain_samples;
-  int x_window_buffer_samples;
-  t_sample *x_window_buffer;
+  t_window_table *x_window; // shared, see window_table.c
+  t_canvas *x_canvas; // for file names relative to the patch
+  t_float x_window_scale; // grain position -> window table index
 
   int x_write_phase;
+  int x_recorded; // samples of the buffer that hold audio, up to r_size
   int x_grain_pos;
+  // how far the read pointer has moved into the grain, see phase_step
+  int x_grain_phase;
+  t_sample x_grain_phase_frac;
 
   t_glooper_state x_state;
+  t_event_queue x_events; // messages waiting for their sample
 
   t_float x_sms; // samples per ms
   int x_num_grains;
 
-  t_float x_mix; // wet/dry
+  t_ramp x_mix; // wet/dry
+  t_interp x_interp;
+
+  t_dsp_stats x_stats; // `profile` and `stats`
 
   t_inlet *x_inlet_pos;
+  t_inlet *x_inlet_rate; // playback rate, 1 when not connected
+  t_outlet *x_info; // stats
   t_float x_f; // dummy arg for MAINSIGNALIN
 } t_glooper;
 
 static t_class *glooper_class = NULL;
-static int initialize_buffers(t_glooper *x);
+static void glooper_free(t_glooper *x);
 
 static void *glooper_new(t_floatarg grain_ms, t_floatarg num_grains)
 {
   t_glooper *x = (t_glooper *)pd_new(glooper_class);
 
   x->x_input_buffer_ms = 4000;
+  x->x_canvas = canvas_getcurrent();
   x->x_grain_ms = (grain_ms > 10) ? grain_ms : 10; // todo: find a better
   // default
   x->x_num_grains = (num_grains > 0) ? num_grains : 1;
 
   x->x_sms = 0;
   x->x_write_phase = 0;
+  x->x_recorded = 0;
   x->x_grain_pos = 0;
+  x->x_grain_phase = 0;
+  x->x_grain_phase_frac = 0;
   x->x_grain_samples = 0;
 
-  x->x_mix = 0.5f;
+  ramp_jump(&x->x_mix, 0.5f);
   x->x_state = STATE_IDLE;
+  event_queue_init(&x->x_events);
+  x->x_interp = INTERP_DEFAULT;
+  dsp_stats_init(&x->x_stats);
+
+  x->x_window = window_table_get(WINDOW_HANN, WINDOW_TABLE_SIZE);
+  if (x->x_window == NULL) {
+    pd_error(x, "glooper~: unable to allocate window table");
+    return NULL;
+  }
 
-  // initialize with small power of 2 values
-  x->x_input_buffer_samples = 1024;
-  x->x_window_buffer_samples = 1024;
-  if (!initialize_buffers(x)) {
+  // initialize with a small power of 2 value
+  if (!ring_buffer_init(&x->x_buffer, &x->x_obj, "glooper~", 1024, 1, 0)) {
+    glooper_free(x);
     return NULL;
   }
 
   x->x_inlet_pos = inlet_new(&x->x_obj, &x->x_obj.ob_pd, &s_signal, &s_signal);
+  x->x_inlet_rate = signalinlet_new(&x->x_obj, 1.0f);
 
   outlet_new(&x->x_obj, &s_signal);
+  x->x_info = outlet_new(&x->x_obj, &s_anything);
 
   return (void *)x;
 }
 
-int initialize_buffers(t_glooper *x)
+// swapped in by glooper_perform once the worker has built it
+static void update_input_buffer(t_glooper *x)
 {
-  x->x_input_buffer = getbytes(x->x_input_buffer_samples * sizeof(t_sample));
-  if (x->x_input_buffer == NULL) {
-    pd_error(x, "glooper~: unable to allocate memory to input buffer");
-    return 0;
-  }
-
-  x->x_window_buffer = getbytes(x->x_window_buffer_samples * sizeof(t_sample));
-  if (x->x_window_buffer == NULL) {
-    pd_error(x, "glooper~: unable to allocate memory to window buffer");
-    return 0;
+  int buffer_size = ring_buffer_size_for(x->x_input_buffer_ms * x->x_sms);
+  if (ring_buffer_request(&x->x_buffer, buffer_size)) {
+    post("glooper~: (debug) x_input_buffer_samples: %d", buffer_size);
   }
-  return 1;
 }
 
-static void update_input_buffer(t_glooper *x)
+static void update_grain(t_glooper *x)
 {
-  int buffer_size = 1;
-  while (buffer_size < (x->x_input_buffer_ms * x->x_sms)) {
-    buffer_size *= 2;
-  }
-
-  x->x_input_buffer = (t_sample *)resizebytes(x->x_input_buffer,
-                                              x->x_input_buffer_samples * sizeof(t_sample),
-                                              buffer_size * sizeof(t_sample));
-  if (x->x_input_buffer == NULL) {
-    pd_error(x, "glooper~: unable to resize input buffer");
-    return;
-  }
+  int grain_samples = x->x_sms * x->x_grain_ms;
+  x->x_grain_samples = (grain_samples > 0) ? grain_samples : 1;
+  x->x_window_scale = window_table_scale(x->x_window, x->x_grain_samples);
+  x->x_grain_pos = 0;
+  x->x_grain_phase = 0;
+  x->x_grain_phase_frac = 0;
+}
 
-  x->x_input_buffer_samples = buffer_size;
-  x->x_write_phase = 0;
-  post("glooper~: (debug) x_input_buffer_samples: %d", x->x_input_buffer_samples);
+static void system_params(t_glooper *x, t_float sr)
+{
+  x->x_sms = sr * 0.001f;
 }
 
-static void update_window_buffer(t_glooper *x)
+static void apply_event(t_glooper *x, const t_event *e)
 {
-  int buffer_size = 1;
-  while (buffer_size < (x->x_grain_ms * x->x_sms)) {
-    buffer_size *= 2;
+  switch (e->e_type) {
+    case EVENT_RECORD: x->x_state = STATE_RECORDING; break;
+    case EVENT_PLAY: x->x_state = STATE_PLAYING; break;
+    case EVENT_RESIZE:
+      x->x_grain_ms = e->e_value;
+      update_grain(x);
+      break;
+    case EVENT_MIX: ramp_set(&x->x_mix, e->e_value, MIX_RAMP_MS * x->x_sms); break;
   }
+}
 
-  x->x_window_buffer = (t_sample *)resizebytes(x->x_window_buffer,
-                                               x->x_window_buffer_samples * sizeof(t_sample),
-                                               buffer_size * sizeof(t_sample));
+#define GLOOPER_CHUNK 64 // grain starts worked out ahead of the loop at a time
+
+// the loop for one interpolator, state and start precision, all constants
+// once it's inlined into glooper_block, so none of them is tested per sample.
+// the grain starts for a chunk are split (and pulled into a mapped file's
+// resident window) in one pass before the loop, like gl~ does, and everything
+// the loop reads from x is copied to locals: out may alias x as far as the
+// compiler knows, so it would reload them after every store.
+//
+// the read pointer's fraction is the one thing carried from sample to sample,
+// and phase_step's floor makes that chain longer than the rest of the loop.
+// at the default rate of 1 it's a fixed point once it has been through one
+// step (a multiple of 2^-23 in [0, 1), so adding 1 is exact), after which
+// the step only moves the whole part; `settled` says it's there
+DSP_INLINE void glooper_span(t_glooper *x, const t_sample *in1, const t_sample *in2,
+                             const t_sample *in3, t_sample *out, int n, t_interp interp,
+                             int recording, int wide)
+{
+  t_sample *input_buffer = x->x_buffer.r_samples;
+  int input_buffer_samples = x->x_buffer.r_size;
+  int input_buffer_mask = input_buffer_samples - 1;
+  int shift = x->x_buffer.r_shift;
+  int write_phase = x->x_write_phase;
+  int grain_pos = x->x_grain_pos;
+  int grain_phase = x->x_grain_phase;
+  t_sample grain_phase_frac = x->x_grain_phase_frac;
+  int grain_samples = x->x_grain_samples;
+  const t_sample *window = x->x_window->w_samples;
+  t_float window_scale = x->x_window_scale;
+  t_ramp mix = x->x_mix;
+  int settled = 0;
+  int start[GLOOPER_CHUNK];
+  t_sample start_frac[GLOOPER_CHUNK];
+
+  while (n > 0) {
+    int chunk = (n < GLOOPER_CHUNK) ? n : GLOOPER_CHUNK;
+
+    // the expected input for in2 will be in the range (-1, 1), split like the
+    // read pointer. long buffers need it in double, see start_split. out is
+    // only written below, so it may share in2's memory
+    for (int i = 0; i < chunk; i++) {
+      start[i] = wide ? start_split_wide(in2[i], input_buffer_samples, &start_frac[i])
+                      : start_split(in2[i], input_buffer_samples, &start_frac[i]);
+    }
+    ring_buffer_clamp_reads(&x->x_buffer, start, start_frac, chunk);
+
+    for (int i = 0; i < chunk; i++) {
+      t_sample f = in1[i];
+      t_sample rate = in3[i];
+
+      if (recording) {
+        input_buffer[write_phase << shift] = f;
+      }
+
+      t_sample frac;
+      int grain_index = interp_split_parts(start[i] + grain_phase,
+                                           start_frac[i] + grain_phase_frac,
+                                           input_buffer_samples, &frac);
+      t_sample grain_sample = interp_sample(interp, input_buffer, grain_index,
+                                             input_buffer_mask, shift, frac);
+
+      grain_sample = grain_sample * window_table_read(window, grain_pos * window_scale);
+
+      t_float m = ramp_next(&mix);
+      out[i] = (grain_sample * m) + (f * (1.0f - m));
+
+      write_phase = (write_phase +1) & input_buffer_mask;
+      if (rate == 1.0f && settled) {
+        grain_phase++;
+      } else {
+        phase_step(&grain_phase, &grain_phase_frac, rate);
+        settled = (rate == 1.0f);
+      }
+      grain_pos = grain_pos + 1;
+      if (grain_pos >= grain_samples) {
+        grain_pos = 0;
+        grain_phase = 0;
+        grain_phase_frac = 0;
+      }
+    }
 
-  if (x->x_window_buffer == NULL) {
-    pd_error(x, "glooper~: unable to resize window buffer");
-    return;
+    in1 += chunk;
+    in2 += chunk;
+    in3 += chunk;
+    out += chunk;
+    n -= chunk;
   }
-  x->x_window_buffer_samples = buffer_size;
-  post("glooper~: (debug) x_window_buffer_samples: %d", x->x_window_buffer_samples);
+
+  x->x_mix = mix;
+  x->x_grain_pos = grain_pos;
+  x->x_grain_phase = grain_phase;
+  x->x_grain_phase_frac = grain_phase_frac;
+  if (recording) ring_buffer_written(&x->x_buffer);
+  x->x_write_phase = write_phase;
 }
 
-static void hanning_window(t_glooper *x)
+// the state only changes between the spans glooper_perform cuts the block
+// into, so the copy of the loop is picked once per span
+static void glooper_block(t_glooper *x, const t_sample *in1, const t_sample *in2,
+                          const t_sample *in3, t_sample *out, int n)
 {
-  int grain_samples = x->x_sms * x->x_grain_ms;
-  for (int i = 0; i < grain_samples; i++) {
-    float phase = (float)i / (grain_samples - 1);
-    x->x_window_buffer[i] = 0.5f * (1.0f - cos(2.0f * M_PI * phase));
+  int recording = (x->x_state == STATE_RECORDING);
+  int wide = (x->x_buffer.r_size > DSP_FLOAT_SAFE);
+
+#define GLOOPER_CASE(kind) \
+  case kind: \
+    if (recording && wide) glooper_span(x, in1, in2, in3, out, n, kind, 1, 1); \
+    else if (recording) glooper_span(x, in1, in2, in3, out, n, kind, 1, 0); \
+    else if (wide) glooper_span(x, in1, in2, in3, out, n, kind, 0, 1); \
+    else glooper_span(x, in1, in2, in3, out, n, kind, 0, 0); \
+    break;
+
+  switch (x->x_interp) {
+    GLOOPER_CASE(INTERP_LINEAR)
+    GLOOPER_CASE(INTERP_HERMITE)
+    GLOOPER_CASE(INTERP_SINC)
+    default:
+    GLOOPER_CASE(INTERP_CUBIC)
   }
-  x->x_grain_samples = grain_samples;
-  x->x_grain_pos = 0;
-}
+#undef GLOOPER_CASE
 
-// NOTE: for the `inline` directive to be respected by the compiler, probably
-// more this method to a header file
-// this method is using a look-behind approach to interpolation, try look
-// forward, or look both forward and back?
-static inline t_sample cubic_interpolate(t_sample *buffer, int phase, int mask, t_sample frac)
-{
-  t_sample a = buffer[phase];
-  t_sample b = buffer[(phase - 1) & mask];
-  t_sample c = buffer[(phase - 2) & mask];
-  t_sample d = buffer[(phase - 3) & mask];
-  t_sample cminusb = c - b;
-
-  return b + frac * (
-      cminusb - 0.1666667f * (1.0f - frac) * (
-          (d - a - 3.0f * cminusb) * frac + (d + 2.0f * a - 3.0f * b)
-      )
-  );
+  if (recording && x->x_recorded < x->x_buffer.r_size) x->x_recorded += n;
 }
 
-static void system_params(t_glooper *x, t_float sr)
+// one DSP block, timed or not by glooper_perform
+DSP_INLINE void glooper_run(t_glooper *x, const t_sample *in1, const t_sample *in2,
+                            const t_sample *in3, t_sample *out, int n)
 {
-  x->x_sms = sr * 0.001f;
+  // grains read relative to the buffer start, so nothing else needs remapping
+  t_ring_map map;
+  int adopted = ring_buffer_adopt(&x->x_buffer, &x->x_write_phase, &map);
+  if (adopted) x->x_recorded = ring_buffer_filled(&x->x_buffer, adopted, x->x_recorded);
+
+  // split the block wherever an event is due
+  double block_start = event_queue_block_start(&x->x_events, n, x->x_sms);
+  const t_event *e;
+  int done = 0, offset;
+  while ((e = event_queue_next(&x->x_events, block_start, x->x_sms, n, &offset)) != NULL) {
+    if (offset > done) {
+      glooper_block(x, in1 + done, in2 + done, in3 + done, out + done, offset - done);
+      done = offset;
+    }
+    apply_event(x, e);
+    event_queue_pop(&x->x_events);
+  }
+  if (done < n) glooper_block(x, in1 + done, in2 + done, in3 + done, out + done, n - done);
+
+  ring_buffer_publish(&x->x_buffer, x->x_write_phase);
 }
 
 static t_int *glooper_perform(t_int *w)
@@ -163,98 +298,140 @@ static t_int *glooper_perform(t_int *w)
   t_glooper *x = (t_glooper *)(w[1]);
   t_sample *in1 = (t_sample *)(w[2]);
   t_sample *in2 = (t_sample *)(w[3]);
-  t_sample *out = (t_sample *)(w[4]);
-  int n = (int)(w[5]);
-
-  t_sample *input_buffer = x->x_input_buffer;
-  int input_buffer_samples = x->x_input_buffer_samples;
-  int input_buffer_mask = input_buffer_samples - 1;
-  int write_phase = x->x_write_phase;
-  int grain_pos = x->x_grain_pos;
-
-  while (n--) {
-    t_sample f = *in1++;
-
-    if (x->x_state == STATE_RECORDING) {
-      input_buffer[write_phase] = f;
-    }
-
-    t_sample gs = *in2++;
-
-    // the expected input for gs will be in the range (-1, 1)
-    // scale it to (0, 1)
-    if (gs > 1) gs = 1.0f;
-    if (gs < -1) gs = -1.0f;
-    gs = gs * 0.5f + 0.5f;
-
-    float full_index = (gs * input_buffer_samples) + grain_pos;
-    int grain_index = (int)full_index;
-    float frac = full_index - grain_index;
-    grain_index = grain_index & input_buffer_mask;
-    t_sample grain_sample = cubic_interpolate(input_buffer, grain_index, input_buffer_mask, frac);
-
-    grain_sample = input_buffer[grain_index] * x->x_window_buffer[grain_pos];
-
-    *out++ = (grain_sample * x->x_mix) + (f * (1.0f - x->x_mix));
-
-    write_phase = (write_phase +1) & input_buffer_mask;
-    grain_pos = grain_pos + 1;
-    if (grain_pos >= x->x_grain_samples) grain_pos = 0;
+  t_sample *in3 = (t_sample *)(w[4]);
+  t_sample *out = (t_sample *)(w[5]);
+  int n = (int)(w[6]);
+
+  if (x->x_stats.s_enabled) {
+    double start = dsp_stats_now();
+    glooper_run(x, in1, in2, in3, out, n);
+    dsp_stats_block(&x->x_stats, start, n, 1, (t_float)x->x_recorded / x->x_buffer.r_size);
+  } else {
+    glooper_run(x, in1, in2, in3, out, n);
   }
-
-  x->x_grain_pos = grain_pos;
-  x->x_write_phase = write_phase;
-  return (w+6);
+  return (w+7);
 }
 
 static void glooper_dsp(t_glooper *x, t_signal **sp)
 {
-  dsp_add(glooper_perform, 5, x, sp[0]->s_vec, sp[1]->s_vec, sp[2]->s_vec, sp[0]->s_length);
+  dsp_add(glooper_perform, 6, x, sp[0]->s_vec, sp[1]->s_vec, sp[2]->s_vec, sp[3]->s_vec,
+          sp[0]->s_length);
   system_params(x, sp[0]->s_sr);
   update_input_buffer(x);
-  update_window_buffer(x);
-  hanning_window(x);
+  update_grain(x);
 }
 
 static void glooper_free(t_glooper *x)
 {
-  if (x->x_input_buffer != NULL) {
-    freebytes(x->x_input_buffer, x->x_input_buffer_samples * sizeof(t_sample));
-    x->x_input_buffer = NULL;
-  }
+  ring_buffer_free(&x->x_buffer);
+  dsp_stats_free(&x->x_stats);
 
-  if (x->x_window_buffer != NULL) {
-    freebytes(x->x_window_buffer, x->x_window_buffer_samples * sizeof(t_sample));
-    x->x_window_buffer = NULL;
+  if (x->x_window != NULL) {
+    window_table_release(x->x_window);
+    x->x_window = NULL;
   }
 
   if (x->x_inlet_pos != NULL) {
     inlet_free(x->x_inlet_pos);
   }
+  if (x->x_inlet_rate != NULL) {
+    inlet_free(x->x_inlet_rate);
+  }
+}
+
+static void glooper_event(t_glooper *x, t_glooper_event type, t_float value)
+{
+  if (!event_queue_push(&x->x_events, type, value)) {
+    pd_error(x, "glooper~: too many messages in one block, dropping one");
+  }
 }
 
 static void looper_record(t_glooper *x)
 {
-  x->x_state = STATE_RECORDING;
+  glooper_event(x, EVENT_RECORD, 0);
 }
 
 static void looper_play(t_glooper *x)
 {
-  x->x_state = STATE_PLAYING;
+  glooper_event(x, EVENT_PLAY, 0);
 }
 
 static void resize_window(t_glooper *x, t_floatarg f)
 {
-  x->x_grain_ms = (f > 10) ? f : 10;
-  update_window_buffer(x);
-  hanning_window(x);
+  glooper_event(x, EVENT_RESIZE, (f > 10) ? f : 10);
+}
+
+static void window(t_glooper *x, t_symbol *s)
+{
+  int shape = window_shape_from_name(s->s_name);
+  if (shape < 0) {
+    pd_error(x, "glooper~: unknown window '%s' (hann, tukey, blackman, gaussian, trapezoid)",
+             s->s_name);
+    return;
+  }
+  t_window_table *table = window_table_get((t_window_shape)shape, WINDOW_TABLE_SIZE);
+  if (table == NULL) {
+    pd_error(x, "glooper~: unable to allocate window table");
+    return;
+  }
+  window_table_release(x->x_window);
+  x->x_window = table;
+}
+
+static void interp(t_glooper *x, t_symbol *s)
+{
+  int kind = dsp_interp_from_name(s->s_name);
+  if (kind < 0) {
+    pd_error(x, "glooper~: unknown interpolation '%s' (linear, cubic, hermite, sinc)", s->s_name);
+    return;
+  }
+  x->x_interp = (t_interp)kind;
+}
+
+// set <array>: record into and read the grain from a Pd array instead of the
+// internal buffer; set with no array goes back to it
+static void set(t_glooper *x, t_symbol *s)
+{
+  ring_buffer_set_array(&x->x_buffer, s);
+}
+
+// map <file> [seconds]: record into and read the grain from a raw file of
+// native floats, mapped rather than loaded. a length creates or extends the
+// file, otherwise the file is left as it is. only the largest power of 2 that
+// fits in it is used, with an error naming the samples past that. map with no
+// file goes back to the internal buffer
+static void map(t_glooper *x, t_symbol *s, t_floatarg seconds)
+{
+  char path[MAXPDSTRING];
+  if (*s->s_name == 0) {
+    ring_buffer_map_file(&x->x_buffer, s, 0);
+    return;
+  }
+  canvas_makefilename(x->x_canvas, s->s_name, path, MAXPDSTRING);
+  t_float sr = (x->x_sms > 0) ? x->x_sms * 1000.0f : sys_getsr();
+  ring_buffer_map_file(&x->x_buffer, gensym(path), seconds * sr);
 }
 
 static void mix(t_glooper *x, t_floatarg f)
 {
   if (f < 0.0f) f = 0.0f;
   if (f > 1.0f) f = 1.0f;
-  x->x_mix = f;
+  glooper_event(x, EVENT_MIX, f);
+}
+
+// profile 1|0: times every DSP block from now on (or stops), see dsp_stats.h
+static void profile(t_glooper *x, t_floatarg f)
+{
+  if (!dsp_stats_enable(&x->x_stats, f != 0)) {
+    pd_error(x, "glooper~: unable to allocate profiler");
+  }
+}
+
+// the blocks timed since the last `profile 1`, out of the right outlet
+static void stats(t_glooper *x)
+{
+  t_float sr = (x->x_sms > 0) ? x->x_sms * 1000.0f : sys_getsr();
+  dsp_stats_report(&x->x_stats, x->x_info, sr);
 }
 
 void glooper_tilde_setup(void)
@@ -271,5 +448,13 @@ void glooper_tilde_setup(void)
   class_addmethod(glooper_class, (t_method)looper_play, gensym("play"), 0);
   class_addmethod(glooper_class, (t_method)resize_window, gensym("resize"), A_FLOAT, 0);
   class_addmethod(glooper_class, (t_method)mix, gensym("mix"), A_FLOAT, 0);
+  class_addmethod(glooper_class, (t_method)set, gensym("set"), A_DEFSYM, 0);
+  class_addmethod(glooper_class, (t_method)map, gensym("map"), A_DEFSYM, A_DEFFLOAT, 0);
+  class_addmethod(glooper_class, (t_method)interp, gensym("interp"), A_SYMBOL, 0);
+  class_addmethod(glooper_class, (t_method)window, gensym("window"), A_SYMBOL, 0);
+  class_addmethod(glooper_class, (t_method)profile, gensym("profile"), A_FLOAT, 0);
+  class_addmethod(glooper_class, (t_method)stats, gensym("stats"), 0);
   CLASS_MAINSIGNALIN(glooper_class, t_glooper, x_f);
+
+  dsp_kernels_setup();
 }
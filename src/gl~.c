@@ -1,315 +1,573 @@
 #include "m_pd.h"
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include "gl_engine.h"
+#include "ring_buffer.h"
+#include "event_queue.h"
+#include "dsp_stats.h"
+#include "grain_budget.h"
+#include "transport.h"
 
 typedef enum {
-  STATE_IDLE,
-  STATE_RECORDING,
-  STATE_PLAYING
-} t_gl_state;
-
-typedef struct _grain {
-  int position;
-  int ms;
-  int samples; // should probably be t_float (depends on sample rate)
-} t_grain;
-
+  EVENT_RECORD,
+  EVENT_PLAY,
+  EVENT_RESIZE,
+  EVENT_MIX,
+  EVENT_SPREAD,
+  EVENT_DENSITY,
+  EVENT_JITTER_ONSET,
+  EVENT_JITTER_POSITION,
+  EVENT_JITTER_DURATION,
+  EVENT_JITTER_PITCH,
+  EVENT_SEED,
+  EVENT_SYNC,
+  EVENT_TEMPO
+} t_gl_event;
+
+// the grains themselves are in x_engine (gl_engine.c); this is Pd's side of
+// them: the buffer's storage, messages timed to the sample, beat sync
 typedef struct _gl {
   t_object x_obj;
 
-  t_grain *x_grains;
-  int x_grain_ms;
+  t_gl_engine x_engine;
 
   int x_input_buffer_ms;
-  int x_input_buffer_samples; // t_float instead?
-  t_sample *x_input_buffer;
-
-  int x_window_buffer_samples; // t_float?
-  t_sample *x_window_buffer;
-
-  int x_write_phase;
+  int x_channels; // of the buffer and the outlet
+  t_ring_buffer x_buffer; // resized off the audio thread or a Pd array, see ring_buffer.c
+  t_canvas *x_canvas; // for file names relative to the patch
 
-  t_gl_state x_state;
+  t_event_queue x_events; // messages waiting for their sample
+  t_transport x_transport; // `sync` and `tempo`
+  int x_deferred; // a record or play waiting for the next tick, -1 for none
 
-  t_float x_sms; // samples per ms
-  int x_num_grains;
-  t_float x_grain_spread; // some float value to set distance between grains;
-
-  t_float x_mix; // wet/dry
+  t_dsp_stats x_stats; // `profile` and `stats`
+  t_grain_budget x_budget; // this instance's share of `budget`
+  t_clock *x_budget_clock; // takes the share out once perform stops, see grain_budget.h
+  double x_budget_ms; // between its ticks
+  int x_budget_armed; // the clock is set
 
   t_inlet *x_inlet_pos;
+  t_inlet *x_inlet_rate; // playback rate, 1 when not connected
+  t_inlet *x_inlet_sync; // phasor~ for `sync` with no tempo
+  t_outlet *x_done; // read, write and stats report here
   t_float x_f; // dummy arg for MAINSIGNALIN
 } t_gl;
 
 static t_class *gl_class = NULL;
 
 static void gl_free(t_gl *x);
-static int initialize_buffers(t_gl *x);
-static int initialize_grains(t_gl *x);
+static void gl_notify(t_object *owner, t_symbol *what, int samples);
+static void gl_clamp(void *arg, int *start, t_sample *frac, int n);
+static void gl_budget_tick(t_gl *x);
 
-static void *gl_new(t_floatarg grain_ms, t_floatarg num_grains)
+static void *gl_new(t_floatarg grain_ms, t_floatarg num_grains, t_floatarg channels)
 {
   t_gl *x = (t_gl *)pd_new(gl_class);
 
   x->x_input_buffer_ms = 4000;
-  x->x_grain_ms = (grain_ms > 10) ? grain_ms : 10; // todo: find a better
-  // default
-  x->x_num_grains = (num_grains > 0) ? num_grains : 1;
-  if (!initialize_grains(x)) {
+  x->x_channels = (channels > 1) ? channels : 1;
+  if (x->x_channels > RING_BUFFER_MAX_CHANNELS) x->x_channels = RING_BUFFER_MAX_CHANNELS;
+  x->x_canvas = canvas_getcurrent();
+  dsp_stats_init(&x->x_stats);
+  // todo: find a better default grain length
+  if (!gl_engine_init(&x->x_engine, (grain_ms > 10) ? grain_ms : 10,
+                      (num_grains > 0) ? num_grains : 1, x->x_channels)) {
+    pd_error(x, "gl~: failed to allocate memory for grains");
     gl_free(x); // I _think_ just Pd will handle the call on return NULL, but...
     return NULL;
   }
 
-  x->x_grain_spread = 0.3f; // testing
-
-  x->x_sms = 0;
-  x->x_write_phase = 0;
-
-  x->x_mix = 0.5f;
-  x->x_state = STATE_IDLE;
+  grain_budget_join(&x->x_budget, x->x_engine.e_grains.g_voices);
+  x->x_budget_clock = clock_new(x, (t_method)gl_budget_tick);
+  event_queue_init(&x->x_events);
+  transport_init(&x->x_transport);
+  x->x_deferred = -1;
 
-  // initialize with small power of 2 values
-  x->x_input_buffer_samples = 1024;
-  x->x_window_buffer_samples = 1024;
-  if (!initialize_buffers(x)) {
+  // initialize with a small value
+  if (!ring_buffer_init(&x->x_buffer, &x->x_obj, "gl~", 1024, x->x_channels, DSP_GUARD)) {
     gl_free(x);
     return NULL;
   }
+  x->x_engine.e_clamp = gl_clamp;
+  x->x_engine.e_clamp_arg = &x->x_buffer;
 
   x->x_inlet_pos = inlet_new(&x->x_obj, &x->x_obj.ob_pd, &s_signal, &s_signal);
+  x->x_inlet_rate = signalinlet_new(&x->x_obj, 1.0f);
+  x->x_inlet_sync = signalinlet_new(&x->x_obj, 0.0f);
+  ring_buffer_set_notify(&x->x_buffer, gl_notify);
 
   outlet_new(&x->x_obj, &s_signal);
+  x->x_done = outlet_new(&x->x_obj, &s_anything);
 
   return (void *)x;
 }
 
-// TODO: rename, or maybe bave separate methods for initializeing and updating
-// grains?
-static int initialize_grains(t_gl *x)
+// swapped in by gl_perform once the worker has built it
+static void update_input_buffer(t_gl *x)
 {
-  x->x_grains = (t_grain *)getbytes(sizeof(t_grain) * x->x_num_grains);
-  if (x->x_grains == NULL) {
-    pd_error(x, "gl~: failed to allocate memory for grains");
-    return 0;
+  // exactly that long: the guard lets the ring be any size (ring_buffer.h)
+  int buffer_size = (int)ceilf(x->x_input_buffer_ms * x->x_engine.e_sms);
+  if (ring_buffer_request(&x->x_buffer, buffer_size)) {
+    post("gl~: (debug) x_input_buffer_samples: %d", buffer_size);
   }
+}
 
-  for (int i = 0; i < x->x_num_grains; i++) {
-    t_grain *grain = &x->x_grains[i];
-    grain->ms = x->x_grain_ms;
-    grain->samples = grain->ms * x->x_sms;
-    // rate
-    grain->position = 0;
-  }
+// grain positions stay inside the resident part of a mapped file
+static void gl_clamp(void *arg, int *start, t_sample *frac, int n)
+{
+  ring_buffer_clamp_reads((t_ring_buffer *)arg, start, frac, n);
+}
 
-  return 1;
+static void gl_deferred(t_gl *x)
+{
+  if (x->x_deferred == EVENT_RECORD) gl_engine_state(&x->x_engine, STATE_RECORDING);
+  if (x->x_deferred == EVENT_PLAY) gl_engine_state(&x->x_engine, STATE_PLAYING);
+  x->x_deferred = -1;
 }
 
-int initialize_buffers(t_gl *x)
+// on a tick: a waiting record or play happens, then the engine's tick (the
+// scheduler starts a grain, or the looping cloud starts over)
+static void gl_tick(t_gl *x)
 {
-  x->x_input_buffer = getbytes(x->x_input_buffer_samples * sizeof(t_sample));
-  if (x->x_input_buffer == NULL) {
-    pd_error(x, "gl~: unable to allocate memory to input buffer");
-    return 0;
-  }
+  gl_deferred(x);
+  gl_engine_tick(&x->x_engine, (x->x_transport.t_period > 0) ? x->x_transport.t_period
+                                                             : x->x_transport.t_interval);
+}
 
-  x->x_window_buffer = getbytes(x->x_window_buffer_samples * sizeof(t_sample));
-  if (x->x_window_buffer == NULL) {
-    pd_error(x, "gl~: unable to allocate memory to window buffer");
-    return 0;
+// while synced the block is cut at every tick
+static void gl_block(t_gl *x, const t_sample *in1, const t_sample *in2,
+                     const t_sample *rate, const t_sample *sync, t_sample *out, int n)
+{
+  if (x->x_transport.t_division == 0) {
+    gl_engine_process(&x->x_engine, in1, in2, rate, out, n);
+    return;
+  }
+  while (n > 0) {
+    int span = transport_next(&x->x_transport, sync, n);
+    if (span == 0) {
+      transport_take(&x->x_transport);
+      gl_tick(x);
+      continue;
+    }
+    gl_engine_process(&x->x_engine, in1, in2, rate, out, span);
+    transport_advance(&x->x_transport, span);
+    in1 += span;
+    in2 += span;
+    rate += span;
+    sync += span;
+    out += span;
+    n -= span;
   }
-  return 1;
 }
 
-static void update_input_buffer(t_gl *x)
+static void apply_event(t_gl *x, const t_event *e)
 {
-  int buffer_size = 1;
-  while (buffer_size < (x->x_input_buffer_ms * x->x_sms)) {
-    buffer_size *= 2;
+  t_gl_engine *engine = &x->x_engine;
+  switch (e->e_type) {
+    case EVENT_RECORD:
+    case EVENT_PLAY:
+      // with sync on, recording starts and stops on the next tick
+      x->x_deferred = e->e_type;
+      if (x->x_transport.t_division == 0) gl_deferred(x);
+      break;
+    case EVENT_RESIZE: gl_engine_grain_ms(engine, e->e_value); break;
+    case EVENT_MIX: gl_engine_mix(engine, e->e_value); break;
+    case EVENT_SPREAD: gl_engine_spread(engine, e->e_value); break;
+    case EVENT_DENSITY: gl_engine_density(engine, e->e_value); break;
+    case EVENT_JITTER_ONSET: gl_engine_jitter(engine, JITTER_ONSET, e->e_value); break;
+    case EVENT_JITTER_POSITION: gl_engine_jitter(engine, JITTER_POSITION, e->e_value); break;
+    case EVENT_JITTER_DURATION: gl_engine_jitter(engine, JITTER_DURATION, e->e_value); break;
+    case EVENT_JITTER_PITCH: gl_engine_jitter(engine, JITTER_PITCH, e->e_value); break;
+    case EVENT_SEED: gl_engine_seed(engine, (unsigned int)e->e_value); break;
+    case EVENT_SYNC:
+      transport_set(&x->x_transport, e->e_value, x->x_transport.t_bpm, engine->e_sms);
+      if (x->x_transport.t_division == 0) gl_deferred(x);
+      gl_engine_sync(engine, x->x_transport.t_division > 0);
+      break;
+    case EVENT_TEMPO:
+      transport_set(&x->x_transport, x->x_transport.t_division, e->e_value, engine->e_sms);
+      break;
   }
+}
 
-  x->x_input_buffer = (t_sample *)resizebytes(x->x_input_buffer,
-                                              x->x_input_buffer_samples * sizeof(t_sample),
-                                              buffer_size * sizeof(t_sample));
-  if (x->x_input_buffer == NULL) {
-    pd_error(x, "gl~: unable to resize input buffer");
-    return;
+// one DSP block, timed or not by gl_perform
+DSP_INLINE void gl_run(t_gl *x, const t_sample *in1, const t_sample *in2,
+                       const t_sample *in3, const t_sample *in4, t_sample *out, int n)
+{
+  t_gl_engine *engine = &x->x_engine;
+  t_float sms = engine->e_sms;
+  int recording = (engine->e_state == STATE_RECORDING);
+
+  // the block the pool is rendering reads the voices and the buffer, so it
+  // has to be in before either changes
+  gl_engine_finish(engine);
+  int voices = grain_budget_limit(&x->x_budget, engine->e_grains.g_voices);
+  if (voices != engine->e_grains.g_limit) gl_engine_limit(engine, voices);
+
+  // grain starts are relative to the buffer start, so nothing else needs
+  // remapping. new storage waits while a late thread may still read the old
+  t_ring_map map;
+  int adopted = gl_engine_busy(engine) ? 0
+    : ring_buffer_adopt(&x->x_buffer, &engine->e_write_phase, &map);
+  if (adopted) engine->e_recorded = ring_buffer_filled(&x->x_buffer, adopted, engine->e_recorded);
+  gl_engine_buffer(engine, x->x_buffer.r_samples, x->x_buffer.r_size, x->x_buffer.r_shift,
+                   x->x_buffer.r_guarded, x->x_buffer.r_format);
+
+  transport_block(&x->x_transport, n, sms);
+
+  double block_start = event_queue_block_start(&x->x_events, n, sms);
+  const t_event *e;
+  int done = 0, offset;
+  if (gl_engine_ahead(engine)) {
+    // a block ahead the events all land at its start
+    while ((e = event_queue_next(&x->x_events, block_start, sms, n, &offset)) != NULL) {
+      apply_event(x, e);
+      event_queue_pop(&x->x_events);
+    }
+  }
+  if (gl_engine_ahead(engine)) {
+    gl_engine_process_ahead(engine, in1, in2, in3, out, n);
+  } else {
+    // split the block wherever an event is due
+    while ((e = event_queue_next(&x->x_events, block_start, sms, n, &offset)) != NULL) {
+      if (offset > done) {
+        gl_block(x, in1 + done, in2 + done, in3 + done, in4 + done, out + done, offset - done);
+        done = offset;
+      }
+      apply_event(x, e);
+      event_queue_pop(&x->x_events);
+    }
+    if (done < n) {
+      gl_block(x, in1 + done, in2 + done, in3 + done, in4 + done, out + done, n - done);
+    }
   }
 
-  x->x_input_buffer_samples = buffer_size;
-  x->x_write_phase = 0;
-  post("gl~: (debug) x_input_buffer_samples: %d", x->x_input_buffer_samples);
+  if (recording || engine->e_state == STATE_RECORDING) ring_buffer_written(&x->x_buffer);
+  ring_buffer_publish(&x->x_buffer, engine->e_write_phase);
 }
 
-static void update_window_buffer(t_gl *x)
+static t_int *gl_perform(t_int *w)
 {
-  int buffer_size = 1;
-  while (buffer_size < (x->x_grain_ms * x->x_sms)) {
-    buffer_size *= 2;
+  t_gl *x = (t_gl *)(w[1]);
+  t_sample *in1 = (t_sample *)(w[2]);
+  t_sample *in2 = (t_sample *)(w[3]);
+  t_sample *in3 = (t_sample *)(w[4]);
+  t_sample *in4 = (t_sample *)(w[5]);
+  t_sample *out = (t_sample *)(w[6]);
+  int n = (int)(w[7]);
+
+  if (x->x_stats.s_enabled || grain_budget_on()) {
+    double start = dsp_stats_now();
+    gl_run(x, in1, in2, in3, in4, out, n);
+    if (x->x_stats.s_enabled) {
+      dsp_stats_block(&x->x_stats, start, n, x->x_engine.e_grains.g_count,
+                      (t_float)x->x_engine.e_recorded / x->x_buffer.r_size);
+    }
+    if (grain_budget_on()) {
+      grain_budget_block(&x->x_budget, dsp_stats_now() - start, n * 1e6 / x->x_engine.e_sms,
+                         x->x_engine.e_grains.g_voices);
+      // running again without a dsp method, after a switch~; sets the clock
+      // like bang~ does, which only happens once per stop
+      if (!x->x_budget_armed) {
+        x->x_budget_armed = 1;
+        clock_delay(x->x_budget_clock, x->x_budget_ms);
+      }
+    }
+  } else {
+    gl_run(x, in1, in2, in3, in4, out, n);
   }
+  return (w+8);
+}
 
-  x->x_window_buffer = (t_sample *)resizebytes(x->x_window_buffer,
-                                               x->x_window_buffer_samples * sizeof(t_sample),
-                                               buffer_size * sizeof(t_sample));
+// runs while perform reports to the budget, and stops once it has taken the
+// load out: set again by the dsp method, or by perform when it reports again
+static void gl_budget_tick(t_gl *x)
+{
+  if (grain_budget_check(&x->x_budget)) {
+    clock_delay(x->x_budget_clock, x->x_budget_ms);
+  } else {
+    x->x_budget_armed = 0;
+  }
+}
 
-  if (x->x_window_buffer == NULL) {
-    pd_error(x, "gl~: unable to resize window buffer");
+static void gl_dsp(t_gl *x, t_signal **sp)
+{
+  int ok = gl_engine_dsp(&x->x_engine, sp[0]->s_sr, sp[0]->s_nchans, sp[0]->s_length);
+  transport_set(&x->x_transport, x->x_transport.t_division, x->x_transport.t_bpm,
+                x->x_engine.e_sms);
+  signal_setmultiout(&sp[4], x->x_channels);
+  if (!ok) {
+    // silence rather than whatever was left in the outlet's signal
+    pd_error(x, "gl~: unable to allocate scratch buffer");
+    dsp_add_zero(sp[4]->s_vec, sp[4]->s_length * x->x_channels);
     return;
   }
-  x->x_window_buffer_samples = buffer_size;
-  post("gl~: (debug) x_window_buffer_samples: %d", x->x_window_buffer_samples);
+  dsp_add(gl_perform, 7, x, sp[0]->s_vec, sp[1]->s_vec, sp[2]->s_vec, sp[3]->s_vec,
+          sp[4]->s_vec, sp[0]->s_length);
+  update_input_buffer(x);
+
+  // two blocks apart at least, so a long block isn't taken for a stop
+  x->x_budget_ms = 2 * sp[0]->s_length / x->x_engine.e_sms;
+  if (x->x_budget_ms < GRAIN_BUDGET_STALE_MS) x->x_budget_ms = GRAIN_BUDGET_STALE_MS;
+  x->x_budget_armed = 1;
+  clock_delay(x->x_budget_clock, x->x_budget_ms);
 }
 
-static void hanning_window(t_gl *x)
+static void gl_free(t_gl *x)
 {
-  int grain_samples = x->x_sms * x->x_grain_ms;
-  for (int i = 0; i < grain_samples; i++) {
-    float phase = (float)i / (grain_samples - 1);
-    x->x_window_buffer[i] = 0.5f * (1.0f - cos(2.0f * M_PI * phase));
+  gl_engine_free(&x->x_engine);
+  dsp_stats_free(&x->x_stats);
+  grain_budget_leave(&x->x_budget);
+  if (x->x_budget_clock != NULL) {
+    clock_free(x->x_budget_clock);
   }
+  ring_buffer_free(&x->x_buffer);
 
-  for (int i = 0; i < x->x_num_grains; i++) {
-    x->x_grains[i].samples = grain_samples;
-    x->x_grains[i].position = 0;
+  if (x->x_inlet_pos != NULL) {
+    inlet_free(x->x_inlet_pos);
+  }
+  if (x->x_inlet_rate != NULL) {
+    inlet_free(x->x_inlet_rate);
+  }
+  if (x->x_inlet_sync != NULL) {
+    inlet_free(x->x_inlet_sync);
   }
-
 }
 
-// NOTE: for the `inline` directive to be respected by the compiler, probably
-// more this method to a header file
-// this method is using a look-behind approach to interpolation, try look
-// forward, or look both forward and back?
-static inline t_sample cubic_interpolate(t_sample *buffer, int phase, int mask, t_sample frac)
+static void gl_event(t_gl *x, t_gl_event type, t_float value)
 {
-  t_sample a = buffer[phase];
-  t_sample b = buffer[(phase - 1) & mask];
-  t_sample c = buffer[(phase - 2) & mask];
-  t_sample d = buffer[(phase - 3) & mask];
-  t_sample cminusb = c - b;
+  if (!event_queue_push(&x->x_events, type, value)) {
+    pd_error(x, "gl~: too many messages in one block, dropping one");
+  }
+}
 
-  return b + frac * (
-      cminusb - 0.1666667f * (1.0f - frac) * (
-          (d - a - 3.0f * cminusb) * frac + (d + 2.0f * a - 3.0f * b)
-      )
-  );
+static void looper_record(t_gl *x)
+{
+  gl_event(x, EVENT_RECORD, 0);
 }
 
-static void system_params(t_gl *x, t_float sr)
+static void looper_play(t_gl *x)
 {
-  x->x_sms = sr * 0.001f;
+  gl_event(x, EVENT_PLAY, 0);
 }
 
-static t_int *gl_perform(t_int *w)
+static void resize_window(t_gl *x, t_floatarg f)
 {
-  t_gl *x = (t_gl *)(w[1]);
-  t_sample *in1 = (t_sample *)(w[2]);
-  t_sample *in2 = (t_sample *)(w[3]);
-  t_sample *out = (t_sample *)(w[4]);
-  int n = (int)(w[5]);
+  gl_event(x, EVENT_RESIZE, (f > 10) ? f : 10);
+}
 
-  t_sample *input_buffer = x->x_input_buffer;
-  int input_buffer_samples = x->x_input_buffer_samples;
-  int input_buffer_mask = input_buffer_samples - 1;
-  int write_phase = x->x_write_phase;
+static void window(t_gl *x, t_symbol *s)
+{
+  int shape = window_shape_from_name(s->s_name);
+  if (shape < 0) {
+    pd_error(x, "gl~: unknown window '%s' (hann, tukey, blackman, gaussian, trapezoid)",
+             s->s_name);
+    return;
+  }
+  if (!gl_engine_window(&x->x_engine, (t_window_shape)shape)) {
+    pd_error(x, "gl~: unable to allocate window table");
+  }
+}
 
-  t_float g_scale = 1.0f / x->x_num_grains;
-  t_float grain_offset = x->x_grain_ms * x->x_sms * x->x_grain_spread;
+// set <array>: record into and read grains from a Pd array instead of the
+// internal buffer; set with no array goes back to it
+static void set(t_gl *x, t_symbol *s)
+{
+  ring_buffer_set_array(&x->x_buffer, s);
+}
 
-  while (n--) {
-    t_sample f = *in1++;
+// the path of a file named in a message, relative to the patch
+static t_symbol *gl_path(t_gl *x, t_symbol *s)
+{
+  char path[MAXPDSTRING];
+  canvas_makefilename(x->x_canvas, s->s_name, path, MAXPDSTRING);
+  return gensym(path);
+}
 
-    if (x->x_state == STATE_RECORDING) {
-      input_buffer[write_phase] = f;
-    }
+// read <file>: preloads the buffer with a WAVE or raw file, from position 0.
+// grains carry on from the old buffer until it's all in
+static void gl_read(t_gl *x, t_symbol *s)
+{
+  ring_buffer_read_file(&x->x_buffer, gl_path(x, s));
+}
 
-    t_sample grain_start = *in2++;
-
-    if (grain_start > 1.0f) grain_start = 1.0f;
-    if (grain_start < -1.0f) grain_start = -1.0f;
-    grain_start = grain_start * 0.5f + 0.5f; // maybe handle scaling in the
-    // patch?
-    t_sample grain_output = 0.0f;
-    for (int i = 0; i < x->x_num_grains; i++) {
-      float full_index = (grain_start * input_buffer_samples) + x->x_grains[i].position + i * grain_offset;
-      int grain_index = (int)full_index;
-      float frac = full_index - (t_sample)grain_index;
-      grain_index = grain_index & input_buffer_mask;
-      t_sample grain_sample = cubic_interpolate(input_buffer, grain_index, input_buffer_mask, frac);
-      grain_output += grain_sample * g_scale * x->x_window_buffer[x->x_grains[i].position];
-      x->x_grains[i].position += 1;
-      if (x->x_grains[i].position >= x->x_grains[i].samples) {
-        x->x_grains[i].position = 0;
-      }
-    }
+// write <file>: saves the whole buffer, position 0 first, as a 32-bit float
+// WAVE file if the name ends in .wav, raw floats otherwise
+static void gl_write(t_gl *x, t_symbol *s)
+{
+  t_float sr = (x->x_engine.e_sms > 0) ? x->x_engine.e_sms * 1000.0f : sys_getsr();
+  ring_buffer_write_file(&x->x_buffer, gl_path(x, s), 0, x->x_buffer.r_size, sr);
+}
 
-    *out++ = (grain_output * x->x_mix) + (f * (1.0f - x->x_mix));
+// `read <samples>` or `write <samples>` out of the right outlet once done
+static void gl_notify(t_object *owner, t_symbol *what, int samples)
+{
+  t_gl *x = (t_gl *)owner;
+  t_atom a;
+  SETFLOAT(&a, samples);
+  outlet_anything(x->x_done, what, 1, &a);
+}
 
-    write_phase = (write_phase +1) & input_buffer_mask;
+// map <file> [seconds]: record into and read grains from a raw file of
+// native floats, mapped rather than loaded, for buffers of hours rather than
+// seconds. a length creates or extends the file, otherwise the file is left
+// as it is. it wraps at the file's length, to the page. map with no file goes
+// back to the internal buffer
+static void map(t_gl *x, t_symbol *s, t_floatarg seconds)
+{
+  if (*s->s_name == 0) {
+    ring_buffer_map_file(&x->x_buffer, s, 0);
+    return;
   }
-
-  x->x_write_phase = write_phase;
-  return (w+6);
+  t_float sr = (x->x_engine.e_sms > 0) ? x->x_engine.e_sms * 1000.0f : sys_getsr();
+  ring_buffer_map_file(&x->x_buffer, gl_path(x, s), seconds * sr);
 }
 
-static void gl_dsp(t_gl *x, t_signal **sp)
+static void mix(t_gl *x, t_floatarg f)
 {
-  dsp_add(gl_perform, 5, x, sp[0]->s_vec, sp[1]->s_vec, sp[2]->s_vec, sp[0]->s_length);
-  system_params(x, sp[0]->s_sr);
-  update_input_buffer(x);
-  update_window_buffer(x);
-  hanning_window(x);
-  initialize_grains(x);
+  if (f < 0.0f) f = 0.0f;
+  if (f > 1.0f) f = 1.0f;
+  gl_event(x, EVENT_MIX, f);
 }
 
-static void gl_free(t_gl *x)
+// 0: SIMD (default), 1: grain-major, 2: scalar. the other two are there to
+// compare against, not to run: with 64 grains both take 3-5 times as long
+// per sample as SIMD. see gl_engine_render
+static void render(t_gl *x, t_floatarg f)
 {
-  if (x->x_grains != NULL) {
-    freebytes(x->x_grains, x->x_num_grains * sizeof(t_grain));
-    x->x_grains = NULL;
+  if (!(f >= RENDER_SIMD && f <= RENDER_SCALAR) || f != (int)f) {
+    pd_error(x, "gl~: unknown render mode %g (0: simd, 1: grain-major, 2: scalar)", f);
+    return;
   }
+  gl_engine_render(&x->x_engine, (t_gl_render)(int)f);
+}
 
-  if (x->x_input_buffer != NULL) {
-    freebytes(x->x_input_buffer, x->x_input_buffer_samples * sizeof(t_sample));
-    x->x_input_buffer = NULL;
+static void interp(t_gl *x, t_symbol *s)
+{
+  int kind = dsp_interp_from_name(s->s_name);
+  if (kind < 0) {
+    pd_error(x, "gl~: unknown interpolation '%s' (linear, cubic, hermite, sinc)", s->s_name);
+    return;
   }
+  gl_engine_interp(&x->x_engine, (t_interp)kind);
+}
 
-  if (x->x_window_buffer != NULL) {
-    freebytes(x->x_window_buffer, x->x_window_buffer_samples * sizeof(t_sample));
-    x->x_window_buffer = NULL;
+// format float|int16|half: how the internal buffer keeps its samples. int16
+// (dithered) and half take half the memory of float, or a quarter in Pd64;
+// int16 is 16 bits at any level, half 11 bits relative to it. this trades
+// CPU for memory: every tap is decoded as it's read, and grains read their
+// buffer in order, so a buffer that fits in the last level cache gains
+// nothing from the smaller footprint. at 192 kHz (a 4 MiB float buffer)
+// with 64 grains, int16 and half cost 5-25% more per sample than float
+// with AVX2 and 3-40% more with SSE2. the buffer is converted in the
+// background, and an array or a mapped file stays float
+static void format(t_gl *x, t_symbol *s)
+{
+  int format = sample_format_from_name(s->s_name);
+  if (format < 0) {
+    pd_error(x, "gl~: unknown format '%s' (float, int16, half)", s->s_name);
+    return;
   }
+  ring_buffer_set_format(&x->x_buffer, (t_sample_format)format);
+}
 
-  if (x->x_inlet_pos != NULL) {
-    inlet_free(x->x_inlet_pos);
+static void spread(t_gl *x, t_floatarg f) {
+  if (f < 0) f = 0;
+  gl_event(x, EVENT_SPREAD, f);
+}
+
+// grains per second. 0 (the default) goes back to every voice looping
+static void density(t_gl *x, t_floatarg f)
+{
+  gl_event(x, EVENT_DENSITY, (f > 0) ? f : 0);
+}
+
+// jitter onset|duration 0..1 (fraction of the mean), position <ms>,
+// pitch <semitones>; each is a +- range
+static void jitter(t_gl *x, t_symbol *s, t_floatarg f)
+{
+  if (f < 0) f = 0;
+  if (!strcmp(s->s_name, "onset")) {
+    gl_event(x, EVENT_JITTER_ONSET, (f < 1) ? f : 1);
+  } else if (!strcmp(s->s_name, "position")) {
+    gl_event(x, EVENT_JITTER_POSITION, f);
+  } else if (!strcmp(s->s_name, "duration")) {
+    gl_event(x, EVENT_JITTER_DURATION, (f < 1) ? f : 1);
+  } else if (!strcmp(s->s_name, "pitch")) {
+    gl_event(x, EVENT_JITTER_PITCH, f);
+  } else {
+    pd_error(x, "gl~: unknown jitter '%s' (onset, position, duration, pitch)", s->s_name);
   }
 }
 
-static void looper_record(t_gl *x)
+// sync <n>: record and play wait for the next of n ticks per beat, density
+// grains start only on ticks, and the looping cloud's grains last a whole
+// number of ticks and start on one; 0 (the default) turns it off. see
+// transport.h
+static void gl_sync(t_gl *x, t_floatarg f)
 {
-  x->x_state = STATE_RECORDING;
+  gl_event(x, EVENT_SYNC, (f > 0) ? (int)f : 0);
 }
 
-static void looper_play(t_gl *x)
+// tempo <bpm>: where the beat comes from while synced: Pd's clock at that
+// tempo, or with 0 (the default) one cycle of the phasor~ in the right inlet
+static void gl_tempo(t_gl *x, t_floatarg f)
 {
-  x->x_state = STATE_PLAYING;
+  gl_event(x, EVENT_TEMPO, (f > 0) ? f : 0);
 }
 
-static void resize_window(t_gl *x, t_floatarg f)
+// threads <n>: the looping cloud (no density, no sync) is cut into up to n
+// parts that render_pool.c's threads render a block ahead, for clouds too
+// big for one core; 0 (the default) renders inline. the output comes a block
+// later, reported as `latency <samples>` out of the right outlet, and events
+// take effect at the start of their block. parts no thread got to in time
+// are rendered on the DSP thread, so a busy machine costs CPU, not dropouts.
+// the grains sum in a different order, so the output isn't bit-identical to
+// rendering inline, and switching between the two drops a block
+static void threads(t_gl *x, t_floatarg f)
 {
-  x->x_grain_ms = (f > 10) ? f : 10;
-  update_window_buffer(x);
-  hanning_window(x);
-  initialize_grains(x);
+  int parts = (f > 0) ? f : 0;
+  if (!gl_engine_threads(&x->x_engine, parts)) {
+    pd_error(x, "gl~: unable to start render threads");
+    gl_engine_threads(&x->x_engine, 0);
+  }
+
+  t_atom a;
+  SETFLOAT(&a, (x->x_engine.e_threads > 0) ? x->x_engine.e_block : 0);
+  outlet_anything(x->x_done, gensym("latency"), 1, &a);
 }
 
-static void mix(t_gl *x, t_floatarg f)
+// restarts the scheduler's random sequence
+static void seed(t_gl *x, t_floatarg f)
 {
-  if (f < 0.0f) f = 0.0f;
-  if (f > 1.0f) f = 1.0f;
-  x->x_mix = f;
+  gl_event(x, EVENT_SEED, f);
 }
 
-static void spread(t_gl *x, t_floatarg f) {
-  if (f < 0) f = 0;
-  x->x_grain_spread = f;
+// profile 1|0: times every DSP block from now on (or stops), see dsp_stats.h
+static void profile(t_gl *x, t_floatarg f)
+{
+  if (!dsp_stats_enable(&x->x_stats, f != 0)) {
+    pd_error(x, "gl~: unable to allocate profiler");
+  }
+}
+
+// budget <percent>: how much of each DSP block's real time every gl~ in Pd
+// may take between them, 0 (the default) for no limit. whichever instance
+// gets it sets it for all. over budget each one fades out some of its
+// voices, the scheduler's nearest their end first, and fades them back in
+// once the load is down again. see grain_budget.h
+static void budget(t_gl *x, t_floatarg f)
+{
+  (void)x;
+  grain_budget_set((f > 0) ? f : 0);
+}
+
+// the blocks timed since the last `profile 1`, out of the right outlet
+static void stats(t_gl *x)
+{
+  t_float sr = (x->x_engine.e_sms > 0) ? x->x_engine.e_sms * 1000.0f : sys_getsr();
+  dsp_stats_report(&x->x_stats, x->x_done, sr);
 }
 
 void gl_tilde_setup(void)
@@ -318,14 +576,33 @@ void gl_tilde_setup(void)
                             (t_newmethod)gl_new,
                             (t_method)gl_free,
                             sizeof(t_gl),
-                            CLASS_DEFAULT,
-                            A_DEFFLOAT, A_DEFFLOAT, 0);
+                            CLASS_MULTICHANNEL,
+                            A_DEFFLOAT, A_DEFFLOAT, A_DEFFLOAT, 0);
 
   class_addmethod(gl_class, (t_method)gl_dsp, gensym("dsp"), A_CANT, 0);
   class_addmethod(gl_class, (t_method)looper_record, gensym("record"), 0);
   class_addmethod(gl_class, (t_method)looper_play, gensym("play"), 0);
   class_addmethod(gl_class, (t_method)resize_window, gensym("resize"), A_FLOAT, 0);
   class_addmethod(gl_class, (t_method)mix, gensym("mix"), A_FLOAT, 0);
+  class_addmethod(gl_class, (t_method)set, gensym("set"), A_DEFSYM, 0);
+  class_addmethod(gl_class, (t_method)map, gensym("map"), A_DEFSYM, A_DEFFLOAT, 0);
+  class_addmethod(gl_class, (t_method)gl_read, gensym("read"), A_SYMBOL, 0);
+  class_addmethod(gl_class, (t_method)gl_write, gensym("write"), A_SYMBOL, 0);
   class_addmethod(gl_class, (t_method)spread, gensym("spread"), A_FLOAT, 0);
+  class_addmethod(gl_class, (t_method)render, gensym("render"), A_FLOAT, 0);
+  class_addmethod(gl_class, (t_method)interp, gensym("interp"), A_SYMBOL, 0);
+  class_addmethod(gl_class, (t_method)window, gensym("window"), A_SYMBOL, 0);
+  class_addmethod(gl_class, (t_method)format, gensym("format"), A_SYMBOL, 0);
+  class_addmethod(gl_class, (t_method)density, gensym("density"), A_FLOAT, 0);
+  class_addmethod(gl_class, (t_method)jitter, gensym("jitter"), A_SYMBOL, A_FLOAT, 0);
+  class_addmethod(gl_class, (t_method)seed, gensym("seed"), A_FLOAT, 0);
+  class_addmethod(gl_class, (t_method)gl_sync, gensym("sync"), A_FLOAT, 0);
+  class_addmethod(gl_class, (t_method)gl_tempo, gensym("tempo"), A_FLOAT, 0);
+  class_addmethod(gl_class, (t_method)threads, gensym("threads"), A_FLOAT, 0);
+  class_addmethod(gl_class, (t_method)profile, gensym("profile"), A_FLOAT, 0);
+  class_addmethod(gl_class, (t_method)stats, gensym("stats"), 0);
+  class_addmethod(gl_class, (t_method)budget, gensym("budget"), A_FLOAT, 0);
   CLASS_MAINSIGNALIN(gl_class, t_gl, x_f);
+
+  post("gl~: using %s grain engine", gl_engine_setup());
 }
@@ -0,0 +1,78 @@
+#include "grain_budget.h"
+
+_Atomic int grain_budget_ppm;
+static _Atomic long long budget_total; // every instance's b_ppm summed
+_Atomic unsigned int grain_budget_generations;
+
+void grain_budget_join(t_grain_budget *b, int voices)
+{
+  b->b_load = 0;
+  atomic_init(&b->b_ppm, 0);
+  b->b_limit = voices;
+  b->b_hold_ns = 0;
+  b->b_generation = grain_budget_generation();
+  atomic_init(&b->b_blocks, 0);
+  b->b_checked = 0;
+}
+
+void grain_budget_leave(t_grain_budget *b)
+{
+  atomic_fetch_sub_explicit(&budget_total,
+                            atomic_exchange_explicit(&b->b_ppm, 0, memory_order_relaxed),
+                            memory_order_relaxed);
+}
+
+int grain_budget_check(t_grain_budget *b)
+{
+  unsigned int blocks = atomic_load_explicit(&b->b_blocks, memory_order_relaxed);
+  int running = (blocks != b->b_checked);
+  if (!running) grain_budget_leave(b);
+  b->b_checked = blocks;
+  return running;
+}
+
+void grain_budget_set(double percent)
+{
+  int ppm = (percent > 0) ? (int)(percent * 1e4) : 0;
+  atomic_fetch_add_explicit(&grain_budget_generations, 1, memory_order_relaxed);
+  atomic_store_explicit(&grain_budget_ppm, ppm, memory_order_relaxed);
+}
+
+void grain_budget_block(t_grain_budget *b, double ns, double block_ns, int voices)
+{
+  unsigned int generation = grain_budget_generation();
+  if (b->b_generation != generation) {
+    b->b_generation = generation;
+    b->b_limit = voices;
+    b->b_hold_ns = 0;
+  }
+  if (b->b_limit > voices) b->b_limit = voices;
+
+  double smooth = block_ns / (block_ns + GRAIN_BUDGET_SMOOTH_MS * 1e6);
+  b->b_load += (ns / block_ns - b->b_load) * smooth;
+  int ppm = (int)(b->b_load * 1e6);
+  int change = ppm - atomic_exchange_explicit(&b->b_ppm, ppm, memory_order_relaxed);
+  long long total = atomic_fetch_add_explicit(&budget_total, change, memory_order_relaxed)
+                    + change;
+  atomic_fetch_add_explicit(&b->b_blocks, 1, memory_order_relaxed);
+
+  int budget = atomic_load_explicit(&grain_budget_ppm, memory_order_relaxed);
+  if (budget <= 0) return;
+  if (b->b_hold_ns > 0) {
+    b->b_hold_ns -= block_ns;
+    return;
+  }
+
+  int limit = b->b_limit;
+  if (total > budget) {
+    limit = (int)(limit * ((double)budget / total));
+    if (limit < 1) limit = 1;
+  } else if (total < budget * GRAIN_BUDGET_RESTORE) {
+    limit += (voices + GRAIN_BUDGET_STEPS - 1) / GRAIN_BUDGET_STEPS;
+    if (limit > voices) limit = voices;
+  }
+  if (limit != b->b_limit) {
+    b->b_limit = limit;
+    b->b_hold_ns = GRAIN_BUDGET_HOLD_MS * 1e6;
+  }
+}
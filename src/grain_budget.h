@@ -0,0 +1,90 @@
+// a CPU budget shared by every gl~ in the process, and the voices each one
+// may play under it
+//
+// `budget <percent>` sets how much of each DSP block's real time all the gl~
+// instances together may take; 0, the default, is no budget. every instance
+// joins at creation and leaves when it's freed. while there's a budget,
+// perform times its blocks (as `profile` does, see dsp_stats.h) and reports
+// each one with grain_budget_block, which smooths it into the instance's
+// load, adds the change to the process-wide total and works out how many
+// voices the instance may play (grain_budget_limit). over budget, every
+// instance scales its voices by budget / total, so the ones costing most
+// give up most; back under GRAIN_BUDGET_RESTORE of the budget, they get
+// their voices back in GRAIN_BUDGET_STEPS steps. after every change an
+// instance waits GRAIN_BUDGET_HOLD_MS for the loads to catch up before it
+// changes again. gl_engine_limit does the shedding itself, fading the voices
+// out rather than cutting them off.
+//
+// an instance that stops running (dsp off, a switch~ that's off, or no
+// budget any more) stops reporting, and its last load would stay in the
+// total and hold every other instance down. so its owner calls
+// grain_budget_check from a clock every GRAIN_BUDGET_STALE_MS, or every two
+// of its blocks if they're longer: one that hasn't reported since the last
+// check has its share taken out, and its next block puts it back. the clock
+// only runs while its instance reports, so idle ones don't wake Pd up.
+//
+// the total is a single atomic that each instance adds its own change to, so
+// reporting takes no lock and one instance never reads another's state. the
+// time measured is the perform routine's own: parts of a block rendered by
+// render_pool.h's threads only count when the DSP thread waits for them.
+
+#ifndef GRAIN_BUDGET_H
+#define GRAIN_BUDGET_H
+
+#include <stdatomic.h>
+
+#define GRAIN_BUDGET_SMOOTH_MS 20 // time constant of an instance's load
+#define GRAIN_BUDGET_HOLD_MS 50
+#define GRAIN_BUDGET_RESTORE 0.8
+#define GRAIN_BUDGET_STEPS 8 // voices come back in this many steps
+#define GRAIN_BUDGET_STALE_MS 100 // see grain_budget_check
+
+// one per instance, only touched by its perform routine after joining, but
+// for what grain_budget_check needs
+typedef struct _grain_budget {
+  double b_load; // smoothed share of a block's real time
+  _Atomic int b_ppm; // b_load in millionths, as added to the total, 0 once stale
+  int b_limit; // the voices it may play
+  double b_hold_ns; // until the limit may change again
+  unsigned int b_generation; // of the budget b_limit was worked out under
+  _Atomic unsigned int b_blocks; // reported so far
+  unsigned int b_checked; // b_blocks as grain_budget_check last saw it
+} t_grain_budget;
+
+extern _Atomic int grain_budget_ppm; // the budget in millionths, 0 for none
+extern _Atomic unsigned int grain_budget_generations; // bumped by grain_budget_set
+
+void grain_budget_join(t_grain_budget *b, int voices);
+void grain_budget_leave(t_grain_budget *b);
+// from the message thread; a new budget starts every instance over from all
+// of its voices
+void grain_budget_set(double percent);
+// from the message thread: takes the instance's share out of the total if
+// it hasn't reported a block since the last call, and returns 0 then, for
+// the clock to stop until it reports again. racing its perform routine can
+// take out a share that was just reported, which its next block puts back
+int grain_budget_check(t_grain_budget *b);
+
+static inline int grain_budget_on(void)
+{
+  return atomic_load_explicit(&grain_budget_ppm, memory_order_relaxed) > 0;
+}
+
+static inline unsigned int grain_budget_generation(void)
+{
+  return atomic_load_explicit(&grain_budget_generations, memory_order_relaxed);
+}
+
+// perform side: a block that took ns of its block_ns, for an instance that
+// has `voices` in all
+void grain_budget_block(t_grain_budget *b, double ns, double block_ns, int voices);
+
+// the voices it may play: all of them without a budget, or until its first
+// block under a new one
+static inline int grain_budget_limit(const t_grain_budget *b, int voices)
+{
+  if (!grain_budget_on() || b->b_generation != grain_budget_generation()) return voices;
+  return (b->b_limit < voices) ? b->b_limit : voices;
+}
+
+#endif
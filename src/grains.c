@@ -0,0 +1,1553 @@
+#include "grains.h"
+#include <math.h>
+#include <string.h>
+
+#if PD_FLOATSIZE == 32
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GRAINS_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GRAINS_NEON
+#endif
+#endif
+
+// the SIMD renderers only implement interp_cubic from dsp_kernels.h, written
+// out per lane, on t_samples or (with a guard) rows of compact storage.
+// anything else goes through grains_render_scalar
+#define CUBIC_K 0.1666667f
+
+int grains_alloc(t_grains *g, int count)
+{
+  int padded = (count + GRAINS_LANES - 1) / GRAINS_LANES * GRAINS_LANES;
+  g->g_capacity = padded;
+  g->g_position = (int *)getbytes(padded * sizeof(int));
+  g->g_samples = (int *)getbytes(padded * sizeof(int));
+  g->g_offset = (int *)getbytes(padded * sizeof(int));
+  g->g_offset_frac = (t_float *)getbytes(padded * sizeof(t_float));
+  g->g_phase = (int *)getbytes(padded * sizeof(int));
+  g->g_phase_frac = (t_float *)getbytes(padded * sizeof(t_float));
+  g->g_rate = (t_float *)getbytes(padded * sizeof(t_float));
+  g->g_gain = (t_float *)getbytes(padded * sizeof(t_float));
+  g->g_window_scale = (t_float *)getbytes(padded * sizeof(t_float));
+  g->g_fade = (t_float *)getbytes(padded * sizeof(t_float));
+  g->g_index = (int *)getbytes(padded * sizeof(int));
+  g->g_frac = (t_sample *)getbytes(padded * sizeof(t_sample));
+  g->g_tap = (t_sample *)getbytes(padded * sizeof(t_sample));
+  g->g_weight = (t_sample *)getbytes(padded * sizeof(t_sample));
+  if (!g->g_position || !g->g_samples || !g->g_offset || !g->g_offset_frac ||
+      !g->g_phase || !g->g_phase_frac || !g->g_rate || !g->g_gain ||
+      !g->g_window_scale || !g->g_fade || !g->g_index || !g->g_frac || !g->g_tap || !g->g_weight) {
+    grains_free(g);
+    return 0;
+  }
+  g->g_count = count;
+  g->g_padded = padded;
+  g->g_voices = count;
+  g->g_limit = count;
+  g->g_interp = INTERP_DEFAULT;
+  g->g_guard = 0;
+  g->g_format = SAMPLE_FLOAT;
+
+  t_float gain = 1.0f / count;
+  for (int i = 0; i < padded; i++) {
+    g->g_gain[i] = (i < count) ? gain : 0.0f;
+    g->g_samples[i] = 1;
+    g->g_rate[i] = 1.0f;
+  }
+  return 1;
+}
+
+void grains_free(t_grains *g)
+{
+  int padded = g->g_capacity;
+  if (g->g_position) freebytes(g->g_position, padded * sizeof(int));
+  if (g->g_samples) freebytes(g->g_samples, padded * sizeof(int));
+  if (g->g_offset) freebytes(g->g_offset, padded * sizeof(int));
+  if (g->g_offset_frac) freebytes(g->g_offset_frac, padded * sizeof(t_float));
+  if (g->g_phase) freebytes(g->g_phase, padded * sizeof(int));
+  if (g->g_phase_frac) freebytes(g->g_phase_frac, padded * sizeof(t_float));
+  if (g->g_rate) freebytes(g->g_rate, padded * sizeof(t_float));
+  if (g->g_gain) freebytes(g->g_gain, padded * sizeof(t_float));
+  if (g->g_window_scale) freebytes(g->g_window_scale, padded * sizeof(t_float));
+  if (g->g_fade) freebytes(g->g_fade, padded * sizeof(t_float));
+  if (g->g_index) freebytes(g->g_index, padded * sizeof(int));
+  if (g->g_frac) freebytes(g->g_frac, padded * sizeof(t_sample));
+  if (g->g_tap) freebytes(g->g_tap, padded * sizeof(t_sample));
+  if (g->g_weight) freebytes(g->g_weight, padded * sizeof(t_sample));
+  g->g_position = g->g_samples = g->g_offset = g->g_phase = g->g_index = NULL;
+  g->g_offset_frac = g->g_phase_frac = g->g_rate = g->g_gain = g->g_window_scale = NULL;
+  g->g_fade = NULL;
+  g->g_frac = g->g_tap = g->g_weight = NULL;
+  g->g_count = g->g_padded = g->g_capacity = g->g_voices = g->g_limit = 0;
+}
+
+static void set_count(t_grains *g, int count)
+{
+  g->g_count = count;
+  g->g_padded = (count + GRAINS_LANES - 1) / GRAINS_LANES * GRAINS_LANES;
+}
+
+void grains_reset(t_grains *g, int grain_samples)
+{
+  if (grain_samples < 1) grain_samples = 1;
+  t_float scale = g->g_window ? window_table_scale(g->g_window, grain_samples) : 0.0f;
+  t_float gain = 1.0f / g->g_voices;
+  set_count(g, g->g_limit);
+  for (int i = 0; i < g->g_capacity; i++) {
+    g->g_samples[i] = grain_samples;
+    g->g_window_scale[i] = scale;
+    g->g_position[i] = 0;
+    g->g_phase[i] = 0;
+    g->g_phase_frac[i] = 0.0f;
+    g->g_rate[i] = 1.0f;
+    g->g_gain[i] = (i < g->g_count) ? gain : 0.0f;
+    g->g_fade[i] = 0.0f;
+  }
+}
+
+void grains_window(t_grains *g, t_window_table *window)
+{
+  g->g_window = window;
+  for (int i = 0; i < g->g_capacity; i++) {
+    g->g_window_scale[i] = window_table_scale(window, g->g_samples[i]);
+  }
+}
+
+static void set_offset(t_grains *g, int i, t_float offset)
+{
+  t_float whole = floorf(offset);
+  g->g_offset[i] = (int)whole;
+  g->g_offset_frac[i] = offset - whole;
+}
+
+void grains_spread(t_grains *g, t_float grain_offset)
+{
+  for (int i = 0; i < g->g_capacity; i++) {
+    set_offset(g, i, (i < g->g_count) ? i * grain_offset : 0.0f);
+  }
+}
+
+// a silent voice: reads position 0 of the window, which the SIMD gathers
+// need to stay in range
+static void clear_voice(t_grains *g, int i)
+{
+  g->g_position[i] = 0;
+  g->g_samples[i] = 1;
+  g->g_offset[i] = 0;
+  g->g_offset_frac[i] = 0.0f;
+  g->g_phase[i] = 0;
+  g->g_phase_frac[i] = 0.0f;
+  g->g_rate[i] = 1.0f;
+  g->g_gain[i] = 0.0f;
+  g->g_window_scale[i] = 0.0f;
+  g->g_fade[i] = 0.0f;
+}
+
+void grains_clear(t_grains *g)
+{
+  for (int i = 0; i < g->g_capacity; i++) clear_voice(g, i);
+  g->g_count = g->g_padded = 0;
+}
+
+static int clamp_voices(int count, int size)
+{
+  return (count < 0) ? 0 : (count > size) ? size : count;
+}
+
+void grains_part(const t_grains *g, int first, int size, t_grains *part)
+{
+  *part = *g;
+  part->g_count = clamp_voices(g->g_count - first, size);
+  part->g_padded = clamp_voices(g->g_padded - first, size);
+  part->g_capacity = clamp_voices(g->g_capacity - first, size);
+  part->g_position += first;
+  part->g_samples += first;
+  part->g_offset += first;
+  part->g_offset_frac += first;
+  part->g_phase += first;
+  part->g_phase_frac += first;
+  part->g_rate += first;
+  part->g_gain += first;
+  part->g_window_scale += first;
+  part->g_fade += first;
+  part->g_index += first;
+  part->g_frac += first;
+  part->g_tap += first;
+  part->g_weight += first;
+}
+
+void grains_snapshot(t_grains *to, const t_grains *from)
+{
+  int n = clamp_voices(from->g_padded, to->g_capacity);
+  memcpy(to->g_position, from->g_position, n * sizeof(int));
+  memcpy(to->g_samples, from->g_samples, n * sizeof(int));
+  memcpy(to->g_offset, from->g_offset, n * sizeof(int));
+  memcpy(to->g_offset_frac, from->g_offset_frac, n * sizeof(t_float));
+  memcpy(to->g_phase, from->g_phase, n * sizeof(int));
+  memcpy(to->g_phase_frac, from->g_phase_frac, n * sizeof(t_float));
+  memcpy(to->g_rate, from->g_rate, n * sizeof(t_float));
+  memcpy(to->g_gain, from->g_gain, n * sizeof(t_float));
+  memcpy(to->g_window_scale, from->g_window_scale, n * sizeof(t_float));
+  memcpy(to->g_fade, from->g_fade, n * sizeof(t_float));
+  to->g_count = clamp_voices(from->g_count, n);
+  to->g_padded = n;
+  to->g_voices = from->g_voices;
+  to->g_limit = from->g_limit;
+  to->g_window = from->g_window;
+  to->g_interp = from->g_interp;
+  to->g_guard = from->g_guard;
+  to->g_format = from->g_format;
+}
+
+void grains_state_copy(t_grains *to, const t_grains *from, int first, int size)
+{
+  int n = clamp_voices(from->g_capacity - first, size);
+  memcpy(to->g_position + first, from->g_position + first, n * sizeof(int));
+  memcpy(to->g_phase + first, from->g_phase + first, n * sizeof(int));
+  memcpy(to->g_phase_frac + first, from->g_phase_frac + first, n * sizeof(t_float));
+}
+
+// a few taps decoded from the buffer, for the interpolators to read instead
+#define TAP_RING 8 // >= the widest interpolator, SINC_TAPS
+
+// the taps of a wrapped index in compact storage, decoded into `ring` where
+// interp_sample(interp, ring, index & (TAP_RING - 1), TAP_RING - 1, 0, frac)
+// reads them: linear reads index - 1 and index - 2, cubic and hermite index
+// down to index - 3, sinc index + 2 down to index - 5
+DSP_INLINE void packed_taps(t_interp interp, const void *buffer, t_sample_format format,
+                            int index, int mask, t_sample *ring)
+{
+  int top = (interp == INTERP_SINC) ? 2 : 0;
+  int bottom = (interp == INTERP_SINC) ? 5 : (interp == INTERP_LINEAR) ? 2 : 3;
+  for (int k = index - bottom; k <= index + top; k++) {
+    ring[k & (TAP_RING - 1)] = sample_load(buffer, format, k & mask);
+  }
+}
+
+// n interpolated taps from compact storage, like interp_n
+DSP_INLINE void packed_interp_n(t_interp interp, const void *buffer, t_sample_format format,
+                                int mask, const int *index, const t_sample *frac,
+                                t_sample *out, int n)
+{
+  t_sample ring[TAP_RING];
+  for (int i = 0; i < n; i++) {
+    packed_taps(interp, buffer, format, index[i], mask, ring);
+    out[i] = interp_sample(interp, ring, index[i] & (TAP_RING - 1), TAP_RING - 1, 0, frac[i]);
+  }
+}
+
+// reference sample-major loop. per sample, the read positions of all grains
+// are worked out first and handed to the batch interpolator, then windowed and
+// summed in grain order. the interpolator, whether it's recording and whether
+// the buffer is in a compact format are fixed for each copy of it
+DSP_INLINE void render_scalar(t_grains *g, void *buffer, int size, int shift,
+                              const int *start, const t_sample *start_frac,
+                              const t_sample *rate, const t_sample *rec, int write_phase,
+                              t_sample *out, int n, t_interp interp, int recording,
+                              int packed)
+{
+  t_sample_format format = packed ? g->g_format : SAMPLE_FLOAT;
+  int count = g->g_count;
+  int *position = g->g_position;
+  const int *samples = g->g_samples;
+  const int *offset = g->g_offset;
+  const t_float *offset_frac = g->g_offset_frac;
+  int *phase = g->g_phase;
+  t_float *phase_frac = g->g_phase_frac;
+  const t_float *grain_rate = g->g_rate;
+  const t_float *gain = g->g_gain;
+  const t_float *window_scale = g->g_window_scale;
+  const t_sample *window = g->g_window->w_samples;
+  int *index = g->g_index;
+  t_sample *frac = g->g_frac;
+  t_sample *tap = g->g_tap;
+  // every tap of a guarded ring is in reach of its wrapped index as it is
+  int taps = (g->g_guard > 0) ? -1 : size - 1;
+
+  for (int s = 0; s < n; s++) {
+    if (recording) {
+      dsp_ring_store(buffer, format, write_phase, size, shift, g->g_guard, rec[s]);
+      write_phase = dsp_wrap(write_phase + 1, size);
+    }
+    int base = start[s];
+    t_sample base_frac = start_frac[s];
+    for (int i = 0; i < count; i++) {
+      index[i] = interp_split_parts(base + offset[i] + phase[i],
+                                    (base_frac + offset_frac[i]) + phase_frac[i],
+                                    size, &frac[i]);
+    }
+    if (packed) {
+      packed_interp_n(interp, buffer, format, taps, index, frac, tap, count);
+    } else {
+      interp_n(interp, buffer, taps, shift, index, frac, tap, count);
+    }
+    t_sample acc = 0.0f;
+    for (int i = 0; i < count; i++) {
+      int pos = position[i];
+      acc += tap[i] * gain[i] * window_table_read(window, pos * window_scale[i]);
+      phase_step(&phase[i], &phase_frac[i], rate[s] * grain_rate[i]);
+      pos += 1;
+      if (pos >= samples[i]) {
+        pos = 0;
+        phase[i] = 0;
+        phase_frac[i] = 0.0f;
+      }
+      position[i] = pos;
+    }
+    out[s] = acc;
+  }
+}
+
+void grains_render_scalar(t_grains *g, void *buffer, int size, int shift,
+                          const int *start, const t_sample *start_frac,
+                          const t_sample *rate, const t_sample *rec, int write_phase,
+                          t_sample *out, int n)
+{
+  int packed = (g->g_format != SAMPLE_FLOAT);
+#define SCALAR_CALL(kind, recording, packed) \
+  render_scalar(g, buffer, size, shift, start, start_frac, rate, rec, write_phase, out, n, \
+                kind, recording, packed)
+#define SCALAR_CASE(kind) \
+  case kind: \
+    if (rec && packed) { \
+      SCALAR_CALL(kind, 1, 1); \
+    } else if (rec) { \
+      SCALAR_CALL(kind, 1, 0); \
+    } else if (packed) { \
+      SCALAR_CALL(kind, 0, 1); \
+    } else { \
+      SCALAR_CALL(kind, 0, 0); \
+    } \
+    break;
+
+  switch (g->g_interp) {
+    SCALAR_CASE(INTERP_LINEAR)
+    SCALAR_CASE(INTERP_HERMITE)
+    SCALAR_CASE(INTERP_SINC)
+    default:
+    SCALAR_CASE(INTERP_CUBIC)
+  }
+#undef SCALAR_CASE
+#undef SCALAR_CALL
+}
+
+// a few grains at a time (GRAIN_MAJOR_GROUP) across the whole block,
+// GRAIN_MAJOR_CHUNK samples at a time. a first pass steps the grains' read
+// pointers and windows through the chunk and keeps where each one reads and
+// its window gain; then each grain's taps are interpolated in one batch,
+// reading the buffer sequentially, and summed into out. the per-sample sum is
+// built up in the same grain order, with the same products, as
+// grains_render_scalar, so the output is bit-identical to it. with a guard
+// the taps of t_sample storage are read without wrapping, see DSP_GUARD;
+// compact storage is decoded tap by tap as grains_render_scalar does.
+//
+// while recording, the sample-major loop writes rec[s] just before reading
+// sample s. here the block is written once at the end, so the few reads that
+// come within reach of the block being written are done again afterwards
+// from a small ring, taking slots the sample-major loop would already have
+// written (distance d from write_phase with d <= s) from rec, stored the way
+// the buffer's format would have stored them.
+
+#define GRAIN_MAJOR_CHUNK 64
+#define GRAIN_MAJOR_GROUP 4
+
+// rec[d] as the buffer would hold it at ring position `at`
+DSP_INLINE t_sample grain_major_stored(t_sample_format format, t_sample x, int at)
+{
+  switch (format) {
+    case SAMPLE_INT16: return sample_from_int16(sample_to_int16(x, at));
+    case SAMPLE_HALF: return sample_from_half(sample_to_half(x));
+    default: return x;
+  }
+}
+
+static inline t_sample grain_major_tap(const void *buffer, t_sample_format format, int index,
+                                       const t_sample *rec, int write_phase,
+                                       int size, int shift, int s)
+{
+  unsigned int d = (unsigned int)dsp_wrap(index - write_phase, size);
+  if (d <= (unsigned int)s) return grain_major_stored(format, rec[d], index);
+  return sample_load(buffer, format, (size_t)index << shift);
+}
+
+// samples [first, first + n) of `group` grains from voice v, a constant 1 or
+// GRAIN_MAJOR_GROUP. stepping a read pointer is a chain of dependent
+// operations, so a group's pointers are stepped side by side
+DSP_INLINE void grain_major_group(t_grains *g, int v, int group, t_interp interp,
+                                  t_sample_format format, void *buffer, int size, int shift,
+                                  const t_sample *window, const int *start,
+                                  const t_sample *start_frac, const t_sample *rate,
+                                  const t_sample *rec, int write_phase, int block, int first,
+                                  t_sample *out, int n)
+{
+  int index[GRAIN_MAJOR_GROUP][GRAIN_MAJOR_CHUNK];
+  t_sample frac[GRAIN_MAJOR_GROUP][GRAIN_MAJOR_CHUNK];
+  t_sample win[GRAIN_MAJOR_GROUP][GRAIN_MAJOR_CHUNK];
+  t_sample tap[GRAIN_MAJOR_GROUP][GRAIN_MAJOR_CHUNK];
+  int pos[GRAIN_MAJOR_GROUP], ph[GRAIN_MAJOR_GROUP];
+  t_float ph_frac[GRAIN_MAJOR_GROUP];
+  // every tap of a guarded ring is in reach of its wrapped index as it is
+  int taps = (g->g_guard > 0) ? -1 : size - 1;
+  for (int j = 0; j < group; j++) {
+    pos[j] = g->g_position[v + j];
+    ph[j] = g->g_phase[v + j];
+    ph_frac[j] = g->g_phase_frac[v + j];
+  }
+  for (int s = 0; s < n; s++) {
+    for (int j = 0; j < group; j++) {
+      index[j][s] = interp_split_parts(start[s] + g->g_offset[v + j] + ph[j],
+                                       (start_frac[s] + g->g_offset_frac[v + j]) + ph_frac[j],
+                                       size, &frac[j][s]);
+      win[j][s] = window_table_read(window, pos[j] * g->g_window_scale[v + j]);
+      phase_step(&ph[j], &ph_frac[j], rate[s] * g->g_rate[v + j]);
+      pos[j] += 1;
+      if (pos[j] >= g->g_samples[v + j]) {
+        pos[j] = 0;
+        ph[j] = 0;
+        ph_frac[j] = 0.0f;
+      }
+    }
+  }
+  for (int j = 0; j < group; j++) {
+    g->g_position[v + j] = pos[j];
+    g->g_phase[v + j] = ph[j];
+    g->g_phase_frac[v + j] = ph_frac[j];
+  }
+
+  for (int j = 0; j < group; j++) {
+    if (format != SAMPLE_FLOAT) {
+      packed_interp_n(interp, buffer, format, taps, index[j], frac[j], tap[j], n);
+    } else {
+      interp_n(interp, (const t_sample *)buffer, taps, shift, index[j], frac[j], tap[j], n);
+    }
+    if (!rec) continue;
+    for (int s = 0; s < n; s++) {
+      // taps run from index + 2 down to index - 5
+      int at = index[j][s];
+      unsigned int top = (unsigned int)dsp_wrap(at + 2 - write_phase, size);
+      if (top >= (unsigned int)(block + TAP_RING)) continue;
+      t_sample ring[TAP_RING];
+      for (int k = at - 5; k <= at + 2; k++) {
+        ring[k & (TAP_RING - 1)] =
+          grain_major_tap(buffer, format, dsp_wrap(k, size), rec, write_phase, size, shift,
+                          first + s);
+      }
+      tap[j][s] = interp_sample(interp, ring, at & (TAP_RING - 1), TAP_RING - 1, 0,
+                                frac[j][s]);
+    }
+  }
+  // in grain order, like the sample-major sum
+  for (int j = 0; j < group; j++) {
+    t_float gain = g->g_gain[v + j];
+    for (int s = 0; s < n; s++) out[s] += tap[j][s] * gain * win[j][s];
+  }
+}
+
+void grains_render_grain_major(t_grains *g, void *buffer, int size, int shift,
+                               const int *start, const t_sample *start_frac,
+                               const t_sample *rate, const t_sample *rec, int write_phase,
+                               t_sample *out, int n)
+{
+  const t_sample *window = g->g_window->w_samples;
+  t_sample_format format = g->g_format;
+  for (int s = 0; s < n; s++) out[s] = 0.0f;
+
+  // one inlined copy of the grain loop per interpolator and format
+#define GRAIN_MAJOR_CALL(kind, fmt) \
+  for (int first = 0; first < n; first += GRAIN_MAJOR_CHUNK) { \
+    int span = (n - first < GRAIN_MAJOR_CHUNK) ? n - first : GRAIN_MAJOR_CHUNK; \
+    int v = 0; \
+    for (; v + GRAIN_MAJOR_GROUP <= g->g_count; v += GRAIN_MAJOR_GROUP) { \
+      grain_major_group(g, v, GRAIN_MAJOR_GROUP, kind, fmt, buffer, size, shift, window, \
+                        start + first, start_frac + first, rate + first, rec, write_phase, \
+                        n, first, out + first, span); \
+    } \
+    for (; v < g->g_count; v++) { \
+      grain_major_group(g, v, 1, kind, fmt, buffer, size, shift, window, start + first, \
+                        start_frac + first, rate + first, rec, write_phase, n, first, \
+                        out + first, span); \
+    } \
+  }
+#define GRAIN_MAJOR_CASE(kind) \
+  case kind: \
+    if (format == SAMPLE_FLOAT) { \
+      GRAIN_MAJOR_CALL(kind, SAMPLE_FLOAT) \
+    } else if (format == SAMPLE_INT16) { \
+      GRAIN_MAJOR_CALL(kind, SAMPLE_INT16) \
+    } else { \
+      GRAIN_MAJOR_CALL(kind, SAMPLE_HALF) \
+    } \
+    break;
+
+  switch (g->g_interp) {
+    GRAIN_MAJOR_CASE(INTERP_LINEAR)
+    GRAIN_MAJOR_CASE(INTERP_HERMITE)
+    GRAIN_MAJOR_CASE(INTERP_SINC)
+    default:
+    GRAIN_MAJOR_CASE(INTERP_CUBIC)
+  }
+#undef GRAIN_MAJOR_CASE
+#undef GRAIN_MAJOR_CALL
+
+  if (rec) {
+    for (int s = 0; s < n; s++) {
+      dsp_ring_store(buffer, format, write_phase, size, shift, g->g_guard, rec[s]);
+      write_phase = dsp_wrap(write_phase + 1, size);
+    }
+  }
+}
+
+// channel c of the planes' buffer
+static inline void *planes_channel(const t_grains_planes *p, int c)
+{
+  return (char *)p->p_buffer + c * p->p_buffer_stride * sample_format_bytes(p->p_format);
+}
+
+// sample-major like grains_render_scalar, but split in two: first where every
+// voice reads and how loud (g_index, g_frac and g_weight), which is the same
+// for all the channels, then each channel's taps summed with those weights
+static void render_planes_scalar(t_grains *g, const t_grains_planes *p, const int *start,
+                                 const t_sample *start_frac, const t_sample *rate,
+                                 int write_phase, int n)
+{
+  int count = g->g_count;
+  t_interp interp = g->g_interp;
+  int *position = g->g_position;
+  const int *samples = g->g_samples;
+  const int *offset = g->g_offset;
+  const t_float *offset_frac = g->g_offset_frac;
+  int *phase = g->g_phase;
+  t_float *phase_frac = g->g_phase_frac;
+  const t_float *grain_rate = g->g_rate;
+  const t_float *gain = g->g_gain;
+  const t_float *window_scale = g->g_window_scale;
+  const t_sample *window = g->g_window->w_samples;
+  int *index = g->g_index;
+  t_sample *frac = g->g_frac;
+  t_sample *weight = g->g_weight;
+  t_sample *tap = g->g_tap;
+  int size = p->p_size;
+  int shift = p->p_shift;
+  int taps = (p->p_guard > 0) ? -1 : size - 1;
+
+  for (int s = 0; s < n; s++) {
+    if (p->p_rec) {
+      for (int c = 0; c < p->p_channels; c++) {
+        const t_sample *rec = p->p_rec + (size_t)(c % p->p_rec_channels) * p->p_stride;
+        dsp_ring_store(planes_channel(p, c), p->p_format, write_phase, size, shift, p->p_guard,
+                       rec[s]);
+      }
+      write_phase = dsp_wrap(write_phase + 1, size);
+    }
+    int base = start[s];
+    t_sample base_frac = start_frac[s];
+    for (int i = 0; i < count; i++) {
+      int pos = position[i];
+      index[i] = interp_split_parts(base + offset[i] + phase[i],
+                                    (base_frac + offset_frac[i]) + phase_frac[i],
+                                    size, &frac[i]);
+      weight[i] = gain[i] * window_table_read(window, pos * window_scale[i]);
+      phase_step(&phase[i], &phase_frac[i], rate[s] * grain_rate[i]);
+      pos += 1;
+      if (pos >= samples[i]) {
+        pos = 0;
+        phase[i] = 0;
+        phase_frac[i] = 0.0f;
+      }
+      position[i] = pos;
+    }
+    for (int c = 0; c < p->p_channels; c++) {
+      if (p->p_format != SAMPLE_FLOAT) {
+        packed_interp_n(interp, planes_channel(p, c), p->p_format, taps, index, frac, tap,
+                        count);
+      } else {
+        interp_n(interp, planes_channel(p, c), taps, shift, index, frac, tap, count);
+      }
+      t_sample acc = 0.0f;
+      for (int i = 0; i < count; i++) acc += tap[i] * weight[i];
+      p->p_out[(size_t)c * p->p_stride + s] = acc;
+    }
+  }
+}
+
+void grains_sched_init(t_grains_sched *s)
+{
+  s->s_interval = 0.0f;
+  s->s_duration = 1.0f;
+  s->s_gain = 1.0f;
+  s->s_jitter_onset = 0.0f;
+  s->s_jitter_position = 0.0f;
+  s->s_jitter_duration = 0.0f;
+  s->s_jitter_pitch = 0.0f;
+  s->s_countdown = 0.0;
+  s->s_sync = 0;
+  grains_sched_seed(s, 1);
+}
+
+void grains_sched_seed(t_grains_sched *s, unsigned int seed)
+{
+  s->s_random = seed * 2654435761u;
+  if (s->s_random == 0) s->s_random = 1;
+}
+
+void grains_sched_timing(t_grains_sched *s, t_float interval, t_float duration)
+{
+  s->s_interval = interval;
+  s->s_duration = duration;
+  s->s_gain = (duration > interval && duration > 0.0f) ? interval / duration : 1.0f;
+}
+
+void grains_sched_sync(t_grains_sched *s, int sync)
+{
+  s->s_sync = sync;
+  s->s_countdown = sync ? HUGE_VAL : 0.0;
+}
+
+void grains_sched_trigger(t_grains_sched *s)
+{
+  if (s->s_sync) s->s_countdown = 0.0;
+}
+
+// xorshift32, in [-1, 1)
+static t_float sched_random(t_grains_sched *s)
+{
+  unsigned int x = s->s_random;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  s->s_random = x;
+  return (t_float)((double)x / 2147483648.0 - 1.0);
+}
+
+// takes a free voice, or steals the one closest to its end when they're all
+// busy: it's the quietest one, and finding it is a single pass. ties go to
+// the lowest slot, so stealing is deterministic
+static void spawn_voice(t_grains *g, t_grains_sched *s)
+{
+  int slot = -1;
+  if (g->g_count < g->g_limit) {
+    slot = g->g_count;
+    set_count(g, g->g_count + 1);
+  } else if (g->g_limit == g->g_voices) {
+    slot = 0;
+    int least = g->g_samples[0] - g->g_position[0];
+    for (int i = 1; i < g->g_count; i++) {
+      int left = g->g_samples[i] - g->g_position[i];
+      if (left < least) {
+        least = left;
+        slot = i;
+      }
+    }
+  }
+
+  // always draw the same number of values, so changing one jitter doesn't
+  // change the others' sequence
+  t_float rd = sched_random(s), rp = sched_random(s), rr = sched_random(s);
+  if (slot < 0) return; // over a governor's limit the onset is dropped
+  t_float duration = s->s_duration * (1.0f + s->s_jitter_duration * rd);
+  int samples = (duration >= 1.0f) ? (int)duration : 1;
+
+  g->g_position[slot] = 0;
+  g->g_samples[slot] = samples;
+  set_offset(g, slot, s->s_jitter_position * rp);
+  g->g_phase[slot] = 0;
+  g->g_phase_frac[slot] = 0.0f;
+  g->g_rate[slot] = exp2f(s->s_jitter_pitch * rr / 12.0f);
+  g->g_gain[slot] = s->s_gain;
+  g->g_window_scale[slot] = window_table_scale(g->g_window, samples);
+  g->g_fade[slot] = 0.0f;
+}
+
+// the last active voice moves into the freed slot
+static void retire_voice(t_grains *g, int i)
+{
+  int last = g->g_count - 1;
+  if (i != last) {
+    g->g_position[i] = g->g_position[last];
+    g->g_samples[i] = g->g_samples[last];
+    g->g_offset[i] = g->g_offset[last];
+    g->g_offset_frac[i] = g->g_offset_frac[last];
+    g->g_phase[i] = g->g_phase[last];
+    g->g_phase_frac[i] = g->g_phase_frac[last];
+    g->g_rate[i] = g->g_rate[last];
+    g->g_gain[i] = g->g_gain[last];
+    g->g_window_scale[i] = g->g_window_scale[last];
+    g->g_fade[i] = g->g_fade[last];
+  }
+  clear_voice(g, last);
+  set_count(g, last);
+}
+
+// voices playing that aren't fading out
+static int unfaded_voices(const t_grains *g)
+{
+  int count = 0;
+  for (int i = 0; i < g->g_count; i++) count += (g->g_fade[i] <= 0.0f);
+  return count;
+}
+
+// one voice at a time, so finding each is a single pass; ties go to the
+// last slot. a silent voice goes at the next step
+void grains_limit(t_grains *g, int limit, int steps)
+{
+  if (limit < 1) limit = 1;
+  if (limit > g->g_voices) limit = g->g_voices;
+  if (steps < 1) steps = 1;
+  g->g_limit = limit;
+  for (int playing = unfaded_voices(g); playing > limit; playing--) {
+    int pick = -1, least = 0;
+    for (int i = g->g_count - 1; i >= 0; i--) {
+      if (g->g_fade[i] > 0.0f) continue;
+      int left = g->g_samples[i] - g->g_position[i];
+      if (pick < 0 || left < least) {
+        least = left;
+        pick = i;
+      }
+    }
+    t_float step = g->g_gain[pick] / steps;
+    g->g_fade[pick] = (step > 0.0f) ? step : 1.0f;
+  }
+}
+
+void grains_fill(t_grains *g, int steps)
+{
+  if (g->g_count == 0) return;
+  if (steps < 1) steps = 1;
+  t_float step = 1.0f / g->g_voices / steps;
+  int playing = unfaded_voices(g);
+  for (int i = 0; i < g->g_count && playing < g->g_limit; i++) {
+    if (g->g_fade[i] > 0.0f) {
+      g->g_fade[i] = -step;
+      playing++;
+    }
+  }
+  for (; playing < g->g_limit && g->g_count < g->g_voices; playing++) {
+    int i = g->g_count;
+    g->g_position[i] = g->g_position[0];
+    g->g_samples[i] = g->g_samples[0];
+    g->g_offset[i] = 0;
+    g->g_offset_frac[i] = 0.0f;
+    g->g_phase[i] = g->g_phase[0];
+    g->g_phase_frac[i] = g->g_phase_frac[0];
+    g->g_rate[i] = g->g_rate[0];
+    g->g_gain[i] = 0.0f;
+    g->g_window_scale[i] = g->g_window_scale[0];
+    g->g_fade[i] = -step;
+    set_count(g, i + 1);
+  }
+}
+
+// from the last voice down, so the one retire_voice moves in is done already.
+// only the looping cloud fades in, up to its 1 / g_voices
+int grains_fade(t_grains *g)
+{
+  t_float full = 1.0f / g->g_voices;
+  int fading = 0;
+  for (int i = g->g_count - 1; i >= 0; i--) {
+    t_float fade = g->g_fade[i];
+    if (fade == 0.0f) continue;
+    t_float gain = g->g_gain[i] - fade;
+    if (fade > 0.0f && gain <= 0.0f) {
+      retire_voice(g, i);
+      continue;
+    }
+    if (fade < 0.0f && gain >= full) {
+      gain = full;
+      g->g_fade[i] = 0.0f;
+    } else {
+      fading = 1;
+    }
+    g->g_gain[i] = gain;
+  }
+  return fading;
+}
+
+// spawns the voices that are due and returns how much of the next n samples
+// can be rendered with them: up to the next onset or the first grain to end,
+// whichever comes first
+static int sched_span(t_grains *g, t_grains_sched *s, int n)
+{
+  while (s->s_countdown <= 0.0) {
+    spawn_voice(g, s);
+    if (s->s_sync) {
+      s->s_countdown = HUGE_VAL;
+      break;
+    }
+    double interval = s->s_interval * (1.0f + s->s_jitter_onset * sched_random(s));
+    s->s_countdown += (interval > 1.0) ? interval : 1.0;
+  }
+
+  int span = n;
+  if (s->s_countdown < span) span = (int)ceil(s->s_countdown);
+  for (int i = 0; i < g->g_count; i++) {
+    int left = g->g_samples[i] - g->g_position[i];
+    if (left < span) span = left;
+  }
+  return span;
+}
+
+// after rendering the span: a grain that reached its end wrapped back to 0;
+// nothing else can be at 0 after a span of at least one sample
+static void sched_retire(t_grains *g, t_grains_sched *s, int span)
+{
+  for (int i = g->g_count - 1; i >= 0; i--) {
+    if (g->g_position[i] == 0) retire_voice(g, i);
+  }
+  s->s_countdown -= span;
+}
+
+void grains_schedule(t_grains *g, t_grains_sched *s, t_grains_render render,
+                     void *buffer, int size, int shift, const int *start,
+                     const t_sample *start_frac, const t_sample *rate,
+                     const t_sample *rec, int write_phase, t_sample *out, int n)
+{
+  while (n > 0) {
+    int span = sched_span(g, s, n);
+    render(g, buffer, size, shift, start, start_frac, rate, rec, write_phase, out, span);
+    sched_retire(g, s, span);
+
+    start += span;
+    start_frac += span;
+    rate += span;
+    if (rec) rec += span;
+    write_phase = dsp_wrap(write_phase + span, size);
+    out += span;
+    n -= span;
+  }
+}
+
+void grains_schedule_planes(t_grains *g, t_grains_sched *s, const t_grains_planes *p,
+                            const int *start, const t_sample *start_frac,
+                            const t_sample *rate, int write_phase, int n)
+{
+  t_grains_planes span_planes = *p;
+  while (n > 0) {
+    int span = sched_span(g, s, n);
+    grains_render_planes(g, &span_planes, start, start_frac, rate, write_phase, span);
+    sched_retire(g, s, span);
+
+    start += span;
+    start_frac += span;
+    rate += span;
+    if (span_planes.p_rec) span_planes.p_rec += span;
+    write_phase = dsp_wrap(write_phase + span, p->p_size);
+    span_planes.p_out += span;
+    n -= span;
+  }
+}
+
+// dsp_wrap for `lanes` voice positions stored from a vector, when the ring
+// isn't a power of 2. such a ring has a guard, so only the positions need
+// wrapping, not the taps; a power of 2 is masked in the vector instead
+DSP_INLINE void wrap_lanes(int *index, int lanes, int size)
+{
+  for (int l = 0; l < lanes; l++) index[l] = dsp_wrap(index[l], size);
+}
+
+#ifdef GRAINS_X86
+
+#define SSE_CUBIC(a, b, c, d, frac, y) do { \
+    __m128 cminusb = _mm_sub_ps(c, b); \
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(d, a), _mm_mul_ps(three, cminusb)), frac); \
+    __m128 t2 = _mm_sub_ps(_mm_add_ps(d, _mm_mul_ps(two, a)), _mm_mul_ps(three, b)); \
+    __m128 t3 = _mm_mul_ps(_mm_mul_ps(k, _mm_sub_ps(one, frac)), _mm_add_ps(t1, t2)); \
+    y = _mm_add_ps(b, _mm_mul_ps(frac, _mm_sub_ps(cminusb, t3))); \
+  } while (0)
+
+// the row of 4 taps in front of index from storage in `format`, like
+// avx2_row. SSE2 has no half conversion, so halves are rebuilt the way
+// sample_from_half does it, and 16-bit integers sign extended by hand
+DSP_INLINE __m128 sse2_row(const void *buffer, t_sample_format format, int index)
+{
+  switch (format) {
+    case SAMPLE_INT16: {
+      __m128i h = _mm_loadl_epi64((const __m128i *)((const int16_t *)buffer + index - 3));
+      __m128i i = _mm_srai_epi32(_mm_unpacklo_epi16(h, h), 16);
+      return _mm_mul_ps(_mm_cvtepi32_ps(i), _mm_set1_ps(1.0f / SAMPLE_INT16_SCALE));
+    }
+    case SAMPLE_HALF: {
+      __m128i h = _mm_unpacklo_epi16(
+          _mm_loadl_epi64((const __m128i *)((const uint16_t *)buffer + index - 3)),
+          _mm_setzero_si128());
+      __m128i a = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+      __m128i sign = _mm_slli_epi32(_mm_xor_si128(h, a), 16);
+      __m128i normal = _mm_add_epi32(_mm_slli_epi32(a, 13), _mm_set1_epi32(0x38000000));
+      __m128i subnormal = _mm_castps_si128(
+          _mm_mul_ps(_mm_cvtepi32_ps(a), _mm_set1_ps(1.0f / 16777216.0f)));
+      __m128i is_normal = _mm_cmpgt_epi32(a, _mm_set1_epi32(0x3ff));
+      __m128i v = _mm_or_si128(_mm_and_si128(is_normal, normal),
+                               _mm_andnot_si128(is_normal, subnormal));
+      return _mm_castsi128_ps(_mm_or_si128(v, sign));
+    }
+    default:
+      return _mm_loadu_ps((const t_sample *)buffer + index - 3);
+  }
+}
+
+// the buffer's format is fixed for each copy of the loop; compact formats
+// are always guarded
+DSP_INLINE void sse2_loop(t_grains *g, void *buffer, int size, int shift, const int *start,
+                          const t_sample *start_frac, const t_sample *rate, const t_sample *rec,
+                          int write_phase, t_sample *out, int n, t_sample_format format)
+{
+  int padded = g->g_padded;
+  int *position = g->g_position;
+  const int *samples = g->g_samples;
+  const int *offset = g->g_offset;
+  const t_float *offset_frac = g->g_offset_frac;
+  int *phase = g->g_phase;
+  t_float *phase_frac = g->g_phase_frac;
+  const t_float *grain_rate = g->g_rate;
+  const t_float *gain = g->g_gain;
+  const t_float *window_scale = g->g_window_scale;
+  const t_sample *window = g->g_window->w_samples;
+
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 three = _mm_set1_ps(3.0f);
+  const __m128 k = _mm_set1_ps(CUBIC_K);
+  int guard = g->g_guard;
+  int mask = size - 1;
+  int pow2 = (size & mask) == 0;
+  const __m128i vmask = _mm_set1_epi32(mask);
+  const __m128i ione = _mm_set1_epi32(1);
+
+  for (int s = 0; s < n; s++) {
+    if (rec) {
+      dsp_ring_store(buffer, format, write_phase, size, shift, g->g_guard, rec[s]);
+      write_phase = dsp_wrap(write_phase + 1, size);
+    }
+    __m128i base = _mm_set1_epi32(start[s]);
+    __m128 base_frac = _mm_set1_ps(start_frac[s]);
+    __m128 vrate = _mm_set1_ps(rate[s]);
+    __m128 acc = _mm_setzero_ps();
+    for (int i = 0; i < padded; i += 4) {
+      __m128i pos = _mm_loadu_si128((const __m128i *)(position + i));
+      __m128i ph = _mm_loadu_si128((const __m128i *)(phase + i));
+      __m128 ph_frac = _mm_loadu_ps(phase_frac + i);
+      __m128 frac_sum = _mm_add_ps(_mm_add_ps(base_frac, _mm_loadu_ps(offset_frac + i)), ph_frac);
+      __m128i carry = _mm_cvttps_epi32(frac_sum);
+      __m128 frac = _mm_sub_ps(frac_sum, _mm_cvtepi32_ps(carry));
+      __m128i index = _mm_add_epi32(_mm_add_epi32(base, _mm_loadu_si128((const __m128i *)(offset + i))),
+                                    _mm_add_epi32(ph, carry));
+      if (pow2) index = _mm_and_si128(index, vmask);
+
+      __m128 wpos = _mm_mul_ps(_mm_cvtepi32_ps(pos), _mm_loadu_ps(window_scale + i));
+      __m128i windex = _mm_cvttps_epi32(wpos);
+      __m128 wfrac = _mm_sub_ps(wpos, _mm_cvtepi32_ps(windex));
+
+      int idx[4], wi[4];
+      _mm_storeu_si128((__m128i *)idx, index);
+      if (!pow2) wrap_lanes(idx, 4, size);
+      _mm_storeu_si128((__m128i *)wi, windex);
+      __m128 a, b, c, d;
+      if (format != SAMPLE_FLOAT || guard > 0) {
+        // each voice's taps are the row {d, c, b, a} in front of its index
+        d = sse2_row(buffer, format, idx[0]);
+        c = sse2_row(buffer, format, idx[1]);
+        b = sse2_row(buffer, format, idx[2]);
+        a = sse2_row(buffer, format, idx[3]);
+        _MM_TRANSPOSE4_PS(d, c, b, a);
+      } else {
+        const t_sample *stored = (const t_sample *)buffer;
+#define TAPS(k) _mm_setr_ps(DSP_TAP(stored, idx[0] - k, mask, shift), \
+                            DSP_TAP(stored, idx[1] - k, mask, shift), \
+                            DSP_TAP(stored, idx[2] - k, mask, shift), \
+                            DSP_TAP(stored, idx[3] - k, mask, shift))
+        a = TAPS(0), b = TAPS(1), c = TAPS(2), d = TAPS(3);
+#undef TAPS
+      }
+      __m128 w0 = _mm_setr_ps(window[wi[0]], window[wi[1]], window[wi[2]], window[wi[3]]);
+      __m128 w1 = _mm_setr_ps(window[wi[0] + 1], window[wi[1] + 1],
+                              window[wi[2] + 1], window[wi[3] + 1]);
+      __m128 w = _mm_add_ps(w0, _mm_mul_ps(wfrac, _mm_sub_ps(w1, w0)));
+      __m128 y;
+      SSE_CUBIC(a, b, c, d, frac, y);
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_mul_ps(y, _mm_loadu_ps(gain + i)), w));
+
+      // phase_step, with floor as truncate and correct
+      __m128 f = _mm_add_ps(ph_frac, _mm_mul_ps(vrate, _mm_loadu_ps(grain_rate + i)));
+      __m128i whole = _mm_cvttps_epi32(f);
+      whole = _mm_add_epi32(whole, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(whole), f)));
+      ph = _mm_add_epi32(ph, whole);
+      ph_frac = _mm_sub_ps(f, _mm_cvtepi32_ps(whole));
+
+      // pos = (pos + 1 >= samples) ? 0 : pos + 1, the phase back to 0 with it
+      pos = _mm_add_epi32(pos, ione);
+      __m128i wrap = _mm_cmplt_epi32(pos, _mm_loadu_si128((const __m128i *)(samples + i)));
+      _mm_storeu_si128((__m128i *)(position + i), _mm_and_si128(pos, wrap));
+      _mm_storeu_si128((__m128i *)(phase + i), _mm_and_si128(ph, wrap));
+      _mm_storeu_ps(phase_frac + i, _mm_and_ps(ph_frac, _mm_castsi128_ps(wrap)));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    out[s] = _mm_cvtss_f32(acc);
+  }
+}
+
+static void grains_render_sse2(t_grains *g, void *storage, int size, int shift,
+                               const int *start, const t_sample *start_frac,
+                               const t_sample *rate, const t_sample *rec, int write_phase,
+                               t_sample *out, int n)
+{
+  t_sample_format format = g->g_format;
+  if (g->g_interp != INTERP_CUBIC || (format != SAMPLE_FLOAT && g->g_guard == 0)) {
+    grains_render_scalar(g, storage, size, shift, start, start_frac, rate, rec, write_phase,
+                         out, n);
+  } else if (format == SAMPLE_INT16) {
+    sse2_loop(g, storage, size, shift, start, start_frac, rate, rec, write_phase, out, n,
+              SAMPLE_INT16);
+  } else if (format == SAMPLE_HALF) {
+    sse2_loop(g, storage, size, shift, start, start_frac, rate, rec, write_phase, out, n,
+              SAMPLE_HALF);
+  } else {
+    sse2_loop(g, storage, size, shift, start, start_frac, rate, rec, write_phase, out, n,
+              SAMPLE_FLOAT);
+  }
+}
+
+// the tap t samples behind index for 8 voices
+#define AVX2_TAPS(index, t) _mm256_i32gather_ps(buffer, _mm256_sll_epi32(_mm256_and_si256( \
+      _mm256_sub_epi32(index, _mm256_set1_epi32(t)), vmask), vshift), 4)
+
+// the row of 4 taps in front of index, buffer[index - 3] up to buffer[index],
+// from storage in `format`. 16-bit integers come out unscaled, see AVX2_ROWS
+__attribute__((target("avx2,f16c")))
+DSP_INLINE __m128 avx2_row(const void *buffer, t_sample_format format, int index)
+{
+  switch (format) {
+    case SAMPLE_INT16:
+      return _mm_cvtepi32_ps(_mm_cvtepi16_epi32(
+          _mm_loadl_epi64((const __m128i *)((const int16_t *)buffer + index - 3))));
+    case SAMPLE_HALF:
+      return _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)((const uint16_t *)buffer + index - 3)));
+    default:
+      return _mm_loadu_ps((const t_sample *)buffer + index - 3);
+  }
+}
+
+// all 4 taps of 8 voices at once, when none of them wraps (or the buffer has
+// guard samples, so none can): voice l's taps are the row {d, c, b, a} at
+// buffer + idx[l] - 3, read as one load and transposed, which is cheaper
+// than 4 gathers, and is how compact storage is read at all. voices 0-3 go
+// in the low half, 4-7 in the high. 16-bit integers are scaled once they're
+// transposed, which gives the same values sample_load does
+#define AVX2_ROWS(buffer, format, idx, a, b, c, d) do { \
+    __m256 r0 = AVX2_ROW(buffer, format, idx, 0), r1 = AVX2_ROW(buffer, format, idx, 1); \
+    __m256 r2 = AVX2_ROW(buffer, format, idx, 2), r3 = AVX2_ROW(buffer, format, idx, 3); \
+    __m256 t0 = _mm256_unpacklo_ps(r0, r1); \
+    __m256 t1 = _mm256_unpacklo_ps(r2, r3); \
+    __m256 t2 = _mm256_unpackhi_ps(r0, r1); \
+    __m256 t3 = _mm256_unpackhi_ps(r2, r3); \
+    d = _mm256_shuffle_ps(t0, t1, 0x44); \
+    c = _mm256_shuffle_ps(t0, t1, 0xee); \
+    b = _mm256_shuffle_ps(t2, t3, 0x44); \
+    a = _mm256_shuffle_ps(t2, t3, 0xee); \
+    if ((format) == SAMPLE_INT16) { \
+      __m256 scale = _mm256_set1_ps(1.0f / SAMPLE_INT16_SCALE); \
+      a = _mm256_mul_ps(a, scale); \
+      b = _mm256_mul_ps(b, scale); \
+      c = _mm256_mul_ps(c, scale); \
+      d = _mm256_mul_ps(d, scale); \
+    } \
+  } while (0)
+#define AVX2_ROW(buffer, format, idx, l) _mm256_insertf128_ps( \
+      _mm256_castps128_ps256(avx2_row(buffer, format, (idx)[l])), \
+      avx2_row(buffer, format, (idx)[(l) + 4]), 1)
+
+// one sample of voices i to i + 7, added to acc. their position and phase
+// are stepped in pos, ph and ph_frac, which the caller loads and stores. a
+// macro rather than a function so it reads the voice arrays in place, which
+// is what the compiler handles best with this many registers live
+#define AVX2_VOICES(i, acc) do { \
+    __m256 frac_sum = _mm256_add_ps(_mm256_add_ps(base_frac, _mm256_loadu_ps(offset_frac + (i))), \
+                                    ph_frac); \
+    __m256i carry = _mm256_cvttps_epi32(frac_sum); \
+    __m256 frac = _mm256_sub_ps(frac_sum, _mm256_cvtepi32_ps(carry)); \
+    __m256i index = _mm256_add_epi32(_mm256_add_epi32(base, _mm256_loadu_si256((const __m256i *)(offset + (i)))), \
+                                     _mm256_add_epi32(ph, carry)); \
+    if (pow2) index = _mm256_and_si256(index, vmask); \
+    __m256 a, b, c, d; \
+    if (guarded) { \
+      int idx[8]; \
+      _mm256_storeu_si256((__m256i *)idx, index); \
+      if (!pow2) wrap_lanes(idx, 8, size); \
+      AVX2_ROWS(buffer, format, idx, a, b, c, d); \
+    } else { \
+      a = AVX2_TAPS(index, 0), b = AVX2_TAPS(index, 1); \
+      c = AVX2_TAPS(index, 2), d = AVX2_TAPS(index, 3); \
+    } \
+    __m256 wpos = _mm256_mul_ps(_mm256_cvtepi32_ps(pos), _mm256_loadu_ps(window_scale + (i))); \
+    __m256i windex = _mm256_cvttps_epi32(wpos); \
+    __m256 wfrac = _mm256_sub_ps(wpos, _mm256_cvtepi32_ps(windex)); \
+    __m256 w0 = _mm256_i32gather_ps(window, windex, 4); \
+    __m256 w1 = _mm256_i32gather_ps(window, _mm256_add_epi32(windex, ione), 4); \
+    __m256 w = _mm256_add_ps(w0, _mm256_mul_ps(wfrac, _mm256_sub_ps(w1, w0))); \
+    __m256 cminusb = _mm256_sub_ps(c, b); \
+    __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(d, a), _mm256_mul_ps(three, cminusb)), frac); \
+    __m256 t2 = _mm256_sub_ps(_mm256_add_ps(d, _mm256_mul_ps(two, a)), _mm256_mul_ps(three, b)); \
+    __m256 t3 = _mm256_mul_ps(_mm256_mul_ps(k, _mm256_sub_ps(one, frac)), _mm256_add_ps(t1, t2)); \
+    __m256 y = _mm256_add_ps(b, _mm256_mul_ps(frac, _mm256_sub_ps(cminusb, t3))); \
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_mul_ps(y, _mm256_loadu_ps(gain + (i))), w)); \
+    __m256 f = _mm256_add_ps(ph_frac, _mm256_mul_ps(vrate, _mm256_loadu_ps(grain_rate + (i)))); \
+    __m256 whole = _mm256_floor_ps(f); \
+    ph = _mm256_add_epi32(ph, _mm256_cvttps_epi32(whole)); \
+    ph_frac = _mm256_sub_ps(f, whole); \
+    pos = _mm256_add_epi32(pos, ione); \
+    __m256i wrap = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *)(samples + (i))), pos); \
+    pos = _mm256_and_si256(pos, wrap); \
+    ph = _mm256_and_si256(ph, wrap); \
+    ph_frac = _mm256_and_ps(ph_frac, _mm256_castsi256_ps(wrap)); \
+  } while (0)
+
+__attribute__((target("avx2,f16c")))
+DSP_INLINE t_sample avx2_sum(__m256 acc)
+{
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+}
+
+// recording or not, guarded or not and the buffer's format are fixed for
+// each copy of the loop; compact formats are always guarded. up to 8 voices
+// fit in one group, which is kept in registers for the whole block; more are
+// loaded and stored back a group at a time every sample
+__attribute__((target("avx2,f16c")))
+DSP_INLINE void render_avx2(t_grains *g, void *buffer, int size, int shift,
+                            const int *start, const t_sample *start_frac,
+                            const t_sample *rate, const t_sample *rec, int write_phase,
+                            t_sample *out, int n, int recording, int one_group, int guarded,
+                            t_sample_format format)
+{
+  int padded = g->g_padded;
+  int *position = g->g_position;
+  const int *samples = g->g_samples;
+  const int *offset = g->g_offset;
+  const t_float *offset_frac = g->g_offset_frac;
+  int *phase = g->g_phase;
+  t_float *phase_frac = g->g_phase_frac;
+  const t_float *grain_rate = g->g_rate;
+  const t_float *gain = g->g_gain;
+  const t_float *window_scale = g->g_window_scale;
+  const t_sample *window = g->g_window->w_samples;
+
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 three = _mm256_set1_ps(3.0f);
+  const __m256 k = _mm256_set1_ps(CUBIC_K);
+  int mask = size - 1;
+  int pow2 = (size & mask) == 0;
+  const __m256i vmask = _mm256_set1_epi32(mask);
+  const __m128i vshift = _mm_cvtsi32_si128(shift);
+  const __m256i ione = _mm256_set1_epi32(1);
+
+  __m256i pos, ph;
+  __m256 ph_frac;
+  if (one_group) {
+    pos = _mm256_loadu_si256((const __m256i *)position);
+    ph = _mm256_loadu_si256((const __m256i *)phase);
+    ph_frac = _mm256_loadu_ps(phase_frac);
+  }
+
+  for (int s = 0; s < n; s++) {
+    if (recording) {
+      dsp_ring_store(buffer, format, write_phase, size, shift, g->g_guard, rec[s]);
+      write_phase = dsp_wrap(write_phase + 1, size);
+    }
+    __m256i base = _mm256_set1_epi32(start[s]);
+    __m256 base_frac = _mm256_set1_ps(start_frac[s]);
+    __m256 vrate = _mm256_set1_ps(rate[s]);
+    __m256 acc = _mm256_setzero_ps();
+    if (one_group) {
+      AVX2_VOICES(0, acc);
+    } else {
+      for (int i = 0; i < padded; i += 8) {
+        pos = _mm256_loadu_si256((const __m256i *)(position + i));
+        ph = _mm256_loadu_si256((const __m256i *)(phase + i));
+        ph_frac = _mm256_loadu_ps(phase_frac + i);
+        AVX2_VOICES(i, acc);
+        _mm256_storeu_si256((__m256i *)(position + i), pos);
+        _mm256_storeu_si256((__m256i *)(phase + i), ph);
+        _mm256_storeu_ps(phase_frac + i, ph_frac);
+      }
+    }
+    out[s] = avx2_sum(acc);
+  }
+
+  if (one_group) {
+    _mm256_storeu_si256((__m256i *)position, pos);
+    _mm256_storeu_si256((__m256i *)phase, ph);
+    _mm256_storeu_ps(phase_frac, ph_frac);
+  }
+}
+
+__attribute__((target("avx2,f16c")))
+static void grains_render_avx2(t_grains *g, void *buffer, int size, int shift,
+                               const int *start, const t_sample *start_frac,
+                               const t_sample *rate, const t_sample *rec, int write_phase,
+                               t_sample *out, int n)
+{
+  t_sample_format format = g->g_format;
+  if (g->g_interp != INTERP_CUBIC || (format != SAMPLE_FLOAT && g->g_guard == 0)) {
+    grains_render_scalar(g, buffer, size, shift, start, start_frac, rate, rec, write_phase, out,
+                         n);
+    return;
+  }
+  int one_group = (g->g_padded == 8);
+#define AVX2_CASE(recording, one_group, guarded, format) \
+  render_avx2(g, buffer, size, shift, start, start_frac, rate, rec, write_phase, out, n, \
+              recording, one_group, guarded, format)
+#define AVX2_GROUPS(guarded, format) \
+  if (rec && one_group) { \
+    AVX2_CASE(1, 1, guarded, format); \
+  } else if (rec) { \
+    AVX2_CASE(1, 0, guarded, format); \
+  } else if (one_group) { \
+    AVX2_CASE(0, 1, guarded, format); \
+  } else { \
+    AVX2_CASE(0, 0, guarded, format); \
+  }
+  if (format == SAMPLE_INT16) {
+    AVX2_GROUPS(1, SAMPLE_INT16)
+  } else if (format == SAMPLE_HALF) {
+    AVX2_GROUPS(1, SAMPLE_HALF)
+  } else if (g->g_guard > 0) {
+    AVX2_GROUPS(1, SAMPLE_FLOAT)
+  } else {
+    AVX2_GROUPS(0, SAMPLE_FLOAT)
+  }
+#undef AVX2_GROUPS
+#undef AVX2_CASE
+}
+
+// render_planes_scalar with the voices 8 at a time, like grains_render_avx2.
+// only the taps and the cubic are done per channel, as rows (AVX2_ROWS)
+// unless one of them wraps around the start of a buffer with no guard. the
+// format is fixed for each copy of it, and compact ones are always guarded
+__attribute__((target("avx2,f16c")))
+DSP_INLINE void planes_avx2(t_grains *g, const t_grains_planes *p, const int *start,
+                            const t_sample *start_frac, const t_sample *rate,
+                            int write_phase, int n, t_sample_format format)
+{
+  int padded = g->g_padded;
+  int *position = g->g_position;
+  const int *samples = g->g_samples;
+  const int *offset = g->g_offset;
+  const t_float *offset_frac = g->g_offset_frac;
+  int *phase = g->g_phase;
+  t_float *phase_frac = g->g_phase_frac;
+  const t_float *grain_rate = g->g_rate;
+  const t_float *gain = g->g_gain;
+  const t_float *window_scale = g->g_window_scale;
+  const t_sample *window = g->g_window->w_samples;
+  int *index_out = g->g_index;
+  t_sample *frac_out = g->g_frac;
+  t_sample *weight_out = g->g_weight;
+  int size = p->p_size;
+  int mask = size - 1;
+  int pow2 = (size & mask) == 0;
+  int shift = p->p_shift;
+  int guarded = (p->p_guard > 0);
+
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 three = _mm256_set1_ps(3.0f);
+  const __m256 k = _mm256_set1_ps(CUBIC_K);
+  const __m256i vmask = _mm256_set1_epi32(mask);
+  const __m128i vshift = _mm_cvtsi32_si128(shift);
+  const __m256i ione = _mm256_set1_epi32(1);
+  const __m256i three_i = _mm256_set1_epi32(3);
+
+  for (int s = 0; s < n; s++) {
+    if (p->p_rec) {
+      for (int c = 0; c < p->p_channels; c++) {
+        const t_sample *rec = p->p_rec + (size_t)(c % p->p_rec_channels) * p->p_stride;
+        dsp_ring_store(planes_channel(p, c), format, write_phase, size, shift, p->p_guard,
+                       rec[s]);
+      }
+      write_phase = dsp_wrap(write_phase + 1, size);
+    }
+    __m256i base = _mm256_set1_epi32(start[s]);
+    __m256 base_frac = _mm256_set1_ps(start_frac[s]);
+    __m256 vrate = _mm256_set1_ps(rate[s]);
+    __m256i wraps = _mm256_setzero_si256();
+    for (int i = 0; i < padded; i += 8) {
+      __m256i pos = _mm256_loadu_si256((const __m256i *)(position + i));
+      __m256i ph = _mm256_loadu_si256((const __m256i *)(phase + i));
+      __m256 ph_frac = _mm256_loadu_ps(phase_frac + i);
+      __m256 frac_sum = _mm256_add_ps(_mm256_add_ps(base_frac, _mm256_loadu_ps(offset_frac + i)),
+                                      ph_frac);
+      __m256i carry = _mm256_cvttps_epi32(frac_sum);
+      __m256 frac = _mm256_sub_ps(frac_sum, _mm256_cvtepi32_ps(carry));
+      __m256i index = _mm256_add_epi32(_mm256_add_epi32(base, _mm256_loadu_si256((const __m256i *)(offset + i))),
+                                       _mm256_add_epi32(ph, carry));
+      if (pow2) index = _mm256_and_si256(index, vmask);
+      if (!guarded) wraps = _mm256_or_si256(wraps, _mm256_cmpgt_epi32(three_i, index));
+      _mm256_storeu_si256((__m256i *)(index_out + i), index);
+      if (!pow2) wrap_lanes(index_out + i, 8, size);
+      _mm256_storeu_ps(frac_out + i, frac);
+
+      __m256 wpos = _mm256_mul_ps(_mm256_cvtepi32_ps(pos), _mm256_loadu_ps(window_scale + i));
+      __m256i windex = _mm256_cvttps_epi32(wpos);
+      __m256 wfrac = _mm256_sub_ps(wpos, _mm256_cvtepi32_ps(windex));
+      __m256 w0 = _mm256_i32gather_ps(window, windex, 4);
+      __m256 w1 = _mm256_i32gather_ps(window, _mm256_add_epi32(windex, ione), 4);
+      __m256 w = _mm256_add_ps(w0, _mm256_mul_ps(wfrac, _mm256_sub_ps(w1, w0)));
+      _mm256_storeu_ps(weight_out + i, _mm256_mul_ps(_mm256_loadu_ps(gain + i), w));
+
+      __m256 f = _mm256_add_ps(ph_frac, _mm256_mul_ps(vrate, _mm256_loadu_ps(grain_rate + i)));
+      __m256 whole = _mm256_floor_ps(f);
+      ph = _mm256_add_epi32(ph, _mm256_cvttps_epi32(whole));
+      ph_frac = _mm256_sub_ps(f, whole);
+
+      pos = _mm256_add_epi32(pos, ione);
+      __m256i wrap = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *)(samples + i)), pos);
+      _mm256_storeu_si256((__m256i *)(position + i), _mm256_and_si256(pos, wrap));
+      _mm256_storeu_si256((__m256i *)(phase + i), _mm256_and_si256(ph, wrap));
+      _mm256_storeu_ps(phase_frac + i, _mm256_and_ps(ph_frac, _mm256_castsi256_ps(wrap)));
+    }
+
+    int rows = guarded || (shift == 0 && _mm256_testz_si256(wraps, wraps));
+    for (int ch = 0; ch < p->p_channels; ch++) {
+      const void *buffer = planes_channel(p, ch);
+      __m256 acc = _mm256_setzero_ps();
+      for (int i = 0; i < padded; i += 8) {
+        __m256 frac = _mm256_loadu_ps(frac_out + i);
+        __m256 a, b, c, d;
+        if (rows) {
+          AVX2_ROWS(buffer, format, index_out + i, a, b, c, d);
+        } else {
+          __m256i index = _mm256_loadu_si256((const __m256i *)(index_out + i));
+#define TAPS(k) _mm256_i32gather_ps(buffer, _mm256_sll_epi32(_mm256_and_si256( \
+            _mm256_sub_epi32(index, _mm256_set1_epi32(k)), vmask), vshift), 4)
+          a = TAPS(0), b = TAPS(1), c = TAPS(2), d = TAPS(3);
+#undef TAPS
+        }
+        __m256 cminusb = _mm256_sub_ps(c, b);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(d, a), _mm256_mul_ps(three, cminusb)), frac);
+        __m256 t2 = _mm256_sub_ps(_mm256_add_ps(d, _mm256_mul_ps(two, a)), _mm256_mul_ps(three, b));
+        __m256 t3 = _mm256_mul_ps(_mm256_mul_ps(k, _mm256_sub_ps(one, frac)), _mm256_add_ps(t1, t2));
+        __m256 y = _mm256_add_ps(b, _mm256_mul_ps(frac, _mm256_sub_ps(cminusb, t3)));
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(y, _mm256_loadu_ps(weight_out + i)));
+      }
+      __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+      sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+      sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+      p->p_out[(size_t)ch * p->p_stride + s] = _mm_cvtss_f32(sum);
+    }
+  }
+}
+
+__attribute__((target("avx2,f16c")))
+static void render_planes_avx2(t_grains *g, const t_grains_planes *p, const int *start,
+                               const t_sample *start_frac, const t_sample *rate,
+                               int write_phase, int n)
+{
+  if (g->g_interp != INTERP_CUBIC || (p->p_format != SAMPLE_FLOAT && p->p_guard == 0)) {
+    render_planes_scalar(g, p, start, start_frac, rate, write_phase, n);
+  } else if (p->p_format == SAMPLE_INT16) {
+    planes_avx2(g, p, start, start_frac, rate, write_phase, n, SAMPLE_INT16);
+  } else if (p->p_format == SAMPLE_HALF) {
+    planes_avx2(g, p, start, start_frac, rate, write_phase, n, SAMPLE_HALF);
+  } else {
+    planes_avx2(g, p, start, start_frac, rate, write_phase, n, SAMPLE_FLOAT);
+  }
+}
+
+#endif // GRAINS_X86
+
+#ifdef GRAINS_NEON
+
+// the row of 4 taps in front of index from storage in `format`, decoded
+// like sse2_row so it matches sample_load whatever the FPU's flush mode
+DSP_INLINE float32x4_t neon_row(const void *buffer, t_sample_format format, int index)
+{
+  switch (format) {
+    case SAMPLE_INT16:
+      return vmulq_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16((const int16_t *)buffer + index - 3))),
+                       vdupq_n_f32(1.0f / SAMPLE_INT16_SCALE));
+    case SAMPLE_HALF: {
+      uint32x4_t h = vmovl_u16(vld1_u16((const uint16_t *)buffer + index - 3));
+      uint32x4_t a = vandq_u32(h, vdupq_n_u32(0x7fff));
+      uint32x4_t sign = vshlq_n_u32(veorq_u32(h, a), 16);
+      uint32x4_t normal = vaddq_u32(vshlq_n_u32(a, 13), vdupq_n_u32(0x38000000));
+      uint32x4_t subnormal = vreinterpretq_u32_f32(
+          vmulq_f32(vcvtq_f32_u32(a), vdupq_n_f32(1.0f / 16777216.0f)));
+      uint32x4_t v = vbslq_u32(vcgtq_u32(a, vdupq_n_u32(0x3ff)), normal, subnormal);
+      return vreinterpretq_f32_u32(vorrq_u32(v, sign));
+    }
+    default:
+      return vld1q_f32((const t_sample *)buffer + index - 3);
+  }
+}
+
+// the buffer's format is fixed for each copy of the loop; compact formats
+// are always guarded
+DSP_INLINE void neon_loop(t_grains *g, void *buffer, int size, int shift, const int *start,
+                          const t_sample *start_frac, const t_sample *rate, const t_sample *rec,
+                          int write_phase, t_sample *out, int n, t_sample_format format)
+{
+  int padded = g->g_padded;
+  int *position = g->g_position;
+  const int *samples = g->g_samples;
+  const int *offset = g->g_offset;
+  const t_float *offset_frac = g->g_offset_frac;
+  int *phase = g->g_phase;
+  t_float *phase_frac = g->g_phase_frac;
+  const t_float *grain_rate = g->g_rate;
+  const t_float *gain = g->g_gain;
+  const t_float *window_scale = g->g_window_scale;
+  const t_sample *window = g->g_window->w_samples;
+
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  const float32x4_t two = vdupq_n_f32(2.0f);
+  const float32x4_t three = vdupq_n_f32(3.0f);
+  const float32x4_t k = vdupq_n_f32(CUBIC_K);
+  int guard = g->g_guard;
+  int mask = size - 1;
+  int pow2 = (size & mask) == 0;
+  const int32x4_t vmask = vdupq_n_s32(mask);
+  const int32x4_t ione = vdupq_n_s32(1);
+
+  for (int s = 0; s < n; s++) {
+    if (rec) {
+      dsp_ring_store(buffer, format, write_phase, size, shift, g->g_guard, rec[s]);
+      write_phase = dsp_wrap(write_phase + 1, size);
+    }
+    int32x4_t base = vdupq_n_s32(start[s]);
+    float32x4_t base_frac = vdupq_n_f32(start_frac[s]);
+    float32x4_t vrate = vdupq_n_f32(rate[s]);
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (int i = 0; i < padded; i += 4) {
+      int32x4_t pos = vld1q_s32(position + i);
+      int32x4_t ph = vld1q_s32(phase + i);
+      float32x4_t ph_frac = vld1q_f32(phase_frac + i);
+      float32x4_t frac_sum = vaddq_f32(vaddq_f32(base_frac, vld1q_f32(offset_frac + i)), ph_frac);
+      int32x4_t carry = vcvtq_s32_f32(frac_sum);
+      float32x4_t frac = vsubq_f32(frac_sum, vcvtq_f32_s32(carry));
+      int32x4_t index = vaddq_s32(vaddq_s32(base, vld1q_s32(offset + i)), vaddq_s32(ph, carry));
+      if (pow2) index = vandq_s32(index, vmask);
+
+      float32x4_t wpos = vmulq_f32(vcvtq_f32_s32(pos), vld1q_f32(window_scale + i));
+      int32x4_t windex = vcvtq_s32_f32(wpos);
+      float32x4_t wfrac = vsubq_f32(wpos, vcvtq_f32_s32(windex));
+
+      int idx[4], wi[4];
+      vst1q_s32(idx, index);
+      if (!pow2) wrap_lanes(idx, 4, size);
+      vst1q_s32(wi, windex);
+      float32x4_t a, b, c, d;
+      if (format != SAMPLE_FLOAT || guard > 0) {
+        // each voice's taps are the row {d, c, b, a} in front of its index
+        float32x4x2_t t01 = vtrnq_f32(neon_row(buffer, format, idx[0]),
+                                      neon_row(buffer, format, idx[1]));
+        float32x4x2_t t23 = vtrnq_f32(neon_row(buffer, format, idx[2]),
+                                      neon_row(buffer, format, idx[3]));
+        d = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+        c = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+        b = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+        a = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+      } else {
+        const t_sample *stored = (const t_sample *)buffer;
+        float ta[4], tb[4], tc[4], td[4];
+        for (int l = 0; l < 4; l++) {
+          ta[l] = DSP_TAP(stored, idx[l], mask, shift);
+          tb[l] = DSP_TAP(stored, idx[l] - 1, mask, shift);
+          tc[l] = DSP_TAP(stored, idx[l] - 2, mask, shift);
+          td[l] = DSP_TAP(stored, idx[l] - 3, mask, shift);
+        }
+        a = vld1q_f32(ta), b = vld1q_f32(tb), c = vld1q_f32(tc), d = vld1q_f32(td);
+      }
+      float tw0[4], tw1[4];
+      for (int l = 0; l < 4; l++) {
+        tw0[l] = window[wi[l]];
+        tw1[l] = window[wi[l] + 1];
+      }
+
+      float32x4_t cminusb = vsubq_f32(c, b);
+      float32x4_t t1 = vmulq_f32(vsubq_f32(vsubq_f32(d, a), vmulq_f32(three, cminusb)), frac);
+      float32x4_t t2 = vsubq_f32(vaddq_f32(d, vmulq_f32(two, a)), vmulq_f32(three, b));
+      float32x4_t t3 = vmulq_f32(vmulq_f32(k, vsubq_f32(one, frac)), vaddq_f32(t1, t2));
+      float32x4_t y = vaddq_f32(b, vmulq_f32(frac, vsubq_f32(cminusb, t3)));
+      float32x4_t w0 = vld1q_f32(tw0);
+      float32x4_t w = vaddq_f32(w0, vmulq_f32(wfrac, vsubq_f32(vld1q_f32(tw1), w0)));
+      acc = vaddq_f32(acc, vmulq_f32(vmulq_f32(y, vld1q_f32(gain + i)), w));
+
+      // phase_step, with floor as truncate and correct
+      float32x4_t f = vaddq_f32(ph_frac, vmulq_f32(vrate, vld1q_f32(grain_rate + i)));
+      int32x4_t whole = vcvtq_s32_f32(f);
+      whole = vaddq_s32(whole, vreinterpretq_s32_u32(vcgtq_f32(vcvtq_f32_s32(whole), f)));
+      ph = vaddq_s32(ph, whole);
+      ph_frac = vsubq_f32(f, vcvtq_f32_s32(whole));
+
+      pos = vaddq_s32(pos, ione);
+      int32x4_t wrap = vreinterpretq_s32_u32(vcltq_s32(pos, vld1q_s32(samples + i)));
+      vst1q_s32(position + i, vandq_s32(pos, wrap));
+      vst1q_s32(phase + i, vandq_s32(ph, wrap));
+      vst1q_f32(phase_frac + i,
+                vreinterpretq_f32_s32(vandq_s32(vreinterpretq_s32_f32(ph_frac), wrap)));
+    }
+    float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    out[s] = vget_lane_f32(vpadd_f32(sum, sum), 0);
+  }
+}
+
+static void grains_render_neon(t_grains *g, void *storage, int size, int shift,
+                               const int *start, const t_sample *start_frac,
+                               const t_sample *rate, const t_sample *rec, int write_phase,
+                               t_sample *out, int n)
+{
+  t_sample_format format = g->g_format;
+  if (g->g_interp != INTERP_CUBIC || (format != SAMPLE_FLOAT && g->g_guard == 0)) {
+    grains_render_scalar(g, storage, size, shift, start, start_frac, rate, rec, write_phase,
+                         out, n);
+  } else if (format == SAMPLE_INT16) {
+    neon_loop(g, storage, size, shift, start, start_frac, rate, rec, write_phase, out, n,
+              SAMPLE_INT16);
+  } else if (format == SAMPLE_HALF) {
+    neon_loop(g, storage, size, shift, start, start_frac, rate, rec, write_phase, out, n,
+              SAMPLE_HALF);
+  } else {
+    neon_loop(g, storage, size, shift, start, start_frac, rate, rec, write_phase, out, n,
+              SAMPLE_FLOAT);
+  }
+}
+
+#endif // GRAINS_NEON
+
+t_grains_render grains_render = grains_render_scalar;
+static void (*render_planes)(t_grains *g, const t_grains_planes *p, const int *start,
+                             const t_sample *start_frac, const t_sample *rate,
+                             int write_phase, int n)
+  = render_planes_scalar;
+
+void grains_render_planes(t_grains *g, const t_grains_planes *p, const int *start,
+                          const t_sample *start_frac, const t_sample *rate, int write_phase,
+                          int n)
+{
+  render_planes(g, p, start, start_frac, rate, write_phase, n);
+}
+
+const char *grains_select_engine(void)
+{
+#ifdef GRAINS_X86
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")) {
+    grains_render = grains_render_avx2;
+    render_planes = render_planes_avx2;
+    return "avx2";
+  }
+#endif
+  grains_render = grains_render_sse2;
+  return "sse2";
+#elif defined(GRAINS_NEON)
+  grains_render = grains_render_neon;
+  return "neon";
+#else
+  grains_render = grains_render_scalar;
+  return "scalar";
+#endif
+}
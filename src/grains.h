@@ -0,0 +1,201 @@
+// structure-of-arrays grain voices for gl~
+//
+// every per-grain field lives in its own array so that a group of 4 (SSE,
+// NEON) or 8 (AVX2) grains can be loaded into one register and advanced
+// together. the arrays are padded to GRAINS_LANES; padding voices have a gain
+// of 0 so the SIMD loops never need a remainder loop.
+//
+// there are two ways to drive the voices. by default every voice loops
+// forever, offset from the others by grains_spread (the original cloud). with
+// a scheduler (t_grains_sched, density > 0) voices are spawned at a rate with
+// random onset, position, duration and pitch, and freed when they end. the
+// active voices are kept packed at the front of the arrays, so allocating and
+// freeing one is O(1) and the render loops only cover the live ones.
+//
+// either way a governor can cap the voices below g_voices (grains_limit, see
+// grain_budget.h): the ones over the cap fade out a step at a time and are
+// retired, so the render loops cover fewer of them, and the scheduler drops
+// onsets rather than go past it. raising the cap again fades the looping
+// cloud's voices back in (grains_fill); the scheduler simply spawns more.
+
+#ifndef GRAINS_H
+#define GRAINS_H
+
+#include "engine.h"
+#include "dsp_kernels.h"
+#include "window_table.h"
+
+#define GRAINS_LANES 8
+
+typedef struct _grains {
+  int g_count; // number of voices in use
+  int g_padded; // g_count rounded up to GRAINS_LANES
+  int g_capacity; // allocated voices, a multiple of GRAINS_LANES
+  int g_voices; // the voice count gl~ was created with
+  int g_limit; // the most voices allowed to play, up to g_voices
+  int *g_position; // samples into the grain
+  int *g_samples; // grain length in samples
+  // the read pointer is the grain start + offset + phase, each kept as whole
+  // samples and a fraction in [0, 1) (see phase_step in dsp_kernels.h)
+  int *g_offset; // fixed read offset from the grain start
+  t_float *g_offset_frac;
+  int *g_phase; // how far the read pointer has moved, back to 0 as the grain loops
+  t_float *g_phase_frac;
+  t_float *g_rate; // buffer samples read per grain sample, times the rate inlet
+  t_float *g_gain;
+  t_float *g_window_scale; // grain position -> window table index
+  t_float *g_fade; // gain taken off per grains_fade, negative fading in, 0 for neither
+  t_window_table *g_window; // shared, owned by the caller
+  t_interp g_interp;
+  int g_guard; // the buffer's mirrored samples either side, see below
+  t_sample_format g_format; // the buffer's, see below
+
+  // per-sample scratch for the batch interpolators
+  int *g_index;
+  t_sample *g_frac;
+  t_sample *g_tap;
+  t_sample *g_weight; // gain times window, see grains_render_planes
+} t_grains;
+
+// renders n samples of the summed grain cloud into out, windowed with
+// g_window (which must be set). buffer holds size samples, sample i at
+// buffer[i << shift] (see ring_buffer.h), and size is a power of 2 unless
+// it has a guard (see dsp_wrap). start and start_frac hold the grain start
+// position for each sample in buffer samples, split into whole samples and a
+// fraction (see start_split in dsp_kernels.h), and rate the playback rate
+// for each sample (1 is the recorded speed, negative reads backwards),
+// which every grain multiplies by its own g_rate. if rec is not NULL,
+// rec[i] is written to buffer[(write_phase + i) % size] before
+// sample i is read, matching the order of the original per-sample loop.
+// with g_guard the buffer has that many samples either side that mirror its
+// other end (DSP_GUARD, dsp_kernels.h) and shift is 0; recording keeps them
+// up to date, and the SIMD renderers read a voice's taps from them instead
+// of wrapping each one. the buffer holds its samples in g_format
+// (sample_format.h), t_samples unless it's compact storage with shift 0;
+// recording converts to it and reading from it. the AVX2 renderers decode
+// compact storage a row of taps at a time, only with a guard, and the
+// grain-major one tap by tap; the others hand it to grains_render_scalar.
+typedef void (*t_grains_render)(t_grains *g, void *buffer, int size, int shift,
+                                const int *start, const t_sample *start_frac,
+                                const t_sample *rate, const t_sample *rec, int write_phase,
+                                t_sample *out, int n);
+
+// the widest SIMD sample-major renderer, set by grains_select_engine()
+extern t_grains_render grains_render;
+
+// reference sample-major loop, one grain at a time per sample
+void grains_render_scalar(t_grains *g, void *buffer, int size, int shift,
+                          const int *start, const t_sample *start_frac,
+                          const t_sample *rate, const t_sample *rec, int write_phase,
+                          t_sample *out, int n);
+
+// grain-major: renders each grain across the whole block before moving on to
+// the next. the same as grains_render_scalar to rounding, and bit-identical
+// to it without -ffast-math
+void grains_render_grain_major(t_grains *g, void *buffer, int size, int shift,
+                               const int *start, const t_sample *start_frac,
+                               const t_sample *rate, const t_sample *rec, int write_phase,
+                               t_sample *out, int n);
+
+// more than one channel, read from and written to the same positions: channel
+// c of the buffer starts at p_buffer + c * p_buffer_stride (see
+// ring_buffer_channel), and rec and out are laid out like Pd's multichannel
+// signals, channel c at c * p_stride. an input with fewer channels wraps
+// around, so a mono one records into all of them. p_buffer_stride counts
+// samples in p_format, like g_format for the mono renderers
+typedef struct _grains_planes {
+  int p_channels;
+  void *p_buffer;
+  size_t p_buffer_stride;
+  int p_size;
+  int p_shift;
+  int p_guard; // see g_guard
+  t_sample_format p_format; // see g_format
+  const t_sample *p_rec; // NULL when not recording
+  int p_rec_channels;
+  t_sample *p_out;
+  int p_stride;
+} t_grains_planes;
+
+// every channel at once: where each grain reads and its window gain are
+// worked out once per sample, whatever the channel count, so each channel
+// only adds its taps. uses the widest engine grains_select_engine() found
+// (AVX2, else the scalar loop), and sums in a different order from the mono
+// renderers, so it isn't bit-identical to them
+void grains_render_planes(t_grains *g, const t_grains_planes *p, const int *start,
+                          const t_sample *start_frac, const t_sample *rate, int write_phase,
+                          int n);
+
+int grains_alloc(t_grains *g, int count);
+void grains_free(t_grains *g);
+// every voice up to g_limit looping from position 0, at 1 / g_voices gain
+void grains_reset(t_grains *g, int grain_samples);
+void grains_spread(t_grains *g, t_float grain_offset);
+void grains_window(t_grains *g, t_window_table *window);
+// no voices playing, for the scheduler to fill
+void grains_clear(t_grains *g);
+// at most `limit` voices (1 to g_voices) from now on. the playing voices over
+// it that are closest to their end fade out over `steps` calls to
+// grains_fade; in the looping cloud they're all at the same point of their
+// window, so those are simply the last ones
+void grains_limit(t_grains *g, int limit, int steps);
+// the looping cloud back up to g_limit voices, fading in over `steps` calls
+// to grains_fade: voices still fading out turn around first, then new ones
+// join in step with voice 0. their offsets need a grains_spread
+void grains_fill(t_grains *g, int steps);
+// one step of every fade, retiring the voices that faded out. returns
+// whether any is still going
+int grains_fade(t_grains *g);
+// voices [first, first + size) of g as a t_grains of their own, sharing their
+// state and scratch with g, so parts that don't overlap can be rendered at the
+// same time (see render_pool.h). first and size are multiples of GRAINS_LANES
+void grains_part(const t_grains *g, int first, int size, t_grains *part);
+// the voices in use and everything about them from one t_grains to another
+// of the same capacity, which keeps its own arrays. parts of the copy can be
+// rendered on other threads while `from` changes, then their state copied
+// back or thrown away (see gl_engine_process_ahead)
+void grains_snapshot(t_grains *to, const t_grains *from);
+// the positions and phases of voices [first, first + size) from one t_grains
+// to another of the same capacity
+void grains_state_copy(t_grains *to, const t_grains *from, int first, int size);
+
+typedef struct _grains_sched {
+  t_float s_interval; // mean samples between onsets
+  t_float s_duration; // mean grain length in samples
+  t_float s_gain; // per grain, from the expected overlap
+  t_float s_jitter_onset; // 0..1, fraction of s_interval
+  t_float s_jitter_position; // +- samples
+  t_float s_jitter_duration; // 0..1, fraction of s_duration
+  t_float s_jitter_pitch; // +- semitones
+  double s_countdown; // samples until the next onset
+  int s_sync; // onsets only come from grains_sched_trigger, see transport.h
+  unsigned int s_random; // xorshift state, never 0
+} t_grains_sched;
+
+void grains_sched_init(t_grains_sched *s);
+void grains_sched_seed(t_grains_sched *s, unsigned int seed);
+// sets the mean interval and duration, and the gain that keeps the expected
+// overlap at unity
+void grains_sched_timing(t_grains_sched *s, t_float interval, t_float duration);
+// s_sync on or off. while it's on, onset jitter doesn't apply
+void grains_sched_sync(t_grains_sched *s, int sync);
+// with s_sync, a grain starts at the next sample rendered
+void grains_sched_trigger(t_grains_sched *s);
+
+// like a t_grains_render, but spawns and retires voices on the way. the block
+// is cut at every onset and every grain end, so each call to render sees a
+// fixed set of voices, none of which wrap
+void grains_schedule(t_grains *g, t_grains_sched *s, t_grains_render render,
+                     void *buffer, int size, int shift, const int *start,
+                     const t_sample *start_frac, const t_sample *rate,
+                     const t_sample *rec, int write_phase, t_sample *out, int n);
+
+// grains_schedule for grains_render_planes
+void grains_schedule_planes(t_grains *g, t_grains_sched *s, const t_grains_planes *p,
+                            const int *start, const t_sample *start_frac,
+                            const t_sample *rate, int write_phase, int n);
+
+// picks the widest render routine the CPU supports, returns its name
+const char *grains_select_engine(void);
+
+#endif
@@ -2,206 +2,1214 @@
 
 #include "m_pd.h"
 #include <math.h>
+#include <string.h>
+#include "dsp_kernels.h"
+#include "window_table.h"
+#include "ring_buffer.h"
+#include "event_queue.h"
+#include "dsp_stats.h"
+#include "transport.h"
 
 typedef enum {
-  STATE_IDLE,
+  STATE_IDLE, // no loop
   STATE_RECORDING,
-  STATE_PLAYING
+  STATE_PLAYING,
+  STATE_OVERDUB // playing, with the input summed into the loop
 } t_looper_state;
 
+typedef enum {
+  EVENT_BANG,
+  EVENT_IDLE,
+  EVENT_OVERDUB,
+  EVENT_UNDO,
+  EVENT_FEEDBACK,
+  EVENT_FADE,
+  EVENT_TRACK,
+  EVENT_GAIN,
+  EVENT_MUTE,
+  EVENT_QUANTIZE,
+  EVENT_SYNC,
+  EVENT_TEMPO
+} t_looper_event;
+
+#define FADE_MS 10 // default length of the crossfade at the loop seam
+#define FADE_MAX_MS 100 // how much input x_preroll keeps
+#define GAIN_RAMP_MS 10
+#define LOOPER_MAX_TRACKS 64
+#define UNDO_SPEED 4 // samples an undo swaps for every sample the loop plays, at least 1
+
+// one track: a region of the shared ring and how it's played. the region is
+// [l_start - l_preroll, l_start + l_length); the input isn't written there
+// while the track holds it
+typedef struct _loop {
+  t_looper_state l_state;
+  int l_start;
+  int l_length;
+  int l_read_phase;
+  int l_preroll; // audio kept before l_start for the seam fade
+  int l_target; // quantized length a recording carries on to, 0 for none
+  int l_layer_start; // loop offset where the current overdub layer started
+  int l_layer_samples; // how much of the loop the layer has saved to x_undo
+  // an undo swaps a layer a stretch at a time, see undo_step
+  int l_undo_start; // loop offset of the stretch it swaps
+  int l_undo_length;
+  int l_undo_next; // where it goes on from, counted from l_undo_start
+  int l_undo_left; // samples it has left, 0 for none
+  t_float l_gain;
+  int l_mute;
+  t_ramp l_level; // follows l_gain, or 0 while muted
+} t_loop;
+
 typedef struct _looper {
   t_object x_obj;
 
   t_float x_s_per_msec;
-  int x_pd_block_size; // possibly not needed
+  int x_pd_block_size; // also the distance between channels of a multichannel signal
+  int x_channels; // of the loop and the outlet
+  int x_in_channels; // of the inlet, wrapped around if fewer
 
-  t_sample *x_input_buffer;
-  t_sample *x_window_buffer;
+  t_ring_buffer x_buffer; // resized off the audio thread or a Pd array, see ring_buffer.c
+  t_ring_buffer x_undo; // what the last overdub layer replaced, same indices as x_buffer
+  int x_undo_phase; // unused, ring_buffer_adopt wants one
+  t_window_table *x_fade; // shared equal-power fade, see play_loop
   t_float x_input_buffer_ms; // could be an int?
-  int x_input_buffer_samples;
+  t_canvas *x_canvas; // for file names relative to the patch
+  t_outlet *x_done; // read, write and stats report here
+  t_dsp_stats x_stats; // `profile` and `stats`
 
-  t_looper_state x_state;
+  t_event_queue x_events; // state changes waiting for their sample
+  t_transport x_transport; // `sync` and `tempo`
+  int x_deferred; // a bang or overdub waiting for the next tick, -1 for none
+  int x_deferred_track; // the track it was sent for
 
-  int x_write_phase; // input buffer write position
-  int x_read_phase; // input buffer read position
-  int x_loop_pos; // current position in the loop
+  // the tracks share x_buffer. messages act on the selected one, and only
+  // one records or overdubs at a time since there's one input
+  t_loop *x_loops;
+  int x_num_loops;
+  int x_track; // selected, perform side
+  int x_track_sent; // selected, as of the last `track` message
+  int x_active; // the track recording or overdubbing, -1 for none
+  int x_quantize; // round loop lengths to x_sync_length
+  int x_sync_length; // of the first loop, 0 while there's none
 
-  int x_loop_start;
-  int x_loop_length;
+  int x_write_phase; // input buffer write position
+  t_float x_fade_ms;
   int x_fade_samples;
+  // the last FADE_MAX_MS of input on every channel, so a recording can start
+  // with the audio that led into it wherever it goes in the ring
+  t_sample *x_preroll;
+  int x_preroll_size; // per channel
+  int x_preroll_phase;
+  int x_run; // how much of x_preroll holds input so far
+
+  t_sample x_feedback; // how much of the loop survives each overdub pass
 
+  t_inlet *x_inlet_sync; // phasor~ for `sync` with no tempo
   t_float x_f; // dummy arg for CLASS_MAINSIGNALIN
 } t_looper;
 
 static t_class *looper_class = NULL;
 
 static void input_buffer_update(t_looper *x);
+static void looper_notify(t_object *owner, t_symbol *what, int samples);
+static void looper_free(t_looper *x);
+
+static void loop_clear(t_loop *l)
+{
+  l->l_state = STATE_IDLE;
+  l->l_start = 0;
+  l->l_length = 0;
+  l->l_read_phase = 0;
+  l->l_preroll = 0;
+  l->l_target = 0;
+  l->l_layer_start = 0;
+  l->l_layer_samples = 0;
+  l->l_undo_left = 0;
+}
 
-static void *looper_new(t_floatarg f) {
+static void *looper_new(t_floatarg f, t_floatarg channels, t_floatarg tracks) {
   t_looper *x = (t_looper *)pd_new(looper_class);
 
   // used to set the minimum size of x_input_buffer once x->x_x_per_ms is known
   x->x_input_buffer_ms = (f > 1) ? f : 4000.0f;
   x->x_s_per_msec = 0.0f;
   x->x_pd_block_size = 0;
+  x->x_channels = (channels > 1) ? channels : 1;
+  if (x->x_channels > RING_BUFFER_MAX_CHANNELS) x->x_channels = RING_BUFFER_MAX_CHANNELS;
+  x->x_in_channels = 1;
+  x->x_canvas = canvas_getcurrent();
+
+  event_queue_init(&x->x_events);
+  transport_init(&x->x_transport);
+  x->x_deferred = -1;
+  x->x_deferred_track = 0;
+  x->x_inlet_sync = NULL;
+  dsp_stats_init(&x->x_stats);
 
-  x->x_state = STATE_IDLE;
+  x->x_num_loops = (tracks > 1) ? tracks : 1;
+  if (x->x_num_loops > LOOPER_MAX_TRACKS) x->x_num_loops = LOOPER_MAX_TRACKS;
+  x->x_loops = (t_loop *)getbytes(x->x_num_loops * sizeof(t_loop));
+  if (x->x_loops == NULL) {
+    pd_error(x, "looper~: unable to allocate tracks");
+    return NULL;
+  }
+  for (int i = 0; i < x->x_num_loops; i++) {
+    t_loop *l = &x->x_loops[i];
+    loop_clear(l);
+    l->l_gain = 1.0f;
+    l->l_mute = 0;
+    ramp_jump(&l->l_level, 1.0f);
+  }
+  x->x_track = 0;
+  x->x_track_sent = 0;
+  x->x_active = -1;
+  x->x_quantize = 0;
+  x->x_sync_length = 0;
 
   x->x_write_phase = 0;
-  x->x_read_phase = 0;
-  x->x_loop_start = 0;
-  x->x_loop_length = 0;
-  x->x_loop_pos = 0;
+  x->x_feedback = 1.0f;
+  x->x_undo_phase = 0;
 
-  x->x_fade_samples = 10 * 64; // hmmm
+  x->x_fade_ms = FADE_MS;
+  x->x_fade_samples = 0;
+  x->x_preroll = NULL;
+  x->x_preroll_size = 0;
+  x->x_preroll_phase = 0;
+  x->x_run = 0;
 
-  x->x_input_buffer_samples = 1024; // initialize to a small power of 2 value
-  x->x_input_buffer = getbytes(x->x_input_buffer_samples * sizeof(t_sample));
-  if (x->x_input_buffer == NULL) {
-    pd_error(x, "looper~: unable to assign memory to input buffer");
+  // initialize to a small power of 2 value
+  if (!ring_buffer_init(&x->x_buffer, &x->x_obj, "looper~", 1024, x->x_channels, 0)) {
+    looper_free(x);
+    return NULL;
+  }
+  if (!ring_buffer_init(&x->x_undo, &x->x_obj, "looper~", 1024, x->x_channels, 0)) {
+    looper_free(x);
     return NULL;
   }
 
-  x->x_window_buffer = getbytes(x->x_input_buffer_samples * sizeof(t_sample));
-  // handle allocation error here
-
-  x->x_window_buffer = getbytes(x->x_input_buffer_samples * sizeof(t_sample));
-  // if (x->x_window_buffer == NULL) {
-  //   pd_error(x, "looper~: unable to assign memory to window buffer");
-  //   return NULL;
-  // }
+  x->x_fade = window_table_get(WINDOW_FADE, WINDOW_TABLE_SIZE);
+  if (x->x_fade == NULL) {
+    pd_error(x, "looper~: unable to allocate fade table");
+    looper_free(x);
+    return NULL;
+  }
+  ring_buffer_set_notify(&x->x_buffer, looper_notify);
 
+  x->x_inlet_sync = signalinlet_new(&x->x_obj, 0.0f);
   outlet_new(&x->x_obj, &s_signal);
+  x->x_done = outlet_new(&x->x_obj, &s_anything);
 
   return (void *)x;
 }
 
+// the new buffer is built on the worker thread and swapped in by
+// looper_perform; the recorded audio and the loops survive the swap
 static void input_buffer_update(t_looper *x)
 {
-  int buffer_size = 1;
   // note: in the delay implementations I've been (unnecessarily?) adding x_pd_block size here
-  while (buffer_size < (x->x_input_buffer_ms * x->x_s_per_msec)) {
-    buffer_size *= 2;
+  int buffer_size = ring_buffer_size_for(x->x_input_buffer_ms * x->x_s_per_msec);
+  if (ring_buffer_request(&x->x_buffer, buffer_size)) {
+    post("looper~: (debug) x_input_buffer_samples: %d", buffer_size);
   }
+  ring_buffer_request(&x->x_undo, ring_buffer_target_size(&x->x_buffer));
+}
 
-  x->x_input_buffer = (t_sample *)resizebytes(x->x_input_buffer,
-                                              x->x_input_buffer_samples * sizeof(t_sample),
-                                              buffer_size * sizeof(t_sample));
-  if (x->x_input_buffer == NULL) {
-    pd_error(x, "looper~: unable to resize input buffer");
-    return;
+// once no track holds a loop, the next one sets the sync length again
+static void looper_forget_sync(t_looper *x)
+{
+  for (int i = 0; i < x->x_num_loops; i++) {
+    if (x->x_loops[i].l_state != STATE_IDLE) return;
   }
-  x->x_window_buffer = (t_sample *)resizebytes(x->x_window_buffer,
-                                              x->x_input_buffer_samples * sizeof(t_sample),
-                                              buffer_size * sizeof(t_sample));
-  if (x->x_window_buffer == NULL) {
-    pd_error(x, "looper~: unable to resize input buffer");
-    return;
+  x->x_sync_length = 0;
+}
+
+// moves the loops into a newly adopted buffer. the worker copies as much of
+// the newest audio before the write phase as fits, so a loop that started
+// before that is gone
+static void looper_remap(t_looper *x, const t_ring_map *map)
+{
+  int size = map->m_new_size;
+  for (int i = 0; i < x->x_num_loops; i++) {
+    t_loop *l = &x->x_loops[i];
+    if (l->l_state == STATE_IDLE) continue;
+    int age = (map->m_old_phase - l->l_start) & (map->m_old_size - 1);
+    if (age < l->l_length) age += map->m_old_size;
+    if (age > size) {
+      if (x->x_active == i) x->x_active = -1;
+      loop_clear(l);
+      continue;
+    }
+    if (l->l_preroll > size - age) l->l_preroll = size - age;
+    l->l_start = ring_buffer_remap(map, l->l_start);
+    l->l_read_phase = ring_buffer_remap(map, l->l_read_phase);
+    // x_undo is indexed like the old buffer
+    l->l_layer_samples = 0;
+    l->l_undo_left = 0;
   }
+  looper_forget_sync(x);
+}
 
-  x->x_input_buffer_samples = buffer_size;
-  x->x_write_phase = 0;
-  post("looper~: (debug) x_input_buffer_samples: %d", x->x_input_buffer_samples);
+// new storage: an array or a file that was read is the selected track's
+// loop, from its first sample, with nothing before it to fade from. a
+// recording carries on into it. the other tracks are gone
+static void looper_switched(t_looper *x, int play)
+{
+  t_loop *sel = &x->x_loops[x->x_track];
+  t_looper_state state = play ? STATE_PLAYING : sel->l_state;
+  for (int i = 0; i < x->x_num_loops; i++) loop_clear(&x->x_loops[i]);
+  x->x_active = -1;
+  x->x_sync_length = 0;
+
+  if (state == STATE_RECORDING) {
+    sel->l_state = STATE_RECORDING;
+    sel->l_start = x->x_write_phase;
+    x->x_active = x->x_track;
+  } else if (state != STATE_IDLE && x->x_buffer.r_content > 0) {
+    sel->l_state = STATE_PLAYING;
+    sel->l_length = x->x_buffer.r_content;
+  }
 }
 
 static void set_system_params(t_looper *x, int blocksize, t_float sr)
 {
   x->x_pd_block_size = blocksize;
   x->x_s_per_msec = sr * 0.001f;
+  x->x_fade_samples = x->x_fade_ms * x->x_s_per_msec;
+  transport_set(&x->x_transport, x->x_transport.t_division, x->x_transport.t_bpm,
+                x->x_s_per_msec);
 }
 
-static t_int *looper_perform(t_int *w)
+// x_preroll for the sample rate, allocated here while perform isn't running
+static void preroll_update(t_looper *x)
 {
-  t_looper *x = (t_looper *)(w[1]);
-  t_sample *in1 = (t_sample *)(w[2]);
-  t_sample *out = (t_sample *)(w[3]);
-  int n = (int)(w[4]);
-
-  int input_buffer_samples = x->x_input_buffer_samples;
-  int input_buffer_mask = input_buffer_samples - 1;
-  int write_phase = x->x_write_phase & input_buffer_mask;
-  int read_phase = x->x_read_phase;
-  t_looper_state state = x->x_state;
-
-  t_sample *vp = x->x_input_buffer;
-
-  while (n--) {
-    t_sample f = *in1++;
-    t_sample ls = 0.0f;
-    int distance_to_end;
-
-    switch (state) {
-      case STATE_IDLE:
-        vp[write_phase] = f;
-        break;
-      case STATE_RECORDING:
-        vp[write_phase] = f;
-        ls = f;
-        break;
-      case STATE_PLAYING:
-        x->x_loop_pos++;
-        if (x->x_loop_pos >= x->x_loop_length) x->x_loop_pos = 0;
-        ls = vp[read_phase] * x->x_window_buffer[x->x_loop_pos];
-        break;
-      }
+  int size = ceilf(FADE_MAX_MS * x->x_s_per_msec);
+  if (size == x->x_preroll_size && x->x_preroll != NULL) return;
+  if (x->x_preroll != NULL) {
+    freebytes(x->x_preroll, (size_t)x->x_preroll_size * x->x_channels * sizeof(t_sample));
+  }
+  x->x_preroll = (t_sample *)getbytes((size_t)size * x->x_channels * sizeof(t_sample));
+  x->x_preroll_size = (x->x_preroll != NULL) ? size : 0;
+  x->x_preroll_phase = 0;
+  x->x_run = 0;
+  if (x->x_preroll == NULL) pd_error(x, "looper~: unable to allocate fade buffer");
+}
+
+
+// the input goes straight into the ring. an array's samples are spaced out
+// by 1 << shift
+static void record_block(t_sample *vp, int mask, int shift, int write_phase,
+                         const t_sample *in, int n)
+{
+  if (shift == 0) {
+    int first = mask + 1 - write_phase;
+    if (first > n) first = n;
+    memcpy(vp + write_phase, in, first * sizeof(t_sample));
+    memcpy(vp, in + first, (n - first) * sizeof(t_sample));
+  } else {
+    for (int i = 0; i < n; i++) vp[((write_phase + i) & mask) << shift] = in[i];
+  }
+}
+
+// a stretch of a loop that doesn't wrap around the ring, the loop end, the
+// start of the seam fade or the end of a gain ramp, at a gain that moves by
+// gain_step a sample. it's added to out, or with `add` 0 replaces it for the
+// first track in a span. the overdub and fade variants are split out so each
+// loop body stays branch free. vp steps by `stride` samples (2 for an array
+// of 8-byte t_words); x_undo is always our own storage
+static void play_span(const t_sample *vp, int stride, t_sample *out, int n, t_float gain,
+                      t_float gain_step, int add)
+{
+  if (!add && stride == 1 && gain_step == 0 && gain == 1) {
+    memcpy(out, vp, n * sizeof(t_sample));
+  } else if (!add) {
+    for (int i = 0; i < n; i++) out[i] = vp[i * stride] * (gain + i * gain_step);
+  } else {
+    for (int i = 0; i < n; i++) out[i] += vp[i * stride] * (gain + i * gain_step);
+  }
+}
 
-    *out++ = ls;
+// the end of the loop fading out while the audio that came just before its
+// start (pre) fades in. fade_pos is the fade-in table index of the first
+// sample; fade_size - index reads the same table as the fade out
+static void fade_span(const t_sample *vp, const t_sample *pre, int stride, t_sample *out,
+                      int n, const t_sample *fade, int fade_size, t_float fade_pos,
+                      t_float fade_step, t_float gain, t_float gain_step, int add)
+{
+  if (!add) memset(out, 0, n * sizeof(t_sample));
+  for (int i = 0; i < n; i++) {
+    t_float index = fade_pos + i * fade_step;
+    t_sample f = vp[i * stride] * window_table_read(fade, fade_size - index)
+               + pre[i * stride] * window_table_read(fade, index);
+    out[i] += f * (gain + i * gain_step);
+  }
+}
 
-    write_phase = (write_phase + 1) & input_buffer_mask;
-    if (state == STATE_PLAYING) {
-      read_phase = (read_phase + 1) & input_buffer_mask;
-      int loop_pos = (read_phase - x->x_loop_start) & input_buffer_mask;
-      if (loop_pos >= x->x_loop_length) {
-        read_phase = x->x_loop_start;
+// out already holds the input, see looper_span
+static void overdub_span(t_sample *vp, int stride, const t_sample *in, t_sample *out, int n,
+                         t_sample feedback, t_float gain, t_float gain_step)
+{
+  for (int i = 0; i < n; i++) {
+    t_sample old = vp[i * stride];
+    vp[i * stride] = old * feedback + in[i];
+    out[i] += old * (gain + i * gain_step);
+  }
+}
+
+static void overdub_fade_span(t_sample *vp, const t_sample *pre, int stride,
+                              const t_sample *in, t_sample *out, int n, const t_sample *fade,
+                              int fade_size, t_float fade_pos, t_float fade_step,
+                              t_sample feedback, t_float gain, t_float gain_step)
+{
+  for (int i = 0; i < n; i++) {
+    t_float index = fade_pos + i * fade_step;
+    t_sample old = vp[i * stride];
+    vp[i * stride] = old * feedback + in[i];
+    t_sample f = old * window_table_read(fade, fade_size - index)
+               + pre[i * stride] * window_table_read(fade, index);
+    out[i] += f * (gain + i * gain_step);
+  }
+}
+
+// the first pass of an overdub layer keeps what it's about to replace
+static void save_span(const t_sample *vp, int stride, t_sample *undo, int n)
+{
+  for (int i = 0; i < n; i++) undo[i] = vp[i * stride];
+}
+
+// exchanges a stretch of the loop with what x_undo kept of it
+static void swap_span(t_sample *vp, int stride, t_sample *undo, int n)
+{
+  for (int i = 0; i < n; i++) {
+    t_sample f = vp[i * stride];
+    vp[i * stride] = undo[i];
+    undo[i] = f;
+  }
+}
+
+// starts swapping `length` samples of the loop from offset `start` with what
+// x_undo holds for them, from the first of them the play head gets to
+static void undo_begin(t_looper *x, t_loop *l, int start, int length)
+{
+  int mask = x->x_buffer.r_size - 1;
+  int offset = (l->l_read_phase - l->l_start) & mask;
+  if (offset >= l->l_length) offset = 0;
+  int next = offset - start;
+  if (next < 0) next += l->l_length;
+  if (next >= length) next = 0;
+  l->l_undo_start = start;
+  l->l_undo_length = length;
+  l->l_undo_next = next;
+  l->l_undo_left = length;
+}
+
+// swaps up to UNDO_SPEED * n samples of a pending undo, before the loop
+// plays n. it starts at the play head and stays ahead of it, so the whole
+// layer sounds undone at once, but a long loop isn't swapped in one block.
+// an overdub started meanwhile only saves what the play head has passed,
+// which is swapped already, so what it keeps in x_undo is the undone audio
+static void undo_step(t_looper *x, t_loop *l, t_sample *vp, int mask, int shift, int n)
+{
+  if (x->x_undo.r_size != mask + 1) {
+    l->l_undo_left = 0;
+    return;
+  }
+  int budget = UNDO_SPEED * n;
+  while (budget > 0 && l->l_undo_left > 0) {
+    int offset = l->l_undo_start + l->l_undo_next;
+    if (offset >= l->l_length) offset -= l->l_length;
+    int index = (l->l_start + offset) & mask;
+    int span = l->l_undo_length - l->l_undo_next;
+    if (span > l->l_undo_left) span = l->l_undo_left;
+    if (span > budget) span = budget;
+    if (span > l->l_length - offset) span = l->l_length - offset;
+    if (span > mask + 1 - index) span = mask + 1 - index;
+    for (int c = 0; c < x->x_channels; c++) {
+      // only our own storage has more than one channel, and its shift is 0
+      size_t plane = (size_t)c * (mask + 1);
+      swap_span(vp + plane + ((size_t)index << shift), 1 << shift,
+                (t_sample *)x->x_undo.r_samples + plane + index, span);
+    }
+    l->l_undo_next += span;
+    if (l->l_undo_next >= l->l_undo_length) l->l_undo_next = 0;
+    l->l_undo_left -= span;
+    budget -= span;
+  }
+  ring_buffer_written(&x->x_buffer);
+}
+
+// the output is silent, on every channel
+static void silence(t_looper *x, t_sample *out, int n)
+{
+  for (int c = 0; c < x->x_channels; c++) {
+    memset(out + (size_t)c * x->x_pd_block_size, 0, n * sizeof(t_sample));
+  }
+}
+
+// adds one playing or overdubbing track to out, or writes it there if `add`
+// is 0; an overdub always adds, to the input. every channel plays the same
+// stretch of the loop, so the spans are worked out once for all of them.
+//
+// the seam is an equal-power crossfade: over the last `fade` samples of each
+// pass the loop fades out while the input that led into its first sample
+// fades back in, so the pass after it carries on from where the fade ends.
+// that audio is kept in the ring just before l_start (l_preroll). everything
+// outside the fade is a straight copy at the track's level
+static void play_loop(t_looper *x, t_loop *l, t_sample *vp, int mask, int shift,
+                      const t_sample *in, t_sample *out, int n, int add)
+{
+  int loop_start = l->l_start;
+  int loop_length = l->l_length;
+  int overdub = (l->l_state == STATE_OVERDUB);
+  int channels = x->x_channels;
+  int stride = x->x_pd_block_size;
+  t_ramp *level = &l->l_level;
+  if (l->l_undo_left > 0) undo_step(x, l, vp, mask, shift, n);
+
+  int read_phase = l->l_read_phase;
+  int offset = (read_phase - loop_start) & mask;
+  if (offset >= loop_length) {
+    read_phase = loop_start;
+    offset = 0;
+  }
+
+  int fade = x->x_fade_samples;
+  if (fade > l->l_preroll) fade = l->l_preroll;
+  if (fade > loop_length) fade = loop_length;
+  int fade_start = loop_length - fade;
+  const t_sample *fade_table = x->x_fade->w_samples;
+  int fade_size = x->x_fade->w_size;
+  t_float fade_step = (fade > 0) ? (t_float)fade_size / fade : 0;
+
+  t_sample feedback = x->x_feedback;
+  // the first pass of a layer saves what it replaces, until the undo buffer
+  // has caught up with a resize
+  t_sample *undo = (overdub && x->x_undo.r_size == mask + 1) ? x->x_undo.r_samples : NULL;
+
+  while (n > 0) {
+    int fading = (offset >= fade_start);
+    int span = (fading ? loop_length : fade_start) - offset;
+    if (span > n) span = n;
+    if (span > mask + 1 - read_phase) span = mask + 1 - read_phase;
+    // the fade reads the audio loop_length samples before the loop position
+    int pre_phase = (read_phase - loop_length) & mask;
+    if (fading && span > mask + 1 - pre_phase) span = mask + 1 - pre_phase;
+    int saving = (undo != NULL && l->l_layer_samples < loop_length);
+    if (saving && span > loop_length - l->l_layer_samples) {
+      span = loop_length - l->l_layer_samples;
+    }
+    if (level->r_left > 0 && span > level->r_left) span = level->r_left;
+    t_float gain = level->r_value;
+    t_float gain_step = (level->r_left > 0) ? level->r_step : 0;
+    // the last sample of the fade is all pre, which the next pass continues
+    t_float fade_pos = (offset - fade_start + 1) * fade_step;
+
+    for (int c = 0; c < channels; c++) {
+      // only our own storage has more than one channel, and its shift is 0
+      size_t plane = (size_t)c * (mask + 1);
+      t_sample *span_vp = vp + plane + (read_phase << shift);
+      const t_sample *span_pre = vp + plane + (pre_phase << shift);
+      const t_sample *span_in = in + (size_t)(c % x->x_in_channels) * stride;
+      t_sample *span_out = out + (size_t)c * stride;
+      if (saving) save_span(span_vp, 1 << shift, undo + plane + read_phase, span);
+      if (!overdub && !fading) {
+        play_span(span_vp, 1 << shift, span_out, span, gain, gain_step, add);
+      } else if (!overdub) {
+        fade_span(span_vp, span_pre, 1 << shift, span_out, span, fade_table, fade_size,
+                  fade_pos, fade_step, gain, gain_step, add);
+      } else if (!fading) {
+        overdub_span(span_vp, 1 << shift, span_in, span_out, span, feedback, gain,
+                     gain_step);
+      } else {
+        overdub_fade_span(span_vp, span_pre, 1 << shift, span_in, span_out, span, fade_table,
+                          fade_size, fade_pos, fade_step, feedback, gain, gain_step);
       }
     }
+    if (saving) l->l_layer_samples += span;
+    ramp_advance(level, span);
+
+    in += span;
+    out += span;
+    n -= span;
+    offset += span;
+    read_phase = (read_phase + span) & mask;
+    if (offset >= loop_length) {
+      read_phase = loop_start;
+      offset = 0;
+    }
+  }
+
+  l->l_read_phase = read_phase;
+}
+
+// how many samples can be written from the write phase on before running
+// into a track's region, and which track that is (NULL for none)
+static int looper_room(const t_looper *x, t_loop **limit)
+{
+  int mask = x->x_buffer.r_size - 1;
+  int room = mask + 1;
+  *limit = NULL;
+  for (int i = 0; i < x->x_num_loops; i++) {
+    t_loop *l = &x->x_loops[i];
+    if (l->l_state == STATE_IDLE) continue;
+    // a recording ends at the write phase, so it only limits itself once
+    // it has gone all the way round
+    int ahead = (l->l_state == STATE_RECORDING)
+      ? mask + 1 - l->l_preroll - l->l_length
+      : (l->l_start - l->l_preroll - x->x_write_phase) & mask;
+    if (ahead < room) {
+      room = ahead;
+      *limit = l;
+    }
+  }
+  return room;
+}
+
+// record_block for every channel, from the write phase on
+static void record_channels(t_looper *x, const t_sample *in, int n)
+{
+  int mask = x->x_buffer.r_size - 1;
+  int shift = x->x_buffer.r_shift;
+  int stride = x->x_pd_block_size;
+  for (int c = 0; c < x->x_channels; c++) {
+    record_block(ring_buffer_channel(&x->x_buffer, c), mask, shift, x->x_write_phase,
+                 in + (size_t)(c % x->x_in_channels) * stride, n);
+  }
+  x->x_write_phase = (x->x_write_phase + n) & mask;
+}
+
+// the input goes through x_preroll, recording or not. only the last fade's
+// worth of it is ever copied out, so a longer stretch skips the rest
+static void preroll_write(t_looper *x, const t_sample *in, int n)
+{
+  int size = x->x_preroll_size;
+  int keep = (x->x_fade_samples < size) ? x->x_fade_samples : size;
+  int skip = (n > keep) ? n - keep : 0;
+  if (skip > 0) x->x_run = 0;
+  n -= skip;
+  if (n == 0) return;
+  int first = size - x->x_preroll_phase;
+  if (first > n) first = n;
+  for (int c = 0; c < x->x_channels; c++) {
+    const t_sample *from = in + (size_t)(c % x->x_in_channels) * x->x_pd_block_size + skip;
+    t_sample *to = x->x_preroll + (size_t)c * size;
+    memcpy(to + x->x_preroll_phase, from, first * sizeof(t_sample));
+    memcpy(to, from + first, (n - first) * sizeof(t_sample));
+  }
+  x->x_preroll_phase += n;
+  if (x->x_preroll_phase >= size) x->x_preroll_phase -= size;
+  x->x_run += n;
+  if (x->x_run > size) x->x_run = size;
+}
+
+// a new recording goes after the end of whichever region has the most free
+// space ahead of it, so loops that were dropped leave room that's used again
+static void looper_place(t_looper *x)
+{
+  int mask = x->x_buffer.r_size - 1;
+  int best = -1;
+  for (int i = 0; i < x->x_num_loops; i++) {
+    const t_loop *l = &x->x_loops[i];
+    if (l->l_state == STATE_IDLE) continue;
+    int end = (l->l_start + l->l_length) & mask;
+    int room = mask + 1;
+    for (int j = 0; j < x->x_num_loops; j++) {
+      const t_loop *o = &x->x_loops[j];
+      if (o->l_state == STATE_IDLE) continue;
+      int ahead = (o->l_start - o->l_preroll - end) & mask;
+      if (j == i) ahead = mask + 1 - o->l_preroll - o->l_length;
+      if (ahead < room) room = ahead;
+    }
+    if (room > best) {
+      best = room;
+      x->x_write_phase = end;
+    }
+  }
+}
+
+// the last `preroll` samples of input go into the ring just before the write
+// phase, which moves on past them
+static void preroll_copy(t_looper *x, int preroll)
+{
+  int mask = x->x_buffer.r_size - 1;
+  int shift = x->x_buffer.r_shift;
+  int size = x->x_preroll_size;
+  int from = x->x_preroll_phase - preroll;
+  int second = (from < 0) ? x->x_preroll_phase : 0;
+  if (from < 0) from += size;
+  for (int c = 0; c < x->x_channels; c++) {
+    t_sample *vp = ring_buffer_channel(&x->x_buffer, c);
+    const t_sample *pre = x->x_preroll + (size_t)c * size;
+    record_block(vp, mask, shift, x->x_write_phase, pre + from, preroll - second);
+    record_block(vp, mask, shift, (x->x_write_phase + preroll - second) & mask, pre, second);
+  }
+  x->x_write_phase = (x->x_write_phase + preroll) & mask;
+  if (preroll > 0) ring_buffer_written(&x->x_buffer);
+}
+
+// a recording becomes a playing loop. with `round`, a loop after the first is
+// rounded to a whole number of the first one's length, and carries on
+// recording if that's longer
+static void loop_close(t_looper *x, t_loop *l, int round)
+{
+  if (round && x->x_sync_length > 0) {
+    int sync = x->x_sync_length;
+    int target = ((l->l_length + sync / 2) / sync) * sync;
+    if (target < sync) target = sync;
+    if (target > l->l_length) {
+      l->l_target = target;
+      return;
+    }
+    l->l_length = target;
+  }
+  if (x->x_sync_length == 0) x->x_sync_length = l->l_length;
+  l->l_target = 0;
+  l->l_state = (l->l_length > 0) ? STATE_PLAYING : STATE_IDLE;
+  l->l_read_phase = l->l_start;
+  if (x->x_active == (int)(l - x->x_loops)) x->x_active = -1;
+}
+
+// the recording track takes up to `n` samples of input, and returns how many
+// it took. *closing is set once it has to stop: at its quantized length, or
+// on running into another track's region. running into its own start drops
+// the oldest audio instead
+static int loop_record(t_looper *x, t_loop *l, const t_sample *in, int n, int *closing)
+{
+  int mask = x->x_buffer.r_size - 1;
+  *closing = 0;
+  if (l->l_target > 0 && n >= l->l_target - l->l_length) {
+    n = l->l_target - l->l_length;
+    *closing = 1;
+  }
+  t_loop *limit;
+  int room = looper_room(x, &limit);
+  if (room < n && limit == l) {
+    // first from before the loop, then from its start
+    int excess = n - room;
+    int preroll = (excess < l->l_preroll) ? excess : l->l_preroll;
+    l->l_preroll -= preroll;
+    excess -= preroll;
+    if (excess > l->l_length) excess = l->l_length;
+    l->l_start = (l->l_start + excess) & mask;
+    l->l_length -= excess;
+    room = looper_room(x, &limit);
+  }
+  if (room < n) {
+    n = room;
+    *closing = 1;
+  }
+  record_channels(x, in, n);
+  ring_buffer_written(&x->x_buffer);
+  l->l_length += n;
+  return n;
+}
+
+// n samples with no state change: the tracks summed into out. while a track
+// records or overdubs, out starts out as the input, like recording monitors
+// it. in and out are multichannel signals, x_pd_block_size samples from one
+// channel to the next, and may share memory
+static void looper_span(t_looper *x, const t_sample *in, t_sample *out, int n,
+                        int recorded)
+{
+  int mask = x->x_buffer.r_size - 1;
+  int shift = x->x_buffer.r_shift;
+  int stride = x->x_pd_block_size;
+  t_sample *vp = x->x_buffer.r_samples;
+  t_loop *overdub = NULL;
+  if (x->x_active >= 0 && x->x_loops[x->x_active].l_state == STATE_OVERDUB) {
+    overdub = &x->x_loops[x->x_active];
+  }
+
+  int add = (recorded || overdub != NULL);
+  if (add) {
+    for (int c = 0; c < x->x_channels; c++) {
+      const t_sample *from = in + (size_t)(c % x->x_in_channels) * stride;
+      t_sample *to = out + (size_t)c * stride;
+      if (to != from) memmove(to, from, n * sizeof(t_sample));
+    }
+  }
+
+  // the overdub reads the input, so it goes before anything else is added
+  if (overdub != NULL) {
+    play_loop(x, overdub, vp, mask, shift, in, out, n, 1);
+    ring_buffer_written(&x->x_buffer);
+  }
+  for (int i = 0; i < x->x_num_loops; i++) {
+    t_loop *l = &x->x_loops[i];
+    if (l->l_state == STATE_PLAYING && l->l_length > 0) {
+      play_loop(x, l, vp, mask, shift, in, out, n, add);
+      add = 1;
+    }
+  }
+  if (!add) silence(x, out, n);
+}
+
+// state changes, applied by looper_perform at the sample the message was
+// sent for (see event_queue.h). they act on the selected track
+
+// whichever other track takes the input stops, so `l` can have it. a
+// recording closes where it is, without rounding
+static void looper_release(t_looper *x, t_loop *l)
+{
+  if (x->x_active < 0 || &x->x_loops[x->x_active] == l) return;
+  t_loop *active = &x->x_loops[x->x_active];
+  if (active->l_state == STATE_RECORDING) {
+    loop_close(x, active, 0);
+  } else {
+    active->l_state = STATE_PLAYING;
+  }
+  x->x_active = -1;
+}
+
+// from recording, starts the loop playing (a second bang while a quantized
+// loop waits for its length closes it there). otherwise records a new loop
+// for the track in the largest free space, with the input that came just
+// before it copied in first for the seam fade
+static void apply_bang(t_looper *x, int track)
+{
+  t_loop *l = &x->x_loops[track];
+  if (l->l_state == STATE_RECORDING) {
+    loop_close(x, l, x->x_quantize && l->l_target == 0);
+    return;
+  }
+
+  looper_release(x, l);
+  loop_clear(l); // the old loop is gone
+  looper_forget_sync(x);
+  looper_place(x);
+  t_loop *limit;
+  int preroll = (x->x_run < x->x_fade_samples) ? x->x_run : x->x_fade_samples;
+  int room = looper_room(x, &limit);
+  if (preroll > room / 2) preroll = room / 2;
+  preroll_copy(x, preroll);
+  l->l_state = STATE_RECORDING;
+  l->l_start = x->x_write_phase;
+  l->l_preroll = preroll;
+  x->x_active = track;
+}
+
+// toggles between playing and overdubbing; from recording it closes the loop
+// first. each overdub starts a new layer that `undo` can take back
+static void apply_overdub(t_looper *x, int track)
+{
+  t_loop *l = &x->x_loops[track];
+  if (l->l_state == STATE_OVERDUB) {
+    l->l_state = STATE_PLAYING;
+    x->x_active = -1;
+    return;
+  }
+  if (l->l_state == STATE_RECORDING) apply_bang(x, track);
+  if (l->l_state != STATE_PLAYING || l->l_length <= 0) return;
+
+  looper_release(x, l);
+  int mask = x->x_buffer.r_size - 1;
+  l->l_layer_start = (l->l_read_phase - l->l_start) & mask;
+  if (l->l_layer_start >= l->l_length) l->l_layer_start = 0;
+  l->l_layer_samples = 0;
+  l->l_state = STATE_OVERDUB;
+  x->x_active = track;
+}
+
+// swaps the last layer with what it replaced, so a second undo redoes it.
+// play_loop does the swapping, see undo_step; one that comes in while it's
+// still at it only has to swap back what it has done so far
+static void apply_undo(t_looper *x)
+{
+  t_loop *l = &x->x_loops[x->x_track];
+  int mask = x->x_buffer.r_size - 1;
+  if (l->l_layer_samples <= 0 || x->x_undo.r_size != mask + 1) return;
+  if (l->l_state == STATE_OVERDUB) {
+    l->l_state = STATE_PLAYING;
+    x->x_active = -1;
+  }
+  if (l->l_undo_left > 0) {
+    int done = l->l_undo_length - l->l_undo_left;
+    int first = l->l_undo_next - done;
+    if (first < 0) first += l->l_undo_length;
+    int start = l->l_undo_start + first;
+    if (start >= l->l_length) start -= l->l_length;
+    undo_begin(x, l, start, done);
+    return;
+  }
+  undo_begin(x, l, l->l_layer_start, l->l_layer_samples);
+}
+
+// the track's loop is dropped and its part of the ring is free again
+static void apply_idle(t_looper *x)
+{
+  if (x->x_active == x->x_track) x->x_active = -1;
+  loop_clear(&x->x_loops[x->x_track]);
+  looper_forget_sync(x);
+}
+
+static void apply_level(t_looper *x, t_loop *l)
+{
+  ramp_set(&l->l_level, l->l_mute ? 0.0f : l->l_gain, GAIN_RAMP_MS * x->x_s_per_msec);
+}
+
+// a bang or overdub that was waiting for a tick
+static void looper_tick(t_looper *x)
+{
+  if (x->x_deferred == EVENT_BANG) apply_bang(x, x->x_deferred_track);
+  if (x->x_deferred == EVENT_OVERDUB) apply_overdub(x, x->x_deferred_track);
+  x->x_deferred = -1;
+}
+
+static void apply_event(t_looper *x, const t_event *e)
+{
+  t_loop *l = &x->x_loops[x->x_track];
+  switch (e->e_type) {
+    case EVENT_BANG:
+    case EVENT_OVERDUB:
+      // with sync on, recording starts and stops on the next tick
+      x->x_deferred = e->e_type;
+      x->x_deferred_track = x->x_track;
+      if (x->x_transport.t_division == 0) looper_tick(x);
+      break;
+    case EVENT_IDLE: apply_idle(x); break;
+    case EVENT_UNDO: apply_undo(x); break;
+    case EVENT_FEEDBACK: x->x_feedback = e->e_value; break;
+    case EVENT_FADE:
+      x->x_fade_ms = e->e_value;
+      x->x_fade_samples = x->x_fade_ms * x->x_s_per_msec;
+      break;
+    case EVENT_TRACK: x->x_track = e->e_value; break;
+    case EVENT_GAIN:
+      l->l_gain = e->e_value;
+      apply_level(x, l);
+      break;
+    case EVENT_MUTE:
+      l->l_mute = (e->e_value != 0);
+      apply_level(x, l);
+      break;
+    case EVENT_QUANTIZE: x->x_quantize = (e->e_value != 0); break;
+    case EVENT_SYNC:
+      transport_set(&x->x_transport, e->e_value, x->x_transport.t_bpm, x->x_s_per_msec);
+      if (x->x_transport.t_division == 0) looper_tick(x);
+      break;
+    case EVENT_TEMPO:
+      transport_set(&x->x_transport, x->x_transport.t_division, e->e_value, x->x_s_per_msec);
+      break;
+  }
+}
+
+// n samples in the current state. a recording can stop part way through, at
+// its quantized length or when it runs out of room, so the block is cut
+// there and the rest goes on with the loop playing
+static void looper_stretch(t_looper *x, const t_sample *in, t_sample *out, int n)
+{
+  while (n > 0) {
+    int span = n;
+    t_loop *rec = NULL;
+    if (x->x_active >= 0 && x->x_loops[x->x_active].l_state == STATE_RECORDING) {
+      rec = &x->x_loops[x->x_active];
+    }
+    if (rec != NULL) {
+      int closing;
+      span = loop_record(x, rec, in, n, &closing);
+      if (span > 0) looper_span(x, in, out, span, 1);
+      if (closing) loop_close(x, rec, 0);
+    } else {
+      looper_span(x, in, out, span, 0);
+    }
+    in += span;
+    out += span;
+    n -= span;
   }
+}
 
-  x->x_read_phase = read_phase;
-  x->x_write_phase = write_phase;
-  return (w+5);
+// n samples between events, cut at every tick while synced
+static void looper_block(t_looper *x, const t_sample *in, const t_sample *sync,
+                         t_sample *out, int n)
+{
+  preroll_write(x, in, n);
+  if (x->x_transport.t_division == 0) {
+    looper_stretch(x, in, out, n);
+    return;
+  }
+  while (n > 0) {
+    int span = transport_next(&x->x_transport, sync, n);
+    if (span == 0) {
+      transport_take(&x->x_transport);
+      looper_tick(x);
+      continue;
+    }
+    looper_stretch(x, in, out, span);
+    transport_advance(&x->x_transport, span);
+    in += span;
+    sync += span;
+    out += span;
+    n -= span;
+  }
+}
+
+// one DSP block, timed or not by looper_perform
+DSP_INLINE void looper_run(t_looper *x, const t_sample *in1, const t_sample *in2,
+                           t_sample *out, int n)
+{
+  t_ring_map map;
+  switch (ring_buffer_adopt(&x->x_buffer, &x->x_write_phase, &map)) {
+    case RING_BUFFER_RESIZED: looper_remap(x, &map); break;
+    case RING_BUFFER_SWITCHED: looper_switched(x, 0); break;
+    case RING_BUFFER_LOADED: looper_switched(x, 1); break;
+  }
+  if (ring_buffer_adopt(&x->x_undo, &x->x_undo_phase, &map)) {
+    for (int i = 0; i < x->x_num_loops; i++) {
+      x->x_loops[i].l_layer_samples = 0;
+      x->x_loops[i].l_undo_left = 0;
+    }
+  }
+
+  transport_block(&x->x_transport, n, x->x_s_per_msec);
+
+  // split the block wherever an event is due
+  double block_start = event_queue_block_start(&x->x_events, n, x->x_s_per_msec);
+  const t_event *e;
+  int done = 0, offset;
+  while ((e = event_queue_next(&x->x_events, block_start, x->x_s_per_msec, n, &offset)) != NULL) {
+    if (offset > done) {
+      looper_block(x, in1 + done, in2 + done, out + done, offset - done);
+      done = offset;
+    }
+    apply_event(x, e);
+    event_queue_pop(&x->x_events);
+  }
+  if (done < n) looper_block(x, in1 + done, in2 + done, out + done, n - done);
+
+  ring_buffer_publish(&x->x_buffer, x->x_write_phase);
+}
+
+// how much of the buffer the loops take up, counting a recording so far
+static t_float looper_fill(const t_looper *x)
+{
+  int length = 0;
+  for (int i = 0; i < x->x_num_loops; i++) length += x->x_loops[i].l_length;
+  return (t_float)length / x->x_buffer.r_size;
+}
+
+static t_int *looper_perform(t_int *w)
+{
+  t_looper *x = (t_looper *)(w[1]);
+  t_sample *in1 = (t_sample *)(w[2]);
+  t_sample *in2 = (t_sample *)(w[3]);
+  t_sample *out = (t_sample *)(w[4]);
+  int n = (int)(w[5]);
+
+  if (x->x_stats.s_enabled) {
+    double start = dsp_stats_now();
+    looper_run(x, in1, in2, out, n);
+    dsp_stats_block(&x->x_stats, start, n, 0, looper_fill(x));
+  } else {
+    looper_run(x, in1, in2, out, n);
+  }
+  return (w+6);
 }
 
 static void looper_dsp(t_looper *x, t_signal **sp)
 {
-  dsp_add(looper_perform, 4, x, sp[0]->s_vec, sp[1]->s_vec, sp[0]->s_length);
+  x->x_in_channels = sp[0]->s_nchans;
+  signal_setmultiout(&sp[2], x->x_channels);
+  dsp_add(looper_perform, 5, x, sp[0]->s_vec, sp[1]->s_vec, sp[2]->s_vec, sp[0]->s_length);
   set_system_params(x, sp[0]->s_length, sp[0]->s_sr);
+  preroll_update(x);
   input_buffer_update(x);
 }
 
+static void looper_event(t_looper *x, t_looper_event type, t_float value)
+{
+  if (!event_queue_push(&x->x_events, type, value)) {
+    pd_error(x, "looper~: too many messages in one block, dropping one");
+  }
+}
+
 static void looper_bang(t_looper *x)
 {
-  x->x_state = (x->x_state == STATE_RECORDING) ? STATE_PLAYING : STATE_RECORDING;
+  looper_event(x, EVENT_BANG, 0);
+}
 
-  if (x->x_state == STATE_RECORDING) {
-    x->x_loop_start = x->x_write_phase;
-    x->x_loop_length = 0;
-  } else {
-    x->x_read_phase = x->x_loop_start;
-    x->x_loop_pos = 0;
-    x->x_loop_length = (x->x_write_phase - x->x_loop_start) & x->x_input_buffer_samples - 1;
-    for (int i = 0; i < x->x_loop_length; i++) {
-      float phase = (float)i / (x->x_loop_length - 1);
-      x->x_window_buffer[i] = 0.5f * (1.0f - cos(2.0f * M_PI * phase));
-    }
+ static void looper_idle(t_looper *x)
+{
+  looper_event(x, EVENT_IDLE, 0);
+}
+
+static void looper_overdub(t_looper *x)
+{
+  const t_loop *l = &x->x_loops[x->x_track_sent];
+  if (event_queue_empty(&x->x_events) && l->l_state != STATE_RECORDING
+      && l->l_state != STATE_OVERDUB
+      && (l->l_state != STATE_PLAYING || l->l_length <= 0)) {
+    pd_error(x, "looper~: overdub: nothing recorded yet");
+    return;
   }
+  looper_event(x, EVENT_OVERDUB, 0);
 }
 
- static void looper_idle(t_looper *x)
+// feedback 1 keeps every layer at full level, lower values fade older layers
+// out a little on each pass
+static void looper_feedback(t_looper *x, t_floatarg f)
+{
+  if (f < 0.0f) f = 0.0f;
+  if (f > 1.0f) f = 1.0f;
+  looper_event(x, EVENT_FEEDBACK, f);
+}
+
+// fade <ms>: length of the crossfade at the loop seam, 0 for a plain cut, up
+// to FADE_MAX_MS
+static void looper_fade(t_looper *x, t_floatarg f)
+{
+  if (f > FADE_MAX_MS) f = FADE_MAX_MS;
+  looper_event(x, EVENT_FADE, (f > 0) ? f : 0);
+}
+
+static void looper_undo(t_looper *x)
+{
+  if (event_queue_empty(&x->x_events) && x->x_loops[x->x_track_sent].l_layer_samples <= 0) {
+    pd_error(x, "looper~: undo: nothing to undo");
+    return;
+  }
+  looper_event(x, EVENT_UNDO, 0);
+}
+
+// track <n>: the track (from 0) that the other messages act on from now on
+static void looper_track(t_looper *x, t_floatarg f)
+{
+  int track = f;
+  if (track < 0 || track >= x->x_num_loops) {
+    pd_error(x, "looper~: track: no track %d (0 to %d)", track, x->x_num_loops - 1);
+    return;
+  }
+  x->x_track_sent = track;
+  looper_event(x, EVENT_TRACK, track);
+}
+
+// gain <g>: the selected track's level, ramped
+static void looper_gain(t_looper *x, t_floatarg f)
+{
+  looper_event(x, EVENT_GAIN, (f > 0) ? f : 0);
+}
+
+// mute 1|0: silences the selected track, which keeps going
+static void looper_mute(t_looper *x, t_floatarg f)
+{
+  looper_event(x, EVENT_MUTE, f != 0);
+}
+
+// quantize 1|0: rounds each loop after the first to a whole number of the
+// first one's length, so they stay in step. a loop stopped short keeps
+// recording up to the next multiple
+static void looper_quantize(t_looper *x, t_floatarg f)
+{
+  looper_event(x, EVENT_QUANTIZE, f != 0);
+}
+
+
+// sync <n>: bang and overdub wait for the next of n ticks per beat, so loops
+// start and end on the beat; 0 (the default) turns it off. see transport.h
+static void looper_sync(t_looper *x, t_floatarg f)
+{
+  looper_event(x, EVENT_SYNC, (f > 0) ? (int)f : 0);
+}
+
+// tempo <bpm>: where the beat comes from while synced: Pd's clock at that
+// tempo, or with 0 (the default) one cycle of the phasor~ in the right inlet
+static void looper_tempo(t_looper *x, t_floatarg f)
+{
+  looper_event(x, EVENT_TEMPO, (f > 0) ? f : 0);
+}
+
+// set <array>: record into and play the loop from a Pd array instead of the
+// internal buffer. the whole array (up to the largest power of 2 that fits)
+// becomes the selected track's loop, so a looper that's playing carries on
+// with the table; the other tracks are dropped. set with no array goes back
+// to the internal buffer
+static void looper_set(t_looper *x, t_symbol *s)
+{
+  if (ring_buffer_set_array(&x->x_buffer, s)) {
+    ring_buffer_request(&x->x_undo, ring_buffer_target_size(&x->x_buffer));
+  }
+}
+
+// the path of a file named in a message, relative to the patch
+static t_symbol *looper_path(t_looper *x, t_symbol *s)
 {
-  x->x_state = STATE_IDLE;
+  char path[MAXPDSTRING];
+  canvas_makefilename(x->x_canvas, s->s_name, path, MAXPDSTRING);
+  return gensym(path);
 }
 
+// write <file>: saves the selected track's loop as a 32-bit float WAVE file
+// if the name ends in .wav, raw floats otherwise. the loop keeps playing
+// while it's written
+static void looper_write(t_looper *x, t_symbol *s)
+{
+  const t_loop *l = &x->x_loops[x->x_track_sent];
+  if (l->l_state == STATE_RECORDING || l->l_length <= 0) {
+    pd_error(x, "looper~: write: nothing recorded yet");
+    return;
+  }
+  t_float sr = (x->x_s_per_msec > 0) ? x->x_s_per_msec * 1000.0f : sys_getsr();
+  ring_buffer_write_file(&x->x_buffer, looper_path(x, s), l->l_start, l->l_length, sr);
+}
+
+// read <file>: loads a WAVE or raw file as the selected track's loop and
+// plays it, dropping the other tracks. the old loops carry on until the new
+// one is all in
+static void looper_read(t_looper *x, t_symbol *s)
+{
+  ring_buffer_read_file(&x->x_buffer, looper_path(x, s));
+}
+
+// a read or write has finished: `read <samples>` or `write <samples>` out of
+// the right outlet. a loop that was read may need a bigger undo buffer
+static void looper_notify(t_object *owner, t_symbol *what, int samples)
+{
+  t_looper *x = (t_looper *)owner;
+  if (what == gensym("read")) {
+    ring_buffer_request(&x->x_undo, ring_buffer_target_size(&x->x_buffer));
+  }
+  t_atom a;
+  SETFLOAT(&a, samples);
+  outlet_anything(x->x_done, what, 1, &a);
+}
+
+// profile 1|0: times every DSP block from now on (or stops), see dsp_stats.h
+static void looper_profile(t_looper *x, t_floatarg f)
+{
+  if (!dsp_stats_enable(&x->x_stats, f != 0)) {
+    pd_error(x, "looper~: unable to allocate profiler");
+  }
+}
+
+// the blocks timed since the last `profile 1`, out of the right outlet.
+// there are no grains, so that field is always 0
+static void looper_stats(t_looper *x)
+{
+  t_float sr = (x->x_s_per_msec > 0) ? x->x_s_per_msec * 1000.0f : sys_getsr();
+  dsp_stats_report(&x->x_stats, x->x_done, sr);
+}
 
 static void looper_free(t_looper *x) {
-  if (x->x_input_buffer != NULL) {
-    freebytes(x->x_input_buffer, x->x_input_buffer_samples * sizeof(t_sample));
-    x->x_input_buffer = NULL;
+  ring_buffer_free(&x->x_buffer);
+  ring_buffer_free(&x->x_undo);
+  dsp_stats_free(&x->x_stats);
+
+  if (x->x_inlet_sync != NULL) {
+    inlet_free(x->x_inlet_sync);
+    x->x_inlet_sync = NULL;
+  }
+
+  if (x->x_preroll != NULL) {
+    freebytes(x->x_preroll, (size_t)x->x_preroll_size * x->x_channels * sizeof(t_sample));
+    x->x_preroll = NULL;
+  }
+
+  if (x->x_loops != NULL) {
+    freebytes(x->x_loops, x->x_num_loops * sizeof(t_loop));
+    x->x_loops = NULL;
   }
 
-  if (x->x_window_buffer != NULL) {
-    freebytes(x->x_window_buffer, x->x_input_buffer_samples * sizeof(t_sample));
-    x->x_window_buffer = NULL;
+  if (x->x_fade != NULL) {
+    window_table_release(x->x_fade);
+    x->x_fade = NULL;
   }
 }
 
@@ -211,13 +1219,43 @@ void looper_tilde_setup(void)
                            (t_newmethod)looper_new,
                            (t_method)looper_free,
                            sizeof(t_looper),
-                           CLASS_DEFAULT,
-                           A_DEFFLOAT, 0);
+                           CLASS_MULTICHANNEL,
+                           A_DEFFLOAT, A_DEFFLOAT, A_DEFFLOAT, 0);
 
   class_addmethod(looper_class, (t_method)looper_dsp,
                   gensym("dsp"), A_CANT, 0);
   class_addmethod(looper_class, (t_method)looper_idle,
                   gensym("idle"), 0);
+  class_addmethod(looper_class, (t_method)looper_overdub,
+                  gensym("overdub"), 0);
+  class_addmethod(looper_class, (t_method)looper_feedback,
+                  gensym("feedback"), A_FLOAT, 0);
+  class_addmethod(looper_class, (t_method)looper_undo,
+                  gensym("undo"), 0);
+  class_addmethod(looper_class, (t_method)looper_fade,
+                  gensym("fade"), A_FLOAT, 0);
+  class_addmethod(looper_class, (t_method)looper_track,
+                  gensym("track"), A_FLOAT, 0);
+  class_addmethod(looper_class, (t_method)looper_gain,
+                  gensym("gain"), A_FLOAT, 0);
+  class_addmethod(looper_class, (t_method)looper_mute,
+                  gensym("mute"), A_FLOAT, 0);
+  class_addmethod(looper_class, (t_method)looper_quantize,
+                  gensym("quantize"), A_FLOAT, 0);
+  class_addmethod(looper_class, (t_method)looper_sync,
+                  gensym("sync"), A_FLOAT, 0);
+  class_addmethod(looper_class, (t_method)looper_tempo,
+                  gensym("tempo"), A_FLOAT, 0);
+  class_addmethod(looper_class, (t_method)looper_set,
+                  gensym("set"), A_DEFSYM, 0);
+  class_addmethod(looper_class, (t_method)looper_write,
+                  gensym("write"), A_SYMBOL, 0);
+  class_addmethod(looper_class, (t_method)looper_read,
+                  gensym("read"), A_SYMBOL, 0);
+  class_addmethod(looper_class, (t_method)looper_profile,
+                  gensym("profile"), A_FLOAT, 0);
+  class_addmethod(looper_class, (t_method)looper_stats,
+                  gensym("stats"), 0);
   class_addbang(looper_class, looper_bang);
 
   CLASS_MAINSIGNALIN(looper_class, t_looper, x_f);
@@ -0,0 +1,232 @@
+#include "mapped_file.h"
+#include <errno.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define MAPPED_FILE_PASS_MS 5
+// a window that hasn't moved is still touched this often, so the kernel
+// doesn't take it for memory nobody uses
+#define MAPPED_FILE_REFRESH_MS 250
+
+#ifdef _WIN32
+
+int mapped_file_page(void)
+{
+  return 1;
+}
+
+t_mapped_file *mapped_file_open(const char *path, int size, int length, int guard)
+{
+  (void)path;
+  (void)size;
+  (void)length;
+  (void)guard;
+  errno = ENOSYS;
+  return NULL;
+}
+
+void mapped_file_close(t_mapped_file *f)
+{
+  (void)f;
+}
+
+#else
+
+typedef struct _prefetcher {
+  t_mapped_file p_file; // first, so a t_mapped_file * is a t_prefetcher *
+  char *p_base; // the whole mapping, guard pages and all
+  size_t p_bytes;
+  size_t p_page; // in samples
+  pthread_t p_thread;
+  _Atomic int p_quit;
+  int p_centre; // the window touched last
+  int p_since; // ms since it was touched in full
+} t_prefetcher;
+
+// the samples in [from, from + count) of the ring, as up to two runs
+static void ring_span(const t_mapped_file *f, int from, int count, int *start, int *run)
+{
+  if (count > f->m_size) count = f->m_size;
+  start[0] = dsp_wrap(from, f->m_size);
+  run[0] = count;
+  if (start[0] + count > f->m_size) run[0] = f->m_size - start[0];
+  start[1] = 0;
+  run[1] = count - run[0];
+}
+
+// asks for the pages to be read in the background, then reads one sample
+// from each so they're all there by the time this returns
+static void touch(t_prefetcher *p, int from, int count)
+{
+  int start[2], run[2];
+  ring_span(&p->p_file, from, count, start, run);
+  for (int k = 0; k < 2; k++) {
+    if (run[k] == 0) continue;
+    size_t page = p->p_page;
+    size_t first = start[k] / page * page;
+    t_sample *base = p->p_file.m_samples + first;
+    madvise(base, (start[k] + run[k] - first) * sizeof(t_sample), MADV_WILLNEED);
+    volatile t_sample *v = base;
+    for (size_t i = 0; first + i < (size_t)(start[k] + run[k]); i += page) (void)v[i];
+  }
+}
+
+// the first write to a clean page of a shared mapping faults too. an atomic
+// or of nothing dirties it without being able to lose a sample perform
+// writes at the same moment
+static void touch_for_writing(t_prefetcher *p, int from, int count)
+{
+  int start[2], run[2];
+  ring_span(&p->p_file, from, count, start, run);
+  for (int k = 0; k < 2; k++) {
+    if (run[k] == 0) continue;
+    size_t page = p->p_page;
+    for (size_t i = start[k] / page * page; i < (size_t)(start[k] + run[k]); i += page) {
+      atomic_fetch_or_explicit((_Atomic unsigned int *)&p->p_file.m_samples[i], 0u,
+                               memory_order_relaxed);
+    }
+  }
+}
+
+static void prefetch(t_prefetcher *p)
+{
+  t_mapped_file *f = &p->p_file;
+  int centre = atomic_load_explicit(&f->m_read_centre, memory_order_relaxed);
+  int moved = dsp_wrap(centre - p->p_centre, f->m_size);
+  if (moved > f->m_size / 2) moved = f->m_size - moved;
+
+  if (moved >= (int)p->p_page || p->p_since >= MAPPED_FILE_REFRESH_MS) {
+    touch(p, centre - MAPPED_FILE_WINDOW, 2 * MAPPED_FILE_WINDOW);
+    p->p_centre = centre;
+    p->p_since = 0;
+    atomic_store_explicit(&f->m_resident, centre, memory_order_release);
+  }
+  int phase = atomic_load_explicit(&f->m_write_phase, memory_order_relaxed);
+  touch_for_writing(p, phase, MAPPED_FILE_WRITE_AHEAD);
+}
+
+static void *prefetch_main(void *arg)
+{
+  t_prefetcher *p = (t_prefetcher *)arg;
+  struct timespec pass = {0, MAPPED_FILE_PASS_MS * 1000000L};
+  while (!atomic_load_explicit(&p->p_quit, memory_order_acquire)) {
+    nanosleep(&pass, NULL);
+    p->p_since += MAPPED_FILE_PASS_MS;
+    prefetch(p);
+  }
+  return NULL;
+}
+
+int mapped_file_page(void)
+{
+  return (int)((size_t)sysconf(_SC_PAGESIZE) / sizeof(t_sample));
+}
+
+// the file's pages with a page of anonymous memory either side for the
+// guard, or just the file's pages without one. returns the whole mapping
+static char *map_pages(int fd, size_t bytes, size_t lead)
+{
+  if (lead == 0) {
+    void *m = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return (m != MAP_FAILED) ? (char *)m : NULL;
+  }
+  void *m = mmap(NULL, bytes + 2 * lead, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                 -1, 0);
+  if (m == MAP_FAILED) return NULL;
+  // the file goes over the middle of it
+  if (mmap((char *)m + lead, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)
+      == MAP_FAILED) {
+    int e = errno;
+    munmap(m, bytes + 2 * lead);
+    errno = e;
+    return NULL;
+  }
+  return (char *)m;
+}
+
+t_mapped_file *mapped_file_open(const char *path, int size, int length, int guard)
+{
+  size_t bytes = (size_t)size * sizeof(t_sample);
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t lead = (guard > 0) ? page : 0;
+  if ((guard > 0 && bytes % page != 0) || guard * sizeof(t_sample) > page) {
+    errno = EINVAL;
+    return NULL;
+  }
+  int fd = open(path, (length > 0) ? (O_RDWR | O_CREAT) : O_RDWR, 0644);
+  if (fd < 0) return NULL;
+  struct stat st;
+  int ok = (fstat(fd, &st) == 0);
+  size_t wanted = (size_t)length * sizeof(t_sample);
+  if (ok && length > 0 && (size_t)st.st_size < wanted) {
+    ok = (ftruncate(fd, wanted) == 0);
+  } else if (ok && (size_t)st.st_size < bytes) {
+    ok = 0; // it's been cut short since its length was worked out
+    errno = EINVAL;
+  }
+  if (!ok) {
+    int e = errno;
+    close(fd);
+    errno = e;
+    return NULL;
+  }
+  char *base = map_pages(fd, bytes, lead);
+  int e = errno;
+  close(fd); // the mapping keeps the file
+  if (base == NULL) {
+    errno = e;
+    return NULL;
+  }
+
+  t_prefetcher *p = (t_prefetcher *)getbytes(sizeof(t_prefetcher));
+  if (p == NULL) {
+    munmap(base, bytes + 2 * lead);
+    errno = ENOMEM;
+    return NULL;
+  }
+  t_mapped_file *f = &p->p_file;
+  f->m_samples = (t_sample *)(base + lead);
+  f->m_size = size;
+  f->m_guard = guard;
+  atomic_init(&f->m_read_centre, 0);
+  atomic_init(&f->m_write_phase, 0);
+  atomic_init(&f->m_resident, 0);
+  p->p_base = base;
+  p->p_bytes = bytes + 2 * lead;
+  p->p_page = page / sizeof(t_sample);
+  atomic_init(&p->p_quit, 0);
+  dsp_guard_fill(f->m_samples, SAMPLE_FLOAT, size, guard);
+
+  // perform starts reading and writing around 0; have it all in before the
+  // storage is handed over
+  touch(p, -MAPPED_FILE_WINDOW, 2 * MAPPED_FILE_WINDOW);
+  touch_for_writing(p, 0, MAPPED_FILE_WRITE_AHEAD);
+  p->p_centre = 0;
+  p->p_since = 0;
+
+  if (pthread_create(&p->p_thread, NULL, prefetch_main, p) != 0) {
+    munmap(base, p->p_bytes);
+    freebytes(p, sizeof(t_prefetcher));
+    errno = EAGAIN;
+    return NULL;
+  }
+  return f;
+}
+
+void mapped_file_close(t_mapped_file *f)
+{
+  t_prefetcher *p = (t_prefetcher *)f;
+  atomic_store_explicit(&p->p_quit, 1, memory_order_release);
+  pthread_join(p->p_thread, NULL);
+  munmap(p->p_base, p->p_bytes);
+  freebytes(p, sizeof(t_prefetcher));
+}
+
+#endif
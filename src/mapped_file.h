@@ -0,0 +1,96 @@
+// ring buffer storage mapped from a file, for more audio than fits in RAM
+//
+// the file holds raw native t_samples and is mapped shared, so whatever is
+// recorded ends up in it. the kernel only keeps the parts that were touched
+// recently in memory, and touching a part that isn't costs a page fault (and a
+// disk read) that must never happen on the audio thread. each mapping has its
+// own prefetch thread: perform tells it where the grains are reading and
+// where it's writing, the thread faults those pages in (and dirties the ones
+// just ahead of the write phase, so the first write to a page doesn't fault
+// either: the write phase moves whether or not anything is recorded, and
+// recording can start on any block), then tells perform which window is
+// resident. perform keeps its reads inside that window, so a jump of the
+// position inlet lands a pass of the prefetcher (a few ms) late rather than
+// on a page fault.
+//
+// a mapping can also have guard samples either side, like our own storage
+// (DSP_GUARD, see dsp_kernels.h), so an owner that has them can wrap at the
+// file's own length rather than at a power of 2 (see dsp_wrap). they live in
+// memory of our own just before and after the file's pages, never in the
+// file: the part of its last page past the end of the file is zeroed by the
+// kernel whenever it writes the page back. so the ring is a whole number of
+// pages, and up to a page at the end of a file is left out of it.
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "m_pd.h"
+#include <stdatomic.h>
+#include "dsp_kernels.h"
+
+// samples either side of the read centre kept resident, ~11 s at 48k. reads
+// are kept within 3/4 of it, leaving the rest for grain offsets and lengths
+#define MAPPED_FILE_WINDOW (1 << 19)
+#define MAPPED_FILE_READ_REACH (MAPPED_FILE_WINDOW / 4 * 3)
+// samples ahead of the write phase kept resident and dirty
+#define MAPPED_FILE_WRITE_AHEAD (1 << 17)
+
+typedef struct _mapped_file t_mapped_file;
+
+// samples per page: a mapping with a guard is a whole number of them
+int mapped_file_page(void);
+
+// maps `size` samples of the file at path, with `guard` samples either side
+// (0 or DSP_GUARD, filled from the file), and makes the start of it resident
+// before returning. with a `length` it creates the file or extends it with
+// silence to that many samples if it's shorter; without (0), a missing file
+// or one shorter than `size` fails. size is a power of 2 without a guard and
+// a whole number of pages with one. returns NULL with errno set on failure.
+// blocks on the disk: call it from the worker thread
+t_mapped_file *mapped_file_open(const char *path, int size, int length, int guard);
+// stops the prefetcher and unmaps the file; also blocks on the disk
+void mapped_file_close(t_mapped_file *f);
+
+// the fields perform touches; the prefetch thread's own state is in mapped_file.c
+struct _mapped_file {
+  t_sample *m_samples;
+  int m_size;
+  int m_guard;
+  _Atomic int m_read_centre; // where perform wants to read
+  _Atomic int m_write_phase;
+  _Atomic int m_resident; // the read centre of the window that's resident
+};
+
+// perform routine side
+static inline void mapped_file_writing(t_mapped_file *f, int write_phase)
+{
+  atomic_store_explicit(&f->m_write_phase, write_phase, memory_order_relaxed);
+}
+
+// asks for the window around the last of the n grain start positions (whole
+// samples and fractions, see start_split in dsp_kernels.h) and pulls any that
+// are outside the resident window back to its edge. the distances are whole
+// samples, so nothing is rounded however long the file is
+static inline void mapped_file_clamp(t_mapped_file *f, int *start, t_sample *frac, int n)
+{
+  if (n <= 0) return;
+  int size = f->m_size;
+  atomic_store_explicit(&f->m_read_centre, dsp_wrap(start[n - 1], size), memory_order_relaxed);
+  if (size <= 2 * MAPPED_FILE_READ_REACH) return; // all of it is resident
+
+  int centre = atomic_load_explicit(&f->m_resident, memory_order_acquire);
+  for (int i = 0; i < n; i++) {
+    int d = dsp_wrap(start[i] - centre, size);
+    if (d >= size / 2) d -= size; // the shortest way round
+    if (d > MAPPED_FILE_READ_REACH) {
+      d = MAPPED_FILE_READ_REACH;
+      frac[i] = 0.0f;
+    } else if (d < -MAPPED_FILE_READ_REACH) {
+      d = -MAPPED_FILE_READ_REACH;
+      frac[i] = 0.0f;
+    }
+    start[i] = dsp_wrap(centre + d, size);
+  }
+}
+
+#endif
@@ -0,0 +1,56 @@
+// t_ramp smooths a parameter towards a new value, one step per sample, so
+// mix changes don't step
+
+#ifndef RAMP_H
+#define RAMP_H
+
+#include "engine.h"
+
+typedef struct _ramp {
+  t_float r_value;
+  t_float r_target;
+  t_float r_step;
+  int r_left; // samples until r_value reaches r_target
+} t_ramp;
+
+static inline void ramp_jump(t_ramp *r, t_float value)
+{
+  r->r_value = r->r_target = value;
+  r->r_step = 0.0f;
+  r->r_left = 0;
+}
+
+static inline void ramp_set(t_ramp *r, t_float target, int samples)
+{
+  if (samples <= 0) {
+    ramp_jump(r, target);
+    return;
+  }
+  r->r_target = target;
+  r->r_step = (target - r->r_value) / samples;
+  r->r_left = samples;
+}
+
+static inline t_float ramp_next(t_ramp *r)
+{
+  if (r->r_left > 0 && --r->r_left == 0) {
+    r->r_value = r->r_target;
+  } else if (r->r_left > 0) {
+    r->r_value += r->r_step;
+  }
+  return r->r_value;
+}
+
+// moves the ramp n samples on at once
+static inline t_float ramp_advance(t_ramp *r, int n)
+{
+  if (r->r_left <= n) {
+    ramp_jump(r, r->r_target);
+  } else {
+    r->r_value += r->r_step * n;
+    r->r_left -= n;
+  }
+  return r->r_value;
+}
+
+#endif
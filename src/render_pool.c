@@ -0,0 +1,283 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+#include "render_pool.h"
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+
+static pthread_t pool_thread[POOL_MAX_THREADS];
+static int pool_count = 0;
+static int pool_users = 0;
+static pthread_mutex_t pool_users_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// only for sleeping and waking, never held while a part runs
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+
+static _Atomic(t_pool_job *) pool_jobs[POOL_MAX_JOBS];
+// odd while a worker is going through pool_jobs, see pool_remove
+static _Atomic unsigned int pool_epoch[POOL_MAX_THREADS];
+static _Atomic unsigned int pool_posted; // bumped by every pool_post
+static _Atomic int pool_quit;
+
+static inline void pool_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static double pool_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// the next unclaimed part of the job's current generation and that
+// generation, or -1
+static int pool_claim(t_pool_job *j, unsigned int *generation)
+{
+  unsigned long long s = atomic_load_explicit(&j->j_state, memory_order_acquire);
+  while (1) {
+    int next = (s >> 16) & 0xffff;
+    int parts = s & 0xffff;
+    if (next >= parts) return -1;
+    if (atomic_compare_exchange_weak_explicit(&j->j_state, &s, s + (1 << 16),
+                                              memory_order_acq_rel, memory_order_acquire)) {
+      *generation = s >> 32;
+      return next;
+    }
+  }
+}
+
+// runs parts until there are none left, returns how many. a part a thread
+// is still in from an earlier generation is skipped rather than run by two
+// threads at once; pool_finish hands it back to perform.
+//
+// a thread can be descheduled between claiming a part and marking itself in
+// it, and the job may have been posted again by then, with new arguments.
+// so it checks the generation once it's marked: perform checks pool_busy
+// before it writes a job's arguments, then posts, and between the two
+// sequentially consistent orders either perform sees the mark or the
+// thread sees the new generation and leaves the part alone
+static int pool_drain(t_pool_job *j)
+{
+  int ran = 0, part;
+  unsigned int generation;
+  while ((part = pool_claim(j, &generation)) >= 0) {
+    unsigned long long bit = 1ULL << part;
+    int skip = (atomic_fetch_or(&j->j_running, bit) & bit) != 0;
+    if (!skip && (unsigned int)(atomic_load(&j->j_state) >> 32) != generation) {
+      atomic_fetch_and_explicit(&j->j_running, ~bit, memory_order_release);
+      continue; // given up on and posted again, its mark is the new one's
+    }
+    if (!skip) {
+      j->j_fn(j->j_arg, part, generation);
+      ran++;
+    }
+    atomic_store_explicit(&j->j_done[part], (generation << 1) | skip, memory_order_release);
+    if (!skip) atomic_fetch_and_explicit(&j->j_running, ~bit, memory_order_release);
+  }
+  return ran;
+}
+
+static void pool_pin(int index)
+{
+#ifdef __linux__
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 2) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET((index + 1) % cpus, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)index;
+#endif
+}
+
+static void *pool_main(void *arg)
+{
+  int index = (int)(long)arg;
+  pool_pin(index);
+  while (!atomic_load(&pool_quit)) {
+    unsigned int seen = atomic_load(&pool_posted);
+    int ran = 0;
+    atomic_fetch_add(&pool_epoch[index], 1);
+    for (int k = 0; k < POOL_MAX_JOBS; k++) {
+      t_pool_job *j = atomic_load_explicit(&pool_jobs[k], memory_order_acquire);
+      if (j != NULL) ran += pool_drain(j);
+    }
+    atomic_fetch_add(&pool_epoch[index], 1);
+    if (ran > 0) continue;
+
+    // nothing to do until the next post. a wake up can be missed when the
+    // post finds pool_lock taken, so don't sleep for long
+    pthread_mutex_lock(&pool_lock);
+    if (atomic_load(&pool_posted) == seen && !atomic_load(&pool_quit)) {
+      struct timespec until;
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += POOL_NAP_MS * 1000000L;
+      if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&pool_wake, &pool_lock, &until);
+    }
+    pthread_mutex_unlock(&pool_lock);
+  }
+  return NULL;
+}
+
+int pool_start(void)
+{
+  pthread_mutex_lock(&pool_users_lock);
+  if (pool_users++ == 0) {
+    // on one CPU a worker could only take time from perform, which then
+    // renders every part itself in pool_finish
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = (cpus > 1) ? cpus - 1 : 0;
+    if (count > POOL_MAX_THREADS) count = POOL_MAX_THREADS;
+    atomic_store(&pool_quit, 0);
+    for (pool_count = 0; pool_count < count; pool_count++) {
+      if (pthread_create(&pool_thread[pool_count], NULL, pool_main,
+                         (void *)(long)pool_count) != 0) {
+        break;
+      }
+    }
+    if (count > 0 && pool_count == 0) {
+      pool_users = 0;
+      pthread_mutex_unlock(&pool_users_lock);
+      return 0;
+    }
+  }
+  pthread_mutex_unlock(&pool_users_lock);
+  return 1;
+}
+
+void pool_stop(void)
+{
+  pthread_mutex_lock(&pool_users_lock);
+  if (pool_users == 0 || --pool_users > 0) {
+    pthread_mutex_unlock(&pool_users_lock);
+    return;
+  }
+  atomic_store(&pool_quit, 1);
+  pthread_mutex_lock(&pool_lock);
+  pthread_cond_broadcast(&pool_wake);
+  pthread_mutex_unlock(&pool_lock);
+  for (int i = 0; i < pool_count; i++) pthread_join(pool_thread[i], NULL);
+  pool_count = 0;
+  pthread_mutex_unlock(&pool_users_lock);
+}
+
+int pool_threads(void)
+{
+  pthread_mutex_lock(&pool_users_lock);
+  int count = pool_count;
+  pthread_mutex_unlock(&pool_users_lock);
+  return count;
+}
+
+void pool_job_init(t_pool_job *j, t_pool_fn fn, void *arg)
+{
+  atomic_init(&j->j_state, 0);
+  for (int p = 0; p < POOL_MAX_PARTS; p++) atomic_init(&j->j_done[p], 0);
+  atomic_init(&j->j_running, 0);
+  j->j_fn = fn;
+  j->j_arg = arg;
+  j->j_pending = 0;
+}
+
+int pool_add(t_pool_job *j)
+{
+  pthread_mutex_lock(&pool_users_lock);
+  for (int k = 0; k < POOL_MAX_JOBS; k++) {
+    if (atomic_load(&pool_jobs[k]) == NULL) {
+      atomic_store_explicit(&pool_jobs[k], j, memory_order_release);
+      pthread_mutex_unlock(&pool_users_lock);
+      return 1;
+    }
+  }
+  pthread_mutex_unlock(&pool_users_lock);
+  return 0;
+}
+
+void pool_remove(t_pool_job *j)
+{
+  pthread_mutex_lock(&pool_users_lock);
+  for (int k = 0; k < POOL_MAX_JOBS; k++) {
+    if (atomic_load(&pool_jobs[k]) == j) atomic_store(&pool_jobs[k], NULL);
+  }
+  // a worker that was going through the jobs may still have it; wait for
+  // each one to get to the end of that pass
+  for (int i = 0; i < pool_count; i++) {
+    unsigned int epoch = atomic_load(&pool_epoch[i]);
+    if (epoch & 1) {
+      while (atomic_load(&pool_epoch[i]) == epoch) pool_relax();
+    }
+  }
+  pthread_mutex_unlock(&pool_users_lock);
+}
+
+void pool_post(t_pool_job *j, int parts)
+{
+  if (parts > POOL_MAX_PARTS) parts = POOL_MAX_PARTS;
+  unsigned long long generation = (atomic_load(&j->j_state) >> 32) + 1;
+  // the job's arguments are written before any part can be claimed, and
+  // sequentially consistent for pool_drain's generation check
+  atomic_store(&j->j_state, (generation << 32) | (unsigned int)parts);
+  j->j_pending = 1;
+
+  atomic_fetch_add(&pool_posted, 1);
+  if (pthread_mutex_trylock(&pool_lock) == 0) {
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+  }
+}
+
+unsigned long long pool_finish(t_pool_job *j, double wait_ns)
+{
+  if (!j->j_pending) return 0;
+  j->j_pending = 0;
+  pool_drain(j);
+  unsigned long long s = atomic_load_explicit(&j->j_state, memory_order_relaxed);
+  unsigned int run = (unsigned int)(s >> 32) << 1;
+  int parts = s & 0xffff;
+  unsigned long long missing = 0;
+  double until = 0;
+  for (int p = 0; p < parts; p++) {
+    // no yielding: a descheduled worker could have the CPU for a whole time
+    // slice, and perform would rather render its part again
+    unsigned int done;
+    while (((done = atomic_load_explicit(&j->j_done[p], memory_order_acquire)) | 1) != (run | 1)) {
+      double now = pool_now();
+      if (until == 0) until = now + wait_ns;
+      if (now >= until) break;
+      pool_relax();
+    }
+    if (done != run) missing |= 1ULL << p;
+  }
+  return missing;
+}
+
+unsigned int pool_generation(t_pool_job *j)
+{
+  return (unsigned int)(atomic_load_explicit(&j->j_state, memory_order_relaxed) >> 32);
+}
+
+int pool_busy(t_pool_job *j)
+{
+  return atomic_load(&j->j_running) != 0;
+}
+
+void pool_wait(t_pool_job *j)
+{
+  for (int spins = 0; pool_busy(j); spins++) {
+    if (spins < POOL_SPINS) {
+      pool_relax();
+    } else {
+      sched_yield();
+    }
+  }
+}
@@ -0,0 +1,88 @@
+// worker threads that render parts of a block alongside Pd's DSP thread
+//
+// a t_pool_job is a block's worth of work cut into parts that can run in any
+// order on any thread. the perform routine posts it and carries on; the
+// workers claim parts one at a time and run them. when perform needs the
+// result (typically one block later) pool_finish claims whatever parts are
+// still unclaimed and runs them itself, then waits for the parts a worker is
+// running, but only until a deadline: a worker that has been descheduled
+// could otherwise hold the DSP thread for as long as the system likes. the
+// parts it gives up on are handed back, and the caller renders them again
+// itself. so a late worker costs the wait plus its part rendered twice, and
+// the caller has to keep what a part writes double-buffered: the thread it
+// gave up on carries on writing its own copy, whose result is ignored.
+//
+// such a thread stays in its part for however long it takes. until it's out,
+// that part is left to perform in every block (its claims are skipped, see
+// pool_finish) and nothing it reads may be freed, replaced or written:
+// pool_busy says whether there is one, and pool_wait waits for it without a
+// deadline. so a job's arguments can't be shared between posts: the caller
+// keeps a copy per generation (the part function is told which), and only
+// writes one while pool_busy says no thread is left in any part.
+//
+// claiming is a compare-and-swap on the job's state, which also carries a
+// generation, so a worker holding an old view of a job can never claim a
+// part of the next one. each job has a single claim counter that every
+// thread takes its next part from, with no per-thread queues or stealing.
+// posting never blocks: workers that have gone to sleep are woken if their
+// lock is free, and otherwise wake up by themselves within POOL_NAP_MS.
+//
+// there's one pool for every instance in the binary, with a thread for each
+// CPU but one (up to POOL_MAX_THREADS), pinned to its CPU where the system
+// allows it; on a single CPU there are none and pool_finish runs every part.
+// like worker.h, it starts with its first user and stops with the last.
+
+#ifndef RENDER_POOL_H
+#define RENDER_POOL_H
+
+#include <stdatomic.h>
+
+#define POOL_MAX_THREADS 16
+#define POOL_MAX_JOBS 64 // registered jobs, so gl~ instances with threads on
+#define POOL_MAX_PARTS 64 // the bits of pool_finish's result
+#define POOL_NAP_MS 1
+#define POOL_SPINS 4096 // pool_wait busy-waits this long before yielding
+
+// the generation is the job's count of pool_posts, see pool_generation
+typedef void (*t_pool_fn)(void *arg, int part, unsigned int generation);
+
+typedef struct _pool_job {
+  // generation << 32 | next unclaimed part << 16 | parts
+  _Atomic unsigned long long j_state;
+  // per part, generation << 1 of the last time it was run, | 1 if its claim
+  // was skipped instead
+  _Atomic unsigned int j_done[POOL_MAX_PARTS];
+  _Atomic unsigned long long j_running; // bit p: a thread is in part p, of any generation
+  t_pool_fn j_fn;
+  void *j_arg;
+  int j_pending; // posted and not finished yet, perform side only
+} t_pool_job;
+
+// returns 0 if the threads couldn't be started
+int pool_start(void);
+void pool_stop(void);
+// the number of worker threads, 0 when the pool isn't running or there's
+// only one CPU
+int pool_threads(void);
+
+// a job is registered once (from the message thread) and posted every block.
+// pool_remove waits until no worker can still be looking at it, so it can
+// be freed afterwards
+void pool_job_init(t_pool_job *j, t_pool_fn fn, void *arg);
+int pool_add(t_pool_job *j);
+void pool_remove(t_pool_job *j);
+
+// perform side. pool_finish runs the parts nobody has claimed, then waits up
+// to wait_ns for the ones other threads are in. it returns the parts that
+// weren't run, bit p for part p: given up on, or skipped because a thread
+// that was given up on earlier is still in them. 0 if nothing was posted
+void pool_post(t_pool_job *j, int parts);
+// the generation of the last post; the next one is this plus 1
+unsigned int pool_generation(t_pool_job *j);
+unsigned long long pool_finish(t_pool_job *j, double wait_ns);
+// whether a thread pool_finish gave up on is still in one of the job's parts
+int pool_busy(t_pool_job *j);
+// waits, with no deadline, until none is. call pool_finish first
+void pool_wait(t_pool_job *j);
+
+#endif
@@ -0,0 +1,772 @@
+#include "ring_buffer.h"
+#include "worker.h"
+#include "sound_file.h"
+#include "dsp_kernels.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define RING_BUFFER_POLL_MS 20
+#define RING_BUFFER_REDRAW_MS 200
+#define RING_BUFFER_MAX_SIZE (1 << 30) // samples, ~6 hours at 48k
+
+// what the worker was asked to do
+#define JOB_RESIZE 0
+#define JOB_MAP 1
+#define JOB_READ 2
+#define JOB_WRITE 3
+
+static void ring_buffer_tick(t_ring_buffer *rb);
+
+// copies the `count` samples before src_phase so that they end right before
+// dst_phase, converting them if the formats differ. the buffers may be
+// different sizes, and either can be one that isn't a power of 2
+static void copy_recent(void *dst, t_sample_format dst_format, int dst_size, int dst_phase,
+                        const void *src, t_sample_format src_format, int src_size,
+                        int src_phase, int count)
+{
+  size_t dst_bytes = sample_format_bytes(dst_format);
+  size_t src_bytes = sample_format_bytes(src_format);
+  while (count > 0) {
+    int d = dsp_wrap(dst_phase - count, dst_size);
+    int s = dsp_wrap(src_phase - count, src_size);
+    // the longest run that doesn't wrap in either buffer
+    int run = count;
+    if (run > dst_size - d) run = dst_size - d;
+    if (run > src_size - s) run = src_size - s;
+    sample_convert((char *)dst + d * dst_bytes, dst_format,
+                   (const char *)src + s * src_bytes, src_format, run, d);
+    count -= run;
+  }
+}
+
+// our own storage: `channels` planes of `size` samples in `format`, each
+// with `guard` samples either side of it. returns its first sample, or NULL
+static void *storage_alloc(int size, int channels, int guard, t_sample_format format)
+{
+  size_t bytes = sample_format_bytes(format);
+  char *samples = (char *)getbytes((size_t)(size + 2 * guard) * channels * bytes);
+  return (samples != NULL) ? samples + guard * bytes : NULL;
+}
+
+static void storage_free(void *samples, int size, int channels, int guard,
+                         t_sample_format format)
+{
+  size_t bytes = sample_format_bytes(format);
+  freebytes((char *)samples - guard * bytes, (size_t)(size + 2 * guard) * channels * bytes);
+}
+
+// channel c of our own storage, like ring_buffer_channel
+static void *storage_plane(void *samples, int size, int guard, t_sample_format format, int c)
+{
+  return (char *)samples + (size_t)c * (size + 2 * guard) * sample_format_bytes(format);
+}
+
+// after the planes of our own storage were filled in bulk
+static void storage_mirror(void *samples, int size, int channels, int guard,
+                           t_sample_format format)
+{
+  for (int c = 0; c < channels; c++) {
+    dsp_guard_fill(storage_plane(samples, size, guard, format, c), format, size, guard);
+  }
+}
+
+static void free_block(void *arg)
+{
+  t_ring_block *b = (t_ring_block *)arg;
+  if (b->b_file != NULL) {
+    mapped_file_close(b->b_file);
+  } else if (!b->b_borrowed) {
+    storage_free(b->b_samples, b->b_size, b->b_channels, b->b_guard, b->b_format);
+  }
+  freebytes(b, sizeof(t_ring_block));
+}
+
+// hands storage nobody uses any more to the worker
+static void reclaim(t_ring_buffer *rb, t_ring_block *b)
+{
+  if (worker_post(free_block, b)) return;
+  if (rb->r_reclaim == NULL) {
+    rb->r_reclaim = b;
+  } else {
+    free_block(b);
+  }
+}
+
+// a read or write is done: tells the owner
+static void ring_buffer_finished(t_ring_buffer *rb, t_symbol *what)
+{
+  if (rb->r_notify != NULL) rb->r_notify(rb->r_owner, what, rb->r_job_length);
+}
+
+// worker thread: builds the new storage from the current one
+static void build_block(void *arg)
+{
+  t_ring_buffer *rb = (t_ring_buffer *)arg;
+  int size = rb->r_job_size;
+  int channels = rb->r_channels;
+  int guard = rb->r_guard;
+  t_sample_format format = rb->r_job_format;
+
+  t_ring_block *b = (t_ring_block *)getbytes(sizeof(t_ring_block));
+  void *samples = (b != NULL) ? storage_alloc(size, channels, guard, format) : NULL;
+  if (samples == NULL) {
+    if (b != NULL) freebytes(b, sizeof(t_ring_block));
+    atomic_store_explicit(&rb->r_failed, ENOMEM, memory_order_release);
+    return;
+  }
+
+  // r_samples, r_size and r_format don't change until perform adopts this block
+  int old_size = rb->r_size;
+  int phase = atomic_load_explicit(&rb->r_phase, memory_order_acquire);
+  int keep = (size < old_size) ? size : old_size;
+  for (int c = 0; c < channels; c++) {
+    copy_recent(storage_plane(samples, size, guard, format, c), format, size, phase,
+                ring_buffer_channel(rb, c), rb->r_format, old_size, phase, keep);
+  }
+  storage_mirror(samples, size, channels, guard, format);
+
+  b->b_samples = samples;
+  b->b_size = size;
+  b->b_shift = 0;
+  b->b_borrowed = 0;
+  b->b_channels = channels;
+  b->b_guard = guard;
+  b->b_format = format;
+  b->b_file = NULL;
+  b->b_kind = RING_BUFFER_RESIZED;
+  b->b_phase = phase;
+  b->b_content = 0;
+  atomic_store_explicit(&rb->r_pending, b, memory_order_release);
+}
+
+int ring_buffer_init(t_ring_buffer *rb, t_object *owner, const char *name, int size,
+                     int channels, int guard)
+{
+  rb->r_owner = owner;
+  rb->r_name = name;
+  rb->r_channels = channels;
+  rb->r_guard = guard;
+  if (size < 2 * guard) size = 2 * guard;
+  rb->r_size = size;
+  rb->r_shift = 0;
+  rb->r_guarded = guard;
+  rb->r_format = SAMPLE_FLOAT;
+  rb->r_borrowed = 0;
+  rb->r_file = NULL;
+  rb->r_content = 0;
+  rb->r_requested = size;
+  rb->r_requested_format = SAMPLE_FLOAT;
+  rb->r_job = JOB_RESIZE;
+  rb->r_job_size = size;
+  rb->r_job_format = SAMPLE_FLOAT;
+  rb->r_job_path = NULL;
+  rb->r_job_start = 0;
+  rb->r_job_length = 0;
+  rb->r_job_sr = 0;
+  rb->r_minimum = 0;
+  rb->r_swapping = 0;
+  rb->r_reclaim = NULL;
+  rb->r_array = NULL;
+  rb->r_array_words = NULL;
+  rb->r_array_length = 0;
+  rb->r_path = NULL;
+  rb->r_path_size = 0;
+  rb->r_path_extend = 0;
+  rb->r_mapped = NULL;
+  rb->r_read = NULL;
+  rb->r_write = NULL;
+  rb->r_write_start = 0;
+  rb->r_write_length = 0;
+  rb->r_write_sr = 0;
+  rb->r_notify = NULL;
+  atomic_init(&rb->r_pending, NULL);
+  atomic_init(&rb->r_retired, NULL);
+  atomic_init(&rb->r_phase, 0);
+  atomic_init(&rb->r_failed, 0);
+  atomic_init(&rb->r_dirty, 0);
+  atomic_init(&rb->r_finished, 0);
+
+  rb->r_samples = storage_alloc(size, channels, guard, SAMPLE_FLOAT);
+  if (rb->r_samples == NULL) {
+    pd_error(owner, "%s: unable to allocate memory to input buffer", name);
+    return 0;
+  }
+  if (!worker_start()) {
+    pd_error(owner, "%s: unable to start worker thread", name);
+    storage_free(rb->r_samples, size, channels, guard, SAMPLE_FLOAT);
+    rb->r_samples = NULL;
+    return 0;
+  }
+  rb->r_clock = clock_new(rb, (t_method)ring_buffer_tick);
+  return 1;
+}
+
+void ring_buffer_free(t_ring_buffer *rb)
+{
+  if (rb->r_samples == NULL) return;
+
+  clock_free(rb->r_clock);
+  // a queued build_block still points at rb
+  worker_wait_idle();
+  worker_stop();
+
+  t_ring_block *b = atomic_exchange(&rb->r_pending, NULL);
+  if (b != NULL) free_block(b);
+  b = atomic_exchange(&rb->r_retired, NULL);
+  if (b != NULL) free_block(b);
+  if (rb->r_reclaim != NULL) free_block(rb->r_reclaim);
+  rb->r_reclaim = NULL;
+
+  if (rb->r_file != NULL) {
+    mapped_file_close(rb->r_file);
+    rb->r_file = NULL;
+  } else if (!rb->r_borrowed) {
+    storage_free(rb->r_samples, rb->r_size, rb->r_channels, rb->r_guarded, rb->r_format);
+  }
+  rb->r_samples = NULL;
+}
+
+int ring_buffer_size_for(t_float samples)
+{
+  int size = 1;
+  while (size < samples) size *= 2;
+  return size;
+}
+
+// how big a ring for `samples` can be: just that with a guard, otherwise the
+// smallest power of 2 that holds it (see dsp_wrap)
+static int ring_size(const t_ring_buffer *rb, int samples)
+{
+  return (rb->r_guard > 0) ? samples : ring_buffer_size_for(samples);
+}
+
+// the largest power of 2 that fits in an array
+static int array_size(int length)
+{
+  int size = 1;
+  while (size <= length / 2) size *= 2;
+  return size;
+}
+
+// t_samples per t_word, as a shift: 1 for 32-bit floats on 64-bit builds
+static int array_shift(void)
+{
+  int shift = 0;
+  while ((sizeof(t_sample) << shift) < sizeof(t_word)) shift++;
+  return shift;
+}
+
+static t_garray *find_array(t_ring_buffer *rb, t_symbol *name, t_word **words, int *length)
+{
+  t_garray *a = (t_garray *)pd_findbyclass(name, garray_class);
+  if (a == NULL) {
+    pd_error(rb->r_owner, "%s: %s: no such array", rb->r_name, name->s_name);
+    return NULL;
+  }
+  if (!garray_getfloatwords(a, length, words) || *length < 1) {
+    pd_error(rb->r_owner, "%s: %s: bad template or empty array", rb->r_name, name->s_name);
+    return NULL;
+  }
+  return a;
+}
+
+// hands perform new storage right away instead of waiting for the worker.
+// perform may be reading freed memory until it adopts this (an array that
+// was resized or deleted), so anything still in the way is cleared first
+static void switch_storage(t_ring_buffer *rb, t_ring_block *b)
+{
+  // a resize the worker is still building would land on top of b
+  if (rb->r_swapping) worker_wait_idle();
+  atomic_store_explicit(&rb->r_failed, 0, memory_order_relaxed);
+  if (atomic_exchange_explicit(&rb->r_finished, 0, memory_order_acquire)) {
+    ring_buffer_finished(rb, gensym("write"));
+  }
+  rb->r_job = JOB_RESIZE; // a file that was read is replaced before it lands
+
+  t_ring_block *old = atomic_exchange_explicit(&rb->r_retired, NULL, memory_order_acquire);
+  if (old != NULL) reclaim(rb, old);
+  old = atomic_exchange_explicit(&rb->r_pending, b, memory_order_acq_rel);
+  if (old != NULL) reclaim(rb, old); // never adopted
+
+  rb->r_swapping = 1;
+  clock_delay(rb->r_clock, RING_BUFFER_POLL_MS);
+}
+
+static t_ring_block *new_block(void *samples, int size, int shift, int borrowed)
+{
+  t_ring_block *b = (t_ring_block *)getbytes(sizeof(t_ring_block));
+  if (b == NULL) return NULL;
+  b->b_samples = samples;
+  b->b_size = size;
+  b->b_shift = shift;
+  b->b_borrowed = borrowed;
+  b->b_channels = 1;
+  b->b_guard = 0;
+  b->b_format = SAMPLE_FLOAT;
+  b->b_file = NULL;
+  b->b_kind = RING_BUFFER_SWITCHED;
+  b->b_phase = 0;
+  b->b_content = borrowed ? size : 0;
+  return b;
+}
+
+// back to our own storage, allocated here rather than on the worker: perform
+// can't be left on an array that's gone, and this only happens when the patch
+// asks for it. if even that fails, a single shared sample keeps perform safe
+static void leave_storage(t_ring_buffer *rb)
+{
+  static t_sample fallback[RING_BUFFER_MAX_CHANNELS];
+  int size = rb->r_requested;
+  t_sample_format format = rb->r_requested_format;
+  void *samples = storage_alloc(size, rb->r_channels, rb->r_guard, format);
+  t_ring_block *b = (samples != NULL) ? new_block(samples, size, 0, 0) : NULL;
+  if (b != NULL) {
+    b->b_guard = rb->r_guard;
+    b->b_format = format;
+  } else {
+    pd_error(rb->r_owner, "%s: unable to allocate memory to input buffer", rb->r_name);
+    if (samples != NULL) storage_free(samples, size, rb->r_channels, rb->r_guard, format);
+    b = new_block(fallback, 1, 0, 1);
+    rb->r_requested = 1;
+    if (b == NULL) return;
+  }
+  b->b_channels = rb->r_channels;
+  rb->r_array = NULL;
+  rb->r_array_words = NULL;
+  rb->r_path = NULL;
+  rb->r_mapped = NULL;
+  switch_storage(rb, b);
+}
+
+// looks the array up again: follows it if it was resized, leaves it if it's
+// gone, and redraws it if perform wrote to it
+static void refresh_array(t_ring_buffer *rb)
+{
+  t_word *words;
+  int length;
+  t_garray *a = find_array(rb, rb->r_array, &words, &length);
+  if (a == NULL) {
+    leave_storage(rb);
+    return;
+  }
+  if (words != rb->r_array_words || length != rb->r_array_length) {
+    t_ring_block *b = new_block(&words[0].w_float, array_size(length), array_shift(), 1);
+    if (b == NULL) {
+      pd_error(rb->r_owner, "%s: out of memory", rb->r_name);
+      leave_storage(rb);
+      return;
+    }
+    garray_usedindsp(a);
+    rb->r_array_words = words;
+    rb->r_array_length = length;
+    switch_storage(rb, b);
+  }
+  if (atomic_exchange_explicit(&rb->r_dirty, 0, memory_order_relaxed)) garray_redraw(a);
+}
+
+int ring_buffer_set_array(t_ring_buffer *rb, t_symbol *name)
+{
+  if (name == NULL || *name->s_name == 0) {
+    if (rb->r_array != NULL) leave_storage(rb);
+    return 1;
+  }
+  if (rb->r_channels > 1) {
+    pd_error(rb->r_owner, "%s: %s: arrays are one channel, this has %d", rb->r_name,
+             name->s_name, rb->r_channels);
+    return 0;
+  }
+  t_word *words;
+  int length;
+  if (find_array(rb, name, &words, &length) == NULL) return 0;
+  rb->r_path = NULL;
+  rb->r_mapped = NULL;
+  rb->r_read = NULL;
+  rb->r_array = name;
+  rb->r_array_words = NULL; // switch even if it's the same array
+  refresh_array(rb);
+  ring_buffer_tick(rb);
+  return 1;
+}
+
+// worker thread: maps the file and faults the start of it in
+static void map_block(void *arg)
+{
+  t_ring_buffer *rb = (t_ring_buffer *)arg;
+  t_mapped_file *f = mapped_file_open(rb->r_job_path->s_name, rb->r_job_size,
+                                      rb->r_job_extend, rb->r_guard);
+  int error = (errno != 0) ? errno : EIO;
+  t_ring_block *b = (f != NULL) ? new_block(f->m_samples, f->m_size, 0, 1) : NULL;
+  if (b != NULL) b->b_guard = f->m_guard;
+  if (b == NULL) {
+    if (f != NULL) {
+      mapped_file_close(f);
+      error = ENOMEM;
+    }
+    atomic_store_explicit(&rb->r_failed, error, memory_order_release);
+    return;
+  }
+  b->b_file = f;
+  atomic_store_explicit(&rb->r_pending, b, memory_order_release);
+}
+
+int ring_buffer_map_file(t_ring_buffer *rb, t_symbol *path, t_float samples)
+{
+  if (path == NULL || *path->s_name == 0) {
+    if (rb->r_path != NULL) leave_storage(rb);
+    return 1;
+  }
+  if (rb->r_channels > 1) {
+    pd_error(rb->r_owner, "%s: %s: mapped files are one channel, this has %d", rb->r_name,
+             path->s_name, rb->r_channels);
+    return 0;
+  }
+  int page = mapped_file_page();
+  off_t length;
+  int extend;
+  if (samples <= 0) {
+    struct stat st;
+    if (stat(path->s_name, &st) < 0 || st.st_size < (off_t)sizeof(t_sample)) {
+      pd_error(rb->r_owner, "%s: %s: no such file, or empty (give a length to create it)",
+               rb->r_name, path->s_name);
+      return 0;
+    }
+    length = st.st_size / sizeof(t_sample);
+    extend = 0;
+  } else {
+    if (samples > RING_BUFFER_MAX_SIZE) samples = RING_BUFFER_MAX_SIZE;
+    extend = (samples > 1) ? (int)(samples + 0.5f) : 1; // seconds * sr is rarely whole
+    // a guard lives in whole pages either side of the file, so the file
+    // has to be whole pages too
+    if (rb->r_guard > 0) extend = (extend + page - 1) / page * page;
+    length = extend;
+  }
+  // with a guard it wraps at the file's own length, to the page; without one
+  // at the largest power of 2 that fits (see dsp_wrap)
+  int usable = (length < RING_BUFFER_MAX_SIZE) ? (int)length : RING_BUFFER_MAX_SIZE;
+  int size = (rb->r_guard > 0) ? usable / page * page : array_size(usable);
+  if (size < 2 * rb->r_guard || size < 1) {
+    pd_error(rb->r_owner, "%s: %s: too short to map, it needs at least %d samples", rb->r_name,
+             path->s_name, (rb->r_guard > 0) ? page : 1);
+    return 0;
+  }
+  if (size < length) {
+    pd_error(rb->r_owner, "%s: %s: only the first %d samples are used, %lld past them are left "
+             "as they are", rb->r_name, path->s_name, size, (long long)(length - size));
+  }
+  rb->r_path_size = size;
+  rb->r_path_extend = extend;
+  rb->r_read = NULL;
+  rb->r_path = path;
+  rb->r_mapped = NULL; // map it again even if it's the same file
+  ring_buffer_tick(rb);
+  return 1;
+}
+
+// worker thread: reads the file into new storage. perform keeps going with
+// the old storage until it's all in, so nothing is heard half loaded
+static void load_block(void *arg)
+{
+  t_ring_buffer *rb = (t_ring_buffer *)arg;
+  t_sound_file sf;
+  int channels = rb->r_channels;
+  int error = sound_file_open_read(&sf, rb->r_job_path->s_name, channels);
+  if (!error && sf.f_frames > RING_BUFFER_MAX_SIZE) {
+    sound_file_close(&sf);
+    error = EFBIG;
+  }
+  if (error) {
+    atomic_store_explicit(&rb->r_failed, error, memory_order_release);
+    return;
+  }
+
+  int frames = sf.f_frames;
+  int guard = rb->r_guard;
+  t_sample_format format = rb->r_job_format;
+  int size = ring_size(rb, (frames > rb->r_job_size) ? frames : rb->r_job_size);
+  void *samples = storage_alloc(size, channels, guard, format);
+  t_ring_block *b = (samples != NULL) ? new_block(samples, size, 0, 0) : NULL;
+  if (b == NULL) {
+    sound_file_close(&sf);
+    if (samples != NULL) storage_free(samples, size, channels, guard, format);
+    atomic_store_explicit(&rb->r_failed, ENOMEM, memory_order_release);
+    return;
+  }
+  b->b_channels = channels;
+  b->b_guard = guard;
+  b->b_format = format;
+
+  // t_samples are read in place. compact storage is read through a chunk
+  // shared out between the channels, like save_block's, and converted
+  size_t bytes = sample_format_bytes(format);
+  t_sample chunk[SOUND_FILE_CHUNK];
+  t_sample *planes[RING_BUFFER_MAX_CHANNELS];
+  int per_chunk = (format == SAMPLE_FLOAT) ? SOUND_FILE_CHUNK : SOUND_FILE_CHUNK / channels;
+  int done = 0, got = 1;
+  while (!error && done < frames && got > 0) {
+    int n = (frames - done < per_chunk) ? frames - done : per_chunk;
+    for (int c = 0; c < channels; c++) {
+      planes[c] = (format == SAMPLE_FLOAT)
+        ? (t_sample *)storage_plane(samples, size, guard, format, c) + done
+        : chunk + c * per_chunk;
+    }
+    error = sound_file_read(&sf, planes, channels, n, &got);
+    for (int c = 0; format != SAMPLE_FLOAT && c < channels; c++) {
+      char *plane = (char *)storage_plane(samples, size, guard, format, c);
+      sample_convert(plane + done * bytes, format, planes[c], SAMPLE_FLOAT, got, done);
+    }
+    done += got;
+  }
+  sound_file_close(&sf);
+  storage_mirror(samples, size, channels, guard, format);
+  if (error) {
+    free_block(b);
+    atomic_store_explicit(&rb->r_failed, error, memory_order_release);
+    return;
+  }
+
+  b->b_kind = RING_BUFFER_LOADED;
+  b->b_phase = done;
+  b->b_content = done;
+  rb->r_job_length = done;
+  atomic_store_explicit(&rb->r_pending, b, memory_order_release);
+}
+
+// worker thread: streams from the active storage, which stays put while a
+// job is in flight. perform may still be writing to it (an overdub), like
+// build_block copies it while perform records
+static void save_block(void *arg)
+{
+  t_ring_buffer *rb = (t_ring_buffer *)arg;
+  int channels = rb->r_channels;
+  int size = rb->r_size;
+  int shift = rb->r_shift;
+  int start = rb->r_job_start;
+  int length = rb->r_job_length;
+  // the chunk is shared out between the channels
+  t_sample chunk[SOUND_FILE_CHUNK];
+  t_sample *planes[RING_BUFFER_MAX_CHANNELS];
+  int per_chunk = SOUND_FILE_CHUNK / channels;
+  for (int c = 0; c < channels; c++) planes[c] = chunk + c * per_chunk;
+
+  t_sound_file sf;
+  int error = sound_file_open_write(&sf, rb->r_job_path->s_name, length, channels,
+                                    rb->r_job_sr);
+  for (int done = 0; !error && done < length; done += per_chunk) {
+    int n = (length - done < per_chunk) ? length - done : per_chunk;
+    for (int c = 0; c < channels; c++) {
+      const void *samples = ring_buffer_channel(rb, c);
+      for (int i = 0; i < n; i++) {
+        int at = dsp_wrap(start + done + i, size);
+        planes[c][i] = sample_load(samples, rb->r_format, (size_t)at << shift);
+      }
+    }
+    error = sound_file_write(&sf, planes, n);
+  }
+  int closed = sound_file_close(&sf);
+  if (!error) error = closed;
+
+  if (error) {
+    atomic_store_explicit(&rb->r_failed, error, memory_order_release);
+  } else {
+    atomic_store_explicit(&rb->r_finished, 1, memory_order_release);
+  }
+}
+
+void ring_buffer_read_file(t_ring_buffer *rb, t_symbol *path)
+{
+  rb->r_read = path;
+  ring_buffer_tick(rb);
+}
+
+void ring_buffer_write_file(t_ring_buffer *rb, t_symbol *path, int start, int length,
+                            t_float sr)
+{
+  rb->r_write = path;
+  rb->r_write_start = start;
+  rb->r_write_length = length;
+  rb->r_write_sr = sr;
+  ring_buffer_tick(rb);
+}
+
+void ring_buffer_set_notify(t_ring_buffer *rb, t_ring_notify fn)
+{
+  rb->r_notify = fn;
+}
+
+void ring_buffer_set_format(t_ring_buffer *rb, t_sample_format format)
+{
+  if (format == rb->r_requested_format) return;
+  rb->r_requested_format = format;
+  ring_buffer_tick(rb);
+}
+
+int ring_buffer_target_size(const t_ring_buffer *rb)
+{
+  if (rb->r_path != NULL) return rb->r_path_size;
+  return (rb->r_array != NULL) ? array_size(rb->r_array_length) : rb->r_requested;
+}
+
+int ring_buffer_request(t_ring_buffer *rb, int size)
+{
+  if (size < rb->r_minimum) size = rb->r_minimum;
+  if (size < 2 * rb->r_guard) size = 2 * rb->r_guard;
+  size = ring_size(rb, size);
+  if (rb->r_array != NULL) refresh_array(rb);
+  if (size == rb->r_requested) return 0;
+  rb->r_requested = size;
+  ring_buffer_tick(rb);
+  return 1;
+}
+
+// message thread: reclaims retired storage and starts the next job
+static void ring_buffer_tick(t_ring_buffer *rb)
+{
+  t_ring_block *b = atomic_exchange_explicit(&rb->r_retired, NULL, memory_order_acquire);
+  if (b != NULL) {
+    rb->r_reclaim = b;
+    rb->r_swapping = 0;
+    if (rb->r_job == JOB_READ) {
+      rb->r_job = JOB_RESIZE;
+      rb->r_requested = rb->r_minimum = rb->r_size;
+      ring_buffer_finished(rb, gensym("read"));
+    }
+  }
+  if (rb->r_reclaim != NULL && worker_post(free_block, rb->r_reclaim)) {
+    rb->r_reclaim = NULL;
+  }
+  if (atomic_exchange_explicit(&rb->r_finished, 0, memory_order_acquire)) {
+    rb->r_swapping = 0;
+    ring_buffer_finished(rb, gensym("write"));
+  }
+
+  int failed = atomic_exchange_explicit(&rb->r_failed, 0, memory_order_acquire);
+  if (failed && rb->r_job == JOB_MAP) {
+    pd_error(rb->r_owner, "%s: %s: %s", rb->r_name, rb->r_job_path->s_name, strerror(failed));
+    rb->r_swapping = 0;
+    leave_storage(rb); // whatever was there before is already gone
+  } else if (failed && rb->r_job != JOB_RESIZE) {
+    pd_error(rb->r_owner, "%s: %s: %s", rb->r_name, rb->r_job_path->s_name,
+             sound_file_strerror(failed));
+    rb->r_swapping = 0;
+    rb->r_job = JOB_RESIZE;
+  } else if (failed) {
+    pd_error(rb->r_owner, "%s: unable to resize input buffer to %d samples",
+             rb->r_name, rb->r_job_size);
+    rb->r_swapping = 0;
+    rb->r_requested = rb->r_size; // don't keep retrying
+    rb->r_requested_format = rb->r_format;
+  }
+
+  // what's there is saved before anything replaces it
+  if (!rb->r_swapping && rb->r_write != NULL) {
+    rb->r_job = JOB_WRITE;
+    rb->r_job_path = rb->r_write;
+    rb->r_job_start = rb->r_write_start;
+    rb->r_job_length = rb->r_write_length;
+    rb->r_job_sr = rb->r_write_sr;
+    rb->r_swapping = worker_post(save_block, rb);
+    if (rb->r_swapping) rb->r_write = NULL;
+  }
+
+  int map = (rb->r_path != NULL && rb->r_path != rb->r_mapped);
+  if (!rb->r_swapping && map) {
+    rb->r_array = NULL;
+    rb->r_array_words = NULL;
+    rb->r_mapped = rb->r_path;
+    rb->r_job = JOB_MAP;
+    rb->r_job_path = rb->r_path;
+    rb->r_job_size = rb->r_path_size;
+    rb->r_job_extend = rb->r_path_extend;
+    rb->r_swapping = worker_post(map_block, rb);
+    if (!rb->r_swapping) rb->r_mapped = NULL; // try again next tick
+  }
+
+  if (!rb->r_swapping && rb->r_read != NULL) {
+    rb->r_array = NULL;
+    rb->r_array_words = NULL;
+    rb->r_path = NULL;
+    rb->r_mapped = NULL;
+    rb->r_job = JOB_READ;
+    rb->r_job_path = rb->r_read;
+    rb->r_job_size = rb->r_requested;
+    rb->r_job_format = rb->r_requested_format;
+    rb->r_swapping = worker_post(load_block, rb);
+    if (rb->r_swapping) rb->r_read = NULL;
+  }
+
+  // an array or a file sets its own size and format
+  int resize = (rb->r_array == NULL && rb->r_path == NULL
+                && (rb->r_requested != rb->r_size || rb->r_requested_format != rb->r_format));
+  if (!rb->r_swapping && resize) {
+    rb->r_job = JOB_RESIZE;
+    rb->r_job_size = rb->r_requested;
+    rb->r_job_format = rb->r_requested_format;
+    rb->r_swapping = worker_post(build_block, rb);
+  }
+
+  // keep polling until perform has adopted the new storage or the worker is
+  // done with the file. with dsp off that can take a while, but a tick is cheap
+  int waiting = (rb->r_write != NULL || rb->r_read != NULL || resize || map);
+  if (rb->r_swapping || rb->r_reclaim != NULL || waiting) {
+    clock_delay(rb->r_clock, RING_BUFFER_POLL_MS);
+  } else if (rb->r_array != NULL) {
+    refresh_array(rb);
+    clock_delay(rb->r_clock, RING_BUFFER_REDRAW_MS);
+  }
+}
+
+int ring_buffer_adopt_pending(t_ring_buffer *rb, int *write_phase, t_ring_map *map)
+{
+  // the last storage hasn't been reclaimed yet; only one can be on its way back
+  if (atomic_load_explicit(&rb->r_retired, memory_order_acquire) != NULL) return 0;
+  t_ring_block *b = atomic_exchange_explicit(&rb->r_pending, NULL, memory_order_acquire);
+  if (b == NULL) return 0;
+
+  int old_size = rb->r_size;
+  int new_size = b->b_size;
+  int phase = dsp_wrap(*write_phase, old_size);
+  int new_phase = dsp_wrap(b->b_phase, new_size);
+
+  if (b->b_kind == RING_BUFFER_RESIZED) {
+    // samples written after the worker's copy; at most a few blocks
+    int since = dsp_wrap(phase - b->b_phase, old_size);
+    new_phase = dsp_wrap(b->b_phase + since, new_size);
+    int count = since;
+    if (count > new_size) count = new_size;
+    for (int c = 0; c < rb->r_channels; c++) {
+      copy_recent(storage_plane(b->b_samples, b->b_size, b->b_guard, b->b_format, c),
+                  b->b_format, new_size, new_phase, ring_buffer_channel(rb, c), rb->r_format,
+                  old_size, phase, count);
+    }
+    storage_mirror(b->b_samples, b->b_size, rb->r_channels, b->b_guard, b->b_format);
+  }
+
+  map->m_old_phase = phase;
+  map->m_old_size = old_size;
+  map->m_new_phase = new_phase;
+  map->m_new_size = new_size;
+
+  // the block goes back to the message thread carrying the old storage
+  t_ring_block old = *b;
+  b->b_samples = rb->r_samples;
+  b->b_size = rb->r_size;
+  b->b_shift = rb->r_shift;
+  b->b_borrowed = rb->r_borrowed;
+  b->b_guard = rb->r_guarded;
+  b->b_format = rb->r_format;
+  b->b_file = rb->r_file;
+  rb->r_samples = old.b_samples;
+  rb->r_size = old.b_size;
+  rb->r_shift = old.b_shift;
+  rb->r_borrowed = old.b_borrowed;
+  rb->r_guarded = old.b_guard;
+  rb->r_format = old.b_format;
+  rb->r_file = old.b_file;
+  rb->r_content = old.b_content;
+  atomic_store_explicit(&rb->r_retired, b, memory_order_release);
+
+  *write_phase = new_phase;
+  atomic_store_explicit(&rb->r_phase, new_phase, memory_order_release);
+  return old.b_kind;
+}
@@ -0,0 +1,277 @@
+// input ring buffers that can be resized without allocating on the audio thread
+//
+// the perform routine owns r_samples/r_size. a resize is requested from the
+// message thread (usually the dsp method), the new storage is allocated and
+// filled with the most recent audio on the worker thread (worker.c), then
+// published through r_pending. perform picks it up at the start of its next
+// block with ring_buffer_adopt, copies the few samples written since the
+// worker took its copy, and hands the old storage back through r_retired.
+// a clock on the message thread passes retired storage to the worker to be
+// freed, and starts the next resize if another one was requested meanwhile.
+//
+// only one resize is in flight at a time, so the worker can read the active
+// storage while perform keeps writing to it: anything written after the
+// worker's snapshot of r_phase is copied again on adoption.
+//
+// the storage can also be borrowed from a Pd array (ring_buffer_set_array),
+// so a loop can be seen, edited and saved like any table without a second
+// copy of it. the array's t_words are read and written in place: on 64-bit
+// builds a t_word is two t_samples wide, which is what r_shift is for. the
+// ring only uses the largest power of 2 that fits in the array. switching
+// storage goes through r_pending like a resize, but nothing carries over.
+// the clock that reclaims storage also redraws the array (at most every
+// RING_BUFFER_REDRAW_MS) and follows it when it's resized or deleted.
+//
+// for more audio than fits in memory the storage can be mapped from a file
+// (ring_buffer_map_file, see mapped_file.c). mapping it and faulting the
+// start of it in happen on the worker, then it's switched to like an array.
+// while it's mapped, perform has to keep its reads inside the window that
+// mapped_file.c keeps resident: ring_buffer_clamp_reads.
+//
+// files are read into new storage by the worker a chunk at a time (see
+// sound_file.c) while perform carries on with the old storage, then switched
+// in; writing one streams from the active storage, which can't be replaced
+// until the worker is done with it. both report back through the owner's
+// notify function once they're finished.
+//
+// our own storage can hold more than one channel (r_channels), as planes of
+// r_size samples one after the other like Pd's multichannel signals, so each
+// channel can be read and written like a mono ring (ring_buffer_channel).
+// arrays and mapped files are one channel only.
+//
+// our own storage can also have guard samples either side of each plane that
+// mirror its other end (DSP_GUARD, see dsp_kernels.h), for owners that read
+// it with interpolators and want a wrapped index's taps to be contiguous.
+// everything here that fills storage fills the mirrors too; perform keeps
+// them up to date as it writes, with dsp_ring_write. mapped files get theirs
+// in memory next to the mapping (see mapped_file.h); arrays have none, so
+// perform has to check r_guarded before relying on them.
+//
+// storage without a guard (r_guarded 0: arrays, and our own storage and
+// mapped files for owners that don't ask for one) is a power of 2, so the
+// owner can wrap positions and taps with r_size - 1 as a mask (looper~,
+// glooper~). storage with a guard is exactly the size that was asked for, or
+// for a mapped file the file's length to the page: only the positions need
+// wrapping, the taps are in the guard, and dsp_wrap does that for any size
+// while a power of 2 still costs one mask. everything here wraps with it,
+// and an owner with a guard has to as well.
+//
+// and it can be kept in a compact format (ring_buffer_set_format, see
+// sample_format.h), which is switched to like a resize: the worker builds
+// new storage with the audio converted, and perform converts what it wrote
+// meanwhile when it adopts it. arrays and mapped files are always t_samples,
+// so perform goes by r_format, not by what was asked for. r_samples and the
+// planes are in that format, which is why they're void pointers; owners that
+// never set one can take them as t_samples.
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include "m_pd.h"
+#include <stdatomic.h>
+#include "mapped_file.h"
+#include "sample_format.h"
+#include "dsp_kernels.h"
+
+#define RING_BUFFER_MAX_CHANNELS 64
+
+typedef struct _ring_block {
+  void *b_samples;
+  int b_size;
+  int b_shift; // see r_shift
+  int b_borrowed; // the samples belong to a Pd array, don't free them
+  int b_channels; // planes of b_size samples
+  int b_guard; // see r_guarded
+  t_sample_format b_format; // see r_format
+  t_mapped_file *b_file; // the samples are mapped from it, close it instead
+  int b_kind; // what ring_buffer_adopt returns for it, see below
+  int b_phase; // resized: write phase of the old storage when the worker
+               // copied it. otherwise: the new write phase
+  int b_content; // samples at the start that hold a file or an array
+} t_ring_block;
+
+typedef void (*t_ring_notify)(t_object *owner, t_symbol *what, int samples);
+
+typedef struct _ring_buffer {
+  t_object *r_owner; // for error messages
+  const char *r_name;
+  int r_channels; // fixed when it's created
+  int r_guard; // DSP_GUARD or 0, also fixed: guard samples for our own storage
+
+  // owned by the perform routine
+  void *r_samples;
+  int r_size; // a power of 2 unless r_guarded is set, see above
+  int r_shift; // ring sample i is r_samples[i << r_shift]
+  int r_guarded; // guard samples either side of each plane: r_guard, or 0 for arrays
+  t_sample_format r_format; // of r_samples, SAMPLE_FLOAT for arrays and files
+  int r_borrowed; // r_samples is a Pd array
+  t_mapped_file *r_file; // r_samples is mapped from it
+  int r_content; // see b_content
+
+  // handover between the threads
+  _Atomic(t_ring_block *) r_pending; // worker -> perform
+  _Atomic(t_ring_block *) r_retired; // perform -> message thread
+  _Atomic int r_phase; // write phase published by perform at the end of a block
+  _Atomic int r_failed; // an errno, set by the worker if a job failed
+  _Atomic int r_dirty; // perform wrote to the array since the last redraw
+  _Atomic int r_finished; // set by the worker when a write is done
+
+  // message thread only
+  int r_requested; // the size the owner asked for last
+  t_sample_format r_requested_format; // and the format
+  int r_job; // what the worker is (or was last) asked to do
+  int r_job_size; // the size it's asked to build, at least
+  int r_job_extend; // map: the length to create or extend the file to, 0 to leave it
+  t_sample_format r_job_format; // the format to build it in
+  t_symbol *r_job_path; // the file it's asked to map, read or write
+  int r_job_start; // write: the first sample
+  int r_job_length; // write: how many samples. read: how many it read
+  t_float r_job_sr; // write: for the header
+  int r_minimum; // a file that was read sets the smallest size
+  int r_swapping; // a job is in flight, or its storage is pending or not reclaimed yet
+  t_ring_block *r_reclaim; // retired storage the worker couldn't take yet
+  t_clock *r_clock;
+  t_symbol *r_array; // the array in use, NULL for our own storage
+  t_word *r_array_words; // as last seen, to notice the array being resized
+  int r_array_length;
+  t_symbol *r_path; // the file to map, NULL for none
+  int r_path_size;
+  int r_path_extend; // the length to create or extend it to, 0 if none was given
+  t_symbol *r_mapped; // the file the worker was last asked to map
+  t_symbol *r_read; // a file waiting to be read
+  t_symbol *r_write; // a file waiting to be written
+  int r_write_start;
+  int r_write_length;
+  t_float r_write_sr;
+  t_ring_notify r_notify;
+} t_ring_buffer;
+
+// how positions in the old storage map into the new one after an adoption
+typedef struct _ring_map {
+  int m_old_phase;
+  int m_old_size;
+  int m_new_phase;
+  int m_new_size;
+} t_ring_map;
+
+// allocates `size` samples per channel right away; call from the object's
+// new method. `guard` is DSP_GUARD for mirrored guard samples, or 0
+int ring_buffer_init(t_ring_buffer *rb, t_object *owner, const char *name, int size,
+                     int channels, int guard);
+void ring_buffer_free(t_ring_buffer *rb);
+
+// the smallest power of 2 that holds `samples`
+int ring_buffer_size_for(t_float samples);
+
+// queues a resize to `size` samples, rounded up to a power of 2 without a
+// guard; returns 1 if that differs from the current request.
+// while an array or a file is set the request is kept for when it's unset,
+// and an array is looked up again (call this from the dsp method)
+int ring_buffer_request(t_ring_buffer *rb, int size);
+
+// our own storage from now on is kept in `format`, converted on the worker.
+// while an array or a file is set it's kept for when it's unset
+void ring_buffer_set_format(t_ring_buffer *rb, t_sample_format format);
+
+// records into and plays from the named array; &s_ goes back to our own
+// storage, which starts out silent. returns 0 if there's no such array, or
+// the ring has more than one channel
+int ring_buffer_set_array(t_ring_buffer *rb, t_symbol *name);
+
+// records into and plays from a raw file, creating or extending it to
+// `samples` samples (rounded up to the page with a guard) as needed, or
+// leaving its length alone for 0 samples. with a guard it wraps at the
+// file's length to the page; without one at the largest power of 2 that
+// fits, like an array. either way an error names the samples left unused.
+// &s_ goes back to our own storage. returns 0 if the length can't be worked
+// out, it's too short or the ring has more than one channel; failing to map
+// is reported later from the clock
+int ring_buffer_map_file(t_ring_buffer *rb, t_symbol *path, t_float samples);
+
+// reads a sound file into new storage (see sound_file.h), at least as big
+// as the current request. perform switches to it when it's all in, with
+// the write phase right after it
+void ring_buffer_read_file(t_ring_buffer *rb, t_symbol *path);
+
+// writes `length` samples from `start` to a sound file, in the background
+void ring_buffer_write_file(t_ring_buffer *rb, t_symbol *path, int start, int length,
+                            t_float sr);
+
+// called on the message thread when a read or write has finished, with
+// `what` read or write and the number of samples
+void ring_buffer_set_notify(t_ring_buffer *rb, t_ring_notify fn);
+
+// message thread: the size the storage has once everything pending lands
+int ring_buffer_target_size(const t_ring_buffer *rb);
+
+// what ring_buffer_adopt did. after a resize the old positions can be mapped
+// into the new storage; after a switch they mean nothing and the write phase
+// starts again at 0. a file that was read is at the start of the storage,
+// r_content samples long, and the write phase starts after it
+#define RING_BUFFER_RESIZED 1
+#define RING_BUFFER_SWITCHED 2
+#define RING_BUFFER_LOADED 3
+
+// perform routine side. adopt swaps in pending storage (if any) and moves
+// *write_phase into it; publish makes the block's final write phase visible
+// to the worker
+int ring_buffer_adopt_pending(t_ring_buffer *rb, int *write_phase, t_ring_map *map);
+
+static inline int ring_buffer_adopt(t_ring_buffer *rb, int *write_phase, t_ring_map *map)
+{
+  if (atomic_load_explicit(&rb->r_pending, memory_order_relaxed) == NULL) return 0;
+  return ring_buffer_adopt_pending(rb, write_phase, map);
+}
+
+static inline void ring_buffer_publish(t_ring_buffer *rb, int write_phase)
+{
+  write_phase = dsp_wrap(write_phase, rb->r_size);
+  atomic_store_explicit(&rb->r_phase, write_phase, memory_order_release);
+  if (rb->r_file != NULL) mapped_file_writing(rb->r_file, write_phase);
+}
+
+// perform routine side: channel c of the active storage, in r_format. only
+// our own storage has more than one, and its r_shift is 0
+static inline void *ring_buffer_channel(const t_ring_buffer *rb, int c)
+{
+  size_t stride = (size_t)(rb->r_size + 2 * rb->r_guarded) * sample_format_bytes(rb->r_format);
+  return (char *)rb->r_samples + c * stride;
+}
+
+// perform routine side: grain start positions, split into whole samples and
+// fractions, pulled into the resident part of a mapped file. a no-op otherwise
+static inline void ring_buffer_clamp_reads(t_ring_buffer *rb, int *start, t_sample *frac,
+                                           int n)
+{
+  if (rb->r_file != NULL) mapped_file_clamp(rb->r_file, start, frac, n);
+}
+
+// perform routine side: call after writing, so a borrowed array gets redrawn
+static inline void ring_buffer_written(t_ring_buffer *rb)
+{
+  if (rb->r_borrowed) atomic_store_explicit(&rb->r_dirty, 1, memory_order_relaxed);
+}
+
+// perform routine side: how many samples of the storage hold audio after
+// ring_buffer_adopt returned `adopted`, given `filled` before it. our own
+// storage starts out silent when it's switched to; an array or a file is
+// taken as full
+static inline int ring_buffer_filled(const t_ring_buffer *rb, int adopted, int filled)
+{
+  switch (adopted) {
+    case RING_BUFFER_RESIZED: return (filled < rb->r_size) ? filled : rb->r_size;
+    case RING_BUFFER_SWITCHED: return (rb->r_borrowed || rb->r_file) ? rb->r_size : 0;
+    case RING_BUFFER_LOADED: return rb->r_content;
+  }
+  return filled;
+}
+
+// a read position in the old storage -> the same audio in the new storage.
+// positions older than the new buffer can hold wrap onto newer audio
+static inline int ring_buffer_remap(const t_ring_map *map, int index)
+{
+  int age = dsp_wrap(map->m_old_phase - index, map->m_old_size);
+  return dsp_wrap(map->m_new_phase - age, map->m_new_size);
+}
+
+#endif
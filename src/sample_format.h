@@ -0,0 +1,143 @@
+// compact sample formats for ring buffer storage
+//
+// a ring buffer's own storage can hold its samples as t_samples (the
+// default), 16-bit integers or half floats (ring_buffer_set_format), so
+// long buffers take a half or a quarter of the memory. that saves memory,
+// not time: every tap read is decoded, which costs more than the smaller
+// footprint saves while the buffers fit in the cache (see `format` in
+// gl~.c). everything that reads or writes storage goes through the format:
+// sample_load and sample_store one sample at a time, sample_convert in bulk.
+// the SIMD renderers in grains.c decode whole rows of taps instead, and have
+// to match sample_load exactly.
+//
+// int16 is dithered with triangular noise of one bit. the noise comes from
+// a hash of the position being written, so every writer of a ring (perform,
+// the worker, the render pool) dithers the same way without sharing state.
+// half floats keep 11 bits of mantissa at any level, rounded to nearest
+// even; anything past the largest half (65504) is clamped to it, and NaNs
+// are stored as 0, so storage never holds an infinity or a NaN.
+
+#ifndef SAMPLE_FORMAT_H
+#define SAMPLE_FORMAT_H
+
+#include "engine.h"
+#include <stdint.h>
+#include <string.h>
+
+typedef enum {
+  SAMPLE_FLOAT, // t_sample, whatever its size
+  SAMPLE_INT16,
+  SAMPLE_HALF
+} t_sample_format;
+
+#define SAMPLE_INT16_SCALE 32767.0f
+
+// returns -1 for an unknown name
+static inline int sample_format_from_name(const char *name)
+{
+  if (!strcmp(name, "float")) return SAMPLE_FLOAT;
+  if (!strcmp(name, "int16")) return SAMPLE_INT16;
+  if (!strcmp(name, "half")) return SAMPLE_HALF;
+  return -1;
+}
+
+static inline size_t sample_format_bytes(t_sample_format format)
+{
+  return (format == SAMPLE_FLOAT) ? sizeof(t_sample) : sizeof(uint16_t);
+}
+
+// triangular noise in [-1, 1) for position `at`: the sum of the two halves
+// of a hash of it, each uniform
+static inline t_sample sample_dither(unsigned int at)
+{
+  unsigned int h = at * 0x9e3779b1u;
+  h ^= h >> 15;
+  h *= 0x2c1b3c6du;
+  h ^= h >> 12;
+  return (t_sample)((h & 0xffff) + (h >> 16)) * (1.0f / 65536.0f) - 1.0f;
+}
+
+static inline int16_t sample_to_int16(t_sample x, unsigned int at)
+{
+  t_sample v = x * SAMPLE_INT16_SCALE + sample_dither(at);
+  if (!(v < SAMPLE_INT16_SCALE)) v = (v > 0) ? SAMPLE_INT16_SCALE : 0; // and NaN
+  if (v < -SAMPLE_INT16_SCALE) v = -SAMPLE_INT16_SCALE;
+  return (int16_t)((v >= 0) ? (int)(v + 0.5f) : -(int)(0.5f - v));
+}
+
+static inline t_sample sample_from_int16(int16_t i)
+{
+  return (t_sample)i * (1.0f / SAMPLE_INT16_SCALE);
+}
+
+static inline uint16_t sample_to_half(t_sample x)
+{
+  union { float f; uint32_t u; } v;
+  v.f = (float)x;
+  uint16_t sign = (uint16_t)((v.u >> 16) & 0x8000);
+  uint32_t a = v.u & 0x7fffffff;
+  if (a > 0x7f800000) return 0; // NaN
+  if (a >= 0x477ff000) return sign | 0x7bff; // would round to infinity
+  if (a >= 0x38800000) {
+    // normal: rebias the exponent, round the mantissa to 10 bits
+    return sign | (uint16_t)((a - 0x38000000 + 0xfff + ((a >> 13) & 1)) >> 13);
+  }
+  if (a < 0x33000000) return sign; // below half the smallest subnormal
+  // subnormal: the mantissa shifted down to units of 2^-24, rounded
+  int shift = 126 - (int)(a >> 23);
+  uint32_t mantissa = (a & 0x7fffff) | 0x800000;
+  uint32_t m = mantissa >> shift;
+  uint32_t rest = mantissa & ((1u << shift) - 1), half = 1u << (shift - 1);
+  if (rest > half || (rest == half && (m & 1))) m++;
+  return sign | (uint16_t)m;
+}
+
+// exact, like the F16C instructions
+static inline t_sample sample_from_half(uint16_t h)
+{
+  uint32_t a = h & 0x7fff;
+  union { uint32_t u; float f; } v;
+  if (a >= 0x400) {
+    v.u = ((uint32_t)(h & 0x8000) << 16) | ((a << 13) + 0x38000000);
+    return v.f;
+  }
+  t_sample m = (t_sample)a * (1.0f / 16777216.0f);
+  return (h & 0x8000) ? -m : m;
+}
+
+// sample i of storage in `format`
+static inline t_sample sample_load(const void *buffer, t_sample_format format, size_t i)
+{
+  switch (format) {
+    case SAMPLE_INT16: return sample_from_int16(((const int16_t *)buffer)[i]);
+    case SAMPLE_HALF: return sample_from_half(((const uint16_t *)buffer)[i]);
+    default: return ((const t_sample *)buffer)[i];
+  }
+}
+
+// sample i of storage in `format`, dithered for position `at`
+static inline void sample_store(void *buffer, t_sample_format format, size_t i, t_sample x,
+                                unsigned int at)
+{
+  switch (format) {
+    case SAMPLE_INT16: ((int16_t *)buffer)[i] = sample_to_int16(x, at); break;
+    case SAMPLE_HALF: ((uint16_t *)buffer)[i] = sample_to_half(x); break;
+    default: ((t_sample *)buffer)[i] = x; break;
+  }
+}
+
+// n samples from one format to another, the first of them at position `at`.
+// the same format is a copy, so nothing is dithered twice
+static inline void sample_convert(void *dst, t_sample_format dst_format, const void *src,
+                                  t_sample_format src_format, int n, unsigned int at)
+{
+  if (dst_format == src_format) {
+    memcpy(dst, src, n * sample_format_bytes(dst_format));
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    sample_store(dst, dst_format, i, sample_load(src, src_format, i), at + i);
+  }
+}
+
+#endif
@@ -0,0 +1,248 @@
+#include "sound_file.h"
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#define WAVE_PCM 1
+#define WAVE_FLOAT 3
+#define WAVE_EXTENSIBLE 0xfffe
+
+static int is_wav(const char *path)
+{
+  size_t n = strlen(path);
+  if (n < 4) return 0;
+  const char *ext = path + n - 4;
+  return (ext[0] == '.' && (ext[1] | 0x20) == 'w' && (ext[2] | 0x20) == 'a'
+          && (ext[3] | 0x20) == 'v');
+}
+
+static uint32_t le32(const unsigned char *b)
+{
+  return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static unsigned int le16(const unsigned char *b)
+{
+  return (unsigned int)b[0] | ((unsigned int)b[1] << 8);
+}
+
+static void put32(unsigned char *b, uint32_t v)
+{
+  b[0] = v & 0xff;
+  b[1] = (v >> 8) & 0xff;
+  b[2] = (v >> 16) & 0xff;
+  b[3] = (v >> 24) & 0xff;
+}
+
+static void put16(unsigned char *b, unsigned int v)
+{
+  b[0] = v & 0xff;
+  b[1] = (v >> 8) & 0xff;
+}
+
+static int read_error(FILE *fp)
+{
+  return ferror(fp) ? errno : SOUND_FILE_EFORMAT;
+}
+
+// walks the chunks up to "data", picking up the format on the way
+static int read_wav_header(t_sound_file *sf)
+{
+  unsigned char b[40];
+  if (fread(b, 1, 12, sf->f_fp) != 12) return read_error(sf->f_fp);
+  if (memcmp(b, "RIFF", 4) || memcmp(b + 8, "WAVE", 4)) return SOUND_FILE_EFORMAT;
+
+  int format = 0;
+  while (1) {
+    if (fread(b, 1, 8, sf->f_fp) != 8) return read_error(sf->f_fp);
+    uint32_t size = le32(b + 4);
+    if (!memcmp(b, "data", 4)) {
+      if (format == 0) return SOUND_FILE_EFORMAT; // no "fmt " before it
+      sf->f_frames = size / (sf->f_channels * sf->f_bytes);
+      return 0;
+    }
+    if (!memcmp(b, "fmt ", 4) && size >= 16) {
+      uint32_t want = (size < sizeof(b)) ? size : sizeof(b);
+      if (fread(b, 1, want, sf->f_fp) != want) return read_error(sf->f_fp);
+      size -= want;
+      format = le16(b);
+      if (format == WAVE_EXTENSIBLE && want >= 26) format = le16(b + 24);
+      sf->f_channels = le16(b + 2);
+      sf->f_sr = le32(b + 4);
+      sf->f_bytes = le16(b + 14) / 8;
+      sf->f_float = (format == WAVE_FLOAT);
+      if (sf->f_channels < 1 || sf->f_channels * sf->f_bytes > SOUND_FILE_CHUNK * 4) {
+        return SOUND_FILE_EFORMAT;
+      }
+      if (format == WAVE_FLOAT && sf->f_bytes != 4) return SOUND_FILE_EFORMAT;
+      if (format == WAVE_PCM && (sf->f_bytes < 2 || sf->f_bytes > 4)) return SOUND_FILE_EFORMAT;
+      if (format != WAVE_FLOAT && format != WAVE_PCM) return SOUND_FILE_EFORMAT;
+    }
+    // chunks are padded to an even length
+    if (fseek(sf->f_fp, size + (size & 1), SEEK_CUR) != 0) return errno;
+  }
+}
+
+int sound_file_open_read(t_sound_file *sf, const char *path, int channels)
+{
+  sf->f_fp = fopen(path, "rb");
+  if (sf->f_fp == NULL) return errno;
+  sf->f_wav = is_wav(path);
+  int error = 0;
+  if (sf->f_wav) {
+    error = read_wav_header(sf);
+  } else {
+    sf->f_channels = channels;
+    sf->f_sr = 0;
+    sf->f_bytes = sizeof(t_sample);
+    sf->f_float = 1;
+    if (fseek(sf->f_fp, 0, SEEK_END) != 0) {
+      error = errno;
+    } else {
+      sf->f_frames = ftell(sf->f_fp) / (channels * sizeof(t_sample));
+      rewind(sf->f_fp);
+    }
+  }
+  if (error) {
+    fclose(sf->f_fp);
+    sf->f_fp = NULL;
+  }
+  return error;
+}
+
+static t_sample decode(const t_sound_file *sf, const unsigned char *b)
+{
+  if (!sf->f_wav) {
+    t_sample f;
+    memcpy(&f, b, sizeof(f));
+    return f;
+  } else if (sf->f_float) {
+    uint32_t u = le32(b);
+    float v;
+    memcpy(&v, &u, sizeof(v));
+    return v;
+  } else if (sf->f_bytes == 2) {
+    return (int16_t)le16(b) * (1.0f / 32768.0f);
+  } else if (sf->f_bytes == 3) {
+    return (int32_t)(le32((const unsigned char[]){0, b[0], b[1], b[2]})) * (1.0f / 2147483648.0f);
+  }
+  return (int32_t)le32(b) * (1.0f / 2147483648.0f);
+}
+
+int sound_file_read(t_sound_file *sf, t_sample *const *dst, int channels, int frames, int *got)
+{
+  unsigned char bytes[SOUND_FILE_CHUNK * 4];
+  *got = 0;
+  if (frames > sf->f_frames) frames = sf->f_frames;
+  if (frames <= 0) return 0;
+
+  if (!sf->f_wav && channels == 1 && sf->f_channels == 1) {
+    *got = fread(dst[0], sizeof(t_sample), frames, sf->f_fp);
+    sf->f_frames -= *got;
+    return (*got < frames) ? read_error(sf->f_fp) : 0;
+  }
+
+  // a chunk of frames at a time into `bytes`, then split into the channels
+  int frame_bytes = sf->f_channels * sf->f_bytes;
+  int per_read = sizeof(bytes) / frame_bytes;
+  while (*got < frames) {
+    int want = frames - *got;
+    if (want > per_read) want = per_read;
+    int n = fread(bytes, frame_bytes, want, sf->f_fp);
+    for (int c = 0; c < channels; c++) {
+      const unsigned char *b = bytes + (c % sf->f_channels) * sf->f_bytes;
+      t_sample *d = dst[c] + *got;
+      for (int i = 0; i < n; i++) d[i] = decode(sf, b + i * frame_bytes);
+    }
+    *got += n;
+    sf->f_frames -= n;
+    if (n < want) return read_error(sf->f_fp);
+  }
+  return 0;
+}
+
+int sound_file_open_write(t_sound_file *sf, const char *path, long frames, int channels,
+                          t_float sr)
+{
+  sf->f_fp = fopen(path, "wb");
+  if (sf->f_fp == NULL) return errno;
+  sf->f_wav = is_wav(path);
+  sf->f_channels = channels;
+  sf->f_bytes = 4;
+  sf->f_float = 1;
+  sf->f_frames = frames;
+  if (!sf->f_wav) return 0;
+  if (frames > (0xffffffffL - 36) / (4 * channels)) {
+    fclose(sf->f_fp);
+    sf->f_fp = NULL;
+    return EFBIG;
+  }
+
+  uint32_t data = (uint32_t)(frames * 4 * channels);
+  unsigned char h[44];
+  memcpy(h, "RIFF", 4);
+  put32(h + 4, 36 + data);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  put32(h + 16, 16);
+  put16(h + 20, WAVE_FLOAT);
+  put16(h + 22, channels);
+  put32(h + 24, (uint32_t)sr);
+  put32(h + 28, (uint32_t)sr * 4 * channels);
+  put16(h + 32, 4 * channels);
+  put16(h + 34, 32);
+  memcpy(h + 36, "data", 4);
+  put32(h + 40, data);
+  if (fwrite(h, 1, sizeof(h), sf->f_fp) != sizeof(h)) {
+    int error = errno;
+    fclose(sf->f_fp);
+    sf->f_fp = NULL;
+    return error;
+  }
+  return 0;
+}
+
+int sound_file_write(t_sound_file *sf, t_sample *const *src, int frames)
+{
+  int channels = sf->f_channels;
+  if (!sf->f_wav && channels == 1) {
+    return (fwrite(src[0], sizeof(t_sample), frames, sf->f_fp) == (size_t)frames) ? 0 : errno;
+  }
+  // interleaved into `bytes` a chunk of frames at a time
+  unsigned char bytes[SOUND_FILE_CHUNK * 4];
+  int per_write = SOUND_FILE_CHUNK / channels;
+  for (int done = 0; done < frames; done += per_write) {
+    int n = (frames - done < per_write) ? frames - done : per_write;
+    for (int c = 0; c < channels; c++) {
+      const t_sample *s = src[c] + done;
+      for (int i = 0; i < n; i++) {
+        unsigned char *b = bytes + 4 * (i * channels + c);
+        float v = s[i];
+        if (sf->f_wav) {
+          uint32_t u;
+          memcpy(&u, &v, sizeof(u));
+          put32(b, u);
+        } else {
+          memcpy(b, &v, sizeof(v));
+        }
+      }
+    }
+    if (fwrite(bytes, 4 * channels, n, sf->f_fp) != (size_t)n) return errno;
+  }
+  return 0;
+}
+
+int sound_file_close(t_sound_file *sf)
+{
+  if (sf->f_fp == NULL) return 0;
+  int error = (fclose(sf->f_fp) != 0) ? errno : 0;
+  sf->f_fp = NULL;
+  return error;
+}
+
+const char *sound_file_strerror(int error)
+{
+  if (error == SOUND_FILE_EFORMAT) {
+    return "unsupported format (16, 24 or 32-bit WAVE, or raw floats)";
+  }
+  return strerror(error);
+}
@@ -0,0 +1,46 @@
+// reading and writing loops as sound files, a chunk at a time
+//
+// names ending in .wav are RIFF WAVE: 16, 24 and 32-bit integer or 32-bit
+// float samples are read, and 32-bit float is written. anything else is raw
+// native t_samples, interleaved when there's more than one channel; mono raw
+// is the same layout map (mapped_file.c) uses. samples come and go one
+// channel at a time: a file with fewer channels than asked for is repeated
+// across them (mono into every one), extra channels are dropped. these block
+// on the disk and are meant for the worker thread.
+
+#ifndef SOUND_FILE_H
+#define SOUND_FILE_H
+
+#include "engine.h"
+#include <stdio.h>
+
+#define SOUND_FILE_CHUNK 4096 // frames per read or write
+#define SOUND_FILE_EFORMAT (-1) // an error that isn't an errno
+
+typedef struct _sound_file {
+  FILE *f_fp;
+  int f_wav;
+  int f_channels;
+  int f_bytes; // per sample
+  int f_float; // 32-bit float rather than integer samples
+  long f_frames; // frames left to read
+  t_float f_sr; // of a WAVE file being read, 0 for raw
+} t_sound_file;
+
+// these return 0, an errno or SOUND_FILE_EFORMAT
+// `channels` is only used for raw files, which don't say
+int sound_file_open_read(t_sound_file *sf, const char *path, int channels);
+// reads up to `frames` frames (at most SOUND_FILE_CHUNK), channel c into
+// dst[c]; *got is how many
+int sound_file_read(t_sound_file *sf, t_sample *const *dst, int channels, int frames,
+                    int *got);
+// `frames` is the length of the whole file, written up front
+int sound_file_open_write(t_sound_file *sf, const char *path, long frames, int channels,
+                          t_float sr);
+// channel c from src[c]
+int sound_file_write(t_sound_file *sf, t_sample *const *src, int frames);
+int sound_file_close(t_sound_file *sf);
+
+const char *sound_file_strerror(int error);
+
+#endif
@@ -0,0 +1,122 @@
+// beat subdivisions ("ticks") for syncing loops and grains to a transport
+//
+// `sync <n>` turns it on with n ticks per beat, `tempo <bpm>` says where the
+// beat comes from. with a tempo the beat is worked out from Pd's logical
+// time since startup, so every instance at the same tempo ticks on the same
+// samples without any messages between them. with tempo 0 a beat is one
+// cycle of a phasor~ in the sync inlet, so the patch's own transport drives
+// it; ticks then fall where floor(phase * n) changes.
+//
+// the perform routine cuts its block at every tick (transport_next), takes
+// the tick (transport_take) and moves on by the span it rendered
+// (transport_advance). with a tempo the position is set from the clock once
+// a block (transport_block), so it never drifts, and counted down in between;
+// neither way divides per sample.
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "m_pd.h"
+#include <limits.h>
+#include <math.h>
+
+// a tick lands on the first sample at or after its time, give or take this
+// much of a sample, so one that falls on a block boundary isn't lost to
+// rounding on one side or taken twice
+#define TRANSPORT_SLOP 1e-6
+
+typedef struct _transport {
+  int t_division; // ticks per beat, 0 for off
+  t_float t_bpm; // 0 to follow the sync inlet
+  double t_tick_ms; // ms per tick at t_bpm
+  double t_period; // the same in samples
+  double t_countdown; // samples from the current position to the next tick
+  int t_last; // floor(phase * t_division) of the last phasor sample
+  int t_next; // the same at the tick transport_next found
+  int t_since; // samples since the last tick
+  int t_interval; // samples between the last two ticks, 0 until there are two
+} t_transport;
+
+static inline void transport_init(t_transport *t)
+{
+  t->t_division = 0;
+  t->t_bpm = 0;
+  t->t_tick_ms = 0;
+  t->t_period = 0;
+  t->t_countdown = 0;
+  t->t_last = INT_MIN;
+  t->t_next = INT_MIN;
+  t->t_since = 0;
+  t->t_interval = 0;
+}
+
+// applied by perform when a `sync` or `tempo` message is due, and when the
+// sample rate changes. the phasor's first sample only sets where it is
+static inline void transport_set(t_transport *t, int division, t_float bpm, t_float sms)
+{
+  t->t_division = (division > 0) ? division : 0;
+  t->t_bpm = (bpm > 0) ? bpm : 0;
+  t->t_tick_ms = (t->t_bpm > 0 && t->t_division > 0 && sms > 0)
+    ? 60000.0 / (t->t_bpm * t->t_division) : 0;
+  if (t->t_tick_ms > 0 && t->t_tick_ms * sms < 1) t->t_tick_ms = 1 / sms;
+  t->t_period = t->t_tick_ms * sms;
+  t->t_last = INT_MIN;
+  t->t_interval = (int)t->t_period;
+  t->t_since = 0;
+}
+
+// perform side, before the first transport_next of a block of n samples:
+// how far the first tick that lands in it is from its start. worked out in
+// ms like event_queue.h, since samples per ms is only a float
+static inline void transport_block(t_transport *t, int n, t_float sms)
+{
+  if (t->t_period <= 0) return;
+  double start = clock_gettimesince(0) - n / sms;
+  // a tick up to a sample before the block landed in the last one
+  double from = start - (1.0 - TRANSPORT_SLOP) / sms;
+  double tick = floor(from / t->t_tick_ms) + 1;
+  t->t_countdown = (tick * t->t_tick_ms - start) * sms;
+}
+
+// the offset of the next tick in the next n samples, n if there's none.
+// sync is the phasor, only read with no tempo
+static inline int transport_next(t_transport *t, const t_sample *sync, int n)
+{
+  if (t->t_period > 0) {
+    double c = ceil(t->t_countdown - TRANSPORT_SLOP);
+    if (c < 0) c = 0;
+    return (c < n) ? (int)c : n;
+  }
+  int last = t->t_last;
+  for (int i = 0; i < n; i++) {
+    int tick = (int)floorf(sync[i] * t->t_division);
+    if (tick != last && last != INT_MIN) {
+      t->t_last = last;
+      t->t_next = tick;
+      return i;
+    }
+    last = tick;
+  }
+  t->t_last = last;
+  return n;
+}
+
+// the tick transport_next found at offset 0
+static inline void transport_take(t_transport *t)
+{
+  if (t->t_period > 0) {
+    t->t_countdown += t->t_period;
+  } else {
+    t->t_last = t->t_next;
+    t->t_interval = t->t_since;
+  }
+  t->t_since = 0;
+}
+
+static inline void transport_advance(t_transport *t, int n)
+{
+  t->t_countdown -= n;
+  t->t_since += n;
+}
+
+#endif
@@ -0,0 +1,111 @@
+#include "window_table.h"
+#include <math.h>
+#include <string.h>
+
+#define TUKEY_ALPHA 0.5 // fraction of the window spent in the cosine tapers
+#define GAUSSIAN_SIGMA 0.4 // relative to the half width
+#define TRAPEZOID_RAMP 0.25 // fraction of the window spent in each ramp
+
+static t_window_table *window_tables = NULL;
+
+// the interpolators' sinc kernel (dsp_kernels.h) lives here with the windows,
+// so every file that interpolates reads the same table
+t_sample dsp_sinc_table[(SINC_PHASES + 2) * SINC_TAPS];
+static int dsp_sinc_ready = 0;
+
+void dsp_kernels_setup(void)
+{
+  if (dsp_sinc_ready) return;
+  for (int p = 0; p < SINC_PHASES + 2; p++) {
+    double frac = (double)p / SINC_PHASES;
+    for (int t = 0; t < SINC_TAPS; t++) {
+      // distance from the read position to tap t, see interp_sinc
+      double x = (SINC_TAPS / 2 - 1) - t + frac;
+      double sinc = (fabs(x) < 1e-9) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+      // blackman window over (-SINC_TAPS/2, SINC_TAPS/2)
+      double w = (x + SINC_TAPS / 2) / SINC_TAPS;
+      double blackman = 0.42 - 0.5 * cos(2.0 * M_PI * w) + 0.08 * cos(4.0 * M_PI * w);
+      dsp_sinc_table[p * SINC_TAPS + t] = (t_sample)(sinc * blackman);
+    }
+  }
+  dsp_sinc_ready = 1;
+}
+
+static double window_value(t_window_shape shape, double phase)
+{
+  switch (shape) {
+    case WINDOW_TUKEY: {
+      double edge = TUKEY_ALPHA * 0.5;
+      if (phase < edge) return 0.5 * (1.0 - cos(M_PI * phase / edge));
+      if (phase > 1.0 - edge) return 0.5 * (1.0 - cos(M_PI * (1.0 - phase) / edge));
+      return 1.0;
+    }
+    case WINDOW_BLACKMAN:
+      return 0.42 - 0.5 * cos(2.0 * M_PI * phase) + 0.08 * cos(4.0 * M_PI * phase);
+    case WINDOW_GAUSSIAN: {
+      // shifted and rescaled so that it starts and ends at 0
+      double x = (phase - 0.5) / (0.5 * GAUSSIAN_SIGMA);
+      double edge = exp(-0.5 / (GAUSSIAN_SIGMA * GAUSSIAN_SIGMA));
+      return (exp(-0.5 * x * x) - edge) / (1.0 - edge);
+    }
+    case WINDOW_TRAPEZOID:
+      if (phase < TRAPEZOID_RAMP) return phase / TRAPEZOID_RAMP;
+      if (phase > 1.0 - TRAPEZOID_RAMP) return (1.0 - phase) / TRAPEZOID_RAMP;
+      return 1.0;
+    case WINDOW_FADE:
+      return sin(0.5 * M_PI * phase);
+    default:
+      return 0.5 * (1.0 - cos(2.0 * M_PI * phase));
+  }
+}
+
+t_window_table *window_table_get(t_window_shape shape, int size)
+{
+  for (t_window_table *t = window_tables; t != NULL; t = t->w_next) {
+    if (t->w_shape == shape && t->w_size == size) {
+      t->w_refcount++;
+      return t;
+    }
+  }
+
+  t_window_table *t = (t_window_table *)getbytes(sizeof(t_window_table));
+  if (t == NULL) return NULL;
+  t->w_samples = (t_sample *)getbytes((size + 2) * sizeof(t_sample));
+  if (t->w_samples == NULL) {
+    freebytes(t, sizeof(t_window_table));
+    return NULL;
+  }
+  for (int i = 0; i <= size; i++) {
+    t->w_samples[i] = (t_sample)window_value(shape, (double)i / size);
+  }
+  t->w_samples[size + 1] = t->w_samples[size];
+
+  t->w_shape = shape;
+  t->w_size = size;
+  t->w_refcount = 1;
+  t->w_next = window_tables;
+  window_tables = t;
+  return t;
+}
+
+void window_table_release(t_window_table *table)
+{
+  if (table == NULL || --table->w_refcount > 0) return;
+
+  t_window_table **link = &window_tables;
+  while (*link != NULL && *link != table) link = &(*link)->w_next;
+  if (*link != NULL) *link = table->w_next;
+
+  freebytes(table->w_samples, (table->w_size + 2) * sizeof(t_sample));
+  freebytes(table, sizeof(t_window_table));
+}
+
+int window_shape_from_name(const char *name)
+{
+  if (!strcmp(name, "hann")) return WINDOW_HANN;
+  if (!strcmp(name, "tukey")) return WINDOW_TUKEY;
+  if (!strcmp(name, "blackman")) return WINDOW_BLACKMAN;
+  if (!strcmp(name, "gaussian")) return WINDOW_GAUSSIAN;
+  if (!strcmp(name, "trapezoid")) return WINDOW_TRAPEZOID;
+  return -1;
+}
@@ -0,0 +1,60 @@
+// shared, read-only window tables
+//
+// tables are cached process-wide and refcounted, keyed by (shape, size). a
+// table holds one period of the window at `size` intervals and is read with a
+// fractional index, so every grain length shares the same table instead of
+// each instance computing its own buffer with cos().
+//
+// get/release are only called from the message thread (object creation,
+// deletion and messages), so the cache itself needs no locking. the samples
+// are never written after the table is built.
+
+#ifndef WINDOW_TABLE_H
+#define WINDOW_TABLE_H
+
+#include "engine.h"
+#include "dsp_kernels.h"
+
+#define WINDOW_TABLE_SIZE 4096
+
+typedef enum {
+  WINDOW_HANN,
+  WINDOW_TUKEY,
+  WINDOW_BLACKMAN,
+  WINDOW_GAUSSIAN,
+  WINDOW_TRAPEZOID,
+  WINDOW_FADE // equal-power fade in, sin over a quarter period; read backwards to fade out
+} t_window_shape;
+
+typedef struct _window_table {
+  t_window_shape w_shape;
+  int w_size; // number of intervals; w_samples has w_size + 2 entries
+  int w_refcount;
+  t_sample *w_samples;
+  struct _window_table *w_next;
+} t_window_table;
+
+// returns NULL if the table can't be allocated
+t_window_table *window_table_get(t_window_shape shape, int size);
+void window_table_release(t_window_table *table);
+
+// returns -1 for an unknown name
+int window_shape_from_name(const char *name);
+
+// the scale that maps a position in a window of `length` samples to a table
+// index: the first sample reads the start of the table, the last one the end
+static inline t_float window_table_scale(const t_window_table *table, int length)
+{
+  return (length > 1) ? (t_float)table->w_size / (length - 1) : 0.0f;
+}
+
+// linear interpolation between table entries. the extra guard entry makes the
+// last position (index == w_size) safe to read
+DSP_INLINE t_sample window_table_read(const t_sample *samples, t_float index)
+{
+  int i = (int)index;
+  t_sample frac = index - (t_sample)i;
+  return samples[i] + frac * (samples[i + 1] - samples[i]);
+}
+
+#endif
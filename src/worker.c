@@ -0,0 +1,100 @@
+#include "worker.h"
+#include <pthread.h>
+
+#define WORKER_QUEUE_SIZE 64
+
+typedef struct _job {
+  t_worker_fn j_fn;
+  void *j_arg;
+} t_job;
+
+static pthread_t worker_thread;
+static pthread_mutex_t worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t worker_idle = PTHREAD_COND_INITIALIZER;
+
+static t_job worker_queue[WORKER_QUEUE_SIZE];
+static int worker_head = 0; // next job to run
+static int worker_count = 0; // queued jobs
+static int worker_busy = 0; // a job is running
+static int worker_users = 0;
+static int worker_quit = 0;
+
+static void *worker_main(void *unused)
+{
+  (void)unused;
+  pthread_mutex_lock(&worker_lock);
+  while (1) {
+    while (worker_count == 0 && !worker_quit) {
+      pthread_cond_wait(&worker_wake, &worker_lock);
+    }
+    if (worker_count == 0 && worker_quit) break;
+
+    t_job job = worker_queue[worker_head];
+    worker_head = (worker_head + 1) % WORKER_QUEUE_SIZE;
+    worker_count--;
+    worker_busy = 1;
+    pthread_mutex_unlock(&worker_lock);
+
+    job.j_fn(job.j_arg);
+
+    pthread_mutex_lock(&worker_lock);
+    worker_busy = 0;
+    if (worker_count == 0) pthread_cond_broadcast(&worker_idle);
+  }
+  pthread_mutex_unlock(&worker_lock);
+  return NULL;
+}
+
+int worker_start(void)
+{
+  pthread_mutex_lock(&worker_lock);
+  if (worker_users++ == 0) {
+    worker_quit = 0;
+    if (pthread_create(&worker_thread, NULL, worker_main, NULL) != 0) {
+      worker_users = 0;
+      pthread_mutex_unlock(&worker_lock);
+      return 0;
+    }
+  }
+  pthread_mutex_unlock(&worker_lock);
+  return 1;
+}
+
+void worker_stop(void)
+{
+  pthread_mutex_lock(&worker_lock);
+  if (worker_users == 0 || --worker_users > 0) {
+    pthread_mutex_unlock(&worker_lock);
+    return;
+  }
+  worker_quit = 1;
+  pthread_cond_signal(&worker_wake);
+  pthread_mutex_unlock(&worker_lock);
+  pthread_join(worker_thread, NULL);
+}
+
+int worker_post(t_worker_fn fn, void *arg)
+{
+  pthread_mutex_lock(&worker_lock);
+  if (worker_users == 0 || worker_count == WORKER_QUEUE_SIZE) {
+    pthread_mutex_unlock(&worker_lock);
+    return 0;
+  }
+  t_job *job = &worker_queue[(worker_head + worker_count) % WORKER_QUEUE_SIZE];
+  job->j_fn = fn;
+  job->j_arg = arg;
+  worker_count++;
+  pthread_cond_signal(&worker_wake);
+  pthread_mutex_unlock(&worker_lock);
+  return 1;
+}
+
+void worker_wait_idle(void)
+{
+  pthread_mutex_lock(&worker_lock);
+  while (worker_count > 0 || worker_busy) {
+    pthread_cond_wait(&worker_idle, &worker_lock);
+  }
+  pthread_mutex_unlock(&worker_lock);
+}
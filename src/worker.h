@@ -0,0 +1,26 @@
+// background thread for work that must stay off the audio thread
+//
+// in Pd the message thread and the audio thread are usually the same thread,
+// so allocating, copying or freeing large buffers from a method or a dsp
+// routine can still cause dropouts. jobs posted here run one at a time on a
+// single worker thread shared by every instance in the binary.
+//
+// worker_post is meant to be called from Pd's thread only. it takes a mutex
+// that the worker holds just long enough to pop a job, never while running one.
+
+#ifndef WORKER_H
+#define WORKER_H
+
+typedef void (*t_worker_fn)(void *arg);
+
+// refcounted; the thread starts with the first user and stops with the last
+int worker_start(void);
+void worker_stop(void);
+
+// returns 0 if the queue is full or the worker isn't running
+int worker_post(t_worker_fn fn, void *arg);
+
+// blocks until every posted job has finished (object teardown, the bench)
+void worker_wait_idle(void);
+
+#endif